@@ -0,0 +1,42 @@
+#pragma once
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <cstddef>
+#include <functional>
+#include <condition_variable>
+
+// Fixed set of threads for password checks. A login's KDF takes tens of
+// milliseconds of CPU, so it runs here and posts its result back to the
+// reactor instead of stalling every other connection on that reactor.
+// The queue is bounded: during a reconnect storm submit() refuses work
+// beyond max_pending, which turns into a quick "busy" reply rather than
+// minutes of queued hashing.
+class AuthPool
+{
+public:
+
+    using Job = std::function<void()>;
+
+    AuthPool(int threads, size_t max_pending); // threads <= 0 uses half the cores
+    ~AuthPool(); // Drops jobs that have not started and waits for the running ones
+
+    AuthPool(const AuthPool&) = delete;
+    AuthPool& operator=(const AuthPool&) = delete;
+
+    bool submit(Job job); // False if the queue is full
+    size_t pending() const;
+    size_t thread_count() const;
+
+private:
+
+    void run();
+
+    const size_t max_pending;
+    mutable std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<Job> jobs;
+    bool stopping;
+    std::vector<std::thread> threads;
+};
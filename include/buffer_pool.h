@@ -0,0 +1,45 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// Size-classed block pool for the message path: encoded frames, outbound
+// queue nodes, posted tasks and queued messages.
+//
+// Blocks come in powers of two from 32 bytes to 64 KiB. Each thread keeps a
+// small free list per size class, so a steady stream of allocate/deallocate
+// calls never reaches the global allocator and rarely takes a lock. Blocks
+// may be freed on a different thread than the one that allocated them; the
+// surplus drifts back through a shared list per class. Memory is carved from
+// 256 KiB slabs that stay with the pool for the life of the process.
+// Requests over 64 KiB go straight to operator new.
+namespace buffer_pool
+{
+
+const size_t largest_block = 64 * 1024;
+
+void* allocate(size_t size);
+void deallocate(void* block, size_t size); // size must match the allocate() call
+
+uint64_t slab_bytes(); // Total carved into slabs so far, for monitoring
+
+} // namespace buffer_pool
+
+// std::allocator replacement backed by buffer_pool, for node-based containers
+// on the message path (std::deque grows and frees a node every few entries)
+template <typename T>
+struct PoolAllocator
+{
+    using value_type = T;
+
+    PoolAllocator() = default;
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U>&) {}
+
+    T* allocate(size_t count) { return static_cast<T*>(buffer_pool::allocate(count * sizeof(T))); }
+    void deallocate(T* block, size_t count) { buffer_pool::deallocate(block, count * sizeof(T)); }
+};
+
+template <typename T, typename U>
+bool operator==(const PoolAllocator<T>&, const PoolAllocator<U>&) { return true; }
+template <typename T, typename U>
+bool operator!=(const PoolAllocator<T>&, const PoolAllocator<U>&) { return false; }
@@ -0,0 +1,248 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <functional>
+#include "db_connection.h"
+#include "database.h"
+#include "group.h"
+#include "membership_index.h"
+#include "recent_message_cache.h"
+#include "user_directory.h"
+#include "group_stats.h"
+#include "message_archive.h"
+
+class MessageIngestQueue;
+struct IngestOptions;
+class MessageLog;
+class DatabaseExecutor;
+
+// How hard a commit pushes data to disk (PRAGMA synchronous)
+enum class Durability
+{
+    FULL,   // fsync on every commit
+    NORMAL  // fsync at checkpoints only, a crash may lose the last commits
+};
+
+// Persistent handle to a chat database.
+// The file is opened once and every statement used by the database layer is
+// prepared on first use and then reused (reset + rebind) for later calls.
+// Writes go through a single writer connection; reads are spread over a fixed
+// pool of read-only connections, one per worker thread, which run against WAL
+// snapshots and never wait for the writer.
+class ChatDatabase
+{
+public:
+
+    explicit ChatDatabase(const std::string& db_name, const DatabaseTuning& tuning = DatabaseTuning()); // Opens the database file
+    ~ChatDatabase(); // Finalizes cached statements and closes the file
+
+    ChatDatabase(const ChatDatabase&) = delete;
+    ChatDatabase& operator=(const ChatDatabase&) = delete;
+
+    bool is_open() const;
+    const std::string& name() const;
+
+    // Database initialization
+    bool init_schema(); // Creates missing tables and applies pending migrations
+    int schema_version(); // PRAGMA user_version, -1 on failure
+    bool set_durability(Durability durability);
+    bool checkpoint(); // Copies the WAL into the database file and syncs both, so every commit so far is on disk
+    void set_password_cost(int iterations); // PBKDF2 rounds for new hashes; older hashes are upgraded at their next login
+    DatabaseExecutor& executor(); // Runs calls off the caller's thread, see database_executor.h; started on first use
+    bool assign_shard(int shard, int shard_count); // Binds the file to one place in a sharded layout, see sharded_database.h
+
+    // Holds the writer connection for the lifetime of the object and runs every
+    // write issued through the database in between as one transaction.
+    // Rolls back unless commit() succeeded.
+    class Transaction
+    {
+    public:
+        explicit Transaction(ChatDatabase& database);
+        ~Transaction();
+
+        Transaction(const Transaction&) = delete;
+        Transaction& operator=(const Transaction&) = delete;
+
+        bool active() const; // BEGIN succeeded and nothing was committed yet
+        bool commit();
+
+    private:
+        ChatDatabase& database;
+        std::unique_lock<std::recursive_mutex> lock;
+        bool open;
+    };
+
+    // User management
+    bool register_user(const std::string& username, const std::string& password); // Stores a salted hash, see password_hash.h
+    bool authenticate_user(const std::string& username, const std::string& password); // Runs the KDF; call it off latency-sensitive threads
+    int get_user_id(const std::string& username); // Served from memory once init_schema() has run
+    std::string get_username(int user_id); // Served from memory once init_schema() has run
+    std::vector<std::string> get_usernames(const std::vector<int>& user_ids); // "" for unknown ids
+    const UserDirectory& users() const; // Interned names; views stay valid while the database is open
+
+    // Group management
+    bool create_group(const std::string& group_name);
+    bool add_user_to_group(int user_id, int group_id);
+    std::vector<bool> add_users_to_group(int group_id, const std::vector<int>& user_ids); // One transaction, a result per user
+    bool remove_user_from_group(int user_id, int group_id);
+    std::vector<int> get_user_groups(int user_id); // Sorted; served from memory once init_schema() has run
+    std::vector<int> get_group_members(int group_id); // Sorted; served from memory once init_schema() has run
+    std::string get_group_name(int group_id);
+    Group get_group(int group_id); // group_id is -1 if there is no such group
+    const MembershipIndex& membership() const; // Kept in step with add_user_to_group and remove_user_from_group
+
+    // Message management
+    bool save_message(int sender_id, int group_id, const std::string& text, const std::string& file_path = "");
+    int store_message(int sender_id, int group_id, std::string_view text, std::string_view file_path = ""); // New message_id, -1 on failure
+    std::vector<int> save_messages(const std::vector<MessageRecord>& messages); // One transaction, the new message_id or -1 per message
+    MessageIngestQueue& ingest_queue(); // Group-commit writer for this database, started on first use
+    MessageIngestQueue& ingest_queue(const IngestOptions& options); // Options apply if the writer is not running yet
+    MessageLog& message_log(); // Write-ahead log in front of Messages, see message_log.h; replayed and started on first use
+
+    // The same components without starting them, nullptr if not running yet; for flushing at shutdown
+    DatabaseExecutor* running_executor();
+    MessageIngestQueue* running_ingest_queue();
+    MessageLog* running_message_log();
+
+    // Message log support: ids, stores and the applied position of a MessageLog
+    int reserve_message_ids(int count, int& reserved); // First of reserved (<= count) ids no other insert will use, -1 if none are left
+    bool insert_message(const MessageRecord& message); // Keeps message_id and sent_at_ms; an id already stored is a success
+    int message_log_checkpoint(); // message_id of the last applied record, 0 if none, -1 on failure
+    bool save_message_log_checkpoint(int message_id);
+    bool park_rejected_message(const MessageRecord& message); // Into RejectedMessages, for a record insert_message refused
+    bool save_failed_log_range(int first_message_id, int last_message_id); // Logged ids answered with -1, never to be applied
+    bool failed_log_ranges(std::vector<std::pair<int, int>>& ranges); // Appends (first, last) of every saved range
+    bool clear_failed_log_ranges();
+    std::vector<std::pair<std::string, std::string>> get_group_messages(int group_id, int limit = 50);
+    std::vector<MessageRecord> get_group_messages_before(int group_id, int before_message_id, int limit = 50); // Served from the recent-message cache when it can
+    RecentCacheStats recent_cache_stats();
+
+    // Group-Message relationship functions
+    std::vector<int> get_group_message_ids(int group_id);
+    bool remove_message_from_group(int message_id, int group_id);
+    int get_message_group_id(int message_id);
+    int get_message_file(int message_id, std::string& file_path); // group_id or -1; file_path is empty for text messages
+    int get_message_count_in_group(int group_id); // Maintained counter; served from memory once init_schema() has run
+
+    // Read markers and unread counts
+    bool mark_read(int user_id, int group_id, int message_id); // Only moves the marker forward
+    std::vector<std::pair<int, int>> get_unread_counts(int user_id); // (group_id, unread) for each of the user's groups, by group_id
+
+    // Message search, over an FTS5 index the Messages triggers keep current
+    std::vector<MessageRecord> search_messages(int group_id, const std::string& query, int limit = 20); // Best match first; see search_messages() in database.h
+    bool merge_search_index(int pages = 500); // One bounded merge step; false once the index is fully merged
+
+    // Cold history, see message_archive.h. History reads continue into the
+    // archive transparently; archived messages are read-only and not searchable.
+    int archive_messages(int64_t before_ms); // Offline: moves messages sent before before_ms into monthly partitions; count moved, -1 on failure
+    const MessageArchive& archive() const;
+
+private:
+
+    // Every statement the database layer runs, indexing the statement cache
+    enum Statement
+    {
+        REGISTER_USER,
+        AUTHENTICATE_USER,
+        UPDATE_PASSWORD,
+        GET_USER_ID,
+        GET_USERNAME,
+        LOAD_USERS,
+        CREATE_GROUP,
+        ADD_USER_TO_GROUP,
+        REMOVE_USER_FROM_GROUP,
+        GET_USER_GROUPS,
+        GET_GROUP_MEMBERS,
+        LOAD_MEMBERSHIP,
+        GET_GROUP_NAME,
+        SAVE_MESSAGE,
+        GET_GROUP_MESSAGES_BEFORE,
+        GET_GROUP_MESSAGE_IDS,
+        REMOVE_MESSAGE_FROM_GROUP,
+        GET_MESSAGE_GROUP_ID,
+        GET_MESSAGE_FILE,
+        GET_MESSAGE_COUNT_IN_GROUP,
+        SEARCH_MESSAGES,
+        MERGE_SEARCH_INDEX,
+        LOAD_GROUP_STATS,
+        LOAD_READ_MARKERS,
+        COUNT_MESSAGES_AFTER,
+        SAVE_READ_MARKER,
+        GET_UNREAD_COUNTS,
+        LOAD_PARTITIONS,
+        SAVE_PARTITION,
+        GET_OLDEST_MESSAGE,
+        GET_FIRST_MESSAGE_SINCE,
+        READ_MESSAGES_BEFORE_ID,
+        DELETE_MESSAGES_BEFORE_ID,
+        BEGIN_ARCHIVING,
+        END_ARCHIVING,
+        BEGIN_TRANSACTION,
+        COMMIT_TRANSACTION,
+        ROLLBACK_TRANSACTION,
+        GET_SCHEMA_VERSION,
+        GET_SHARD_LAYOUT,
+        SAVE_SHARD_LAYOUT,
+        GET_MESSAGE_SEQUENCE,
+        SAVE_MESSAGE_SEQUENCE,
+        UPDATE_MESSAGE_SEQUENCE,
+        INSERT_MESSAGE,
+        GET_LOG_CHECKPOINT,
+        SAVE_LOG_CHECKPOINT,
+        PARK_REJECTED_MESSAGE,
+        SAVE_FAILED_LOG_RANGE,
+        GET_FAILED_LOG_RANGES,
+        CLEAR_FAILED_LOG_RANGES,
+        STATEMENT_COUNT
+    };
+
+    // Connection used by one call, locked until the call returns
+    struct Lease
+    {
+        explicit Lease(DbConnection& connection) : connection(connection), lock(connection.mutex()) {}
+        DbConnection& connection;
+        std::unique_lock<std::recursive_mutex> lock;
+    };
+
+    Lease write_lease();
+    Lease read_lease(); // Reader for the calling thread, or the writer if there is no pool
+    static sqlite3_stmt* statement(Lease& lease, Statement id); // Prepares on first use, nullptr on failure
+    bool run(Statement id); // Steps a writer statement that takes no parameters
+    bool migrate();
+    bool load_membership();
+    bool load_group_stats();
+    bool load_partitions();
+    int archive_month(const std::string& month, int first_message_id, int end_message_id); // Moves ids below end_message_id into one partition
+    bool load_users();
+    bool insert_member(int user_id, int group_id); // The GroupMembers row only; callers update the index
+    void read_group_page(int group_id, int before_message_id, int limit, std::vector<MessageRecord>& messages); // Cache first, then SQLite
+    bool query_group_messages(int group_id, int before_message_id, int limit, std::vector<MessageRecord>& messages);
+    void after_commit(std::function<void()> action); // Runs now, or when the open Transaction commits
+
+    std::string db_name;
+    std::unique_ptr<DbConnection> writer;
+    std::vector<std::unique_ptr<DbConnection>> readers;
+    MembershipIndex memberships; // Memberships change only through this object, so the copy never goes stale
+    RecentMessageCache recent; // Records without usernames, those come from the directory
+    UserDirectory directory;
+    GroupStats stats; // Counters and read markers, updated after each commit that changes them
+    MessageArchive archived; // Sealed monthly partitions below the hot Messages table
+    std::vector<std::function<void()>> commit_actions; // Deferred by after_commit(), guarded by the writer mutex
+
+    std::atomic<int> password_iterations;
+    int max_message_id; // End of this file's slice of ids, see assign_shard(); guarded by the writer mutex
+
+    std::mutex ingest_mutex;
+    std::unique_ptr<MessageIngestQueue> ingest;
+    std::unique_ptr<MessageLog> wal; // Guarded by ingest_mutex
+    std::unique_ptr<DatabaseExecutor> async; // Guarded by ingest_mutex
+};
+
+// Shared handle for db_name, opened on first use and kept until close_database().
+// Returns nullptr if the file cannot be opened.
+ChatDatabase* get_database(const std::string& db_name);
+void close_database(const std::string& db_name);
@@ -0,0 +1,39 @@
+#pragma once
+#include <deque>
+#include <cstdint>
+#include "user.h"
+#include "ring_buffer.h"
+#include "protocol.h"
+#include "shared_buffer.h"
+#include "buffer_pool.h"
+#include "file_store.h"
+
+class Reactor;
+
+// One client socket, owned by exactly one reactor thread.
+// Only the owning reactor reads or writes these fields.
+struct Connection
+{
+    Connection(int sock, uint64_t id, Reactor* owner)
+        : user(sock), id(id), owner(owner), user_id(-1), authenticating(false), outbound_offset(0), outbound_bytes(0),
+          lagging(false), dropped(0), flush_scheduled(false), closing(false) {}
+
+    User user; // Owns the socket
+    uint64_t id; // Unique per reactor, tells a reused fd from the connection that had it before
+    Reactor* owner;
+
+    int user_id; // -1 until LOGIN succeeds; group membership lives in the database's MembershipIndex
+    bool authenticating; // A password check for this connection is on the auth pool
+
+    RingBuffer inbound; // Allocated on first read, so idle sockets hold no buffer
+    protocol::FrameParser parser;
+
+    std::deque<BufferRef, PoolAllocator<BufferRef>> outbound; // Encoded frames, oldest first; broadcasts share one buffer across connections
+    size_t outbound_offset; // Bytes of outbound.front() already sent
+    size_t outbound_bytes; // Unsent bytes across outbound
+    bool lagging; // Crossed the high watermark; deliveries are skipped until the queue drains to the low one
+    uint32_t dropped; // Deliveries skipped while lagging, reported in MESSAGES_DROPPED once caught up
+    std::deque<FileSend> downloads; // Streamed a chunk at a time, after the frames queued before each chunk
+    bool flush_scheduled; // Already listed for the flush at the end of the current batch
+    bool closing; // Set when a read or write failed; the reactor closes it after the current event
+};
@@ -1,6 +1,20 @@
 #pragma once
 #include <string>
 #include <vector>
+#include <future>
+#include <cstdint>
+
+// One stored message, as returned by the paginated history API
+struct MessageRecord
+{
+    int message_id;
+    int sender_id;
+    int group_id;
+    std::string username;
+    std::string text;
+    std::string file_path;
+    int64_t sent_at_ms; // Milliseconds since the Unix epoch
+};
 
 // Database initialization
 bool init_db(const std::string& db_name);
@@ -10,10 +24,12 @@ bool register_user(const std::string& db_name, const std::string& username, cons
 bool authenticate_user(const std::string& db_name, const std::string& username, const std::string& password);
 int get_user_id(const std::string& db_name, const std::string& username);
 std::string get_username(const std::string& db_name, int user_id);
+std::vector<std::string> get_usernames(const std::string& db_name, const std::vector<int>& user_ids); // "" for unknown ids
 
 // Group management
 bool create_group(const std::string& db_name, const std::string& group_name);
 bool add_user_to_group(const std::string& db_name, int user_id, int group_id);
+std::vector<bool> add_users_to_group(const std::string& db_name, int group_id, const std::vector<int>& user_ids); // One transaction, a result per user
 bool remove_user_from_group(const std::string& db_name, int user_id, int group_id);
 std::vector<int> get_user_groups(const std::string& db_name, int user_id);
 std::vector<int> get_group_members(const std::string& db_name, int group_id);
@@ -21,11 +37,23 @@ std::string get_group_name(const std::string& db_name, int group_id);
 
 // Message management
 bool save_message(const std::string& db_name, int sender_id, int group_id, const std::string& text, const std::string& file_path = "");
+std::vector<int> save_messages(const std::string& db_name, const std::vector<MessageRecord>& messages); // One transaction; the new message_id or -1 per message, only sender_id, group_id, text and file_path are read
+std::future<int> save_message_async(const std::string& db_name, int sender_id, int group_id, const std::string& text, const std::string& file_path = ""); // Group-commit writer, resolves to the message_id or -1
 std::vector<std::pair<std::string, std::string>> get_group_messages(const std::string& db_name, int group_id, int limit = 50);
+// Newest-first page of messages older than before_message_id (<= 0 starts at the newest).
+// Pass the last message_id of a page as the cursor for the next one.
+std::vector<MessageRecord> get_group_messages_before(const std::string& db_name, int group_id, int before_message_id, int limit = 50);
+// Messages in the group whose text contains every word of query, best match first.
+// A word ending in * matches any word it starts; quotes and search operators are ignored.
+std::vector<MessageRecord> search_messages(const std::string& db_name, int group_id, const std::string& query, int limit = 20);
 
 // Group-Message relationship functions
 std::vector<int> get_group_message_ids(const std::string& db_name, int group_id);
 bool add_message_to_group(const std::string& db_name, int message_id, int group_id);
 bool remove_message_from_group(const std::string& db_name, int message_id, int group_id);
 int get_message_group_id(const std::string& db_name, int message_id);
-int get_message_count_in_group(const std::string& db_name, int group_id);
\ No newline at end of file
+int get_message_count_in_group(const std::string& db_name, int group_id);
+
+// Read markers
+bool mark_read(const std::string& db_name, int user_id, int group_id, int message_id); // Marks the group read up to message_id
+std::vector<std::pair<int, int>> get_unread_counts(const std::string& db_name, int user_id); // (group_id, unread) for each of the user's groups
\ No newline at end of file
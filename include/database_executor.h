@@ -0,0 +1,141 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <cstdint>
+#include <type_traits>
+#include <condition_variable>
+#include "database.h"
+#include "inline_function.h"
+
+class ChatDatabase;
+
+// Asynchronous front end to a ChatDatabase.
+// Calls are queued and run on the executor's own threads, so a reactor never
+// waits on SQLite. Reads go to a pool of threads, one per read connection,
+// which run side by side on WAL snapshots. Writes go to a single thread,
+// since SQLite serializes writers anyway, and so run in submission order.
+// Every call comes in two forms: one returns a std::future, the other calls
+// done(result) on the executor thread, where a reactor posts the result back
+// to itself. Messages still go through the ingest queue, which batches them.
+class DatabaseExecutor
+{
+public:
+
+    using Job = InlineFunction<void(), 64>;
+
+    DatabaseExecutor(ChatDatabase& database, int read_threads); // At least one reader thread
+    ~DatabaseExecutor(); // Runs every queued job, then joins the threads; later jobs run on the caller
+
+    DatabaseExecutor(const DatabaseExecutor&) = delete;
+    DatabaseExecutor& operator=(const DatabaseExecutor&) = delete;
+
+    // fn(ChatDatabase&) on a reader thread; it must not write
+    template <typename Fn>
+    auto read(Fn fn) -> std::future<std::invoke_result_t<Fn, ChatDatabase&>>;
+    template <typename Fn, typename Done>
+    void read(Fn fn, Done done);
+
+    // fn(ChatDatabase&) on the writer thread, after every write submitted before it
+    template <typename Fn>
+    auto write(Fn fn) -> std::future<std::invoke_result_t<Fn, ChatDatabase&>>;
+    template <typename Fn, typename Done>
+    void write(Fn fn, Done done);
+
+    void flush(); // Blocks until every job submitted so far has run
+    size_t pending_reads() const;
+    size_t pending_writes() const;
+    size_t read_thread_count() const;
+
+    // Future-returning versions of the database.h calls
+    std::future<bool> register_user(std::string username, std::string password);
+    std::future<bool> authenticate_user(std::string username, std::string password);
+    std::future<int> get_user_id(std::string username);
+    std::future<std::string> get_username(int user_id);
+    std::future<std::vector<std::string>> get_usernames(std::vector<int> user_ids);
+    std::future<bool> create_group(std::string group_name);
+    std::future<bool> add_user_to_group(int user_id, int group_id);
+    std::future<std::vector<bool>> add_users_to_group(int group_id, std::vector<int> user_ids);
+    std::future<bool> remove_user_from_group(int user_id, int group_id);
+    std::future<std::vector<int>> get_user_groups(int user_id);
+    std::future<std::vector<int>> get_group_members(int group_id);
+    std::future<std::string> get_group_name(int group_id);
+    std::future<bool> save_message(int sender_id, int group_id, std::string text, std::string file_path = "");
+    std::future<std::vector<int>> save_messages(std::vector<MessageRecord> messages);
+    std::future<std::vector<std::pair<std::string, std::string>>> get_group_messages(int group_id, int limit = 50);
+    std::future<std::vector<MessageRecord>> get_group_messages_before(int group_id, int before_message_id, int limit = 50);
+    std::future<std::vector<MessageRecord>> search_messages(int group_id, std::string query, int limit = 20);
+    std::future<std::vector<int>> get_group_message_ids(int group_id);
+    std::future<bool> remove_message_from_group(int message_id, int group_id);
+    std::future<int> get_message_group_id(int message_id);
+    std::future<int> get_message_count_in_group(int group_id);
+    std::future<bool> mark_read(int user_id, int group_id, int message_id);
+    std::future<std::vector<std::pair<int, int>>> get_unread_counts(int user_id);
+
+private:
+
+    // One FIFO of jobs and the threads that drain it
+    struct Lane
+    {
+        mutable std::mutex mutex;
+        std::condition_variable ready;
+        std::condition_variable drained;
+        std::deque<Job> jobs;
+        uint64_t submitted = 0;
+        uint64_t finished = 0;
+        bool stopping = false;
+        std::vector<std::thread> threads;
+    };
+
+    template <typename Fn>
+    auto promised(Lane& lane, Fn fn) -> std::future<std::invoke_result_t<Fn, ChatDatabase&>>;
+
+    void push(Lane& lane, Job job);
+    void run(Lane& lane);
+    static void wait(Lane& lane); // Until the lane has run every job it had when called
+    static void stop(Lane& lane);
+
+    ChatDatabase& database;
+    Lane reads;
+    Lane writes;
+};
+
+template <typename Fn>
+auto DatabaseExecutor::promised(Lane& lane, Fn fn) -> std::future<std::invoke_result_t<Fn, ChatDatabase&>> {
+    using Result = std::invoke_result_t<Fn, ChatDatabase&>;
+    std::promise<Result> promise;
+    std::future<Result> result = promise.get_future();
+    push(lane, [this, fn = std::move(fn), promise = std::move(promise)]() mutable {
+        if constexpr (std::is_void<Result>::value) {
+            fn(database);
+            promise.set_value();
+        } else {
+            promise.set_value(fn(database));
+        }
+    });
+    return result;
+}
+
+template <typename Fn>
+auto DatabaseExecutor::read(Fn fn) -> std::future<std::invoke_result_t<Fn, ChatDatabase&>> {
+    return promised(reads, std::move(fn));
+}
+
+template <typename Fn, typename Done>
+void DatabaseExecutor::read(Fn fn, Done done) {
+    push(reads, [this, fn = std::move(fn), done = std::move(done)]() mutable { done(fn(database)); });
+}
+
+template <typename Fn>
+auto DatabaseExecutor::write(Fn fn) -> std::future<std::invoke_result_t<Fn, ChatDatabase&>> {
+    return promised(writes, std::move(fn));
+}
+
+template <typename Fn, typename Done>
+void DatabaseExecutor::write(Fn fn, Done done) {
+    push(writes, [this, fn = std::move(fn), done = std::move(done)]() mutable { done(fn(database)); });
+}
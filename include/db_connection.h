@@ -0,0 +1,73 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <mutex>
+#include <cstddef>
+#include <cstdint>
+
+struct sqlite3;
+struct sqlite3_stmt;
+
+// Connection, page cache and locking settings of a database
+struct DatabaseTuning
+{
+    int read_connections = 4; // Read-only connections next to the single writer
+    int64_t mmap_size = 256LL * 1024 * 1024; // Bytes of the file read through mmap
+    int cache_size_kib = 16384; // Page cache per connection
+    int busy_timeout_ms = 5000; // Wait this long on a locked database before failing
+    size_t recent_messages_per_group = 100; // Newest messages kept in memory per warm group, 0 disables
+    size_t recent_cache_bytes = 64 * 1024 * 1024; // Budget of the recent-message cache across all groups
+};
+
+// One SQLite connection with its own prepared-statement cache.
+// Statements are identified by a small integer so callers can keep their SQL
+// in a table; the connection is not thread-safe, lock mutex() around use.
+class DbConnection
+{
+public:
+
+    DbConnection(const std::string& path, bool read_only, const DatabaseTuning& tuning = DatabaseTuning());
+    ~DbConnection();
+
+    DbConnection(const DbConnection&) = delete;
+    DbConnection& operator=(const DbConnection&) = delete;
+
+    bool is_open() const;
+    sqlite3* handle() const;
+    std::recursive_mutex& mutex();
+
+    sqlite3_stmt* statement(int id, const char* sql); // Prepares on first use, nullptr on failure
+    bool execute(const char* sql, const std::string& error_msg); // Runs SQL that returns no rows
+
+private:
+
+    sqlite3* db;
+    std::vector<sqlite3_stmt*> statements;
+    std::recursive_mutex connection_mutex;
+};
+
+// Resets a cached statement and clears its bindings when the call is done,
+// so the next call finds it ready to bind again
+class ScopedStatement
+{
+public:
+
+    explicit ScopedStatement(sqlite3_stmt* stmt) : stmt(stmt) {}
+    ~ScopedStatement();
+
+    ScopedStatement(const ScopedStatement&) = delete;
+    ScopedStatement& operator=(const ScopedStatement&) = delete;
+
+    sqlite3_stmt* get() const { return stmt; }
+    explicit operator bool() const { return stmt != nullptr; }
+
+private:
+
+    sqlite3_stmt* stmt;
+};
+
+// Column value as std::string, empty for NULL
+std::string column_string(sqlite3_stmt* stmt, int column);
+
+// True for databases that only exist inside one connection (":memory:", "")
+bool is_memory_database(const std::string& path);
@@ -0,0 +1,134 @@
+#pragma once
+#include <string>
+#include <memory>
+#include <mutex>
+#include <map>
+#include <deque>
+#include <thread>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <condition_variable>
+#include "protocol.h"
+#include "sha256.h"
+#include "shared_buffer.h"
+#include "inline_function.h"
+
+// A download in progress: an open file and the FILE_CHUNK being written.
+// The reactor sends each chunk's header from here and its body straight from
+// the file with sendfile(), so content never passes through user space.
+// Move-only; closes the file.
+struct FileSend
+{
+    FileSend(int fd, uint64_t transfer_id, uint64_t offset, uint64_t length)
+        : fd(fd), transfer_id(transfer_id), offset(offset), remaining(length), header_size(0), header_sent(0),
+          body_left(0), last(false) {}
+    FileSend(FileSend&& other) noexcept;
+    FileSend& operator=(FileSend&& other) noexcept;
+    FileSend(const FileSend&) = delete;
+    FileSend& operator=(const FileSend&) = delete;
+    ~FileSend();
+
+    bool in_chunk() const { return header_size > 0; } // A chunk is partly written; finish it before any other frame
+    bool finished() const { return last && !in_chunk(); }
+
+    int fd;
+    uint64_t transfer_id;
+    uint64_t offset; // File offset of the next body byte
+    uint64_t remaining; // Bytes not yet put in a chunk
+    char header[protocol::file_chunk_header_size];
+    size_t header_size; // 0 between chunks
+    size_t header_sent;
+    size_t body_left; // Body bytes of the current chunk still to send
+    bool last; // The current or most recent chunk is the final one
+};
+
+// Content-addressed file storage under one directory.
+// A finished upload is stored as <root>/<first two hex digits>/<sha256 hex>,
+// so identical files share one copy, and the digest is what a file message
+// records as its file_path. Uploads are written to <root>/tmp as their chunks
+// arrive, hashed on the way, and synced and renamed into place on the last
+// one; a copy already in place is reused only if its content checks out.
+// Nothing holds a whole file in memory. An interrupted upload can be resumed
+// from where it stopped until the server restarts or an hour passes without
+// chunks. Chunks are written, hashed and stored on the store's own I/O
+// thread, in the order they were queued, so a reactor never waits on the disk.
+// Thread-safe.
+class FileStore
+{
+public:
+
+    static const uint64_t max_file_size = 1024 * 1024 * 1024; // Offsets and sizes fit the i32 RESULT value
+
+    struct Upload; // Opaque outside file_store.cpp
+
+    struct Completed
+    {
+        int group_id;
+        std::string name;
+        std::string digest;
+        uint64_t size;
+    };
+
+    enum class ChunkStatus
+    {
+        ACCEPTED, // More chunks expected
+        COMPLETE, // Stored; see Completed
+        FAILED // See error
+    };
+
+    using ChunkDone = InlineFunction<void(ChunkStatus status, const Completed& completed, const std::string& error), 48>;
+
+    explicit FileStore(const std::string& root);
+    ~FileStore(); // Writes every queued chunk, then joins the I/O thread
+
+    FileStore(const FileStore&) = delete;
+    FileStore& operator=(const FileStore&) = delete;
+
+    bool open(); // Creates the directories, clears uploads left by an earlier run and starts the I/O thread
+
+    // Starts an upload, or finds the one with the same id, size and group.
+    // Returns the offset to send from, -1 with error set on failure. A user
+    // may have a few uploads open at once, and the store a bounded number.
+    int64_t offer(int user_id, const protocol::FileOffer& offer, std::string& error);
+    // Copies the chunk into the I/O thread's queue; done runs on that thread.
+    // Refused with "server busy" while too much data is waiting.
+    void write_chunk(int user_id, const protocol::FileChunk& chunk, bool last, ChunkDone done);
+    void flush(); // Blocks until every chunk queued so far is written
+
+    int open_content(const std::string& digest, uint64_t& size); // Read-only fd, -1 if not stored
+    static bool is_digest(const std::string& text); // 64 lowercase hex characters
+
+private:
+
+    using UploadKey = std::pair<int, uint64_t>; // (user_id, transfer_id)
+
+    struct PendingChunk
+    {
+        int user_id;
+        uint64_t transfer_id;
+        uint64_t offset;
+        BufferRef data;
+        bool last;
+        ChunkDone done;
+    };
+
+    ChunkStatus store_chunk(int user_id, const protocol::FileChunk& chunk, bool last, Completed& completed, std::string& error);
+    void run_writer(); // I/O thread
+    void expire_uploads(); // Caller holds mutex
+    std::string content_path(const std::string& digest) const;
+
+    std::string root;
+    std::mutex mutex;
+    std::map<UploadKey, std::shared_ptr<Upload>> uploads;
+
+    std::mutex queue_mutex;
+    std::condition_variable chunk_ready; // Wakes the I/O thread
+    std::condition_variable chunks_written; // Wakes flush() waiters
+    std::deque<PendingChunk> queue;
+    size_t queued_bytes;
+    uint64_t submitted;
+    uint64_t written;
+    bool stopping;
+    std::thread writer;
+};
@@ -1,33 +1,60 @@
 #pragma once
 #include <string>
-#include <vector>
+#include <memory>
 #include <ctime>
+#include "member_set.h"
 
+// A group split by access pattern.
+// The hot part is what membership and delivery checks touch: the id, the
+// counters and a compressed member set, packed into one small object. The
+// name and timestamps sit behind a pointer and are only read for display.
+// The messages themselves are not held here; the Messages table indexes them
+// by (group_id, message_id), so the group only keeps a count.
 class Group 
 {
 public:
 
     Group(int group_id, const std::string& name); // Constructor
-    Group(); // Default Constructor
+    Group(); // Default Constructor; group_id is -1
     ~Group(); // Destructor
 
+    Group(const Group& other);
+    Group& operator=(const Group& other);
+    Group(Group&&) noexcept = default;
+    Group& operator=(Group&&) noexcept = default;
+
+    // Hot
     int group_id; // Primary key of group
-    std::string name;
-    std::vector<int> member_ids; 
-    std::vector<int> message_ids;  // Message IDs in this group
-    time_t created_at;
-    time_t updated_at;
-    
+    int message_count; // Messages stored for this group
+    MemberSet members;
+
     // Member Management
     void add_member(int user_id);
     void remove_member(int user_id);
     bool is_member(int user_id) const;
     bool has_member(int user_id) const;
 
-    // Message Management
-    void add_message(int message_id);
-    void remove_message(int message_id);
-    bool has_message(int message_id) const;
+    // Message Management, counters only
+    void add_message();
+    void remove_message();
     int get_message_count() const;
     int get_member_count() const;
-}; 
\ No newline at end of file
+
+    // Cold; empty on a moved-from group
+    const std::string& name() const;
+    time_t created_at() const;
+    time_t updated_at() const;
+
+private:
+
+    struct Details
+    {
+        std::string name;
+        time_t created_at;
+        time_t updated_at;
+    };
+
+    void touch();
+
+    std::unique_ptr<Details> details;
+};
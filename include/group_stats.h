@@ -0,0 +1,74 @@
+#pragma once
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <utility>
+#include <unordered_map>
+
+// In-memory copy of the GroupStats and ReadMarkers tables: per group, the
+// number of messages and the highest message_id stored, and per member, the
+// last message read plus how many of the group's messages that covered.
+// A user's unread count in a group is then message_count - read_count, one
+// hash lookup instead of a COUNT(*). Sharded by group, so the writer bumping
+// one group's counter does not stall readers of others.
+class GroupStats
+{
+public:
+
+    struct Counter
+    {
+        int message_count = 0;
+        int last_message_id = 0; // Highest id ever stored; deleting it does not lower this
+    };
+
+    struct ReadMarker
+    {
+        int last_read_message_id;
+        int read_count; // Messages in the group with ids up to last_read_message_id
+    };
+
+    struct MarkerRow
+    {
+        int user_id;
+        int group_id;
+        ReadMarker marker;
+    };
+
+    GroupStats();
+
+    GroupStats(const GroupStats&) = delete;
+    GroupStats& operator=(const GroupStats&) = delete;
+
+    void load(const std::vector<std::pair<int, Counter>>& counters, const std::vector<MarkerRow>& markers); // Replaces the contents
+
+    // Mirror committed changes; the tables are updated by the same statements' triggers
+    void message_added(int group_id, int message_id);
+    void message_removed(int group_id, int message_id);
+    void mark_read(int user_id, int group_id, const ReadMarker& marker); // Ignored unless it moves the marker forward
+
+    Counter counter(int group_id) const;
+    int unread_count(int user_id, int group_id) const; // Every message is unread until the first mark_read
+    bool loaded() const;
+
+private:
+
+    struct Entry
+    {
+        Counter counter;
+        std::unordered_map<int, ReadMarker> markers; // user_id -> marker
+    };
+
+    struct Shard
+    {
+        mutable std::mutex mutex;
+        std::unordered_map<int, Entry> groups;
+    };
+
+    static const int shard_count = 64;
+
+    Shard& shard_of(int group_id) { return shards[static_cast<unsigned>(group_id) % shard_count]; }
+    const Shard& shard_of(int group_id) const { return shards[static_cast<unsigned>(group_id) % shard_count]; }
+
+    Shard shards[shard_count];
+    std::atomic<bool> is_loaded;
+};
@@ -0,0 +1,120 @@
+#pragma once
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include "buffer_pool.h"
+
+template <typename Signature, size_t Capacity>
+class InlineFunction;
+
+// Move-only std::function replacement for the message path.
+// Callables up to Capacity bytes live inside the object; larger ones go to
+// buffer_pool, so wrapping a lambda never calls the global allocator.
+// std::function only keeps two pointers inline, which a task capturing a
+// BufferRef and a member list already exceeds.
+template <typename Result, typename... Args, size_t Capacity>
+class InlineFunction<Result(Args...), Capacity>
+{
+public:
+
+    InlineFunction() : operations(nullptr) {}
+    InlineFunction(std::nullptr_t) : operations(nullptr) {}
+
+    template <typename F, typename = std::enable_if_t<!std::is_same<std::decay_t<F>, InlineFunction>::value>>
+    InlineFunction(F&& callable) : operations(&Model<std::decay_t<F>>::table) {
+        Model<std::decay_t<F>>::create(storage, std::forward<F>(callable));
+    }
+
+    InlineFunction(InlineFunction&& other) noexcept : operations(other.operations) {
+        if (operations) {
+            operations->move(storage, other.storage);
+            other.operations = nullptr;
+        }
+    }
+
+    InlineFunction& operator=(InlineFunction&& other) noexcept {
+        if (this != &other) {
+            reset();
+            operations = other.operations;
+            if (operations) {
+                operations->move(storage, other.storage);
+                other.operations = nullptr;
+            }
+        }
+        return *this;
+    }
+
+    InlineFunction(const InlineFunction&) = delete;
+    InlineFunction& operator=(const InlineFunction&) = delete;
+
+    ~InlineFunction() { reset(); }
+
+    Result operator()(Args... args) const { return operations->invoke(storage, std::forward<Args>(args)...); }
+    explicit operator bool() const { return operations != nullptr; }
+
+    void reset() {
+        if (operations) {
+            operations->destroy(storage);
+            operations = nullptr;
+        }
+    }
+
+private:
+
+    static_assert(Capacity >= sizeof(void*), "Capacity must at least hold a pointer");
+
+    struct Operations
+    {
+        Result (*invoke)(void* storage, Args&&... args);
+        void (*move)(void* to, void* from); // Move-constructs into to and destroys from
+        void (*destroy)(void* storage);
+    };
+
+    template <typename F, bool Inline = sizeof(F) <= Capacity && alignof(F) <= alignof(std::max_align_t) &&
+                                        std::is_nothrow_move_constructible<F>::value>
+    struct Model;
+
+    // Stored in place
+    template <typename F>
+    struct Model<F, true>
+    {
+        static F* get(void* storage) { return std::launder(static_cast<F*>(storage)); }
+
+        template <typename G>
+        static void create(void* storage, G&& callable) { new (storage) F(std::forward<G>(callable)); }
+        static Result invoke(void* storage, Args&&... args) { return (*get(storage))(std::forward<Args>(args)...); }
+        static void move(void* to, void* from) {
+            new (to) F(std::move(*get(from)));
+            get(from)->~F();
+        }
+        static void destroy(void* storage) { get(storage)->~F(); }
+
+        static constexpr Operations table{invoke, move, destroy};
+    };
+
+    // Too big: storage holds a pointer to a pooled block
+    template <typename F>
+    struct Model<F, false>
+    {
+        static_assert(alignof(F) <= alignof(std::max_align_t), "Over-aligned callables are not supported");
+
+        static F*& get(void* storage) { return *static_cast<F**>(storage); }
+
+        template <typename G>
+        static void create(void* storage, G&& callable) {
+            get(storage) = new (buffer_pool::allocate(sizeof(F))) F(std::forward<G>(callable));
+        }
+        static Result invoke(void* storage, Args&&... args) { return (*get(storage))(std::forward<Args>(args)...); }
+        static void move(void* to, void* from) { get(to) = get(from); }
+        static void destroy(void* storage) {
+            get(storage)->~F();
+            buffer_pool::deallocate(get(storage), sizeof(F));
+        }
+
+        static constexpr Operations table{invoke, move, destroy};
+    };
+
+    const Operations* operations;
+    alignas(std::max_align_t) mutable unsigned char storage[Capacity];
+};
@@ -0,0 +1,46 @@
+#pragma once
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+// Log-linear latency histogram in nanoseconds.
+// Every power of two is split into 64 equal buckets, so any reported
+// percentile is within about 1.6% of the true value, and recording is an
+// index computation plus an increment. Not thread-safe: keep one per thread
+// and merge() them when reporting.
+class LatencyHistogram
+{
+public:
+
+    LatencyHistogram();
+
+    void record(uint64_t nanoseconds);
+    void record(std::chrono::nanoseconds latency) { record(static_cast<uint64_t>(latency.count())); }
+    void record(uint64_t nanoseconds, uint64_t times); // The same value times times over
+    void merge(const LatencyHistogram& other);
+    void reset();
+
+    uint64_t count() const;
+    uint64_t min() const; // Nanoseconds, 0 when empty
+    uint64_t max() const;
+    double mean() const;
+    uint64_t percentile(double percent) const; // percent in [0, 100], e.g. 99.9
+
+    // The bucket layout, for recorders that keep their own counts (see metrics.h)
+    static constexpr int sub_bits = 6;
+    static constexpr uint64_t sub_count = uint64_t(1) << sub_bits;
+    static constexpr int max_shift = 40 - sub_bits; // Values are clamped to about 18 minutes
+    static constexpr size_t bucket_count = (max_shift + 2) * sub_count;
+
+    static size_t bucket_of(uint64_t nanoseconds);
+    static uint64_t value_of(size_t bucket); // Midpoint of the bucket
+
+private:
+
+    std::array<uint64_t, bucket_count> buckets;
+    uint64_t total;
+    uint64_t smallest;
+    uint64_t largest;
+    long double sum;
+};
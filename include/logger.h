@@ -0,0 +1,65 @@
+#pragma once
+#include <sstream>
+#include <cstddef>
+#include <cstdint>
+
+enum class LogLevel
+{
+    DEBUG,
+    INFO,
+    WARN,
+    ERROR,
+    OFF
+};
+
+// Leveled, asynchronous, rate-limited log to stderr.
+// A line is formatted on the calling thread into a thread-local buffer and
+// handed to a writer thread through a lock-free queue, so logging never waits
+// on the terminal or on other loggers. Each level may emit a bounded number of
+// lines per second and at most max_queued lines wait for the writer; anything
+// beyond that is dropped and reported as a count on the next line written.
+//
+//     log_error() << "Failed to open " << path << ": " << strerror(errno);
+namespace logging
+{
+
+void set_level(LogLevel level); // Lines below level are skipped before formatting; INFO by default
+LogLevel level();
+bool enabled(LogLevel level);
+void set_rate_limit(uint32_t lines_per_second); // Per level, 0 for no limit; 200 by default
+void flush(); // Blocks until every line logged so far is written
+uint64_t dropped(); // Lines lost to the rate limit or a full queue since start
+
+const size_t max_queued = 8192;
+
+} // namespace logging
+
+// One log line, written when the object is destroyed at the end of the statement
+class LogLine
+{
+public:
+
+    explicit LogLine(LogLevel level);
+    ~LogLine();
+
+    LogLine(const LogLine&) = delete;
+    LogLine& operator=(const LogLine&) = delete;
+
+    template <typename T>
+    LogLine& operator<<(const T& value) {
+        if (stream) {
+            *stream << value;
+        }
+        return *this;
+    }
+
+private:
+
+    LogLevel level;
+    std::ostringstream* stream; // Thread-local buffer, nullptr when the level is off
+};
+
+inline LogLine log_debug() { return LogLine(LogLevel::DEBUG); }
+inline LogLine log_info() { return LogLine(LogLevel::INFO); }
+inline LogLine log_warn() { return LogLine(LogLevel::WARN); }
+inline LogLine log_error() { return LogLine(LogLevel::ERROR); }
@@ -0,0 +1,69 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Compressed set of non-negative ids, laid out like a roaring bitmap.
+// Ids are bucketed by their high 16 bits. A bucket holds its low halves as a
+// sorted uint16 array while it is small, and switches to a 65536-bit bitmap
+// (8 KiB) once the array would be larger than that. A small group costs 2
+// bytes per member; a dense large one about 1 bit per possible id.
+// Lookups are a binary search over buckets plus a binary search or bit test.
+class MemberSet
+{
+public:
+
+    MemberSet() : count(0) {}
+    explicit MemberSet(const std::vector<int>& ids); // Any order; duplicates and negative ids are ignored
+
+    bool insert(int id); // False if already present or negative
+    bool erase(int id); // False if absent
+    bool contains(int id) const;
+
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    size_t memory_bytes() const; // Heap bytes held, for sizing
+    std::vector<int> to_vector() const; // Ascending
+
+    template <typename Visit>
+    void for_each(Visit visit) const; // Ascending
+
+private:
+
+    static const size_t array_limit = 4096; // Entries at which an array bucket becomes a bitmap
+    static const size_t bitmap_words = 65536 / 16;
+
+    struct Bucket
+    {
+        uint16_t high;
+        bool bitmap;
+        uint32_t cardinality;
+        std::vector<uint16_t> data; // Sorted low halves, or bitmap_words words of bits
+    };
+
+    std::vector<Bucket>::iterator find_bucket(uint16_t high);
+    std::vector<Bucket>::const_iterator find_bucket(uint16_t high) const;
+    static void to_bitmap(Bucket& bucket);
+    static void to_array(Bucket& bucket);
+
+    std::vector<Bucket> buckets; // Sorted by high
+    size_t count;
+};
+
+template <typename Visit>
+void MemberSet::for_each(Visit visit) const {
+    for (const Bucket& bucket : buckets) {
+        int base = static_cast<int>(bucket.high) << 16;
+        if (!bucket.bitmap) {
+            for (uint16_t low : bucket.data) {
+                visit(base | low);
+            }
+            continue;
+        }
+        for (size_t word = 0; word < bitmap_words; ++word) {
+            for (uint16_t bits = bucket.data[word]; bits != 0; bits &= bits - 1) {
+                visit(base | static_cast<int>(word * 16 + __builtin_ctz(bits)));
+            }
+        }
+    }
+}
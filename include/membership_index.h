@@ -0,0 +1,63 @@
+#pragma once
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <utility>
+#include <unordered_map>
+
+// In-memory copy of GroupMembers in both directions: group -> sorted member ids
+// and user -> sorted group ids.
+// Read-mostly, RCU style: readers grab a snapshot pointer and never wait for a
+// writer. A join or leave copies the one list it changes, publishes the new
+// version with an atomic pointer swap, and the old version is freed when the
+// last reader holding it lets go. A batch join publishes once for the batch.
+class MembershipIndex
+{
+public:
+
+    using IdList = std::shared_ptr<const std::vector<int>>; // Sorted, never null
+
+    MembershipIndex();
+
+    MembershipIndex(const MembershipIndex&) = delete;
+    MembershipIndex& operator=(const MembershipIndex&) = delete;
+
+    void load(const std::vector<std::pair<int, int>>& memberships); // (group_id, user_id) rows, replaces the contents
+    void add(int group_id, int user_id);
+    void add_members(int group_id, const std::vector<int>& user_ids); // Publishes each changed table once for the batch
+    void remove(int group_id, int user_id);
+
+    IdList members(int group_id) const; // Snapshot, unaffected by later joins and leaves
+    IdList groups(int user_id) const;
+    bool is_member(int group_id, int user_id) const;
+    bool loaded() const;
+
+private:
+
+    // id -> sorted id list, sharded so a write copies only one shard's table
+    class Directory
+    {
+    public:
+        Directory();
+        IdList get(int key) const;
+        void insert(int key, int value); // Writers are serialized by the index
+        void insert_values(int key, const std::vector<int>& values);
+        void insert_keys(const std::vector<int>& keys, int value);
+        void erase(int key, int value);
+        void reset(std::unordered_map<int, std::vector<int>>& lists);
+
+    private:
+        using Table = std::unordered_map<int, IdList>;
+        static const int shard_count = 64;
+
+        static size_t shard_of(int key) { return static_cast<unsigned>(key) % shard_count; }
+
+        std::shared_ptr<const Table> shards[shard_count];
+    };
+
+    std::mutex write_mutex;
+    Directory by_group;
+    Directory by_user;
+    std::atomic<bool> is_loaded;
+};
@@ -0,0 +1,91 @@
+#pragma once
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "database.h"
+#include "db_connection.h"
+
+// One sealed partition, as listed in the Partitions catalog
+struct PartitionInfo
+{
+    std::string file; // Name inside the archive directory
+    std::string month; // "YYYY-MM" (UTC) its messages were sent in
+    int first_message_id;
+    int last_message_id;
+    int message_count;
+};
+
+// Cold history: messages moved out of the hot Messages table into one
+// read-only SQLite file per month. A partition keeps each group's messages
+// as zlib-compressed blocks of consecutive messages, keyed by
+// (group_id, first_message_id), so an old page is one index seek plus one or
+// two blocks to inflate. Partitions cover disjoint message_id ranges; files
+// are written once, made read-only and opened with immutable=1, so reading
+// them takes no locks and never touches the hot database.
+class MessageArchive
+{
+public:
+
+    explicit MessageArchive(const std::string& directory); // "" disables the archive
+    ~MessageArchive();
+
+    MessageArchive(const MessageArchive&) = delete;
+    MessageArchive& operator=(const MessageArchive&) = delete;
+
+    bool enabled() const;
+    const std::string& directory() const;
+    bool open(const PartitionInfo& partition); // Adds a sealed partition to the read path
+    std::vector<PartitionInfo> partitions() const; // Newest first
+
+    // Continue a history page below the hot table: newest first, message_id < before_message_id (0 = no bound)
+    bool read_group_page(int group_id, int before_message_id, int limit, std::vector<MessageRecord>& messages);
+    void get_group_message_ids(int group_id, std::vector<int>& message_ids); // Appends, newest first
+    int count_after(int group_id, int message_id); // Archived messages of the group newer than message_id
+    bool find_message(int message_id, MessageRecord& message); // False if no partition holds it
+
+    // Builds one partition file. Messages must arrive ordered by (group_id, message_id);
+    // finish() seals the file and fills in everything but info.month.
+    class Writer
+    {
+    public:
+
+        Writer(const MessageArchive& archive, const std::string& file);
+        ~Writer();
+
+        Writer(const Writer&) = delete;
+        Writer& operator=(const Writer&) = delete;
+
+        bool is_open() const;
+        bool add(const MessageRecord& message);
+        bool finish(PartitionInfo& info);
+
+    private:
+
+        bool flush_block();
+
+        std::string path;
+        std::unique_ptr<DbConnection> connection;
+        int group_id;
+        std::vector<MessageRecord> block;
+        size_t block_bytes;
+        PartitionInfo totals;
+        bool failed;
+    };
+
+private:
+
+    struct Partition
+    {
+        PartitionInfo info;
+        std::unique_ptr<DbConnection> connection;
+    };
+    using PartitionList = std::vector<std::shared_ptr<Partition>>;
+
+    PartitionList snapshot() const;
+
+    std::string root;
+    mutable std::mutex partitions_mutex;
+    PartitionList partitions_by_age; // Newest first
+};
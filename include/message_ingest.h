@@ -0,0 +1,114 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <deque>
+#include <future>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <optional>
+#include <cstdint>
+#include "chat_database.h"
+#include "message_text.h"
+#include "inline_function.h"
+#include "buffer_pool.h"
+
+// Batching limits and durability for a MessageIngestQueue.
+// durability is applied to the database's one writer connection, so it also
+// covers registrations, memberships and read markers. Unset leaves the
+// connection as it is (FULL unless changed). NORMAL makes each batch commit
+// cheaper, but a crash may lose the last commits of every kind, not only
+// messages, so it is opt-in.
+struct IngestOptions
+{
+    size_t max_batch = 256; // Messages per transaction
+    std::chrono::microseconds max_delay{2000}; // Oldest message waits at most this long for its batch
+    std::optional<Durability> durability;
+};
+
+// Timing of one committed batch
+struct BatchStats
+{
+    size_t messages; // Messages in the batch
+    size_t failed; // Messages that could not be stored
+    std::chrono::microseconds commit_time; // BEGIN to COMMIT
+    std::chrono::microseconds latency; // Oldest enqueue to COMMIT
+    double throughput; // Messages per second while committing
+};
+
+// Running totals since the queue started
+struct IngestStats
+{
+    uint64_t batches;
+    uint64_t messages;
+    uint64_t failed;
+    std::chrono::microseconds max_latency;
+    double throughput; // Stored messages per second since start
+};
+
+// Asynchronous save_message pipeline.
+// Producers enqueue messages from any thread and get the new message_id (or -1)
+// through a future or callback. One writer thread drains the queue and stores
+// each batch in a single transaction, so a burst costs one journal sync per
+// batch instead of one per message. Queued text, callbacks and queue nodes
+// come from buffer_pool, so enqueueing with a callback never calls malloc.
+class MessageIngestQueue
+{
+public:
+
+    using Callback = InlineFunction<void(int message_id), 48>; // Fits a send ack with its pending delivery
+    using BatchObserver = std::function<void(const BatchStats&)>;
+
+    explicit MessageIngestQueue(ChatDatabase& database, const IngestOptions& options = IngestOptions()); // Starts the writer
+    ~MessageIngestQueue(); // Stores everything still queued, then stops the writer
+
+    MessageIngestQueue(const MessageIngestQueue&) = delete;
+    MessageIngestQueue& operator=(const MessageIngestQueue&) = delete;
+
+    std::future<int> enqueue(int sender_id, int group_id, std::string_view text, std::string_view file_path = "");
+    void enqueue(int sender_id, int group_id, std::string_view text, std::string_view file_path, Callback done);
+
+    void flush(); // Blocks until everything enqueued so far is committed
+    void stop();
+
+    void set_batch_observer(BatchObserver observer); // Called on the writer thread after every batch
+    IngestStats stats() const;
+    size_t pending() const;
+
+private:
+
+    struct PendingMessage
+    {
+        int sender_id;
+        int group_id;
+        MessageText text;
+        MessageText file_path;
+        Callback done;
+        std::chrono::steady_clock::time_point enqueued_at;
+    };
+
+    using PendingQueue = std::deque<PendingMessage, PoolAllocator<PendingMessage>>;
+
+    void push(PendingMessage message);
+    void run(); // Writer thread
+    void write_batch(PendingQueue& batch);
+
+    ChatDatabase& database;
+    IngestOptions options;
+
+    mutable std::mutex queue_mutex;
+    std::condition_variable queue_ready;
+    std::condition_variable queue_drained;
+    PendingQueue queue;
+    uint64_t enqueued;
+    uint64_t committed;
+    bool stopping;
+
+    BatchObserver observer;
+    IngestStats totals;
+    std::chrono::steady_clock::time_point started_at;
+
+    std::thread writer;
+};
@@ -0,0 +1,151 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+#include "chat_database.h"
+#include "message_text.h"
+#include "inline_function.h"
+#include "buffer_pool.h"
+
+// Sizes and batching of a MessageLog
+struct MessageLogOptions
+{
+    size_t segment_bytes = 64 * 1024 * 1024; // Preallocated size of each segment file
+    size_t max_batch = 512; // Messages the indexer applies per SQLite transaction
+    int reserved_ids = 4096; // Message ids taken from SQLite at a time
+};
+
+// Running totals since the log opened
+struct MessageLogStats
+{
+    uint64_t appended;
+    uint64_t durable; // Acknowledged
+    uint64_t applied; // In the Messages table
+    uint64_t syncs; // fdatasync calls; appended / syncs is the group-commit size
+    uint64_t replayed; // Records applied at open, left over from the previous run
+    uint64_t failed; // Records that could not be made durable, and were answered with -1
+    uint64_t parked; // Acknowledged records SQLite refused, kept in RejectedMessages
+    size_t segments; // Segment files on disk
+};
+
+// Write-ahead message log in front of the Messages table.
+// append() copies the message into a memory-mapped segment file, and one
+// sync thread makes the log durable with fdatasync. Every message appended
+// during a sync is covered by the next one, so a burst shares a single disk
+// flush. Messages are acknowledged with their message_id once durable. An
+// indexer thread then stores them in SQLite in batches, which makes the
+// Messages table an asynchronous view of the log: history may trail an
+// acknowledged message by one batch.
+//
+// Ids are handed out from blocks reserved in SQLite, so they never collide
+// with messages stored directly. append() runs on the reactors and never
+// touches the disk or SQLite: the sync thread keeps the next segment
+// preallocated and mapped, and the indexer reserves the next id block ahead,
+// so an append copies into mapped memory and at most swaps in a segment or
+// block. It only waits if one was used up before its successor was ready.
+// The id of the last applied record is saved in the same transaction as the
+// batch, and on open every record after it is replayed before the log takes
+// new appends. A record SQLite refuses is moved to the RejectedMessages
+// table in that transaction, never dropped. Segments are deleted once all
+// of their records are applied.
+//
+// The log lives in db_name.log/. A memory database has no log; appends then
+// go through the database's ingest queue, with the same callbacks.
+class MessageLog
+{
+public:
+
+    using Callback = InlineFunction<void(int message_id), 48>; // Same as MessageIngestQueue::Callback
+
+    explicit MessageLog(ChatDatabase& database, const MessageLogOptions& options = MessageLogOptions()); // Replays, then starts the threads
+    ~MessageLog(); // Acknowledges and applies everything appended, then stops the threads
+
+    MessageLog(const MessageLog&) = delete;
+    MessageLog& operator=(const MessageLog&) = delete;
+
+    bool is_open() const;
+    const std::string& directory() const;
+
+    std::future<int> append(int sender_id, int group_id, std::string_view text, std::string_view file_path = "");
+    void append(int sender_id, int group_id, std::string_view text, std::string_view file_path, Callback done); // done runs on the sync thread
+
+    void sync(); // Blocks until everything appended so far is durable
+    void flush(); // Blocks until everything appended so far is in SQLite
+    bool applying(int message_id) const; // Logged but not yet in SQLite; never blocks
+    void wait_applied(int message_id); // Blocks while applying(message_id), unless the indexer gave up at shutdown
+    void stop();
+
+    MessageLogStats stats() const;
+
+private:
+
+    struct Segment;
+
+    struct PendingRecord
+    {
+        int message_id;
+        int sender_id;
+        int group_id;
+        int64_t sent_at_ms;
+        MessageText text;
+        MessageText file_path;
+        Callback done;
+    };
+
+    using PendingQueue = std::deque<PendingRecord, PoolAllocator<PendingRecord>>;
+
+    bool open();
+    bool replay(); // Applies records past the checkpoint, in id order
+    std::shared_ptr<Segment> create_segment(); // Preallocated and mapped; sync thread, or open() before it starts
+    Segment* writable_segment(size_t bytes, std::unique_lock<std::mutex>& lock); // nullptr if the log failed or stopped
+    int next_message_id(std::unique_lock<std::mutex>& lock); // -1 if no ids are left
+    bool ids_wanted() const; // Caller holds log_mutex; the indexer should reserve the next block
+    bool apply(const std::vector<MessageRecord>& records, uint64_t& rejected); // One transaction, checkpoint included
+    void retire_segments(int applied_message_id);
+    void run_sync(); // Sync thread
+    void run_indexer(); // Indexer thread
+
+    ChatDatabase& database;
+    MessageLogOptions options;
+    std::string log_directory;
+    bool opened;
+
+    mutable std::mutex log_mutex;
+    std::condition_variable append_ready; // Wakes the sync thread
+    std::condition_variable records_durable; // Wakes sync() waiters and the indexer
+    std::condition_variable records_applied; // Wakes flush() waiters
+    std::condition_variable segment_ready; // Wakes an append waiting for the spare segment
+    std::condition_variable ids_ready; // Wakes an append waiting for the spare id block
+    std::vector<std::shared_ptr<Segment>> segments; // Oldest first, the last one takes appends
+    std::shared_ptr<Segment> spare_segment; // Next to take appends, made ahead by the sync thread
+    int next_sequence; // Number of the next segment file
+    PendingQueue unsynced;
+    PendingQueue unapplied;
+    int reserved_next; // Next id of the reserved block
+    int64_t reserved_end; // One past the block
+    int spare_first; // Block the indexer reserved ahead, 0 if none
+    int spare_count;
+    bool ids_failed; // The last reservation failed; appends needing ids are refused until a retry succeeds
+    std::chrono::steady_clock::time_point ids_retry_at;
+    uint64_t synced; // Records the sync thread is done with, durable or not
+    uint64_t finished; // Records that are applied or will never be
+    int last_appended_id;
+    int synced_through; // Every record up to this id is durable or failed
+    int finished_through; // Every record up to this id is finished
+    bool failed; // The log takes no more appends
+    bool sync_failed; // Nothing written before the failed sync can be acknowledged
+    bool stopping;
+    bool abandoned; // The indexer gave up on a batch at shutdown; nothing from it on is applied
+    MessageLogStats totals;
+
+    std::thread syncer;
+    std::thread indexer;
+};
@@ -0,0 +1,25 @@
+#pragma once
+#include <string>
+
+struct sqlite3;
+
+// Full-text search over message text, backing ChatDatabase::search_messages.
+// The MessageSearch FTS5 index reads each message as "<group_id>\x1f<text>",
+// and the group_words tokenizer turns every word of it into "<group_id>:<word>".
+// Each group thus has posting lists of its own, so a search costs what it
+// matches in that group, however large the rest of the history is.
+namespace message_search
+{
+
+const char* const tokenizer_name = "group_words";
+
+// Registers group_words on a connection. Every connection that reads the index
+// or writes Messages (whose triggers update the index) needs it.
+bool register_tokenizer(sqlite3* db);
+
+// FTS5 query for the words of query within one group. Every word must match;
+// a trailing * makes it a prefix match. Words are quoted, so FTS5 operators in
+// the input are plain text. Empty if the input has no words.
+std::string expression(int group_id, const std::string& query);
+
+} // namespace message_search
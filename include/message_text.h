@@ -0,0 +1,39 @@
+#pragma once
+#include <cstddef>
+#include <string_view>
+
+// Chat text with inline storage for typical short lines.
+// Up to inline_capacity bytes are kept inside the object; longer text goes
+// to a buffer_pool block. Either way, holding a message costs no global
+// allocation, unlike std::string past its 15-byte small-string buffer.
+class MessageText
+{
+public:
+
+    static constexpr size_t inline_capacity = 128;
+
+    MessageText() : length(0), pooled(nullptr) {}
+    MessageText(std::string_view text);
+    MessageText(const MessageText& other) : MessageText(other.view()) {}
+    MessageText(MessageText&& other) noexcept;
+    ~MessageText();
+
+    MessageText& operator=(const MessageText& other);
+    MessageText& operator=(MessageText&& other) noexcept;
+
+    const char* data() const { return pooled ? pooled : inline_bytes; }
+    size_t size() const { return length; }
+    bool empty() const { return length == 0; }
+    std::string_view view() const { return std::string_view(data(), length); }
+    operator std::string_view() const { return view(); }
+
+private:
+
+    void assign(std::string_view text);
+    void take(MessageText& other); // Steals other's bytes and leaves it empty
+    void release();
+
+    size_t length;
+    char* pooled; // nullptr while the text fits inline
+    char inline_bytes[inline_capacity];
+};
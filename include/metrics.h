@@ -0,0 +1,86 @@
+#pragma once
+#include <string>
+#include <chrono>
+#include <cstdint>
+
+// Process-wide counters, gauges and latency histograms, rendered in the
+// Prometheus text format.
+// Every thread updates its own copy of each metric with relaxed atomics on
+// memory no other thread writes, so recording costs a thread-local lookup and
+// an uncontended add; render() sums the copies. Histograms bucket like
+// LatencyHistogram and are exported as summaries with exact _sum and _count.
+//
+// Metric objects are handles: constructing one with a name and label set that
+// is already registered returns the same series, so they are usually
+// namespace-scope constants next to the code that updates them.
+namespace metrics
+{
+
+const size_t max_values = 256; // Counters and gauges together
+const size_t max_histograms = 64;
+
+class Counter
+{
+public:
+
+    Counter(const std::string& name, const std::string& help, const std::string& labels = ""); // labels like key="value",...
+
+    void add(uint64_t amount = 1) const;
+    uint64_t value() const; // Sum over every thread
+
+private:
+
+    uint32_t slot;
+};
+
+// Rises and falls; each thread's share may go negative, the sum is what counts
+class Gauge
+{
+public:
+
+    Gauge(const std::string& name, const std::string& help, const std::string& labels = "");
+
+    void add(int64_t amount) const;
+    int64_t value() const;
+
+private:
+
+    uint32_t slot;
+};
+
+class Histogram
+{
+public:
+
+    // unit converts recorded values for export: 1e-9 turns nanoseconds into seconds
+    Histogram(const std::string& name, const std::string& help, const std::string& labels = "", double unit = 1e-9);
+
+    void record(uint64_t value) const;
+    void record(std::chrono::nanoseconds latency) const { record(static_cast<uint64_t>(latency.count())); }
+    uint64_t count() const;
+
+private:
+
+    uint32_t slot;
+};
+
+// Records the time from construction to destruction
+class Timer
+{
+public:
+
+    explicit Timer(const Histogram& histogram) : histogram(histogram), started(std::chrono::steady_clock::now()) {}
+    ~Timer() { histogram.record(std::chrono::steady_clock::now() - started); }
+
+    Timer(const Timer&) = delete;
+    Timer& operator=(const Timer&) = delete;
+
+private:
+
+    const Histogram& histogram;
+    std::chrono::steady_clock::time_point started;
+};
+
+std::string render(); // Every registered metric in the Prometheus text exposition format
+
+} // namespace metrics
@@ -0,0 +1,31 @@
+#pragma once
+#include <atomic>
+#include <thread>
+
+// Serves metrics::render() as GET /metrics over HTTP on 127.0.0.1, for a
+// Prometheus scraper on the same host. One thread, one request per
+// connection; it never touches the reactors or the database.
+class MetricsEndpoint
+{
+public:
+
+    explicit MetricsEndpoint(int port); // 0 picks a free port
+    ~MetricsEndpoint();
+
+    MetricsEndpoint(const MetricsEndpoint&) = delete;
+    MetricsEndpoint& operator=(const MetricsEndpoint&) = delete;
+
+    bool start(); // Binds and spawns the thread
+    void stop();
+    int bound_port() const;
+
+private:
+
+    void run();
+    void serve(int client);
+
+    int port;
+    int listen_fd;
+    std::atomic<bool> running;
+    std::thread thread;
+};
@@ -0,0 +1,67 @@
+#pragma once
+#include <atomic>
+#include <utility>
+#include "buffer_pool.h"
+
+// Unbounded lock-free queue for many producers and a single consumer.
+// push() is one atomic exchange plus a store, so producers never wait on each
+// other or on the consumer. Only one thread may call pop(). Nodes come from
+// buffer_pool.
+//
+// A push that is half done (exchanged but not yet linked) briefly hides itself
+// and everything queued after it; pop() reports empty until the producer
+// finishes. Callers that sleep between drains must wake the consumer after
+// push() returns, not before.
+template <typename T>
+class MpscQueue
+{
+public:
+
+    MpscQueue() : head(new Node()), tail(head.load(std::memory_order_relaxed)) {}
+
+    ~MpscQueue() {
+        T discarded;
+        while (pop(discarded)) {
+        }
+        delete tail;
+    }
+
+    MpscQueue(const MpscQueue&) = delete;
+    MpscQueue& operator=(const MpscQueue&) = delete;
+
+    // Any thread
+    void push(T value) {
+        Node* node = new Node(std::move(value));
+        Node* previous = head.exchange(node, std::memory_order_acq_rel);
+        previous->next.store(node, std::memory_order_release);
+    }
+
+    // Consumer thread only; false when empty
+    bool pop(T& out) {
+        Node* next = tail->next.load(std::memory_order_acquire);
+        if (!next) {
+            return false;
+        }
+        out = std::move(next->value);
+        delete tail;
+        tail = next; // next becomes the empty sentinel
+        return true;
+    }
+
+private:
+
+    struct Node
+    {
+        Node() : next(nullptr) {}
+        explicit Node(T value) : next(nullptr), value(std::move(value)) {}
+
+        static void* operator new(size_t size) { return buffer_pool::allocate(size); }
+        static void operator delete(void* block, size_t size) { buffer_pool::deallocate(block, size); }
+
+        std::atomic<Node*> next;
+        T value;
+    };
+
+    std::atomic<Node*> head; // Most recently pushed node
+    Node* tail; // Sentinel whose successor is the oldest entry; consumer only
+};
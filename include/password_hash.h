@@ -0,0 +1,24 @@
+#pragma once
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include "sha256.h"
+
+// Salted password hashes, stored as
+//     pbkdf2-sha256$<iterations>$<salt hex>$<key hex>
+// using PBKDF2-HMAC-SHA256 (RFC 8018) with a 16-byte random salt. The cost
+// travels with each hash, so raising it affects new hashes only; older ones
+// are upgraded the next time their password is verified.
+namespace password_hash
+{
+
+const int default_iterations = 100000;
+
+std::string hash(std::string_view password, int iterations); // "" if no salt could be drawn
+bool verify(std::string_view password, std::string_view stored); // Constant time; plaintext rows from older databases still verify
+bool needs_upgrade(std::string_view stored, int iterations); // Plaintext, or hashed at a different cost
+
+Sha256::Digest pbkdf2(std::string_view password, std::string_view salt, int iterations); // One 32-byte block
+bool random_bytes(void* out, size_t length); // From the kernel's CSPRNG
+
+} // namespace password_hash
@@ -0,0 +1,239 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include "ring_buffer.h"
+
+// Binary wire protocol shared by the server and clients.
+//
+// Every frame is an 8-byte little-endian header followed by the payload:
+//     u32 payload_length | u16 type | u16 flags | payload
+// Payload fields are little-endian integers and length-prefixed strings
+// (str16 = u16 length + bytes, str32 = u32 length + bytes).
+namespace protocol
+{
+
+const size_t header_size = 8;
+const uint32_t max_payload = 1024 * 1024; // Larger frames are a protocol error
+
+enum class FrameType : uint16_t
+{
+    LOGIN = 1,            // u8 create_account, str16 username, str16 password; the RESULT detail is a session token
+    RESULT = 2,           // u16 request_type, i32 value, str16 detail
+    JOIN_GROUP = 3,       // i32 group_id
+    LEAVE_GROUP = 4,      // i32 group_id
+    SEND_MESSAGE = 5,     // i32 group_id, u64 client_tag, str32 text
+    DELIVER_MESSAGE = 6,  // i32 group_id, i32 sender_id, i32 message_id, i64 sent_at_ms, u64 client_tag, str16 sender_name, str32 text
+    HISTORY_REQUEST = 7,  // i32 group_id, i32 before_message_id, u16 limit
+    HISTORY_RESPONSE = 8, // i32 group_id, u16 count, count x (i32 message_id, i32 sender_id, i64 sent_at_ms, str16 username, str32 text)
+    FILE_CHUNK = 9,       // u64 transfer_id, u64 offset, raw bytes to the end of the payload
+    MESSAGES_DROPPED = 10, // u32 dropped_count; deliveries skipped while the client lagged, reload them with HISTORY_REQUEST
+    FILE_OFFER = 11,      // u64 transfer_id, i32 group_id, u64 size, str16 name; the RESULT value is the offset to upload from.
+                          // Files are at most 1 GiB (FileStore::max_file_size), so sizes and offsets fit the i32 RESULT value
+    FILE_DOWNLOAD = 12    // i32 message_id, u64 transfer_id, u64 offset, u64 length (0 = to the end); answered with FILE_CHUNK frames
+};
+
+const uint16_t FLAG_LAST_CHUNK = 1; // FILE_CHUNK: final chunk of the transfer
+const uint16_t FLAG_FILE_MESSAGE = 1; // DELIVER_MESSAGE: text is a file name, fetch the content with FILE_DOWNLOAD
+const uint16_t FLAG_SESSION_TOKEN = 1; // LOGIN: password is the token from an earlier LOGIN result, valid for a while
+
+const size_t file_chunk_header_size = header_size + 16; // Frame header, transfer_id and offset of a FILE_CHUNK
+
+bool is_known_type(uint16_t type);
+
+// A parsed frame. payload points into the receive ring (or the parser's
+// scratch space) and stays valid until FrameParser::consume().
+struct Frame
+{
+    FrameType type;
+    uint16_t flags;
+    std::string_view payload;
+};
+
+enum class ParseStatus
+{
+    FRAME,     // A complete frame was returned
+    NEED_MORE, // Read more bytes (the ring may need at least required_capacity())
+    INVALID    // Oversized or unknown frame, the connection should be dropped
+};
+
+// Pulls frames out of a RingBuffer without copying payloads, except for the
+// rare frame that wraps around the end of the ring.
+class FrameParser
+{
+public:
+
+    FrameParser();
+
+    ParseStatus next(const RingBuffer& buffer, Frame& frame);
+    void consume(RingBuffer& buffer); // Drops the frame returned by next()
+    size_t required_capacity() const; // Ring size that fits the frame being waited on
+
+private:
+
+    std::vector<char> scratch; // Holds a frame that wraps around the ring
+    size_t current_size; // Header + payload of the frame returned by next()
+    size_t waiting_for;
+};
+
+// Appends one frame to out; the header is patched in by finish()
+class FrameWriter
+{
+public:
+
+    FrameWriter(std::string& out, FrameType type, uint16_t flags = 0);
+
+    FrameWriter& u8(uint8_t value);
+    FrameWriter& u16(uint16_t value);
+    FrameWriter& u32(uint32_t value);
+    FrameWriter& u64(uint64_t value);
+    FrameWriter& i32(int32_t value) { return u32(static_cast<uint32_t>(value)); }
+    FrameWriter& i64(int64_t value) { return u64(static_cast<uint64_t>(value)); }
+    FrameWriter& str16(std::string_view value); // Truncated to 65535 bytes
+    FrameWriter& str32(std::string_view value);
+    FrameWriter& bytes(std::string_view value); // Raw, no length prefix
+
+    void finish(); // Writes the header with the final payload length
+
+private:
+
+    std::string& out;
+    size_t start;
+    FrameType type;
+    uint16_t flags;
+};
+
+// Sequential reader over a payload; any short read clears ok()
+class PayloadReader
+{
+public:
+
+    explicit PayloadReader(std::string_view payload) : payload(payload), position(0), valid(true) {}
+
+    uint8_t u8();
+    uint16_t u16();
+    uint32_t u32();
+    uint64_t u64();
+    int32_t i32() { return static_cast<int32_t>(u32()); }
+    int64_t i64() { return static_cast<int64_t>(u64()); }
+    std::string_view str16();
+    std::string_view str32();
+    std::string_view rest();
+
+    bool ok() const { return valid; }
+    bool at_end() const { return position == payload.size(); }
+
+private:
+
+    bool need(size_t length);
+
+    std::string_view payload;
+    size_t position;
+    bool valid;
+};
+
+// Decoded payloads; string fields view into the frame payload
+struct LoginRequest
+{
+    bool create_account;
+    std::string_view username;
+    std::string_view password;
+};
+
+struct ResultMessage
+{
+    uint16_t request_type;
+    int32_t value; // user_id, message_id... or -1 on failure
+    std::string_view detail;
+};
+
+struct SendMessageRequest
+{
+    int32_t group_id;
+    uint64_t client_tag; // Echoed in DELIVER_MESSAGE so clients can match their own sends
+    std::string_view text;
+};
+
+struct DeliverMessage
+{
+    int32_t group_id;
+    int32_t sender_id;
+    int32_t message_id;
+    int64_t sent_at_ms;
+    uint64_t client_tag;
+    std::string_view sender_name;
+    std::string_view text;
+};
+
+struct HistoryRequest
+{
+    int32_t group_id;
+    int32_t before_message_id; // <= 0 for the newest messages
+    uint16_t limit;
+};
+
+struct HistoryEntry
+{
+    int32_t message_id;
+    int32_t sender_id;
+    int64_t sent_at_ms;
+    std::string_view username;
+    std::string_view text;
+};
+
+struct FileChunk
+{
+    uint64_t transfer_id;
+    uint64_t offset;
+    std::string_view data;
+};
+
+struct FileOffer
+{
+    uint64_t transfer_id; // Chosen by the uploader, unique among its own uploads
+    int32_t group_id;
+    uint64_t size;
+    std::string_view name;
+};
+
+struct FileDownloadRequest
+{
+    int32_t message_id;
+    uint64_t transfer_id; // Echoed in every FILE_CHUNK of the download
+    uint64_t offset;
+    uint64_t length; // 0 for everything from offset on
+};
+
+bool decode_login(std::string_view payload, LoginRequest& out);
+bool decode_result(std::string_view payload, ResultMessage& out);
+bool decode_group(std::string_view payload, int32_t& group_id);
+bool decode_send_message(std::string_view payload, SendMessageRequest& out);
+bool decode_deliver_message(std::string_view payload, DeliverMessage& out);
+bool decode_history_request(std::string_view payload, HistoryRequest& out);
+bool decode_history_response(std::string_view payload, int32_t& group_id, std::vector<HistoryEntry>& out);
+bool decode_file_chunk(std::string_view payload, FileChunk& out);
+bool decode_messages_dropped(std::string_view payload, uint32_t& dropped_count);
+bool decode_file_offer(std::string_view payload, FileOffer& out);
+bool decode_file_download(std::string_view payload, FileDownloadRequest& out);
+
+void encode_login(std::string& out, const LoginRequest& request, uint16_t flags = 0);
+void encode_result(std::string& out, const ResultMessage& result);
+void encode_group(std::string& out, FrameType type, int32_t group_id); // JOIN_GROUP or LEAVE_GROUP
+void encode_send_message(std::string& out, const SendMessageRequest& request);
+void encode_deliver_message(std::string& out, const DeliverMessage& message, uint16_t flags = 0);
+void set_deliver_message_id(std::string& frame, int32_t message_id); // Rewrites message_id in an encoded DELIVER_MESSAGE
+void encode_history_request(std::string& out, const HistoryRequest& request);
+void encode_history_response(std::string& out, int32_t group_id, const std::vector<HistoryEntry>& entries);
+void encode_file_chunk(std::string& out, const FileChunk& chunk, bool last);
+void encode_messages_dropped(std::string& out, uint32_t dropped_count);
+void encode_file_offer(std::string& out, const FileOffer& offer);
+void encode_file_download(std::string& out, const FileDownloadRequest& request);
+
+// Writes the first file_chunk_header_size bytes of a FILE_CHUNK carrying
+// data_length bytes; the sender streams the data itself right after, e.g.
+// with sendfile(), so file content never passes through a frame buffer
+void encode_file_chunk_header(char* out, uint64_t transfer_id, uint64_t offset, uint32_t data_length, bool last);
+
+} // namespace protocol
@@ -0,0 +1,94 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <memory>
+#include <unordered_map>
+#include <thread>
+#include <atomic>
+#include <utility>
+#include "connection.h"
+#include "shared_buffer.h"
+#include "membership_index.h"
+#include "mpsc_queue.h"
+#include "inline_function.h"
+
+class Server;
+
+// Event loop for one core.
+// Each reactor owns a SO_REUSEPORT listener, an edge-triggered epoll set and the
+// connections the kernel hands to its listener. Other threads never touch those
+// connections directly; they post() work that runs on the reactor thread.
+//
+// Each connection's outbound queue is bounded. Past the high watermark the
+// connection stops receiving group deliveries until it drains to the low
+// watermark, then gets one MESSAGES_DROPPED frame so it can reload history.
+// Replies are never skipped, but a connection whose queue still reaches the
+// hard limit is closed. One slow reader costs its own deliveries, never the
+// group's.
+//
+// File downloads are sent in chunks with sendfile(), one chunk at a time, and
+// queued frames go out between chunks, so chat traffic never waits behind a
+// whole file. A flush sends a bounded amount of file data and then yields to
+// the other connections.
+class Reactor
+{
+public:
+
+    using Task = InlineFunction<void(), 48>; // Fits a group broadcast: members, frame and sender
+
+    Reactor(Server& server, int index);
+    ~Reactor();
+
+    Reactor(const Reactor&) = delete;
+    Reactor& operator=(const Reactor&) = delete;
+
+    bool listen(int port); // Binds the listener; port 0 picks a free port
+    int bound_port() const;
+    bool start(); // Spawns the event loop thread
+    void stop(); // Closes every connection and joins the thread
+
+    void post(Task task); // Runs task on the reactor thread; lock-free, any thread
+    size_t connection_count() const;
+    int index() const;
+
+    // Reactor thread only
+    void send_to_all(const BufferRef& frame, const User* except);
+    void send_to_group(const MembershipIndex::IdList& members, const BufferRef& frame, const User* except);
+    void bind_user(Connection& connection, int user_id); // Sets user_id and makes the connection reachable by it
+    void send(Connection& connection, BufferRef frame); // Queues the frame; written out at the end of the current batch
+    void deliver(Connection& connection, const BufferRef& frame); // Like send(), but skipped while the connection lags
+    bool send_file(Connection& connection, FileSend file); // Queues a download; false if the connection has too many
+    Connection* find(int fd, uint64_t connection_id); // nullptr once that connection is gone
+
+private:
+
+    void run();
+    void accept_connections();
+    void handle_readable(Connection& connection);
+    bool flush(Connection& connection); // False if the connection failed
+    void schedule_flush(Connection& connection);
+    void unbind_user(Connection& connection);
+    void close_connection(Connection& connection);
+    void flush_pending(); // One write per connection that had frames queued since the last flush
+    bool run_posted_tasks(); // True if it stopped with tasks still queued
+    void wake();
+
+    Server& server;
+    int reactor_index;
+    int listen_fd;
+    int epoll_fd;
+    int wake_fd; // eventfd that interrupts epoll_wait for posted tasks
+    int port;
+
+    std::unordered_map<int, std::unique_ptr<Connection>> connections;
+    std::unordered_multimap<int, Connection*> logged_in; // user_id -> this reactor's connections for it
+    std::vector<std::pair<int, uint64_t>> pending_flush; // (fd, connection id) with queued frames
+    uint64_t next_connection_id;
+    std::atomic<size_t> connection_total;
+
+    MpscQueue<Task> tasks;
+    std::atomic<bool> wake_pending; // wake_fd was written and the tasks are not drained yet
+
+    std::atomic<bool> running;
+    std::thread thread;
+};
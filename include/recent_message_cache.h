@@ -0,0 +1,85 @@
+#pragma once
+#include <list>
+#include <deque>
+#include <mutex>
+#include <vector>
+#include <cstdint>
+#include <unordered_map>
+#include "database.h"
+
+// Counters since the cache was created
+struct RecentCacheStats
+{
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions; // Groups dropped to stay within the memory budget
+    size_t groups; // Groups currently cached
+    size_t bytes; // Approximate memory held by cached messages
+};
+
+// Newest messages of recently read groups, newest last.
+// A group is cached on its first history miss and then kept current by
+// append() as messages commit, so "the last N messages" of a warm group never
+// touches SQLite. Whole groups are evicted least recently used first once the
+// total size passes the memory budget.
+class RecentMessageCache
+{
+public:
+
+    RecentMessageCache(size_t messages_per_group, size_t memory_budget);
+
+    RecentMessageCache(const RecentMessageCache&) = delete;
+    RecentMessageCache& operator=(const RecentMessageCache&) = delete;
+
+    bool enabled() const;
+    size_t messages_per_group() const;
+
+    // Newest first, like get_group_messages_before(); false if the cache cannot
+    // answer the whole page and the caller has to query the database
+    bool lookup(int group_id, int before_message_id, int limit, std::vector<MessageRecord>& out);
+
+    // Filling after a miss: take a token before querying, then hand the newest
+    // messages (newest first) to fill(), or call cancel_fill() if the query
+    // failed. The fill is dropped if the group changed in between, so a load
+    // that raced with a commit never hides a message.
+    uint64_t begin_fill(int group_id);
+    void fill(int group_id, uint64_t token, const std::vector<MessageRecord>& newest_first, bool whole_history);
+    void cancel_fill(int group_id);
+
+    void append(const MessageRecord& message); // Call after the message committed
+    void invalidate(int group_id); // Drops the group, e.g. after a delete
+    bool contains(int group_id);
+
+    RecentCacheStats stats();
+
+private:
+
+    struct Entry
+    {
+        std::deque<MessageRecord> messages; // Oldest first, message_id ascending
+        bool whole_history; // Nothing older exists in the database
+        size_t bytes;
+        std::list<int>::iterator lru_position;
+    };
+
+    struct Fill
+    {
+        int loading; // Callers between begin_fill() and fill()
+        uint64_t version; // Bumped by every change to the group meanwhile
+    };
+
+    static size_t footprint(const MessageRecord& message);
+    void touch(Entry& entry);
+    void evict_over_budget(int keep_group_id);
+    void erase(std::unordered_map<int, Entry>::iterator found);
+
+    const size_t capacity;
+    const size_t budget;
+
+    std::mutex mutex;
+    std::unordered_map<int, Entry> entries;
+    std::unordered_map<int, Fill> fills; // Groups with a load in flight
+    std::list<int> lru; // Most recently used group first
+    size_t total_bytes;
+    RecentCacheStats counters;
+};
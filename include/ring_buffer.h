@@ -0,0 +1,44 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <sys/uio.h>
+
+// Fixed-capacity byte ring used as a per-connection receive buffer.
+// Sockets read straight into the free space (write_regions + readv) and the
+// frame parser reads straight out of the stored bytes, so data is copied only
+// when a frame straddles the end of the ring or the ring has to grow.
+class RingBuffer
+{
+public:
+
+    explicit RingBuffer(size_t capacity = 0); // Rounded up to a power of two
+    ~RingBuffer();
+
+    RingBuffer(const RingBuffer&) = delete;
+    RingBuffer& operator=(const RingBuffer&) = delete;
+
+    size_t capacity() const;
+    size_t size() const; // Bytes stored
+    size_t free_space() const;
+    bool empty() const;
+
+    void reserve(size_t capacity); // Grows to at least capacity, keeping the stored bytes
+
+    // Free space as up to two regions for readv; returns the region count
+    int write_regions(iovec regions[2]);
+    void commit(size_t length); // Marks length bytes written through write_regions as stored
+    size_t append(const char* data, size_t length); // Copies in what fits, returns bytes stored
+
+    // Pointer to stored bytes [offset, offset + length) or nullptr if they wrap
+    const char* contiguous(size_t offset, size_t length) const;
+    void copy_out(size_t offset, size_t length, char* destination) const;
+    void consume(size_t length); // Drops bytes from the front
+
+private:
+
+    std::unique_ptr<char[]> data;
+    size_t cap;
+    uint64_t head; // Read position, grows without wrapping
+    uint64_t tail; // Write position
+};
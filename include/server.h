@@ -1,30 +1,73 @@
 #pragma once
 #include <vector>
-#include <thread>
-#include <mutex>
+#include <memory>
+#include <atomic>
 #include <string>
+#include <string_view>
 #include "user.h"
+#include "reactor.h"
+#include "protocol.h"
+#include "shared_buffer.h"
+#include "file_store.h"
+#include "auth_pool.h"
+#include "session_cache.h"
 
-class Server 
+class ShardedDatabase;
+
+// Chat server built on non-blocking sockets and edge-triggered epoll.
+// N reactor threads (one per core by default) each accept on their own
+// SO_REUSEPORT listener and own a disjoint set of connections, so there is
+// no thread per client and no global lock around the user list.
+// Clients speak the binary protocol from protocol.h.
+// Chat data can be split over several database files by group, see
+// sharded_database.h; each shard has its own writer and executor.
+class Server
 {
 public:
 
-    Server(int port); 
-    ~Server(); 
+    Server(int port, const std::string& db_name = "data/chat.db", int reactor_count = 0, // 0 uses one reactor per core
+           int shard_count = 1);
+    ~Server();
+
+    void start(); // Returns once every reactor is accepting
+    void stop();
 
-    void start(); 
-    void stop(); 
+    bool is_running() const;
+    int get_port() const; // Actual port, useful when constructed with port 0
+    int get_user_count();
 
 private:
 
-    int server_id; 
-    int port; 
-    std::vector<User*> users; 
-    std::mutex users_mutex; 
+    friend class Reactor;
+
+    int server_id;
+    int port;
+    std::string db_name;
+    int shard_count;
+    std::unique_ptr<ShardedDatabase> database;
+    std::unique_ptr<FileStore> files; // Next to the database file, under files/
+    std::unique_ptr<AuthPool> auth; // Password checks, off the reactor threads
+    SessionCache sessions; // Tokens from password logins, for cheap reconnects
+    int reactor_count;
+    std::vector<std::unique_ptr<Reactor>> reactors;
+    std::atomic<bool> running;
 
     // Client Management
-    void acceptClients(); 
-    void handleClient(User* user); 
-    void broadcast(const std::string& message, User* sender); 
-    int get_user_count(); 
-};
\ No newline at end of file
+    bool handle_frame(Connection& connection, const protocol::Frame& frame); // Reactor thread; false drops the client
+    void broadcast(const BufferRef& frame, User* sender); // Every reactor queues the same buffer
+    void broadcast_to_group(int group_id, const BufferRef& frame, User* sender);
+    bool is_member(const Connection& connection, int group_id) const;
+    void reply(Connection& connection, protocol::FrameType request, int32_t value, std::string_view detail = "");
+
+    bool handle_login(Connection& connection, const protocol::LoginRequest& request, bool session_token);
+    void finish_login(Connection& connection, int user_id, const std::string& username, const std::string& token); // Reactor thread
+    bool handle_join(Connection& connection, int32_t group_id);
+    bool handle_leave(Connection& connection, int32_t group_id);
+    bool handle_send(Connection& connection, const protocol::SendMessageRequest& request);
+    bool handle_history(Connection& connection, const protocol::HistoryRequest& request);
+    bool handle_file_offer(Connection& connection, const protocol::FileOffer& offer);
+    bool handle_file_chunk(Connection& connection, const protocol::FileChunk& chunk, bool last);
+    bool handle_file_download(Connection& connection, const protocol::FileDownloadRequest& request);
+    void finish_download(Connection& connection, const protocol::FileDownloadRequest& request, int group_id,
+                         const std::string& digest); // Reactor thread
+};
@@ -0,0 +1,50 @@
+#pragma once
+#include <mutex>
+#include <chrono>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+// Login sessions by token. A password login issues a random 128-bit token;
+// presenting it again within the TTL logs the same user back in with one
+// hash lookup, skipping both the KDF and the database. Tokens live only in
+// memory, so a restart sends every client through a password login once.
+// Sharded by token, so reactors logging users in rarely share a lock.
+class SessionCache
+{
+public:
+
+    using Clock = std::chrono::steady_clock;
+
+    SessionCache(std::chrono::seconds ttl, size_t max_sessions);
+
+    SessionCache(const SessionCache&) = delete;
+    SessionCache& operator=(const SessionCache&) = delete;
+
+    std::string issue(int user_id, const std::string& username); // 32 hex characters, "" if no randomness was available
+    int lookup(std::string_view token, std::string_view username); // user_id, or -1 if unknown, expired or issued to someone else
+    size_t size() const;
+
+private:
+
+    struct Session
+    {
+        int user_id;
+        std::string username;
+        Clock::time_point expires;
+    };
+
+    struct Shard
+    {
+        mutable std::mutex mutex;
+        std::unordered_map<std::string, Session> sessions;
+    };
+
+    static const int shard_count = 16;
+
+    Shard& shard_of(std::string_view token);
+
+    const Clock::duration ttl;
+    const size_t max_per_shard;
+    Shard shards[shard_count];
+};
@@ -0,0 +1,32 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// Incremental SHA-256 (FIPS 180-4). Feed data in pieces of any size with
+// update(), then call finish() once; the state is not reusable afterwards.
+class Sha256
+{
+public:
+
+    using Digest = std::array<uint8_t, 32>;
+
+    Sha256();
+
+    void update(const void* data, size_t length);
+    void update(std::string_view data) { update(data.data(), data.size()); }
+    Digest finish();
+
+    static std::string hex(const Digest& digest); // 64 lowercase hex characters
+
+private:
+
+    void compress(const uint8_t* block);
+
+    std::array<uint32_t, 8> state;
+    std::array<uint8_t, 64> block;
+    size_t block_used;
+    uint64_t total_bytes;
+};
@@ -0,0 +1,90 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <climits>
+#include "chat_database.h"
+
+// Message ids stay unique across shards: shard k of n allocates from the k-th
+// of n equal slices of the positive int range, so an id names its shard
+inline int message_id_slice(int shard_count) {
+    return INT_MAX / shard_count;
+}
+
+// Chat data spread over several database files, so writes to different groups
+// commit in parallel instead of queueing on one SQLite writer.
+// Users and Groups live in a small global file (db_name). Messages,
+// GroupMembers, counters and read markers of group g live in shard
+// g % shard_count (db_name.shard<k>), each a full ChatDatabase with its own
+// writer connection, ingest thread and executor. Group-scoped calls go to the
+// owning shard; calls that span groups ask every shard and merge.
+// With one shard everything stays in db_name, as with a plain ChatDatabase.
+//
+// Every file is a shared handle from get_database(), so tools can still open
+// the global file by name (e.g. to create groups). A file remembers its place
+// in the layout and is refused under a different shard count.
+class ShardedDatabase
+{
+public:
+
+    ShardedDatabase(const std::string& db_name, int shard_count); // Opens every file; other calls need is_open()
+    ~ShardedDatabase() = default;
+
+    ShardedDatabase(const ShardedDatabase&) = delete;
+    ShardedDatabase& operator=(const ShardedDatabase&) = delete;
+
+    bool is_open() const;
+    bool init_schema(); // Every file, then binds each to its place in the layout
+    bool set_durability(Durability durability);
+    int shard_count() const;
+
+    // Routing
+    ChatDatabase& global(); // Users and Groups
+    ChatDatabase& shard(int index);
+    ChatDatabase& group_shard(int group_id); // Owner of the group's messages and members
+    ChatDatabase* message_shard(int message_id); // Owner of the message, nullptr if the id is out of range
+
+    // User management, on the global file
+    bool register_user(const std::string& username, const std::string& password);
+    bool authenticate_user(const std::string& username, const std::string& password);
+    int get_user_id(const std::string& username);
+    std::string get_username(int user_id);
+    std::vector<std::string> get_usernames(const std::vector<int>& user_ids);
+
+    // Group management. Groups are named in the global file, members are kept by the owning shard
+    bool create_group(const std::string& group_name);
+    bool add_user_to_group(int user_id, int group_id);
+    std::vector<bool> add_users_to_group(int group_id, const std::vector<int>& user_ids);
+    bool remove_user_from_group(int user_id, int group_id);
+    std::vector<int> get_user_groups(int user_id); // Sorted, from every shard
+    std::vector<int> get_group_members(int group_id);
+    std::string get_group_name(int group_id);
+    Group get_group(int group_id);
+
+    // Message management
+    bool save_message(int sender_id, int group_id, const std::string& text, const std::string& file_path = "");
+    int store_message(int sender_id, int group_id, std::string_view text, std::string_view file_path = "");
+    std::vector<int> save_messages(const std::vector<MessageRecord>& messages); // One transaction per shard involved
+    std::vector<std::pair<std::string, std::string>> get_group_messages(int group_id, int limit = 50);
+    std::vector<MessageRecord> get_group_messages_before(int group_id, int before_message_id, int limit = 50);
+    std::vector<MessageRecord> search_messages(int group_id, const std::string& query, int limit = 20);
+
+    // Group-Message relationship functions
+    std::vector<int> get_group_message_ids(int group_id);
+    bool remove_message_from_group(int message_id, int group_id);
+    int get_message_group_id(int message_id);
+    int get_message_file(int message_id, std::string& file_path);
+    int get_message_count_in_group(int group_id);
+
+    // Read markers and unread counts
+    bool mark_read(int user_id, int group_id, int message_id);
+    std::vector<std::pair<int, int>> get_unread_counts(int user_id); // By group_id, from every shard
+
+private:
+
+    void fill_usernames(std::vector<MessageRecord>& messages); // Shards have no Users rows
+
+    std::string db_name;
+    std::vector<ChatDatabase*> shards; // Shared handles; shards[0] is also the global file with one shard
+    ChatDatabase* global_database;
+};
@@ -0,0 +1,63 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <utility>
+
+class BufferRef;
+
+// Immutable, reference-counted block of bytes, allocated in one piece with its
+// header, from buffer_pool. A frame fanned out to many recipients is encoded
+// once into a SharedBuffer and every outbound queue just holds a BufferRef to it.
+class SharedBuffer
+{
+public:
+
+    static BufferRef copy_of(std::string_view bytes);
+
+    const char* data() const { return reinterpret_cast<const char*>(this + 1); }
+    size_t size() const { return length; }
+
+private:
+
+    friend class BufferRef;
+
+    explicit SharedBuffer(size_t length) : references(1), length(length) {}
+    SharedBuffer(const SharedBuffer&) = delete;
+    SharedBuffer& operator=(const SharedBuffer&) = delete;
+
+    void retain() { references.fetch_add(1, std::memory_order_relaxed); }
+    void release();
+
+    std::atomic<uint32_t> references;
+    size_t length; // The bytes follow the object in the same allocation
+};
+
+// Owning handle to a SharedBuffer; copying it only bumps the reference count
+class BufferRef
+{
+public:
+
+    BufferRef() : buffer(nullptr) {}
+    BufferRef(const BufferRef& other) : buffer(other.buffer) { if (buffer) buffer->retain(); }
+    BufferRef(BufferRef&& other) noexcept : buffer(other.buffer) { other.buffer = nullptr; }
+    ~BufferRef() { if (buffer) buffer->release(); }
+
+    BufferRef& operator=(BufferRef other) noexcept {
+        std::swap(buffer, other.buffer);
+        return *this;
+    }
+
+    const char* data() const { return buffer->data(); }
+    size_t size() const { return buffer->size(); }
+    explicit operator bool() const { return buffer != nullptr; }
+    uint32_t use_count() const { return buffer ? buffer->references.load(std::memory_order_relaxed) : 0; }
+
+private:
+
+    friend class SharedBuffer;
+    explicit BufferRef(SharedBuffer* adopted) : buffer(adopted) {}
+
+    SharedBuffer* buffer;
+};
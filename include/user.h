@@ -7,7 +7,10 @@ class User
 public:
 
     User(int sock); 
-    ~User(); 
+    ~User(); // Closes the socket
+
+    User(const User&) = delete;
+    User& operator=(const User&) = delete;
 
     int socket; 
     std::string username;
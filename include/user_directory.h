@@ -0,0 +1,68 @@
+#pragma once
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include <utility>
+#include <cstdint>
+#include <string_view>
+#include <shared_mutex>
+#include <unordered_map>
+
+// Interned usernames: a dense user_id -> name table and a name -> user_id map.
+// Names are copied once into append-only chunks and never move, so the
+// string_views handed out stay valid for the directory's lifetime. The id
+// table is split into fixed segments that are published atomically, so
+// name() is a couple of loads with no lock and no allocation.
+class UserDirectory
+{
+public:
+
+    UserDirectory();
+    ~UserDirectory();
+
+    UserDirectory(const UserDirectory&) = delete;
+    UserDirectory& operator=(const UserDirectory&) = delete;
+
+    void load(const std::vector<std::pair<int, std::string>>& users); // Adds every (user_id, username) row
+    void insert(int user_id, std::string_view name);
+
+    std::string_view name(int user_id) const; // Empty if unknown
+    int id(std::string_view name) const; // -1 if unknown
+    bool loaded() const;
+    size_t size() const;
+
+private:
+
+    // Length-prefixed name inside a chunk
+    struct Name
+    {
+        uint32_t length;
+        std::string_view view() const { return std::string_view(reinterpret_cast<const char*>(this + 1), length); }
+    };
+
+    static constexpr size_t segment_bits = 12;
+    static constexpr size_t segment_size = size_t(1) << segment_bits; // Ids per segment
+    static constexpr size_t max_segments = 1 << 14; // Covers ids below 2^26
+    static constexpr size_t chunk_size = 64 * 1024;
+
+    struct Segment
+    {
+        std::atomic<const Name*> names[segment_size];
+    };
+
+    const Name* intern(std::string_view name); // Caller holds write_mutex
+    void insert_locked(int user_id, std::string_view name);
+
+    std::unique_ptr<std::atomic<Segment*>[]> segments;
+
+    mutable std::shared_mutex ids_mutex;
+    std::unordered_map<std::string_view, int> ids; // Keys view interned names
+
+    std::mutex write_mutex;
+    std::vector<std::unique_ptr<char[]>> chunks;
+    size_t chunk_used;
+    std::atomic<size_t> count;
+    std::atomic<bool> is_loaded;
+};
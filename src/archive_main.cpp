@@ -0,0 +1,44 @@
+#include <iostream>
+#include <string>
+#include <ctime>
+#include "chat_database.h"
+
+// Moves every month older than the newest hot_months into sealed, compressed
+// partitions next to the database, then compacts the hot file. Run it while
+// the server is stopped; the server picks the partitions up on its next start.
+int main(int argc, char** argv) {
+    std::string dbPath = argc > 1 ? argv[1] : "data/chat.db";
+    int hot_months = argc > 2 ? std::stoi(argv[2]) : 1;
+    if (hot_months < 1) {
+        std::cout << "Usage: chat_archive [db_path] [hot_months >= 1]" << std::endl;
+        return 1;
+    }
+
+    // Start of the oldest month that stays hot, in UTC
+    time_t now = time(nullptr);
+    struct tm cutoff;
+    gmtime_r(&now, &cutoff);
+    cutoff.tm_mday = 1;
+    cutoff.tm_hour = cutoff.tm_min = cutoff.tm_sec = 0;
+    cutoff.tm_mon -= hot_months - 1;
+    int64_t cutoff_ms = static_cast<int64_t>(timegm(&cutoff)) * 1000;
+
+    ChatDatabase database(dbPath);
+    if (!database.is_open() || !database.init_schema()) {
+        std::cout << "Failed to open " << dbPath << std::endl;
+        return 1;
+    }
+
+    int moved = database.archive_messages(cutoff_ms);
+    if (moved < 0) {
+        std::cout << "Archiving failed" << std::endl;
+        return 1;
+    }
+    std::cout << "Archived " << moved << " messages" << std::endl;
+    for (const PartitionInfo& partition : database.archive().partitions()) {
+        std::cout << "  " << partition.month << "  " << partition.file << "  messages "
+                  << partition.first_message_id << "-" << partition.last_message_id
+                  << " (" << partition.message_count << ")" << std::endl;
+    }
+    return 0;
+}
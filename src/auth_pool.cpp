@@ -0,0 +1,70 @@
+#include "../include/auth_pool.h"
+#include "../include/metrics.h"
+#include <algorithm>
+
+namespace {
+
+const metrics::Gauge queued_logins("chat_auth_queued_jobs", "Password checks waiting for an auth thread");
+
+} // namespace
+
+AuthPool::AuthPool(int thread_count, size_t max_pending) : max_pending(max_pending), stopping(false) {
+    if (thread_count <= 0) {
+        thread_count = static_cast<int>(std::max(1u, std::thread::hardware_concurrency() / 2));
+    }
+    for (int i = 0; i < thread_count; ++i) {
+        threads.emplace_back(&AuthPool::run, this);
+    }
+}
+
+AuthPool::~AuthPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+        queued_logins.add(-static_cast<int64_t>(jobs.size()));
+        jobs.clear();
+    }
+    wake.notify_all();
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+}
+
+bool AuthPool::submit(Job job) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (stopping || jobs.size() >= max_pending) {
+            return false;
+        }
+        jobs.push_back(std::move(job));
+        queued_logins.add(1);
+    }
+    wake.notify_one();
+    return true;
+}
+
+size_t AuthPool::pending() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return jobs.size();
+}
+
+size_t AuthPool::thread_count() const {
+    return threads.size();
+}
+
+void AuthPool::run() {
+    while (true) {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [this]() { return stopping || !jobs.empty(); });
+            if (stopping) {
+                return;
+            }
+            job = std::move(jobs.front());
+            jobs.pop_front();
+            queued_logins.add(-1);
+        }
+        job();
+    }
+}
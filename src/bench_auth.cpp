@@ -0,0 +1,387 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+#include <memory>
+#include <unistd.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include "server.h"
+#include "chat_database.h"
+#include "password_hash.h"
+#include "protocol.h"
+#include "ring_buffer.h"
+#include "latency_histogram.h"
+#include "logger.h"
+
+// Login storm against an in-process server, as when every client reconnects
+// after a deploy. All clients connect and send LOGIN at once. The first wave
+// checks passwords, so each login runs the KDF on the auth pool. The second
+// wave reconnects with the session tokens the first one received. A probe
+// connection keeps round-tripping a token login the whole time, which shows
+// whether the reactors stay responsive while the pool is saturated.
+//
+//   bench_auth --clients 2000 --cost 100000 --reactors 4
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+using protocol::FrameType;
+
+struct Options
+{
+    int clients = 1000;
+    int cost = password_hash::default_iterations; // PBKDF2 rounds
+    int reactors = 0; // 0 for one per core
+    std::string db = "data/bench_auth.db";
+};
+
+struct StormClient
+{
+    int fd = -1;
+    std::string username;
+    std::string password;
+    std::string token; // From the password wave, used by the token wave
+    std::unique_ptr<RingBuffer> inbound; // Fresh for every connection
+    protocol::FrameParser parser;
+    Clock::time_point started;
+    Clock::time_point retry_at; // Set while waiting to retry a "busy" reply
+    bool waiting = false;
+    bool done = false;
+};
+
+struct StormResult
+{
+    double seconds = 0;
+    LatencyHistogram latency; // First send to the successful RESULT, retries included
+    uint64_t busy = 0; // "server busy" replies, each retried after a pause
+    uint64_t failed = 0;
+};
+
+const std::chrono::milliseconds busy_backoff(20);
+
+int connect_to(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    if (fd < 0 || connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+        std::cerr << "Failed to connect: " << strerror(errno) << std::endl;
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+    int enable = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+    return fd;
+}
+
+bool send_all(int fd, const std::string& data) {
+    size_t offset = 0;
+    while (offset < data.size()) {
+        ssize_t sent = send(fd, data.data() + offset, data.size() - offset, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                std::this_thread::yield();
+                continue;
+            }
+            return false;
+        }
+        offset += static_cast<size_t>(sent);
+    }
+    return true;
+}
+
+bool send_login(StormClient& client, bool with_token) {
+    std::string frame;
+    if (with_token) {
+        protocol::encode_login(frame, {false, client.username, client.token}, protocol::FLAG_SESSION_TOKEN);
+    } else {
+        protocol::encode_login(frame, {false, client.username, client.password});
+    }
+    client.waiting = true;
+    return send_all(client.fd, frame);
+}
+
+// Reads what has arrived and returns the LOGIN result, if one is complete
+bool read_result(StormClient& client, protocol::ResultMessage& result, std::string& detail, bool& closed) {
+    closed = false;
+    char buffer[4096];
+    while (true) {
+        ssize_t received = recv(client.fd, buffer, sizeof(buffer), 0);
+        if (received == 0) {
+            closed = true;
+            break;
+        }
+        if (received < 0) {
+            break;
+        }
+        if (client.inbound->free_space() < static_cast<size_t>(received)) {
+            client.inbound->reserve(client.inbound->size() + static_cast<size_t>(received));
+        }
+        client.inbound->append(buffer, static_cast<size_t>(received));
+    }
+
+    protocol::Frame frame;
+    while (client.parser.next(*client.inbound, frame) == protocol::ParseStatus::FRAME) {
+        bool login = frame.type == FrameType::RESULT && protocol::decode_result(frame.payload, result) &&
+                     result.request_type == static_cast<uint16_t>(FrameType::LOGIN);
+        if (login) {
+            detail.assign(result.detail.data(), result.detail.size());
+        }
+        client.parser.consume(*client.inbound);
+        if (login) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// One wave: every client connects, logs in, and the wave ends when all have an answer
+bool run_storm(int port, std::vector<StormClient>& clients, bool with_token, StormResult& result) {
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    for (size_t i = 0; i < clients.size(); ++i) {
+        StormClient& client = clients[i];
+        client.fd = connect_to(port);
+        if (client.fd < 0) {
+            return false;
+        }
+        client.inbound.reset(new RingBuffer(4096));
+        client.parser = protocol::FrameParser();
+        client.done = false;
+        fcntl(client.fd, F_SETFL, fcntl(client.fd, F_GETFL) | O_NONBLOCK);
+        epoll_event event;
+        event.events = EPOLLIN;
+        event.data.u64 = i;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client.fd, &event);
+    }
+
+    Clock::time_point start = Clock::now();
+    for (StormClient& client : clients) {
+        client.started = Clock::now();
+        if (!send_login(client, with_token)) {
+            return false;
+        }
+    }
+
+    size_t remaining = clients.size();
+    epoll_event events[256];
+    while (remaining > 0) {
+        if (Clock::now() - start > std::chrono::minutes(10)) {
+            std::cerr << remaining << " logins still unanswered after 10 minutes" << std::endl;
+            return false;
+        }
+        int count = epoll_wait(epoll_fd, events, 256, 5);
+        for (int i = 0; i < count; ++i) {
+            StormClient& client = clients[events[i].data.u64];
+            protocol::ResultMessage reply;
+            std::string detail;
+            bool closed;
+            if (read_result(client, reply, detail, closed)) {
+                client.waiting = false;
+                if (reply.value >= 0) {
+                    result.latency.record(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - client.started));
+                    client.token = detail;
+                    client.done = true;
+                    remaining--;
+                } else if (detail.compare(0, 11, "server busy") == 0) {
+                    result.busy++;
+                    client.retry_at = Clock::now() + busy_backoff;
+                } else {
+                    result.failed++;
+                    client.done = true;
+                    remaining--;
+                }
+            } else if (closed && !client.done) {
+                result.failed++;
+                client.done = true;
+                remaining--;
+            }
+        }
+
+        Clock::time_point now = Clock::now();
+        for (StormClient& client : clients) {
+            if (!client.done && !client.waiting && client.retry_at <= now && !send_login(client, with_token)) {
+                return false;
+            }
+        }
+    }
+    result.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    for (StormClient& client : clients) {
+        close(client.fd);
+        client.fd = -1;
+    }
+    close(epoll_fd);
+    return true;
+}
+
+// Token logins back to back on one connection; each is pure reactor work
+void run_probe(int port, const StormClient& identity, std::atomic<bool>& stopping, LatencyHistogram& latency) {
+    StormClient probe;
+    probe.username = identity.username;
+    probe.token = identity.token;
+    probe.fd = connect_to(port);
+    probe.inbound.reset(new RingBuffer(4096));
+    fcntl(probe.fd, F_SETFL, fcntl(probe.fd, F_GETFL) | O_NONBLOCK);
+    if (probe.fd < 0) {
+        return;
+    }
+    while (!stopping.load(std::memory_order_relaxed)) {
+        Clock::time_point sent = Clock::now();
+        if (!send_login(probe, true)) {
+            break;
+        }
+        protocol::ResultMessage reply;
+        std::string detail;
+        bool closed = false;
+        pollfd readable{probe.fd, POLLIN, 0};
+        while (!read_result(probe, reply, detail, closed) && !closed) {
+            poll(&readable, 1, 100);
+        }
+        if (closed) {
+            break;
+        }
+        latency.record(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - sent));
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    close(probe.fd);
+}
+
+bool parse_options(int argc, char** argv, Options& options) {
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string flag = argv[i];
+        std::string value = argv[i + 1];
+        if (flag == "--clients") {
+            options.clients = std::stoi(value);
+        } else if (flag == "--cost") {
+            options.cost = std::stoi(value);
+        } else if (flag == "--reactors") {
+            options.reactors = std::stoi(value);
+        } else if (flag == "--db") {
+            options.db = value;
+        } else {
+            std::cerr << "Unknown option " << flag << std::endl;
+            return false;
+        }
+    }
+    if (argc % 2 == 0) {
+        std::cerr << "Missing value for " << argv[argc - 1] << std::endl;
+        return false;
+    }
+    options.clients = std::max(options.clients, 1);
+    options.cost = std::max(options.cost, 1);
+    return true;
+}
+
+void report(std::ostream& out, const std::string& name, const StormResult& result) {
+    const LatencyHistogram& latency = result.latency;
+    out << "  " << name << ": " << latency.count() << " logins in " << result.seconds << " s, "
+        << static_cast<uint64_t>(latency.count() / result.seconds) << " logins/s, p50 "
+        << latency.percentile(50) / 1000 << " us, p99 " << latency.percentile(99) / 1000 << " us, max "
+        << latency.max() / 1000 << " us, " << result.busy << " busy retries, " << result.failed << " failed" << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!parse_options(argc, argv, options)) {
+        std::cerr << "usage: bench_auth [--clients N] [--cost rounds] [--reactors N] [--db path]" << std::endl;
+        return 1;
+    }
+
+    for (const char* suffix : {"", "-wal", "-shm"}) {
+        std::remove((options.db + suffix).c_str());
+    }
+
+    // Only problems from the server; its startup lines would interleave with the report
+    logging::set_level(LogLevel::WARN);
+    std::ostream& out = std::cout;
+
+    ChatDatabase* database = get_database(options.db);
+    if (!database || !database->init_schema()) {
+        std::cerr << "Failed to open " << options.db << std::endl;
+        return 1;
+    }
+    database->set_password_cost(options.cost);
+
+    // Accounts exist before the storm; hashing them is spread over every core
+    std::vector<StormClient> clients(options.clients);
+    std::vector<StormClient> probe_identity(1);
+    for (int i = 0; i <= options.clients; ++i) {
+        StormClient& client = i < options.clients ? clients[i] : probe_identity[0];
+        client.username = "auth" + std::to_string(i);
+        client.password = "secret" + std::to_string(i);
+    }
+    std::atomic<int> next_user(0);
+    std::atomic<bool> registered(true);
+    std::vector<std::thread> registrars;
+    for (unsigned t = 0; t < std::max(1u, std::thread::hardware_concurrency()); ++t) {
+        registrars.emplace_back([&]() {
+            for (int i = next_user++; i <= options.clients; i = next_user++) {
+                const StormClient& client = i < options.clients ? clients[i] : probe_identity[0];
+                if (!database->register_user(client.username, client.password)) {
+                    registered = false;
+                }
+            }
+        });
+    }
+    for (std::thread& registrar : registrars) {
+        registrar.join();
+    }
+
+    Server server(0, options.db, options.reactors);
+    server.start();
+    if (!registered || !server.is_running()) {
+        std::cerr << "Failed to set up the server" << std::endl;
+        return 1;
+    }
+
+    out << "=== Login Storm ===" << std::endl;
+    out << "  " << options.clients << " clients, PBKDF2-SHA256 at " << options.cost << " rounds" << std::endl;
+
+    // The probe logs in with a password first, then pings with its token during both waves
+    StormResult probe_login;
+    if (!run_storm(server.get_port(), probe_identity, false, probe_login) || probe_login.latency.count() != 1) {
+        std::cerr << "Probe could not log in" << std::endl;
+        return 1;
+    }
+    std::atomic<bool> stopping(false);
+    LatencyHistogram probe_latency;
+    std::thread probe(run_probe, server.get_port(), std::cref(probe_identity[0]), std::ref(stopping), std::ref(probe_latency));
+
+    StormResult cold;
+    StormResult warm;
+    bool ok = run_storm(server.get_port(), clients, false, cold) && run_storm(server.get_port(), clients, true, warm);
+    stopping = true;
+    probe.join();
+    server.stop();
+
+    if (!ok) {
+        return 1;
+    }
+    report(out, "password logins (KDF on the auth pool)", cold);
+    report(out, "token reconnects (session cache)", warm);
+    out << "  reactor probe during both waves: " << probe_latency.count() << " round trips, p50 "
+        << probe_latency.percentile(50) / 1000 << " us, p99 " << probe_latency.percentile(99) / 1000
+        << " us, max " << probe_latency.max() / 1000 << " us" << std::endl;
+    return cold.failed == 0 && warm.failed == 0 ? 0 : 1;
+}
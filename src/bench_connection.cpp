@@ -0,0 +1,136 @@
+#include <iostream>
+#include <string>
+#include <chrono>
+#include <cstdio>
+#include <vector>
+#include <thread>
+#include <future>
+#include <sqlite3.h>
+#include "database.h"
+#include "chat_database.h"
+#include "message_ingest.h"
+
+// Compares the old per-call connection pattern (open, prepare, step, finalize,
+// close on every call) against the persistent ChatDatabase handle that the
+// database.h free functions now use, then measures the group-commit ingest
+// queue with several concurrent producers.
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Per-call pattern the database layer used before ChatDatabase
+std::string legacy_get_username(const std::string& db_name, int user_id) {
+    sqlite3* db;
+    if (sqlite3_open(db_name.c_str(), &db)) {
+        sqlite3_close(db);
+        return "";
+    }
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(db, "SELECT username FROM Users WHERE id = ?;", -1, &stmt, nullptr) != SQLITE_OK) {
+        sqlite3_close(db);
+        return "";
+    }
+    sqlite3_bind_int(stmt, 1, user_id);
+    std::string username;
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        username = (const char*)sqlite3_column_text(stmt, 0);
+    }
+    sqlite3_finalize(stmt);
+    sqlite3_close(db);
+    return username;
+}
+
+bool legacy_save_message(const std::string& db_name, int sender_id, int group_id, const std::string& text) {
+    sqlite3* db;
+    if (sqlite3_open(db_name.c_str(), &db)) {
+        sqlite3_close(db);
+        return false;
+    }
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(db, "INSERT INTO Messages (sender_id, group_id, text, file_path) VALUES (?, ?, ?, ?);",
+                           -1, &stmt, nullptr) != SQLITE_OK) {
+        sqlite3_close(db);
+        return false;
+    }
+    sqlite3_bind_int(stmt, 1, sender_id);
+    sqlite3_bind_int(stmt, 2, group_id);
+    sqlite3_bind_text(stmt, 3, text.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 4, "", -1, SQLITE_STATIC);
+    int rc = sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+    sqlite3_close(db);
+    return rc == SQLITE_DONE;
+}
+
+template <typename Fn>
+double calls_per_second(int iterations, Fn&& fn) {
+    auto start = Clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        fn(i);
+    }
+    std::chrono::duration<double> elapsed = Clock::now() - start;
+    return iterations / elapsed.count();
+}
+
+void report(const std::string& name, double before, double after) {
+    std::cout << "  " << name << ": " << static_cast<long>(before) << " calls/s per-call open, "
+              << static_cast<long>(after) << " calls/s persistent handle ("
+              << (before > 0 ? after / before : 0.0) << "x)" << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    std::string dbPath = argc > 1 ? argv[1] : "data/bench_connection.db";
+    int reads = argc > 2 ? std::stoi(argv[2]) : 20000;
+    int writes = argc > 3 ? std::stoi(argv[3]) : 2000;
+
+    for (const char* suffix : {"", "-wal", "-shm"}) {
+        std::remove((dbPath + suffix).c_str());
+    }
+    if (!init_db(dbPath) || !register_user(dbPath, "bench", "bench") || !create_group(dbPath, "bench")) {
+        std::cout << "Failed to set up benchmark database" << std::endl;
+        return 1;
+    }
+    int userId = get_user_id(dbPath, "bench");
+
+    std::cout << "=== Connection Benchmark (" << dbPath << ") ===" << std::endl;
+
+    double readBefore = calls_per_second(reads, [&](int) { legacy_get_username(dbPath, userId); });
+    double readAfter = calls_per_second(reads, [&](int) { get_username(dbPath, userId); });
+    report("get_username", readBefore, readAfter);
+
+    double writeBefore = calls_per_second(writes, [&](int) { legacy_save_message(dbPath, userId, 1, "benchmark message"); });
+    double writeAfter = calls_per_second(writes, [&](int) { save_message(dbPath, userId, 1, "benchmark message"); });
+    report("save_message", writeBefore, writeAfter);
+
+    // Many producers through the group-commit writer
+    const int producers = 8;
+    MessageIngestQueue& ingest = get_database(dbPath)->ingest_queue();
+    auto start = Clock::now();
+    std::vector<std::thread> threads;
+    for (int p = 0; p < producers; ++p) {
+        threads.emplace_back([&]() {
+            std::vector<std::future<int>> pending;
+            for (int i = 0; i < writes; ++i) {
+                pending.push_back(ingest.enqueue(userId, 1, "benchmark message"));
+            }
+            for (auto& result : pending) {
+                result.get();
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    std::chrono::duration<double> elapsed = Clock::now() - start;
+    IngestStats stats = ingest.stats();
+    std::cout << "  save_message via ingest queue (" << producers << " producers): "
+              << static_cast<long>(producers * writes / elapsed.count()) << " messages/s, "
+              << stats.batches << " batches, avg " << (stats.batches ? stats.messages / stats.batches : 0)
+              << " messages/batch, max latency " << stats.max_latency.count() << " us" << std::endl;
+
+    close_database(dbPath);
+    return 0;
+}
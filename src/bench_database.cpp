@@ -0,0 +1,386 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <random>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <algorithm>
+#include "database.h"
+#include "chat_database.h"
+#include "latency_histogram.h"
+#include "logger.h"
+
+// Latency and throughput of every database.h function.
+// Each backend (file, :memory:) is filled with the configured number of users,
+// groups and messages, then every operation runs on 1..N threads at once.
+// Results go to stdout as JSON; progress goes to stderr.
+//
+//   bench_database --users 100000 --messages 10000000 --threads 1,4,16 --backends file,memory
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Options
+{
+    int users = 1000;
+    int groups = 100;
+    int messages = 10000;
+    int ops = 2000; // Per thread and operation
+    std::vector<int> threads{1, 4};
+    std::vector<std::string> backends{"file", "memory"};
+    std::string file = "data/bench_database.db";
+    int password_cost = 1000; // PBKDF2 rounds; bench_auth measures logins at the production cost
+};
+
+// One measured call; returns false if the database reported a failure
+using Operation = std::function<bool(int thread, int iteration, std::mt19937& rng)>;
+
+struct Benchmark
+{
+    std::string name;
+    int divisor; // Runs ops / divisor iterations, for calls whose cost grows with the data
+    Operation run;
+};
+
+struct Result
+{
+    std::string backend;
+    int threads;
+    std::string operation;
+    uint64_t ops;
+    uint64_t errors;
+    double seconds;
+    LatencyHistogram latency;
+};
+
+std::vector<int> parse_list(const std::string& value) {
+    std::vector<int> list;
+    std::stringstream stream(value);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        list.push_back(std::stoi(item));
+    }
+    return list;
+}
+
+std::vector<std::string> parse_names(const std::string& value) {
+    std::vector<std::string> list;
+    std::stringstream stream(value);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        list.push_back(item);
+    }
+    return list;
+}
+
+bool parse_options(int argc, char** argv, Options& options) {
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string flag = argv[i];
+        std::string value = argv[i + 1];
+        if (flag == "--users") {
+            options.users = std::stoi(value);
+        } else if (flag == "--groups") {
+            options.groups = std::stoi(value);
+        } else if (flag == "--messages") {
+            options.messages = std::stoi(value);
+        } else if (flag == "--ops") {
+            options.ops = std::stoi(value);
+        } else if (flag == "--threads") {
+            options.threads = parse_list(value);
+        } else if (flag == "--backends") {
+            options.backends = parse_names(value);
+        } else if (flag == "--db") {
+            options.file = value;
+        } else if (flag == "--password-cost") {
+            options.password_cost = std::stoi(value);
+        } else {
+            std::cerr << "Unknown option " << flag << std::endl;
+            return false;
+        }
+    }
+    if (argc % 2 == 0) {
+        std::cerr << "Missing value for " << argv[argc - 1] << std::endl;
+        return false;
+    }
+    options.users = std::max(options.users, 1);
+    options.groups = std::max(options.groups, 1);
+    return true;
+}
+
+// Message k (1-based) belongs to group (k - 1) % groups + 1 and user u to group (u - 1) % groups + 1,
+// so operations can pick valid ids without asking the database
+int group_of(int id, const Options& options) {
+    return (id - 1) % options.groups + 1;
+}
+
+const int vocabulary_size = 20000;
+
+// "benchmark message" plus six words drawn from the vocabulary, so every
+// message is a different search document and a word matches about 0.03% of them
+std::string message_text(int k) {
+    uint32_t state = static_cast<uint32_t>(k) * 2654435761u;
+    std::string text = "benchmark message";
+    for (int i = 0; i < 6; ++i) {
+        state = state * 1664525u + 1013904223u;
+        text += " w" + std::to_string((state >> 8) % vocabulary_size);
+    }
+    return text;
+}
+
+bool populate(ChatDatabase& db, const Options& options) {
+    const int batch = 10000;
+    for (int start = 1; start <= options.users; start += batch) {
+        ChatDatabase::Transaction transaction(db);
+        for (int u = start; u < start + batch && u <= options.users; ++u) {
+            if (!db.register_user("user" + std::to_string(u), "pw" + std::to_string(u))) {
+                return false;
+            }
+        }
+        if (!transaction.commit()) {
+            return false;
+        }
+    }
+    {
+        ChatDatabase::Transaction transaction(db);
+        for (int g = 1; g <= options.groups; ++g) {
+            if (!db.create_group("group" + std::to_string(g))) {
+                return false;
+            }
+        }
+        for (int u = 1; u <= options.users; ++u) {
+            db.add_user_to_group(u, group_of(u, options));
+        }
+        if (!transaction.commit()) {
+            return false;
+        }
+    }
+
+    for (int start = 1; start <= options.messages; start += batch) {
+        ChatDatabase::Transaction transaction(db);
+        for (int k = start; k < start + batch && k <= options.messages; ++k) {
+            int group = group_of(k, options);
+            int sender = std::min(options.users, group + options.groups * (k % std::max(1, options.users / options.groups)));
+            if (db.store_message(sender, group, message_text(k)) == -1) {
+                return false;
+            }
+        }
+        if (!transaction.commit()) {
+            return false;
+        }
+        std::cerr << "\r  " << std::min(start + batch - 1, options.messages) << " / " << options.messages << " messages" << std::flush;
+    }
+    std::cerr << std::endl;
+    return true;
+}
+
+std::vector<Benchmark> make_benchmarks(const std::string& db, const std::string& tag, const Options& options) {
+    auto user = [&options](std::mt19937& rng) { return static_cast<int>(rng() % options.users) + 1; };
+    auto group = [&options](std::mt19937& rng) { return static_cast<int>(rng() % options.groups) + 1; };
+    // remove_message_from_group deletes from the top of the preloaded ids, reads stay below that
+    int max_threads = *std::max_element(options.threads.begin(), options.threads.end());
+    int readable = std::max(1, options.messages - max_threads * options.ops);
+    auto message = [readable](std::mt19937& rng) { return static_cast<int>(rng() % readable) + 1; };
+    // Unique per scenario, thread and iteration, for calls that insert
+    auto unique = [tag, &options](int thread, int iteration) { return tag + "_" + std::to_string(thread * options.ops + iteration); };
+    // Distinct (user, group) pairs for the add/remove runs, over the groups the create_group run made
+    auto pair_user = [&options](int thread, int iteration) { return (thread * options.ops + iteration) % options.users + 1; };
+    auto pair_group = [&options](int thread, int iteration) { return options.groups + 1 + (thread * options.ops + iteration) / options.users; };
+    const std::string text = "benchmark message with a typical length for a chat line";
+    const int batch_size = 100; // Items per call for the batch APIs
+
+    return {
+        {"init_db", 100, [db](int, int, std::mt19937&) { return init_db(db); }},
+        {"register_user", 1, [db, unique](int t, int i, std::mt19937&) { return register_user(db, "new" + unique(t, i), "pw"); }},
+        {"authenticate_user", 1, [db, user](int, int, std::mt19937& rng) {
+            int u = user(rng);
+            return authenticate_user(db, "user" + std::to_string(u), "pw" + std::to_string(u));
+        }},
+        {"get_user_id", 1, [db, user](int, int, std::mt19937& rng) { return get_user_id(db, "user" + std::to_string(user(rng))) != -1; }},
+        {"get_username", 1, [db, user](int, int, std::mt19937& rng) { return !get_username(db, user(rng)).empty(); }},
+        {"get_usernames", batch_size, [db, user, batch_size](int, int, std::mt19937& rng) {
+            std::vector<int> ids(batch_size);
+            for (int& id : ids) {
+                id = user(rng);
+            }
+            return !get_usernames(db, ids).front().empty();
+        }},
+        {"create_group", 1, [db, unique](int t, int i, std::mt19937&) { return create_group(db, "new" + unique(t, i)); }},
+        {"add_user_to_group", 1, [db, pair_user, pair_group](int t, int i, std::mt19937&) {
+            return add_user_to_group(db, pair_user(t, i), pair_group(t, i));
+        }},
+        {"remove_user_from_group", 1, [db, pair_user, pair_group](int t, int i, std::mt19937&) {
+            return remove_user_from_group(db, pair_user(t, i), pair_group(t, i));
+        }},
+        {"get_user_groups", 1, [db, user](int, int, std::mt19937& rng) { return !get_user_groups(db, user(rng)).empty(); }},
+        {"get_group_members", 1, [db, group](int, int, std::mt19937& rng) { get_group_members(db, group(rng)); return true; }},
+        {"get_group_name", 1, [db, group](int, int, std::mt19937& rng) { return !get_group_name(db, group(rng)).empty(); }},
+        {"save_message", 1, [db, user, text, &options](int, int, std::mt19937& rng) {
+            int u = user(rng);
+            return save_message(db, u, group_of(u, options), text);
+        }},
+        {"save_message_async", 1, [db, user, text, &options](int, int, std::mt19937& rng) {
+            int u = user(rng);
+            return save_message_async(db, u, group_of(u, options), text).get() != -1;
+        }},
+        {"save_messages", batch_size, [db, user, text, batch_size, &options](int, int, std::mt19937& rng) {
+            std::vector<MessageRecord> batch(batch_size);
+            for (MessageRecord& record : batch) {
+                record.sender_id = user(rng);
+                record.group_id = group_of(record.sender_id, options);
+                record.text = text;
+            }
+            return save_messages(db, batch).back() != -1;
+        }},
+        {"get_group_messages", 1, [db, group](int, int, std::mt19937& rng) { get_group_messages(db, group(rng), 50); return true; }},
+        {"get_group_messages_before", 1, [db, message, &options](int, int, std::mt19937& rng) {
+            int cursor = message(rng);
+            get_group_messages_before(db, group_of(cursor, options), cursor, 50);
+            return true;
+        }},
+        {"get_group_message_ids", 20, [db, group](int, int, std::mt19937& rng) { get_group_message_ids(db, group(rng)); return true; }},
+        {"add_message_to_group", 1, [db, message, &options](int, int, std::mt19937& rng) {
+            int id = message(rng);
+            return add_message_to_group(db, id, group_of(id, options));
+        }},
+        {"get_message_group_id", 1, [db, message](int, int, std::mt19937& rng) { return get_message_group_id(db, message(rng)) != -1; }},
+        {"search_messages", 1, [db, group](int, int, std::mt19937& rng) {
+            search_messages(db, group(rng), "w" + std::to_string(rng() % vocabulary_size), 20);
+            return true;
+        }},
+        {"search_messages_prefix", 1, [db, group](int, int, std::mt19937& rng) {
+            search_messages(db, group(rng), "w" + std::to_string(rng() % 900 + 100) + "*", 20);
+            return true;
+        }},
+        {"get_message_count_in_group", 1, [db, group](int, int, std::mt19937& rng) { return get_message_count_in_group(db, group(rng)) >= 0; }},
+        {"mark_read", 1, [db, user, message, &options](int, int, std::mt19937& rng) {
+            int u = user(rng);
+            return mark_read(db, u, group_of(u, options), message(rng));
+        }},
+        {"get_unread_counts", 1, [db, user](int, int, std::mt19937& rng) { return !get_unread_counts(db, user(rng)).empty(); }},
+        // Last: deletes from the top of the preloaded range, each id once
+        {"remove_message_from_group", 1, [db, &options](int t, int i, std::mt19937&) {
+            int id = options.messages - (t * options.ops + i);
+            return id < 1 || remove_message_from_group(db, id, group_of(id, options));
+        }},
+    };
+}
+
+Result run_benchmark(const Benchmark& benchmark, int threads, const Options& options) {
+    int iterations = std::max(1, options.ops / benchmark.divisor);
+    std::vector<LatencyHistogram> histograms(threads);
+    std::atomic<uint64_t> errors(0);
+    std::atomic<int> ready(0);
+    std::atomic<bool> go(false);
+
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t]() {
+            std::mt19937 rng(1234 + t);
+            ready++;
+            while (!go.load(std::memory_order_acquire)) {
+                std::this_thread::yield();
+            }
+            uint64_t failed = 0;
+            for (int i = 0; i < iterations; ++i) {
+                auto start = Clock::now();
+                bool ok = benchmark.run(t, i, rng);
+                histograms[t].record(Clock::now() - start);
+                failed += ok ? 0 : 1;
+            }
+            errors += failed;
+        });
+    }
+    while (ready.load() < threads) {
+        std::this_thread::yield();
+    }
+    auto start = Clock::now();
+    go.store(true, std::memory_order_release);
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    std::chrono::duration<double> elapsed = Clock::now() - start;
+
+    Result result;
+    result.threads = threads;
+    result.operation = benchmark.name;
+    result.ops = static_cast<uint64_t>(iterations) * threads;
+    result.errors = errors.load();
+    result.seconds = elapsed.count();
+    for (const auto& histogram : histograms) {
+        result.latency.merge(histogram);
+    }
+    return result;
+}
+
+void write_json(std::ostream& out, const Options& options, const std::vector<Result>& results) {
+    out << "{\n  \"benchmark\": \"bench_database\",\n  \"config\": {\"users\": " << options.users
+        << ", \"groups\": " << options.groups << ", \"messages\": " << options.messages
+        << ", \"ops_per_thread\": " << options.ops << "},\n  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const Result& r = results[i];
+        out << "    {\"backend\": \"" << r.backend << "\", \"threads\": " << r.threads
+            << ", \"operation\": \"" << r.operation << "\", \"ops\": " << r.ops << ", \"errors\": " << r.errors
+            << ", \"ops_per_sec\": " << static_cast<uint64_t>(r.seconds > 0 ? r.ops / r.seconds : 0)
+            << ", \"latency_ns\": {\"p50\": " << r.latency.percentile(50) << ", \"p99\": " << r.latency.percentile(99)
+            << ", \"p999\": " << r.latency.percentile(99.9) << ", \"max\": " << r.latency.max()
+            << ", \"mean\": " << static_cast<uint64_t>(r.latency.mean()) << "}}"
+            << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    out << "  ]\n}" << std::endl;
+}
+
+// Swallows the database layer's progress lines so stdout stays valid JSON
+} // namespace
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!parse_options(argc, argv, options)) {
+        std::cerr << "usage: bench_database [--users N] [--groups N] [--messages N] [--ops N] "
+                     "[--threads 1,4,16] [--backends file,memory] [--db path] [--password-cost rounds]" << std::endl;
+        return 1;
+    }
+
+    logging::set_level(LogLevel::WARN); // Library progress lines go to stderr; keep them to problems
+
+    std::vector<Result> results;
+    for (const std::string& backend : options.backends) {
+        std::string db = backend == "memory" ? ":memory:" : options.file;
+        if (backend == "file") {
+            for (const char* suffix : {"", "-wal", "-shm"}) {
+                std::remove((db + suffix).c_str());
+            }
+        }
+
+        std::cerr << "Populating " << backend << " database: " << options.users << " users, "
+                  << options.groups << " groups, " << options.messages << " messages" << std::endl;
+        ChatDatabase* database = get_database(db);
+        if (database) {
+            database->set_password_cost(options.password_cost);
+        }
+        if (!database || !database->init_schema() || !populate(*database, options)) {
+            std::cerr << "Failed to populate " << backend << " database" << std::endl;
+            return 1;
+        }
+
+        for (int threads : options.threads) {
+            std::string tag = backend + std::to_string(threads);
+            for (const Benchmark& benchmark : make_benchmarks(db, tag, options)) {
+                Result result = run_benchmark(benchmark, threads, options);
+                result.backend = backend;
+                std::cerr << "  " << backend << " x" << threads << " " << benchmark.name << ": "
+                          << static_cast<uint64_t>(result.ops / result.seconds) << " ops/s, p99 "
+                          << result.latency.percentile(99) << " ns" << std::endl;
+                results.push_back(std::move(result));
+            }
+        }
+        close_database(db);
+    }
+
+    write_json(std::cout, options, results);
+    return 0;
+}
@@ -0,0 +1,53 @@
+#include <iostream>
+#include <string>
+#include <chrono>
+#include <algorithm>
+#include "protocol.h"
+#include "ring_buffer.h"
+
+// Frames parsed (and decoded) per second when a byte stream of typical chat
+// traffic is pushed through a receive ring in socket-sized reads.
+
+int main(int argc, char** argv) {
+    using Clock = std::chrono::steady_clock;
+    using namespace protocol;
+
+    int frameCount = argc > 1 ? std::stoi(argv[1]) : 1000000;
+    size_t readSize = argc > 2 ? std::stoul(argv[2]) : 16384;
+
+    std::string stream;
+    const std::string text = "hey everyone, the build is green again";
+    for (int i = 0; i < frameCount; ++i) {
+        encode_send_message(stream, {i % 64, static_cast<uint64_t>(i), text});
+    }
+
+    std::cout << "=== Protocol Benchmark ===" << std::endl;
+    std::cout << "  " << frameCount << " SEND_MESSAGE frames, " << stream.size() << " bytes, "
+              << readSize << "-byte reads" << std::endl;
+
+    RingBuffer ring(64 * 1024);
+    FrameParser parser;
+    size_t fed = 0;
+    int parsed = 0;
+    uint64_t checksum = 0;
+    auto start = Clock::now();
+    while (parsed < frameCount) {
+        fed += ring.append(stream.data() + fed, std::min(readSize, stream.size() - fed));
+        Frame frame;
+        while (parser.next(ring, frame) == ParseStatus::FRAME) {
+            SendMessageRequest request;
+            if (decode_send_message(frame.payload, request)) {
+                checksum += request.client_tag + request.text.size();
+            }
+            parser.consume(ring);
+            parsed++;
+        }
+    }
+    std::chrono::duration<double> elapsed = Clock::now() - start;
+
+    std::cout << "  parsed " << parsed << " frames in " << elapsed.count() * 1000 << " ms: "
+              << static_cast<long>(parsed / elapsed.count()) << " frames/s, "
+              << static_cast<long>(stream.size() / elapsed.count() / (1024 * 1024)) << " MiB/s"
+              << " (checksum " << checksum << ")" << std::endl;
+    return 0;
+}
@@ -0,0 +1,191 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <random>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <algorithm>
+#include "sharded_database.h"
+#include "latency_histogram.h"
+#include "logger.h"
+
+// Write throughput of a ShardedDatabase by shard count.
+// Writer threads store messages into random groups, one commit per message,
+// so a single file is capped by its one SQLite writer and every extra shard
+// adds a writer. Results go to stdout as JSON; progress goes to stderr.
+//
+//   bench_shards --shards 1,2,4,8 --threads 8 --messages 2000 --durability full
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Options
+{
+    std::vector<int> shards{1, 2, 4};
+    int threads = 4;
+    int messages = 2000; // Per thread
+    int groups = 64;
+    std::string durability = "full";
+    std::string file = "data/bench_shards.db";
+};
+
+struct Result
+{
+    int shards;
+    uint64_t messages;
+    uint64_t errors;
+    double seconds;
+    LatencyHistogram latency;
+};
+
+std::vector<int> parse_list(const std::string& value) {
+    std::vector<int> list;
+    std::stringstream stream(value);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        list.push_back(std::stoi(item));
+    }
+    return list;
+}
+
+bool parse_options(int argc, char** argv, Options& options) {
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string flag = argv[i];
+        std::string value = argv[i + 1];
+        if (flag == "--shards") {
+            options.shards = parse_list(value);
+        } else if (flag == "--threads") {
+            options.threads = std::stoi(value);
+        } else if (flag == "--messages") {
+            options.messages = std::stoi(value);
+        } else if (flag == "--groups") {
+            options.groups = std::stoi(value);
+        } else if (flag == "--durability") {
+            options.durability = value;
+        } else if (flag == "--db") {
+            options.file = value;
+        } else {
+            std::cerr << "Unknown option " << flag << std::endl;
+            return false;
+        }
+    }
+    if (argc % 2 == 0) {
+        std::cerr << "Missing value for " << argv[argc - 1] << std::endl;
+        return false;
+    }
+    options.threads = std::max(options.threads, 1);
+    options.groups = std::max(options.groups, 1);
+    return !options.shards.empty() && *std::min_element(options.shards.begin(), options.shards.end()) >= 1;
+}
+
+// Closes the shared handles of the global file and every shard, then deletes them
+void remove_files(const std::string& db, int shards) {
+    for (int shard = -1; shard < shards; ++shard) {
+        std::string file = shard < 0 ? db : db + ".shard" + std::to_string(shard);
+        close_database(file);
+        for (const char* suffix : {"", "-wal", "-shm"}) {
+            std::remove((file + suffix).c_str());
+        }
+    }
+}
+
+void run(ShardedDatabase& database, int shards, const Options& options, Result& result) {
+    std::vector<LatencyHistogram> histograms(options.threads);
+    std::atomic<uint64_t> errors(0);
+    std::atomic<int> ready(0);
+    std::atomic<bool> go(false);
+    const std::string text = "benchmark message with a typical length for a chat line";
+
+    std::vector<std::thread> workers;
+    for (int t = 0; t < options.threads; ++t) {
+        workers.emplace_back([&, t]() {
+            std::mt19937 rng(1234 + t);
+            ready++;
+            while (!go.load(std::memory_order_acquire)) {
+                std::this_thread::yield();
+            }
+            uint64_t failed = 0;
+            for (int i = 0; i < options.messages; ++i) {
+                int group = static_cast<int>(rng() % options.groups) + 1;
+                auto start = Clock::now();
+                bool ok = database.store_message(1, group, text) != -1;
+                histograms[t].record(Clock::now() - start);
+                failed += ok ? 0 : 1;
+            }
+            errors += failed;
+        });
+    }
+    while (ready.load() < options.threads) {
+        std::this_thread::yield();
+    }
+    auto start = Clock::now();
+    go.store(true, std::memory_order_release);
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    std::chrono::duration<double> elapsed = Clock::now() - start;
+
+    result.shards = shards;
+    result.messages = static_cast<uint64_t>(options.messages) * options.threads;
+    result.errors = errors.load();
+    result.seconds = elapsed.count();
+    for (const auto& histogram : histograms) {
+        result.latency.merge(histogram);
+    }
+}
+
+void write_json(std::ostream& out, const Options& options, const std::vector<Result>& results) {
+    out << "{\n  \"benchmark\": \"bench_shards\",\n  \"config\": {\"threads\": " << options.threads
+        << ", \"messages_per_thread\": " << options.messages << ", \"groups\": " << options.groups
+        << ", \"durability\": \"" << options.durability << "\"},\n  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const Result& r = results[i];
+        out << "    {\"shards\": " << r.shards << ", \"messages\": " << r.messages << ", \"errors\": " << r.errors
+            << ", \"messages_per_sec\": " << static_cast<uint64_t>(r.seconds > 0 ? r.messages / r.seconds : 0)
+            << ", \"latency_ns\": {\"p50\": " << r.latency.percentile(50) << ", \"p99\": " << r.latency.percentile(99)
+            << ", \"max\": " << r.latency.max() << "}}" << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    out << "  ]\n}" << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!parse_options(argc, argv, options)) {
+        std::cerr << "usage: bench_shards [--shards 1,2,4] [--threads N] [--messages per-thread] [--groups N] "
+                     "[--durability full|normal] [--db path]" << std::endl;
+        return 1;
+    }
+
+    logging::set_level(LogLevel::WARN);
+
+    std::vector<Result> results;
+    for (int shards : options.shards) {
+        remove_files(options.file, shards);
+        ShardedDatabase database(options.file, shards);
+        bool ready = database.is_open() && database.init_schema() && database.register_user("bench", "pw") &&
+                     database.set_durability(options.durability == "normal" ? Durability::NORMAL : Durability::FULL);
+        for (int g = 1; ready && g <= options.groups; ++g) {
+            ready = database.create_group("group" + std::to_string(g)) && database.add_user_to_group(1, g);
+        }
+        if (!ready) {
+            std::cerr << "Failed to set up " << shards << " shards" << std::endl;
+            return 1;
+        }
+
+        Result result;
+        run(database, shards, options, result);
+        std::cerr << "  " << shards << " shards: " << static_cast<uint64_t>(result.messages / result.seconds)
+                  << " messages/s, p99 " << result.latency.percentile(99) << " ns" << std::endl;
+        results.push_back(std::move(result));
+        remove_files(options.file, shards);
+    }
+
+    write_json(std::cout, options, results);
+    return 0;
+}
@@ -0,0 +1,190 @@
+#include "../include/buffer_pool.h"
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <new>
+
+namespace {
+
+const size_t smallest_shift = 5; // 32-byte blocks
+const size_t class_count = 12; // 32 B .. 64 KiB
+const size_t slab_size = 256 * 1024;
+const size_t cache_bytes = 256 * 1024; // Kept per thread and class before the surplus is shared
+
+struct FreeBlock
+{
+    FreeBlock* next;
+};
+
+size_t class_of(size_t size) {
+    if (size <= (size_t(1) << smallest_shift)) {
+        return 0;
+    }
+    return static_cast<size_t>(64 - __builtin_clzll(size - 1)) - smallest_shift;
+}
+
+size_t block_size(size_t size_class) {
+    return size_t(1) << (size_class + smallest_shift);
+}
+
+size_t cache_limit(size_t size_class) {
+    return std::max<size_t>(8, cache_bytes / block_size(size_class));
+}
+
+// Blocks released by thread caches, waiting for any thread to pick them up
+struct SharedList
+{
+    std::mutex mutex;
+    FreeBlock* head = nullptr;
+};
+
+SharedList* shared_lists() {
+    // Never destroyed: exiting threads still flush their caches into it
+    static SharedList* lists = new SharedList[class_count];
+    return lists;
+}
+
+std::atomic<uint64_t> carved(0);
+
+// Links first..last (already chained) onto the shared list
+void share(size_t size_class, FreeBlock* first, FreeBlock* last) {
+    SharedList& list = shared_lists()[size_class];
+    std::lock_guard<std::mutex> lock(list.mutex);
+    last->next = list.head;
+    list.head = first;
+}
+
+class ThreadCache
+{
+public:
+
+    ~ThreadCache();
+
+    void* take(size_t size_class);
+    void put(size_t size_class, FreeBlock* block);
+
+private:
+
+    void refill(size_t size_class);
+    void spill(size_t size_class, size_t count); // Moves count blocks to the shared list
+
+    FreeBlock* heads[class_count] = {};
+    size_t counts[class_count] = {};
+};
+
+thread_local bool cache_destroyed = false; // Trivially destructible, so still readable after the cache is gone
+
+ThreadCache* local_cache() {
+    if (cache_destroyed) {
+        return nullptr;
+    }
+    thread_local ThreadCache cache;
+    return &cache;
+}
+
+ThreadCache::~ThreadCache() {
+    for (size_t size_class = 0; size_class < class_count; ++size_class) {
+        spill(size_class, counts[size_class]);
+    }
+    cache_destroyed = true;
+}
+
+void* ThreadCache::take(size_t size_class) {
+    if (!heads[size_class]) {
+        refill(size_class);
+    }
+    FreeBlock* block = heads[size_class];
+    heads[size_class] = block->next;
+    counts[size_class]--;
+    return block;
+}
+
+void ThreadCache::put(size_t size_class, FreeBlock* block) {
+    block->next = heads[size_class];
+    heads[size_class] = block;
+    if (++counts[size_class] > cache_limit(size_class)) {
+        spill(size_class, counts[size_class] / 2);
+    }
+}
+
+void ThreadCache::refill(size_t size_class) {
+    size_t wanted = cache_limit(size_class) / 2;
+    {
+        SharedList& list = shared_lists()[size_class];
+        std::lock_guard<std::mutex> lock(list.mutex);
+        while (list.head && counts[size_class] < wanted) {
+            FreeBlock* block = list.head;
+            list.head = block->next;
+            block->next = heads[size_class];
+            heads[size_class] = block;
+            counts[size_class]++;
+        }
+    }
+    if (heads[size_class]) {
+        return;
+    }
+
+    // Nothing shared either: carve a fresh slab into this class
+    size_t size = block_size(size_class);
+    size_t bytes = std::max(slab_size, size * 4);
+    char* slab = static_cast<char*>(::operator new(bytes));
+    carved.fetch_add(bytes, std::memory_order_relaxed);
+    for (size_t offset = 0; offset + size <= bytes; offset += size) {
+        FreeBlock* block = reinterpret_cast<FreeBlock*>(slab + offset);
+        block->next = heads[size_class];
+        heads[size_class] = block;
+        counts[size_class]++;
+    }
+}
+
+void ThreadCache::spill(size_t size_class, size_t count) {
+    if (count == 0) {
+        return;
+    }
+    FreeBlock* first = heads[size_class];
+    FreeBlock* last = first;
+    for (size_t i = 1; i < count; ++i) {
+        last = last->next;
+    }
+    heads[size_class] = last->next;
+    counts[size_class] -= count;
+    share(size_class, first, last);
+}
+
+} // namespace
+
+namespace buffer_pool
+{
+
+void* allocate(size_t size) {
+    if (size > largest_block) {
+        return ::operator new(size);
+    }
+    size_t size_class = class_of(size);
+    ThreadCache* cache = local_cache();
+    if (!cache) {
+        return ::operator new(block_size(size_class)); // Thread is exiting; the pool adopts it when freed
+    }
+    return cache->take(size_class);
+}
+
+void deallocate(void* block, size_t size) {
+    if (size > largest_block) {
+        ::operator delete(block);
+        return;
+    }
+    size_t size_class = class_of(size);
+    FreeBlock* free_block = static_cast<FreeBlock*>(block);
+    ThreadCache* cache = local_cache();
+    if (cache) {
+        cache->put(size_class, free_block);
+    } else {
+        share(size_class, free_block, free_block);
+    }
+}
+
+uint64_t slab_bytes() {
+    return carved.load(std::memory_order_relaxed);
+}
+
+} // namespace buffer_pool
@@ -0,0 +1,1670 @@
+#include "../include/chat_database.h"
+#include "../include/message_ingest.h"
+#include "../include/message_log.h"
+#include "../include/message_search.h"
+#include "../include/password_hash.h"
+#include "../include/database_executor.h"
+#include "../include/logger.h"
+#include "../include/metrics.h"
+#include "../include/sharded_database.h"
+#include <sqlite3.h>
+#include <memory>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <ctime>
+#include <unordered_map>
+#include <unistd.h>
+
+namespace {
+
+// SQL for every cached statement, in ChatDatabase::Statement order
+const char* const statement_sql[] = {
+    "INSERT INTO Users (username, password) VALUES (?, ?);",
+    "SELECT id, password FROM Users WHERE username = ?;",
+    "UPDATE Users SET password = ? WHERE id = ?;",
+    "SELECT id FROM Users WHERE username = ?;",
+    "SELECT username FROM Users WHERE id = ?;",
+    "SELECT id, username FROM Users;",
+    "INSERT INTO Groups (name) VALUES (?);",
+    "INSERT INTO GroupMembers (group_id, user_id) VALUES (?, ?);",
+    "DELETE FROM GroupMembers WHERE group_id = ? AND user_id = ?;",
+    "SELECT group_id FROM GroupMembers WHERE user_id = ? ORDER BY group_id;",
+    "SELECT user_id FROM GroupMembers WHERE group_id = ? ORDER BY user_id;",
+    "SELECT group_id, user_id FROM GroupMembers;",
+    "SELECT name FROM Groups WHERE group_id = ?;",
+    "INSERT INTO Messages (sender_id, group_id, text, file_path, sent_at_ms) VALUES (?, ?, ?, ?, ?);",
+    "SELECT message_id, sender_id, text, file_path, sent_at_ms FROM Messages "
+    "WHERE group_id = ? AND message_id < ? "
+    "ORDER BY message_id DESC "
+    "LIMIT ?;",
+    "SELECT message_id FROM Messages WHERE group_id = ? ORDER BY message_id DESC;",
+    "DELETE FROM Messages WHERE message_id = ? AND group_id = ?;",
+    "SELECT group_id FROM Messages WHERE message_id = ?;",
+    "SELECT group_id, file_path FROM Messages WHERE message_id = ?;",
+    "SELECT message_count FROM GroupStats WHERE group_id = ?;",
+    "SELECT m.message_id, m.sender_id, m.text, m.file_path, m.sent_at_ms "
+    "FROM (SELECT rowid, rank FROM MessageSearch WHERE MessageSearch MATCH ? ORDER BY rank LIMIT ?) AS hit "
+    "JOIN Messages m ON m.message_id = hit.rowid "
+    "WHERE m.group_id = ? "
+    "ORDER BY hit.rank;",
+    "INSERT INTO MessageSearch (MessageSearch, rank) VALUES ('merge', ?);",
+    "SELECT group_id, message_count, last_message_id FROM GroupStats;",
+    "SELECT user_id, group_id, last_read_message_id, read_count FROM ReadMarkers;",
+    "SELECT COUNT(*) FROM Messages WHERE group_id = ? AND message_id > ?;",
+    "INSERT INTO ReadMarkers (user_id, group_id, last_read_message_id, read_count) VALUES (?, ?, ?, ?) "
+    "ON CONFLICT (user_id, group_id) DO UPDATE SET "
+    "last_read_message_id = excluded.last_read_message_id, read_count = excluded.read_count "
+    "WHERE excluded.last_read_message_id > last_read_message_id;",
+    "SELECT m.group_id, max(0, coalesce(s.message_count, 0) - coalesce(r.read_count, 0)) "
+    "FROM GroupMembers m "
+    "LEFT JOIN GroupStats s ON s.group_id = m.group_id "
+    "LEFT JOIN ReadMarkers r ON r.user_id = m.user_id AND r.group_id = m.group_id "
+    "WHERE m.user_id = ? ORDER BY m.group_id;",
+    "SELECT file, month, first_message_id, last_message_id, message_count FROM Partitions;",
+    "INSERT INTO Partitions (file, month, first_message_id, last_message_id, message_count) VALUES (?, ?, ?, ?, ?);",
+    "SELECT message_id, coalesce(sent_at_ms, 0) FROM Messages ORDER BY message_id LIMIT 1;",
+    "SELECT min(message_id) FROM Messages WHERE sent_at_ms >= ?;",
+    "SELECT message_id, sender_id, group_id, text, file_path, sent_at_ms FROM Messages "
+    "WHERE message_id < ? ORDER BY group_id, message_id;",
+    "DELETE FROM Messages WHERE message_id < ?;",
+    "INSERT INTO ArchiveRun (active) VALUES (1);",
+    "DELETE FROM ArchiveRun;",
+    "BEGIN IMMEDIATE;",
+    "COMMIT;",
+    "ROLLBACK;",
+    "PRAGMA user_version;",
+    "SELECT shard, shard_count FROM ShardLayout;",
+    "INSERT INTO ShardLayout (shard, shard_count) VALUES (?, ?);",
+    "SELECT seq FROM sqlite_sequence WHERE name = 'Messages';",
+    "INSERT INTO sqlite_sequence (name, seq) VALUES ('Messages', ?);",
+    "UPDATE sqlite_sequence SET seq = ? WHERE name = 'Messages';",
+    "INSERT OR IGNORE INTO Messages (message_id, sender_id, group_id, text, file_path, sent_at_ms) VALUES (?, ?, ?, ?, ?, ?);",
+    "SELECT applied_message_id FROM MessageLogCheckpoint;",
+    "INSERT OR REPLACE INTO MessageLogCheckpoint (id, applied_message_id) VALUES (1, ?);",
+    "INSERT OR REPLACE INTO RejectedMessages (message_id, sender_id, group_id, text, file_path, sent_at_ms) VALUES (?, ?, ?, ?, ?, ?);",
+    "INSERT INTO FailedLogRanges (first_message_id, last_message_id) VALUES (?, ?);",
+    "SELECT first_message_id, last_message_id FROM FailedLogRanges;",
+    "DELETE FROM FailedLogRanges;",
+};
+
+// Schema migrations, applied in order on top of the tables init_schema()
+// creates. Entry i upgrades a database from user_version i to i + 1.
+const char* const migrations[] = {
+    // 1: integer send time, history indexes
+    "ALTER TABLE Messages ADD COLUMN sent_at_ms INTEGER;"
+    "UPDATE Messages SET sent_at_ms = CAST(strftime('%s', sent_at) AS INTEGER) * 1000 WHERE sent_at_ms IS NULL;"
+    "CREATE INDEX IF NOT EXISTS idx_messages_group_history ON Messages (group_id, message_id, sender_id, sent_at_ms);"
+    "CREATE INDEX IF NOT EXISTS idx_group_members_user ON GroupMembers (user_id, group_id);",
+
+    // 2: full-text search, see message_search.h. The index has no copy of the
+    // text; it reads Messages through a view, and triggers keep it in step.
+    "CREATE VIEW IF NOT EXISTS MessageSearchContent AS "
+    "SELECT message_id, group_id || char(31) || coalesce(text, '') AS document FROM Messages;"
+    "CREATE VIRTUAL TABLE IF NOT EXISTS MessageSearch USING fts5("
+    "document, content = 'MessageSearchContent', content_rowid = 'message_id', tokenize = 'group_words');"
+    "CREATE TRIGGER IF NOT EXISTS messages_search_insert AFTER INSERT ON Messages BEGIN "
+    "INSERT INTO MessageSearch (rowid, document) VALUES (new.message_id, new.group_id || char(31) || coalesce(new.text, '')); "
+    "END;"
+    "CREATE TRIGGER IF NOT EXISTS messages_search_delete AFTER DELETE ON Messages BEGIN "
+    "INSERT INTO MessageSearch (MessageSearch, rowid, document) "
+    "VALUES ('delete', old.message_id, old.group_id || char(31) || coalesce(old.text, '')); "
+    "END;"
+    "CREATE TRIGGER IF NOT EXISTS messages_search_update AFTER UPDATE OF text, group_id ON Messages BEGIN "
+    "INSERT INTO MessageSearch (MessageSearch, rowid, document) "
+    "VALUES ('delete', old.message_id, old.group_id || char(31) || coalesce(old.text, '')); "
+    "INSERT INTO MessageSearch (rowid, document) VALUES (new.message_id, new.group_id || char(31) || coalesce(new.text, '')); "
+    "END;"
+    "INSERT INTO MessageSearch (MessageSearch) VALUES ('rebuild');",
+
+    // 3: per-group message counters and per-member read markers. Triggers
+    // update both in the transaction that stores or deletes a message.
+    // read_count is how many of the group's messages a marker covers, so
+    // unread = message_count - read_count without counting rows.
+    "CREATE TABLE IF NOT EXISTS GroupStats ("
+    "group_id INTEGER PRIMARY KEY, message_count INTEGER NOT NULL, last_message_id INTEGER NOT NULL);"
+    "INSERT OR REPLACE INTO GroupStats (group_id, message_count, last_message_id) "
+    "SELECT group_id, COUNT(*), MAX(message_id) FROM Messages GROUP BY group_id;"
+    "CREATE TABLE IF NOT EXISTS ReadMarkers ("
+    "user_id INTEGER NOT NULL, group_id INTEGER NOT NULL, "
+    "last_read_message_id INTEGER NOT NULL, read_count INTEGER NOT NULL, "
+    "PRIMARY KEY (user_id, group_id)) WITHOUT ROWID;"
+    "CREATE INDEX IF NOT EXISTS idx_read_markers_group ON ReadMarkers (group_id, last_read_message_id);"
+    "CREATE TRIGGER IF NOT EXISTS messages_stats_insert AFTER INSERT ON Messages BEGIN "
+    "INSERT INTO GroupStats (group_id, message_count, last_message_id) VALUES (new.group_id, 1, new.message_id) "
+    "ON CONFLICT (group_id) DO UPDATE SET message_count = message_count + 1, "
+    "last_message_id = max(last_message_id, excluded.last_message_id); "
+    "END;"
+    "CREATE TRIGGER IF NOT EXISTS messages_stats_delete AFTER DELETE ON Messages BEGIN "
+    "UPDATE GroupStats SET message_count = message_count - 1 WHERE group_id = old.group_id; "
+    "UPDATE ReadMarkers SET read_count = read_count - 1 "
+    "WHERE group_id = old.group_id AND last_read_message_id >= old.message_id AND read_count > 0; "
+    "END;",
+
+    // 4: catalog of archived partitions, see message_archive.h. Archiving
+    // deletes the hot rows, but the messages still count toward their group
+    // and its read markers, so the stats trigger skips deletes made while
+    // ArchiveRun has a row.
+    "CREATE TABLE IF NOT EXISTS Partitions ("
+    "file TEXT PRIMARY KEY, month TEXT NOT NULL, first_message_id INTEGER NOT NULL, "
+    "last_message_id INTEGER NOT NULL, message_count INTEGER NOT NULL);"
+    "CREATE TABLE IF NOT EXISTS ArchiveRun (active INTEGER);"
+    "DROP TRIGGER IF EXISTS messages_stats_delete;"
+    "CREATE TRIGGER messages_stats_delete AFTER DELETE ON Messages "
+    "WHEN NOT EXISTS (SELECT 1 FROM ArchiveRun) BEGIN "
+    "UPDATE GroupStats SET message_count = message_count - 1 WHERE group_id = old.group_id; "
+    "UPDATE ReadMarkers SET read_count = read_count - 1 "
+    "WHERE group_id = old.group_id AND last_read_message_id >= old.message_id AND read_count > 0; "
+    "END;",
+
+    // 5: which shard of a sharded layout the file is, see sharded_database.h.
+    // Empty for a database that holds everything.
+    "CREATE TABLE IF NOT EXISTS ShardLayout (shard INTEGER NOT NULL, shard_count INTEGER NOT NULL);",
+
+    // 6: last message the write-ahead log has applied, see message_log.h
+    "CREATE TABLE IF NOT EXISTS MessageLogCheckpoint ("
+    "id INTEGER PRIMARY KEY CHECK (id = 1), applied_message_id INTEGER NOT NULL);",
+
+    // 7: acknowledged messages the log could not store in Messages, kept for an operator
+    "CREATE TABLE IF NOT EXISTS RejectedMessages ("
+    "message_id INTEGER PRIMARY KEY, sender_id INTEGER NOT NULL, group_id INTEGER NOT NULL, "
+    "text TEXT NOT NULL, file_path TEXT NOT NULL, sent_at_ms INTEGER NOT NULL);",
+
+    // 8: logged messages answered with -1 after a failed sync, which replay must skip
+    "CREATE TABLE IF NOT EXISTS FailedLogRanges ("
+    "first_message_id INTEGER NOT NULL, last_message_id INTEGER NOT NULL);",
+};
+
+int64_t now_ms() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+// "YYYY-MM" of a send time, and the bounds of that month, in UTC
+std::string utc_month(int64_t sent_at_ms, int64_t& start_ms, int64_t& end_ms) {
+    time_t seconds = static_cast<time_t>(sent_at_ms / 1000);
+    struct tm parts;
+    gmtime_r(&seconds, &parts);
+    char name[32]; // Room for any int year, so the name is never cut short
+    snprintf(name, sizeof(name), "%04d-%02d", parts.tm_year + 1900, parts.tm_mon + 1);
+
+    parts.tm_mday = 1;
+    parts.tm_hour = parts.tm_min = parts.tm_sec = 0;
+    start_ms = static_cast<int64_t>(timegm(&parts)) * 1000;
+    parts.tm_mon += 1; // timegm() carries December into the next year
+    end_ms = static_cast<int64_t>(timegm(&parts)) * 1000;
+    return name;
+}
+
+// Partitions of a file database live next to it; a memory database has none
+std::string archive_directory(const std::string& db_name) {
+    return is_memory_database(db_name) ? std::string() : db_name + ".archive";
+}
+
+// Latency of one public call, exported as chat_db_call_seconds{call="..."}.
+// Calls answered from the in-memory indexes or the recent-message cache are not timed.
+metrics::Histogram call_latency(const char* call) {
+    return metrics::Histogram("chat_db_call_seconds", "Latency of ChatDatabase calls that reach SQLite",
+                              std::string("call=\"") + call + "\"");
+}
+
+// Each thread keeps reading through the same pooled connection
+std::atomic<int> next_thread_slot(0);
+thread_local int thread_slot = next_thread_slot++;
+
+} // namespace
+
+ChatDatabase::ChatDatabase(const std::string& db_name, const DatabaseTuning& tuning)
+    : db_name(db_name), writer(new DbConnection(db_name, false, tuning)),
+      recent(tuning.recent_messages_per_group, tuning.recent_cache_bytes), archived(archive_directory(db_name)),
+      password_iterations(password_hash::default_iterations), max_message_id(INT_MAX) {
+    if (!writer->is_open()) {
+        return;
+    }
+    message_search::register_tokenizer(writer->handle());
+    if (is_memory_database(db_name)) {
+        return; // A memory database is private to its connection, reads use the writer
+    }
+    // The writer has switched the file to WAL, so read-only connections can attach now
+    for (int i = 0; i < tuning.read_connections; ++i) {
+        std::unique_ptr<DbConnection> reader(new DbConnection(db_name, true, tuning));
+        if (!reader->is_open()) {
+            readers.clear();
+            break;
+        }
+        message_search::register_tokenizer(reader->handle());
+        readers.push_back(std::move(reader));
+    }
+}
+
+ChatDatabase::~ChatDatabase() {
+    async.reset(); // Runs whatever is still queued
+    wal.reset(); // Applies whatever is still logged; a memory database's log forwards to the ingest queue
+    ingest.reset(); // Stores whatever is still queued
+}
+
+bool ChatDatabase::is_open() const {
+    return writer->is_open();
+}
+
+const std::string& ChatDatabase::name() const {
+    return db_name;
+}
+
+ChatDatabase::Lease ChatDatabase::write_lease() {
+    return Lease(*writer);
+}
+
+ChatDatabase::Lease ChatDatabase::read_lease() {
+    if (readers.empty()) {
+        return Lease(*writer);
+    }
+    return Lease(*readers[thread_slot % readers.size()]);
+}
+
+sqlite3_stmt* ChatDatabase::statement(Lease& lease, Statement id) {
+    static_assert(sizeof(statement_sql) / sizeof(statement_sql[0]) == STATEMENT_COUNT,
+                  "statement_sql must list one query per Statement");
+    return lease.connection.statement(id, statement_sql[id]);
+}
+
+bool ChatDatabase::run(Statement id) {
+    Lease lease = write_lease();
+    ScopedStatement stmt(statement(lease, id));
+    return stmt && sqlite3_step(stmt.get()) == SQLITE_DONE;
+}
+
+ChatDatabase::Transaction::Transaction(ChatDatabase& database)
+    : database(database), lock(database.writer->mutex()), open(false) {
+    open = database.run(BEGIN_TRANSACTION);
+    if (!open) {
+        log_error() << "Failed to begin transaction: " << sqlite3_errmsg(database.writer->handle());
+    }
+}
+
+ChatDatabase::Transaction::~Transaction() {
+    if (open) {
+        database.run(ROLLBACK_TRANSACTION);
+        database.commit_actions.clear();
+    }
+}
+
+bool ChatDatabase::Transaction::active() const {
+    return open;
+}
+
+bool ChatDatabase::Transaction::commit() {
+    if (!open) {
+        return false;
+    }
+    if (!database.run(COMMIT_TRANSACTION)) {
+        log_error() << "Failed to commit transaction: " << sqlite3_errmsg(database.writer->handle());
+        return false; // Still open, the destructor rolls back
+    }
+    open = false;
+
+    std::vector<std::function<void()>> actions;
+    actions.swap(database.commit_actions);
+    for (auto& action : actions) {
+        action();
+    }
+    return true;
+}
+
+void ChatDatabase::after_commit(std::function<void()> action) {
+    // Inside a Transaction the writer is not in autocommit mode until COMMIT
+    if (sqlite3_get_autocommit(writer->handle())) {
+        action();
+    } else {
+        commit_actions.push_back(std::move(action));
+    }
+}
+
+bool ChatDatabase::set_durability(Durability durability) {
+    Lease lease = write_lease();
+    const char* sql = durability == Durability::FULL ? "PRAGMA synchronous = FULL;" : "PRAGMA synchronous = NORMAL;";
+    return lease.connection.execute(sql, "Failed to set durability");
+}
+
+bool ChatDatabase::checkpoint() {
+    Lease lease = write_lease();
+    // Syncs even at synchronous = NORMAL; SQLITE_BUSY means a reader kept it from finishing
+    int rc = sqlite3_wal_checkpoint_v2(lease.connection.handle(), nullptr, SQLITE_CHECKPOINT_FULL, nullptr, nullptr);
+    if (rc != SQLITE_OK) {
+        log_warn() << "Checkpoint of " << db_name << " did not finish: " << sqlite3_errmsg(lease.connection.handle());
+        return false;
+    }
+    return true;
+}
+
+void ChatDatabase::set_password_cost(int iterations) {
+    password_iterations = std::max(1, iterations);
+}
+
+bool ChatDatabase::init_schema() {
+    Lease lease = write_lease();
+    DbConnection& db = lease.connection;
+
+    // Create Users table
+    const char* users_sql = "CREATE TABLE IF NOT EXISTS Users ("
+                           "id INTEGER PRIMARY KEY AUTOINCREMENT,"
+                           "username TEXT UNIQUE NOT NULL,"
+                           "password TEXT NOT NULL,"
+                           "created_at DATETIME DEFAULT CURRENT_TIMESTAMP"
+                           ");";
+
+    // Create Groups table
+    const char* groups_sql = "CREATE TABLE IF NOT EXISTS Groups ("
+                            "group_id INTEGER PRIMARY KEY AUTOINCREMENT,"
+                            "name TEXT NOT NULL UNIQUE,"
+                            "created_at DATETIME DEFAULT CURRENT_TIMESTAMP,"
+                            "updated_at DATETIME DEFAULT CURRENT_TIMESTAMP"
+                            ");";
+
+    // Create GroupMembers table (many-to-many relationship)
+    const char* group_members_sql = "CREATE TABLE IF NOT EXISTS GroupMembers ("
+                                   "group_id INTEGER,"
+                                   "user_id INTEGER,"
+                                   "joined_at DATETIME DEFAULT CURRENT_TIMESTAMP,"
+                                   "PRIMARY KEY (group_id, user_id),"
+                                   "FOREIGN KEY (group_id) REFERENCES Groups(group_id),"
+                                   "FOREIGN KEY (user_id) REFERENCES Users(id)"
+                                   ");";
+
+    // Create Messages table with group_id relationship
+    const char* messages_sql = "CREATE TABLE IF NOT EXISTS Messages ("
+                              "message_id INTEGER PRIMARY KEY AUTOINCREMENT,"
+                              "sender_id INTEGER,"
+                              "group_id INTEGER NOT NULL,"
+                              "text TEXT,"
+                              "file_path TEXT,"
+                              "sent_at DATETIME DEFAULT CURRENT_TIMESTAMP,"
+                              "FOREIGN KEY (sender_id) REFERENCES Users(id),"
+                              "FOREIGN KEY (group_id) REFERENCES Groups(group_id)"
+                              ");";
+
+    // Execute all table creation statements
+    if (!db.execute(users_sql, "Failed to create Users table") ||
+        !db.execute(groups_sql, "Failed to create Groups table") ||
+        !db.execute(group_members_sql, "Failed to create GroupMembers table") ||
+        !db.execute(messages_sql, "Failed to create Messages table")) {
+        return false;
+    }
+
+    return migrate() && load_users() && load_membership() && load_group_stats() && load_partitions();
+}
+
+bool ChatDatabase::load_users() {
+    Lease lease = write_lease();
+    ScopedStatement stmt(statement(lease, LOAD_USERS));
+    if (!stmt) {
+        return false;
+    }
+
+    std::vector<std::pair<int, std::string>> rows;
+    int rc;
+    while ((rc = sqlite3_step(stmt.get())) == SQLITE_ROW) {
+        rows.emplace_back(sqlite3_column_int(stmt.get(), 0), column_string(stmt.get(), 1));
+    }
+    if (rc != SQLITE_DONE) {
+        log_error() << "Failed to load users: " << sqlite3_errmsg(lease.connection.handle());
+        return false;
+    }
+    directory.load(rows);
+    return true;
+}
+
+bool ChatDatabase::load_membership() {
+    Lease lease = write_lease();
+    ScopedStatement stmt(statement(lease, LOAD_MEMBERSHIP));
+    if (!stmt) {
+        return false;
+    }
+
+    std::vector<std::pair<int, int>> rows;
+    int rc;
+    while ((rc = sqlite3_step(stmt.get())) == SQLITE_ROW) {
+        rows.emplace_back(sqlite3_column_int(stmt.get(), 0), sqlite3_column_int(stmt.get(), 1));
+    }
+    if (rc != SQLITE_DONE) {
+        log_error() << "Failed to load group membership: " << sqlite3_errmsg(lease.connection.handle());
+        return false;
+    }
+    memberships.load(rows);
+    return true;
+}
+
+bool ChatDatabase::load_group_stats() {
+    Lease lease = write_lease();
+    ScopedStatement counters_stmt(statement(lease, LOAD_GROUP_STATS));
+    ScopedStatement markers_stmt(statement(lease, LOAD_READ_MARKERS));
+    if (!counters_stmt || !markers_stmt) {
+        return false;
+    }
+
+    std::vector<std::pair<int, GroupStats::Counter>> counters;
+    int rc;
+    while ((rc = sqlite3_step(counters_stmt.get())) == SQLITE_ROW) {
+        GroupStats::Counter counter;
+        counter.message_count = sqlite3_column_int(counters_stmt.get(), 1);
+        counter.last_message_id = sqlite3_column_int(counters_stmt.get(), 2);
+        counters.emplace_back(sqlite3_column_int(counters_stmt.get(), 0), counter);
+    }
+    if (rc != SQLITE_DONE) {
+        log_error() << "Failed to load group stats: " << sqlite3_errmsg(lease.connection.handle());
+        return false;
+    }
+
+    std::vector<GroupStats::MarkerRow> markers;
+    while ((rc = sqlite3_step(markers_stmt.get())) == SQLITE_ROW) {
+        markers.push_back({sqlite3_column_int(markers_stmt.get(), 0), sqlite3_column_int(markers_stmt.get(), 1),
+                           {sqlite3_column_int(markers_stmt.get(), 2), sqlite3_column_int(markers_stmt.get(), 3)}});
+    }
+    if (rc != SQLITE_DONE) {
+        log_error() << "Failed to load read markers: " << sqlite3_errmsg(lease.connection.handle());
+        return false;
+    }
+    stats.load(counters, markers);
+    return true;
+}
+
+bool ChatDatabase::load_partitions() {
+    Lease lease = write_lease();
+    ScopedStatement stmt(statement(lease, LOAD_PARTITIONS));
+    if (!stmt) {
+        return false;
+    }
+
+    int rc;
+    while ((rc = sqlite3_step(stmt.get())) == SQLITE_ROW) {
+        PartitionInfo partition{column_string(stmt.get(), 0), column_string(stmt.get(), 1),
+                                sqlite3_column_int(stmt.get(), 2), sqlite3_column_int(stmt.get(), 3),
+                                sqlite3_column_int(stmt.get(), 4)};
+        if (!archived.open(partition)) {
+            return false; // Serving history with a hole in it would be worse than not starting
+        }
+    }
+    if (rc != SQLITE_DONE) {
+        log_error() << "Failed to load archive partitions: " << sqlite3_errmsg(lease.connection.handle());
+        return false;
+    }
+    return true;
+}
+
+int ChatDatabase::schema_version() {
+    Lease lease = write_lease();
+    ScopedStatement stmt(statement(lease, GET_SCHEMA_VERSION));
+    if (!stmt || sqlite3_step(stmt.get()) != SQLITE_ROW) {
+        return -1;
+    }
+    return sqlite3_column_int(stmt.get(), 0);
+}
+
+bool ChatDatabase::migrate() {
+    const int latest = sizeof(migrations) / sizeof(migrations[0]);
+    int version = schema_version();
+    if (version < 0) {
+        return false;
+    }
+
+    for (; version < latest; ++version) {
+        Transaction transaction(*this);
+        std::string sql = std::string(migrations[version]) +
+                          "PRAGMA user_version = " + std::to_string(version + 1) + ";";
+        if (!transaction.active() ||
+            !writer->execute(sql.c_str(), "Failed to migrate schema to version " + std::to_string(version + 1)) ||
+            !transaction.commit()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool ChatDatabase::assign_shard(int shard, int shard_count) {
+    if (shard_count < 1 || shard < -1 || shard >= shard_count) {
+        log_error() << "Invalid shard " << shard << " of " << shard_count;
+        return false;
+    }
+    Transaction transaction(*this);
+    if (!transaction.active()) {
+        return false;
+    }
+
+    {
+        Lease lease = write_lease();
+        ScopedStatement layout_stmt(statement(lease, GET_SHARD_LAYOUT));
+        ScopedStatement sequence_stmt(statement(lease, GET_MESSAGE_SEQUENCE));
+        ScopedStatement save_layout_stmt(statement(lease, SAVE_SHARD_LAYOUT));
+        ScopedStatement save_sequence_stmt(statement(lease, SAVE_MESSAGE_SEQUENCE));
+        if (!layout_stmt || !sequence_stmt || !save_layout_stmt || !save_sequence_stmt) {
+            return false;
+        }
+
+        if (sqlite3_step(layout_stmt.get()) == SQLITE_ROW) {
+            int stored_shard = sqlite3_column_int(layout_stmt.get(), 0);
+            int stored_count = sqlite3_column_int(layout_stmt.get(), 1);
+            if (stored_shard != shard || stored_count != shard_count) {
+                log_error() << db_name << " is shard " << stored_shard << " of " << stored_count
+                            << ", not shard " << shard << " of " << shard_count;
+                return false;
+            }
+        } else {
+            // Ids already handed out would not fall in this shard's slice
+            if (shard_count > 1 && sqlite3_step(sequence_stmt.get()) == SQLITE_ROW) {
+                log_error() << db_name << " already holds messages and cannot join a layout of "
+                            << shard_count << " shards";
+                return false;
+            }
+            sqlite3_bind_int(save_layout_stmt.get(), 1, shard);
+            sqlite3_bind_int(save_layout_stmt.get(), 2, shard_count);
+            if (sqlite3_step(save_layout_stmt.get()) != SQLITE_DONE) {
+                log_error() << "Failed to save shard layout: " << sqlite3_errmsg(lease.connection.handle());
+                return false;
+            }
+            if (shard > 0 && shard_count > 1) {
+                sqlite3_bind_int(save_sequence_stmt.get(), 1, shard * message_id_slice(shard_count));
+                if (sqlite3_step(save_sequence_stmt.get()) != SQLITE_DONE) {
+                    log_error() << "Failed to start message ids: " << sqlite3_errmsg(lease.connection.handle());
+                    return false;
+                }
+            }
+        }
+    }
+
+    // Only this connection writes, so a TEMP trigger on it is enough to stop
+    // ids running into the next shard's slice. The global shard takes none.
+    // An explicit id (from a reserved block) is checked as is; NEW.message_id
+    // is -1 when SQLite is about to assign the next one itself.
+    int last_id = INT_MAX;
+    if (shard_count > 1) {
+        last_id = shard < 0 ? 0 : (shard + 1) * message_id_slice(shard_count);
+        std::string sql = "DROP TRIGGER IF EXISTS temp.shard_message_ids;"
+                          "CREATE TEMP TRIGGER shard_message_ids BEFORE INSERT ON main.Messages "
+                          "WHEN CASE WHEN NEW.message_id > 0 THEN NEW.message_id "
+                          "ELSE coalesce((SELECT seq FROM main.sqlite_sequence WHERE name = 'Messages'), 0) + 1 END > " +
+                          std::to_string(last_id) + " BEGIN SELECT RAISE(ABORT, 'no message ids left in this shard'); END;";
+        if (!writer->execute(sql.c_str(), "Failed to limit message ids")) {
+            return false;
+        }
+    }
+    if (!transaction.commit()) {
+        return false;
+    }
+    Lease lease = write_lease();
+    max_message_id = last_id;
+    return true;
+}
+
+// User management functions
+bool ChatDatabase::register_user(const std::string& username, const std::string& password) {
+    static const metrics::Histogram latency = call_latency("register_user");
+    metrics::Timer timer(latency);
+    // Hashed before taking the writer, which the KDF would otherwise hold for its whole run
+    std::string hashed = password_hash::hash(password, password_iterations);
+    if (hashed.empty()) {
+        return false;
+    }
+
+    Lease lease = write_lease();
+    ScopedStatement stmt(statement(lease, REGISTER_USER));
+    if (!stmt) {
+        return false;
+    }
+
+    sqlite3_bind_text(stmt.get(), 1, username.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt.get(), 2, hashed.c_str(), -1, SQLITE_STATIC);
+
+    int rc = sqlite3_step(stmt.get());
+    if (rc != SQLITE_DONE) {
+        log_error() << "Failed to register user: " << sqlite3_errmsg(lease.connection.handle());
+        return false;
+    }
+    int user_id = static_cast<int>(sqlite3_last_insert_rowid(lease.connection.handle()));
+    after_commit([this, user_id, username]() { directory.insert(user_id, username); });
+
+    log_debug() << "Registered user " << username;
+    return true;
+}
+
+bool ChatDatabase::authenticate_user(const std::string& username, const std::string& password) {
+    static const metrics::Histogram latency = call_latency("authenticate_user");
+    metrics::Timer timer(latency);
+    int user_id = -1;
+    std::string stored;
+    {
+        Lease lease = read_lease();
+        ScopedStatement stmt(statement(lease, AUTHENTICATE_USER));
+        if (!stmt) {
+            return false;
+        }
+
+        sqlite3_bind_text(stmt.get(), 1, username.c_str(), -1, SQLITE_STATIC);
+
+        if (sqlite3_step(stmt.get()) == SQLITE_ROW) {
+            user_id = sqlite3_column_int(stmt.get(), 0);
+            stored = column_string(stmt.get(), 1);
+        }
+    }
+
+    int iterations = password_iterations;
+    if (user_id == -1) {
+        password_hash::pbkdf2(password, "", iterations); // Same cost as a real check, so timing does not reveal usernames
+        return false;
+    }
+    if (!password_hash::verify(password, stored)) {
+        return false;
+    }
+
+    // Plaintext rows from before hashing, and hashes at an old cost, are rewritten now that the password is known
+    if (password_hash::needs_upgrade(stored, iterations)) {
+        std::string hashed = password_hash::hash(password, iterations);
+        Lease lease = write_lease();
+        ScopedStatement stmt(statement(lease, UPDATE_PASSWORD));
+        if (stmt && !hashed.empty()) {
+            sqlite3_bind_text(stmt.get(), 1, hashed.c_str(), -1, SQLITE_STATIC);
+            sqlite3_bind_int(stmt.get(), 2, user_id);
+            if (sqlite3_step(stmt.get()) != SQLITE_DONE) {
+                log_error() << "Failed to upgrade password hash: " << sqlite3_errmsg(lease.connection.handle());
+            }
+        }
+    }
+    return true;
+}
+
+int ChatDatabase::get_user_id(const std::string& username) {
+    if (directory.loaded()) {
+        return directory.id(username);
+    }
+
+    static const metrics::Histogram latency = call_latency("get_user_id");
+    metrics::Timer timer(latency);
+    Lease lease = read_lease();
+    ScopedStatement stmt(statement(lease, GET_USER_ID));
+    if (!stmt) {
+        return -1;
+    }
+
+    sqlite3_bind_text(stmt.get(), 1, username.c_str(), -1, SQLITE_STATIC);
+
+    int user_id = -1;
+    if (sqlite3_step(stmt.get()) == SQLITE_ROW) {
+        user_id = sqlite3_column_int(stmt.get(), 0);
+    }
+    return user_id;
+}
+
+std::string ChatDatabase::get_username(int user_id) {
+    if (directory.loaded()) {
+        return std::string(directory.name(user_id));
+    }
+
+    static const metrics::Histogram latency = call_latency("get_username");
+    metrics::Timer timer(latency);
+    Lease lease = read_lease();
+    ScopedStatement stmt(statement(lease, GET_USERNAME));
+    if (!stmt) {
+        return "";
+    }
+
+    sqlite3_bind_int(stmt.get(), 1, user_id);
+
+    std::string username = "";
+    if (sqlite3_step(stmt.get()) == SQLITE_ROW) {
+        username = column_string(stmt.get(), 0);
+    }
+    return username;
+}
+
+std::vector<std::string> ChatDatabase::get_usernames(const std::vector<int>& user_ids) {
+    std::vector<std::string> usernames;
+    usernames.reserve(user_ids.size());
+    if (directory.loaded()) {
+        for (int user_id : user_ids) {
+            usernames.emplace_back(directory.name(user_id));
+        }
+        return usernames;
+    }
+
+    // One lease and one statement for the whole list
+    static const metrics::Histogram latency = call_latency("get_usernames");
+    metrics::Timer timer(latency);
+    Lease lease = read_lease();
+    ScopedStatement stmt(statement(lease, GET_USERNAME));
+    for (int user_id : user_ids) {
+        usernames.emplace_back();
+        if (!stmt) {
+            continue;
+        }
+        sqlite3_bind_int(stmt.get(), 1, user_id);
+        if (sqlite3_step(stmt.get()) == SQLITE_ROW) {
+            usernames.back() = column_string(stmt.get(), 0);
+        }
+        sqlite3_reset(stmt.get());
+    }
+    return usernames;
+}
+
+const UserDirectory& ChatDatabase::users() const {
+    return directory;
+}
+
+// Group management functions
+bool ChatDatabase::create_group(const std::string& group_name) {
+    static const metrics::Histogram latency = call_latency("create_group");
+    metrics::Timer timer(latency);
+    // Input validation
+    if (group_name.empty()) {
+        log_warn() << "Group name cannot be empty";
+        return false;
+    }
+
+    if (group_name.length() > 100) { // Reasonable limit
+        log_warn() << "Group name too long (max 100 characters)";
+        return false;
+    }
+
+    Lease lease = write_lease();
+    ScopedStatement stmt(statement(lease, CREATE_GROUP));
+    if (!stmt) {
+        return false;
+    }
+
+    sqlite3_bind_text(stmt.get(), 1, group_name.c_str(), -1, SQLITE_STATIC);
+    int rc = sqlite3_step(stmt.get());
+
+    if (rc == SQLITE_CONSTRAINT) {
+        log_warn() << "Group '" << group_name << "' already exists";
+        return false;
+    } else if (rc != SQLITE_DONE) {
+        log_error() << "Failed to create group: " << sqlite3_errmsg(lease.connection.handle());
+        return false;
+    }
+
+    log_debug() << "Created group " << group_name;
+    return true;
+}
+
+bool ChatDatabase::add_user_to_group(int user_id, int group_id) {
+    static const metrics::Histogram latency = call_latency("add_user_to_group");
+    metrics::Timer timer(latency);
+    if (!insert_member(user_id, group_id)) {
+        return false;
+    }
+    after_commit([this, group_id, user_id]() { memberships.add(group_id, user_id); });
+    return true;
+}
+
+bool ChatDatabase::insert_member(int user_id, int group_id) {
+    Lease lease = write_lease();
+    ScopedStatement stmt(statement(lease, ADD_USER_TO_GROUP));
+    if (!stmt) {
+        return false;
+    }
+
+    sqlite3_bind_int(stmt.get(), 1, group_id);
+    sqlite3_bind_int(stmt.get(), 2, user_id);
+
+    if (sqlite3_step(stmt.get()) != SQLITE_DONE) {
+        log_error() << "Failed to add user to group";
+        return false;
+    }
+    return true;
+}
+
+std::vector<bool> ChatDatabase::add_users_to_group(int group_id, const std::vector<int>& user_ids) {
+    static const metrics::Histogram latency = call_latency("add_users_to_group");
+    metrics::Timer timer(latency);
+    std::vector<bool> added;
+    added.reserve(user_ids.size());
+    Transaction transaction(*this);
+    if (!transaction.active()) {
+        return std::vector<bool>(user_ids.size(), false);
+    }
+    // A rejected row (e.g. already a member) only aborts its own INSERT, the rest still commit
+    std::vector<int> joined;
+    for (int user_id : user_ids) {
+        added.push_back(insert_member(user_id, group_id));
+        if (added.back()) {
+            joined.push_back(user_id);
+        }
+    }
+    // One index update for the whole batch, instead of a snapshot copy per user
+    after_commit([this, group_id, joined = std::move(joined)]() { memberships.add_members(group_id, joined); });
+    if (!transaction.commit()) {
+        return std::vector<bool>(user_ids.size(), false);
+    }
+    return added;
+}
+
+bool ChatDatabase::remove_user_from_group(int user_id, int group_id) {
+    static const metrics::Histogram latency = call_latency("remove_user_from_group");
+    metrics::Timer timer(latency);
+    Lease lease = write_lease();
+    ScopedStatement stmt(statement(lease, REMOVE_USER_FROM_GROUP));
+    if (!stmt) {
+        return false;
+    }
+
+    sqlite3_bind_int(stmt.get(), 1, group_id);
+    sqlite3_bind_int(stmt.get(), 2, user_id);
+
+    if (sqlite3_step(stmt.get()) != SQLITE_DONE) {
+        log_error() << "Failed to remove user from group";
+        return false;
+    }
+    after_commit([this, group_id, user_id]() { memberships.remove(group_id, user_id); });
+    return true;
+}
+
+std::vector<int> ChatDatabase::get_user_groups(int user_id) {
+    if (memberships.loaded()) {
+        return *memberships.groups(user_id);
+    }
+
+    std::vector<int> groups;
+    static const metrics::Histogram latency = call_latency("get_user_groups");
+    metrics::Timer timer(latency);
+    Lease lease = read_lease();
+    ScopedStatement stmt(statement(lease, GET_USER_GROUPS));
+    if (!stmt) {
+        return groups;
+    }
+
+    sqlite3_bind_int(stmt.get(), 1, user_id);
+
+    while (sqlite3_step(stmt.get()) == SQLITE_ROW) {
+        groups.push_back(sqlite3_column_int(stmt.get(), 0));
+    }
+    return groups;
+}
+
+std::vector<int> ChatDatabase::get_group_members(int group_id) {
+    if (memberships.loaded()) {
+        return *memberships.members(group_id);
+    }
+
+    std::vector<int> members;
+    static const metrics::Histogram latency = call_latency("get_group_members");
+    metrics::Timer timer(latency);
+    Lease lease = read_lease();
+    ScopedStatement stmt(statement(lease, GET_GROUP_MEMBERS));
+    if (!stmt) {
+        return members;
+    }
+
+    sqlite3_bind_int(stmt.get(), 1, group_id);
+
+    while (sqlite3_step(stmt.get()) == SQLITE_ROW) {
+        members.push_back(sqlite3_column_int(stmt.get(), 0));
+    }
+    return members;
+}
+
+std::string ChatDatabase::get_group_name(int group_id) {
+    static const metrics::Histogram latency = call_latency("get_group_name");
+    metrics::Timer timer(latency);
+    Lease lease = read_lease();
+    ScopedStatement stmt(statement(lease, GET_GROUP_NAME));
+    if (!stmt) {
+        return "";
+    }
+
+    sqlite3_bind_int(stmt.get(), 1, group_id);
+
+    std::string group_name = "";
+    if (sqlite3_step(stmt.get()) == SQLITE_ROW) {
+        group_name = column_string(stmt.get(), 0);
+    }
+    return group_name;
+}
+
+Group ChatDatabase::get_group(int group_id) {
+    static const metrics::Histogram latency = call_latency("get_group");
+    metrics::Timer timer(latency);
+    std::string group_name = get_group_name(group_id);
+    if (group_name.empty()) {
+        return Group();
+    }
+    Group group(group_id, group_name);
+    group.members = MemberSet(get_group_members(group_id));
+    group.message_count = std::max(0, get_message_count_in_group(group_id));
+    return group;
+}
+
+const MembershipIndex& ChatDatabase::membership() const {
+    return memberships;
+}
+
+// Message management functions
+bool ChatDatabase::save_message(int sender_id, int group_id, const std::string& text, const std::string& file_path) {
+    return store_message(sender_id, group_id, text, file_path) != -1;
+}
+
+int ChatDatabase::store_message(int sender_id, int group_id, std::string_view text, std::string_view file_path) {
+    static const metrics::Histogram latency = call_latency("store_message");
+    metrics::Timer timer(latency);
+    Lease lease = write_lease();
+    ScopedStatement stmt(statement(lease, SAVE_MESSAGE));
+    if (!stmt) {
+        return -1;
+    }
+
+    sqlite3_bind_int(stmt.get(), 1, sender_id);
+    sqlite3_bind_int(stmt.get(), 2, group_id);
+    sqlite3_bind_text(stmt.get(), 3, text.data(), static_cast<int>(text.size()), SQLITE_STATIC);
+    sqlite3_bind_text(stmt.get(), 4, file_path.data(), static_cast<int>(file_path.size()), SQLITE_STATIC);
+    int64_t sent_at_ms = now_ms();
+    sqlite3_bind_int64(stmt.get(), 5, sent_at_ms);
+
+    if (sqlite3_step(stmt.get()) != SQLITE_DONE) {
+        log_error() << "Failed to save message";
+        return -1;
+    }
+    int message_id = static_cast<int>(sqlite3_last_insert_rowid(lease.connection.handle()));
+
+    after_commit([this, group_id, message_id]() { stats.message_added(group_id, message_id); });
+    if (recent.enabled()) {
+        MessageRecord message{message_id, sender_id, group_id, "", std::string(text), std::string(file_path), sent_at_ms};
+        after_commit([this, message]() { recent.append(message); });
+    }
+    return message_id;
+}
+
+std::vector<int> ChatDatabase::save_messages(const std::vector<MessageRecord>& messages) {
+    static const metrics::Histogram latency = call_latency("save_messages");
+    metrics::Timer timer(latency);
+    std::vector<int> message_ids;
+    message_ids.reserve(messages.size());
+    Transaction transaction(*this);
+    if (!transaction.active()) {
+        return std::vector<int>(messages.size(), -1);
+    }
+    for (const MessageRecord& message : messages) {
+        message_ids.push_back(store_message(message.sender_id, message.group_id, message.text, message.file_path));
+    }
+    if (!transaction.commit()) {
+        return std::vector<int>(messages.size(), -1);
+    }
+    return message_ids;
+}
+
+DatabaseExecutor& ChatDatabase::executor() {
+    std::lock_guard<std::mutex> lock(ingest_mutex);
+    if (!async) {
+        async.reset(new DatabaseExecutor(*this, static_cast<int>(readers.size())));
+    }
+    return *async;
+}
+
+MessageIngestQueue& ChatDatabase::ingest_queue() {
+    return ingest_queue(IngestOptions());
+}
+
+DatabaseExecutor* ChatDatabase::running_executor() {
+    std::lock_guard<std::mutex> lock(ingest_mutex);
+    return async.get();
+}
+
+MessageIngestQueue* ChatDatabase::running_ingest_queue() {
+    std::lock_guard<std::mutex> lock(ingest_mutex);
+    return ingest.get();
+}
+
+MessageLog* ChatDatabase::running_message_log() {
+    std::lock_guard<std::mutex> lock(ingest_mutex);
+    return wal.get();
+}
+
+MessageIngestQueue& ChatDatabase::ingest_queue(const IngestOptions& options) {
+    std::lock_guard<std::mutex> lock(ingest_mutex);
+    if (!ingest) {
+        ingest.reset(new MessageIngestQueue(*this, options));
+    }
+    return *ingest;
+}
+
+std::vector<std::pair<std::string, std::string>> ChatDatabase::get_group_messages(int group_id, int limit) {
+    std::vector<std::pair<std::string, std::string>> messages;
+    for (MessageRecord& record : get_group_messages_before(group_id, 0, limit)) {
+        messages.push_back({std::move(record.username), std::move(record.text)});
+    }
+    return messages;
+}
+
+std::vector<MessageRecord> ChatDatabase::get_group_messages_before(int group_id, int before_message_id, int limit) {
+    std::vector<MessageRecord> messages;
+    read_group_page(group_id, before_message_id, limit, messages);
+
+    // A short page means the hot table ran out; older history continues in the archive
+    if (static_cast<int>(messages.size()) < limit) {
+        int cursor = messages.empty() ? before_message_id : messages.back().message_id;
+        archived.read_group_page(group_id, cursor, limit - static_cast<int>(messages.size()), messages);
+    }
+
+    // Rows carry only the sender id; names come from the interned directory
+    for (MessageRecord& message : messages) {
+        message.username = get_username(message.sender_id);
+    }
+    return messages;
+}
+
+void ChatDatabase::read_group_page(int group_id, int before_message_id, int limit, std::vector<MessageRecord>& messages) {
+    if (!recent.enabled()) {
+        query_group_messages(group_id, before_message_id, limit, messages);
+        return;
+    }
+    if (recent.lookup(group_id, before_message_id, limit, messages)) {
+        return;
+    }
+
+    // Only a miss on the newest page loads the group, older pages go straight to SQLite
+    int capacity = static_cast<int>(recent.messages_per_group());
+    if (before_message_id > 0 || limit > capacity) {
+        query_group_messages(group_id, before_message_id, limit, messages);
+        return;
+    }
+
+    uint64_t token = recent.begin_fill(group_id);
+    if (!query_group_messages(group_id, 0, capacity, messages)) {
+        recent.cancel_fill(group_id);
+        messages.clear();
+        return;
+    }
+    recent.fill(group_id, token, messages, static_cast<int>(messages.size()) < capacity);
+    if (static_cast<int>(messages.size()) > limit) {
+        messages.resize(std::max(limit, 0));
+    }
+}
+
+RecentCacheStats ChatDatabase::recent_cache_stats() {
+    return recent.stats();
+}
+
+bool ChatDatabase::query_group_messages(int group_id, int before_message_id, int limit, std::vector<MessageRecord>& messages) {
+    // Timed here rather than in get_group_messages_before, so recent-cache hits stay out of the histogram
+    static const metrics::Histogram latency = call_latency("get_group_messages_before");
+    metrics::Timer timer(latency);
+    Lease lease = read_lease();
+    ScopedStatement stmt(statement(lease, GET_GROUP_MESSAGES_BEFORE));
+    if (!stmt) {
+        return false;
+    }
+
+    // Walks idx_messages_group_history backwards from the cursor, so the cost
+    // depends on the page size and not on how deep the cursor is
+    sqlite3_bind_int(stmt.get(), 1, group_id);
+    sqlite3_bind_int64(stmt.get(), 2, before_message_id > 0 ? before_message_id : INT64_MAX);
+    sqlite3_bind_int(stmt.get(), 3, limit);
+
+    int rc;
+    while ((rc = sqlite3_step(stmt.get())) == SQLITE_ROW) {
+        MessageRecord message;
+        message.message_id = sqlite3_column_int(stmt.get(), 0);
+        message.sender_id = sqlite3_column_int(stmt.get(), 1);
+        message.group_id = group_id;
+        message.text = column_string(stmt.get(), 2);
+        message.file_path = column_string(stmt.get(), 3);
+        message.sent_at_ms = sqlite3_column_int64(stmt.get(), 4);
+        messages.push_back(std::move(message));
+    }
+    return rc == SQLITE_DONE;
+}
+
+// Group-Message relationship functions
+std::vector<int> ChatDatabase::get_group_message_ids(int group_id) {
+    static const metrics::Histogram latency = call_latency("get_group_message_ids");
+    metrics::Timer timer(latency);
+    std::vector<int> message_ids;
+    Lease lease = read_lease();
+    ScopedStatement stmt(statement(lease, GET_GROUP_MESSAGE_IDS));
+    if (!stmt) {
+        return message_ids;
+    }
+
+    sqlite3_bind_int(stmt.get(), 1, group_id);
+
+    while (sqlite3_step(stmt.get()) == SQLITE_ROW) {
+        message_ids.push_back(sqlite3_column_int(stmt.get(), 0));
+    }
+    archived.get_group_message_ids(group_id, message_ids); // Every archived id is below every hot one
+    return message_ids;
+}
+
+bool ChatDatabase::remove_message_from_group(int message_id, int group_id) {
+    static const metrics::Histogram latency = call_latency("remove_message_from_group");
+    metrics::Timer timer(latency);
+    Lease lease = write_lease();
+    ScopedStatement stmt(statement(lease, REMOVE_MESSAGE_FROM_GROUP));
+    if (!stmt) {
+        return false;
+    }
+
+    sqlite3_bind_int(stmt.get(), 1, message_id);
+    sqlite3_bind_int(stmt.get(), 2, group_id);
+
+    if (sqlite3_step(stmt.get()) != SQLITE_DONE) {
+        log_error() << "Failed to remove message from group";
+        return false;
+    }
+    if (sqlite3_changes(lease.connection.handle()) == 0) {
+        return true; // Not in that group; nothing to invalidate or count
+    }
+    after_commit([this, group_id, message_id]() {
+        recent.invalidate(group_id);
+        stats.message_removed(group_id, message_id);
+    });
+    return true;
+}
+
+int ChatDatabase::get_message_group_id(int message_id) {
+    static const metrics::Histogram latency = call_latency("get_message_group_id");
+    metrics::Timer timer(latency);
+    Lease lease = read_lease();
+    ScopedStatement stmt(statement(lease, GET_MESSAGE_GROUP_ID));
+    if (!stmt) {
+        return -1;
+    }
+
+    sqlite3_bind_int(stmt.get(), 1, message_id);
+
+    int group_id = -1;
+    MessageRecord message;
+    if (sqlite3_step(stmt.get()) == SQLITE_ROW) {
+        group_id = sqlite3_column_int(stmt.get(), 0);
+    } else if (archived.find_message(message_id, message)) {
+        group_id = message.group_id;
+    }
+    return group_id;
+}
+
+int ChatDatabase::get_message_file(int message_id, std::string& file_path) {
+    static const metrics::Histogram latency = call_latency("get_message_file");
+    metrics::Timer timer(latency);
+    file_path.clear();
+    Lease lease = read_lease();
+    ScopedStatement stmt(statement(lease, GET_MESSAGE_FILE));
+    if (!stmt) {
+        return -1;
+    }
+
+    sqlite3_bind_int(stmt.get(), 1, message_id);
+
+    int group_id = -1;
+    MessageRecord message;
+    if (sqlite3_step(stmt.get()) == SQLITE_ROW) {
+        group_id = sqlite3_column_int(stmt.get(), 0);
+        file_path = column_string(stmt.get(), 1);
+    } else if (archived.find_message(message_id, message)) {
+        group_id = message.group_id;
+        file_path = std::move(message.file_path);
+    }
+    return group_id;
+}
+
+int ChatDatabase::get_message_count_in_group(int group_id) {
+    if (stats.loaded()) {
+        return stats.counter(group_id).message_count;
+    }
+
+    static const metrics::Histogram latency = call_latency("get_message_count_in_group");
+    metrics::Timer timer(latency);
+    Lease lease = read_lease();
+    ScopedStatement stmt(statement(lease, GET_MESSAGE_COUNT_IN_GROUP));
+    if (!stmt) {
+        return -1;
+    }
+
+    sqlite3_bind_int(stmt.get(), 1, group_id);
+
+    int count = 0;
+    if (sqlite3_step(stmt.get()) == SQLITE_ROW) {
+        count = sqlite3_column_int(stmt.get(), 0);
+    }
+    return count;
+}
+
+MessageLog& ChatDatabase::message_log() {
+    std::lock_guard<std::mutex> lock(ingest_mutex);
+    if (!wal) {
+        wal.reset(new MessageLog(*this));
+    }
+    return *wal;
+}
+
+int ChatDatabase::reserve_message_ids(int count, int& reserved) {
+    reserved = 0;
+    Transaction transaction(*this);
+    if (count < 1 || !transaction.active()) {
+        return -1;
+    }
+    int first_id = -1;
+    {
+        Lease lease = write_lease();
+        ScopedStatement sequence_stmt(statement(lease, GET_MESSAGE_SEQUENCE));
+        ScopedStatement insert_stmt(statement(lease, SAVE_MESSAGE_SEQUENCE));
+        ScopedStatement update_stmt(statement(lease, UPDATE_MESSAGE_SEQUENCE));
+        if (!sequence_stmt || !insert_stmt || !update_stmt) {
+            return -1;
+        }
+        // No row yet means no message was ever stored
+        bool exists = sqlite3_step(sequence_stmt.get()) == SQLITE_ROW;
+        int64_t seq = exists ? sqlite3_column_int64(sequence_stmt.get(), 0) : 0;
+        // A block never crosses the end of the file's slice, where the shard trigger would refuse its ids
+        count = static_cast<int>(std::min<int64_t>(count, max_message_id - seq));
+        if (count < 1) {
+            log_error() << "Message ids of " << db_name << " are used up";
+            return -1;
+        }
+        sqlite3_stmt* save = exists ? update_stmt.get() : insert_stmt.get();
+        sqlite3_bind_int64(save, 1, seq + count);
+        if (sqlite3_step(save) != SQLITE_DONE) {
+            log_error() << "Failed to reserve message ids: " << sqlite3_errmsg(lease.connection.handle());
+            return -1;
+        }
+        first_id = static_cast<int>(seq + 1);
+    }
+    if (!transaction.commit()) {
+        return -1;
+    }
+    reserved = count;
+    return first_id;
+}
+
+bool ChatDatabase::insert_message(const MessageRecord& message) {
+    static const metrics::Histogram latency = call_latency("insert_message");
+    metrics::Timer timer(latency);
+    Lease lease = write_lease();
+    ScopedStatement stmt(statement(lease, INSERT_MESSAGE));
+    if (!stmt) {
+        return false;
+    }
+
+    sqlite3_bind_int(stmt.get(), 1, message.message_id);
+    sqlite3_bind_int(stmt.get(), 2, message.sender_id);
+    sqlite3_bind_int(stmt.get(), 3, message.group_id);
+    sqlite3_bind_text(stmt.get(), 4, message.text.data(), static_cast<int>(message.text.size()), SQLITE_STATIC);
+    sqlite3_bind_text(stmt.get(), 5, message.file_path.data(), static_cast<int>(message.file_path.size()), SQLITE_STATIC);
+    sqlite3_bind_int64(stmt.get(), 6, message.sent_at_ms);
+
+    if (sqlite3_step(stmt.get()) != SQLITE_DONE) {
+        log_error() << "Failed to insert message " << message.message_id << ": " << sqlite3_errmsg(lease.connection.handle());
+        return false;
+    }
+    if (sqlite3_changes(lease.connection.handle()) == 0) {
+        return true; // Stored before, e.g. by a replay that was cut short
+    }
+
+    int group_id = message.group_id;
+    int message_id = message.message_id;
+    after_commit([this, group_id, message_id]() { stats.message_added(group_id, message_id); });
+    if (recent.enabled()) {
+        MessageRecord cached = message;
+        cached.username.clear();
+        after_commit([this, cached]() { recent.append(cached); });
+    }
+    return true;
+}
+
+int ChatDatabase::message_log_checkpoint() {
+    Lease lease = write_lease();
+    ScopedStatement stmt(statement(lease, GET_LOG_CHECKPOINT));
+    if (!stmt) {
+        return -1;
+    }
+    int rc = sqlite3_step(stmt.get());
+    if (rc == SQLITE_ROW) {
+        return sqlite3_column_int(stmt.get(), 0);
+    }
+    return rc == SQLITE_DONE ? 0 : -1;
+}
+
+bool ChatDatabase::save_message_log_checkpoint(int message_id) {
+    Lease lease = write_lease();
+    ScopedStatement stmt(statement(lease, SAVE_LOG_CHECKPOINT));
+    if (!stmt) {
+        return false;
+    }
+    sqlite3_bind_int(stmt.get(), 1, message_id);
+    if (sqlite3_step(stmt.get()) != SQLITE_DONE) {
+        log_error() << "Failed to save message log checkpoint: " << sqlite3_errmsg(lease.connection.handle());
+        return false;
+    }
+    return true;
+}
+
+bool ChatDatabase::park_rejected_message(const MessageRecord& message) {
+    Lease lease = write_lease();
+    ScopedStatement stmt(statement(lease, PARK_REJECTED_MESSAGE));
+    if (!stmt) {
+        return false;
+    }
+
+    sqlite3_bind_int(stmt.get(), 1, message.message_id);
+    sqlite3_bind_int(stmt.get(), 2, message.sender_id);
+    sqlite3_bind_int(stmt.get(), 3, message.group_id);
+    sqlite3_bind_text(stmt.get(), 4, message.text.data(), static_cast<int>(message.text.size()), SQLITE_STATIC);
+    sqlite3_bind_text(stmt.get(), 5, message.file_path.data(), static_cast<int>(message.file_path.size()), SQLITE_STATIC);
+    sqlite3_bind_int64(stmt.get(), 6, message.sent_at_ms);
+
+    if (sqlite3_step(stmt.get()) != SQLITE_DONE) {
+        log_error() << "Failed to park message " << message.message_id << ": " << sqlite3_errmsg(lease.connection.handle());
+        return false;
+    }
+    return true;
+}
+
+bool ChatDatabase::save_failed_log_range(int first_message_id, int last_message_id) {
+    Lease lease = write_lease();
+    ScopedStatement stmt(statement(lease, SAVE_FAILED_LOG_RANGE));
+    if (!stmt) {
+        return false;
+    }
+    sqlite3_bind_int(stmt.get(), 1, first_message_id);
+    sqlite3_bind_int(stmt.get(), 2, last_message_id);
+    if (sqlite3_step(stmt.get()) != SQLITE_DONE) {
+        log_error() << "Failed to save failed log range: " << sqlite3_errmsg(lease.connection.handle());
+        return false;
+    }
+    return true;
+}
+
+bool ChatDatabase::failed_log_ranges(std::vector<std::pair<int, int>>& ranges) {
+    Lease lease = write_lease();
+    ScopedStatement stmt(statement(lease, GET_FAILED_LOG_RANGES));
+    if (!stmt) {
+        return false;
+    }
+    int rc;
+    while ((rc = sqlite3_step(stmt.get())) == SQLITE_ROW) {
+        ranges.emplace_back(sqlite3_column_int(stmt.get(), 0), sqlite3_column_int(stmt.get(), 1));
+    }
+    return rc == SQLITE_DONE;
+}
+
+bool ChatDatabase::clear_failed_log_ranges() {
+    return run(CLEAR_FAILED_LOG_RANGES);
+}
+
+// Read markers and unread counts
+bool ChatDatabase::mark_read(int user_id, int group_id, int message_id) {
+    static const metrics::Histogram latency = call_latency("mark_read");
+    metrics::Timer timer(latency);
+    Transaction transaction(*this);
+    if (!transaction.active()) {
+        return false;
+    }
+
+    // The counter plus the few messages newer than the marker, so marking an
+    // old message read does not count the whole group
+    GroupStats::ReadMarker marker{message_id, 0};
+    {
+        Lease lease = write_lease();
+        ScopedStatement count_stmt(statement(lease, GET_MESSAGE_COUNT_IN_GROUP));
+        ScopedStatement newer_stmt(statement(lease, COUNT_MESSAGES_AFTER));
+        ScopedStatement save_stmt(statement(lease, SAVE_READ_MARKER));
+        if (!count_stmt || !newer_stmt || !save_stmt) {
+            return false;
+        }
+
+        sqlite3_bind_int(count_stmt.get(), 1, group_id);
+        int total = sqlite3_step(count_stmt.get()) == SQLITE_ROW ? sqlite3_column_int(count_stmt.get(), 0) : 0;
+        sqlite3_bind_int(newer_stmt.get(), 1, group_id);
+        sqlite3_bind_int(newer_stmt.get(), 2, message_id);
+        if (sqlite3_step(newer_stmt.get()) != SQLITE_ROW) {
+            log_error() << "Failed to count unread messages: " << sqlite3_errmsg(lease.connection.handle());
+            return false;
+        }
+        int newer = sqlite3_column_int(newer_stmt.get(), 0) + archived.count_after(group_id, message_id);
+        marker.read_count = std::max(0, total - newer);
+
+        sqlite3_bind_int(save_stmt.get(), 1, user_id);
+        sqlite3_bind_int(save_stmt.get(), 2, group_id);
+        sqlite3_bind_int(save_stmt.get(), 3, marker.last_read_message_id);
+        sqlite3_bind_int(save_stmt.get(), 4, marker.read_count);
+        if (sqlite3_step(save_stmt.get()) != SQLITE_DONE) {
+            log_error() << "Failed to save read marker";
+            return false;
+        }
+    }
+    after_commit([this, user_id, group_id, marker]() { stats.mark_read(user_id, group_id, marker); });
+    return transaction.commit();
+}
+
+std::vector<std::pair<int, int>> ChatDatabase::get_unread_counts(int user_id) {
+    std::vector<std::pair<int, int>> counts;
+    if (memberships.loaded() && stats.loaded()) {
+        MembershipIndex::IdList groups = memberships.groups(user_id);
+        counts.reserve(groups->size());
+        for (int group_id : *groups) {
+            counts.emplace_back(group_id, stats.unread_count(user_id, group_id));
+        }
+        return counts;
+    }
+
+    static const metrics::Histogram latency = call_latency("get_unread_counts");
+    metrics::Timer timer(latency);
+    Lease lease = read_lease();
+    ScopedStatement stmt(statement(lease, GET_UNREAD_COUNTS));
+    if (!stmt) {
+        return counts;
+    }
+
+    sqlite3_bind_int(stmt.get(), 1, user_id);
+
+    while (sqlite3_step(stmt.get()) == SQLITE_ROW) {
+        counts.emplace_back(sqlite3_column_int(stmt.get(), 0), sqlite3_column_int(stmt.get(), 1));
+    }
+    return counts;
+}
+
+// Message search
+std::vector<MessageRecord> ChatDatabase::search_messages(int group_id, const std::string& query, int limit) {
+    static const metrics::Histogram latency = call_latency("search_messages");
+    metrics::Timer timer(latency);
+    std::vector<MessageRecord> messages;
+    std::string expression = message_search::expression(group_id, query);
+    if (expression.empty() || limit <= 0) {
+        return messages;
+    }
+
+    Lease lease = read_lease();
+    ScopedStatement stmt(statement(lease, SEARCH_MESSAGES));
+    if (!stmt) {
+        return messages;
+    }
+
+    sqlite3_bind_text(stmt.get(), 1, expression.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_int(stmt.get(), 2, limit);
+    sqlite3_bind_int(stmt.get(), 3, group_id);
+
+    int rc;
+    while ((rc = sqlite3_step(stmt.get())) == SQLITE_ROW) {
+        MessageRecord message;
+        message.message_id = sqlite3_column_int(stmt.get(), 0);
+        message.sender_id = sqlite3_column_int(stmt.get(), 1);
+        message.group_id = group_id;
+        message.username = get_username(message.sender_id);
+        message.text = column_string(stmt.get(), 2);
+        message.file_path = column_string(stmt.get(), 3);
+        message.sent_at_ms = sqlite3_column_int64(stmt.get(), 4);
+        messages.push_back(std::move(message));
+    }
+    if (rc != SQLITE_DONE) {
+        log_error() << "Failed to search messages: " << sqlite3_errmsg(lease.connection.handle());
+    }
+    return messages;
+}
+
+bool ChatDatabase::merge_search_index(int pages) {
+    static const metrics::Histogram latency = call_latency("merge_search_index");
+    metrics::Timer timer(latency);
+    Lease lease = write_lease();
+    ScopedStatement stmt(statement(lease, MERGE_SEARCH_INDEX));
+    if (!stmt) {
+        return false;
+    }
+
+    sqlite3_bind_int(stmt.get(), 1, pages);
+
+    // FTS5 reports a merge that found nothing to do as fewer than two changes
+    int before = sqlite3_total_changes(lease.connection.handle());
+    if (sqlite3_step(stmt.get()) != SQLITE_DONE) {
+        log_error() << "Failed to merge search index: " << sqlite3_errmsg(lease.connection.handle());
+        return false;
+    }
+    return sqlite3_total_changes(lease.connection.handle()) - before >= 2;
+}
+
+// Cold history
+int ChatDatabase::archive_messages(int64_t before_ms) {
+    if (!archived.enabled()) {
+        log_error() << "A memory database cannot be archived";
+        return -1;
+    }
+
+    // One partition per month, oldest first, split on message_id so that
+    // partitions never overlap even if the clock stepped back
+    int moved = 0;
+    for (;;) {
+        int first_message_id;
+        int end_message_id = INT_MAX;
+        std::string month;
+        {
+            Lease lease = write_lease();
+            ScopedStatement oldest_stmt(statement(lease, GET_OLDEST_MESSAGE));
+            ScopedStatement since_stmt(statement(lease, GET_FIRST_MESSAGE_SINCE));
+            if (!oldest_stmt || !since_stmt) {
+                return -1;
+            }
+            if (sqlite3_step(oldest_stmt.get()) != SQLITE_ROW || sqlite3_column_int64(oldest_stmt.get(), 1) >= before_ms) {
+                break;
+            }
+            first_message_id = sqlite3_column_int(oldest_stmt.get(), 0);
+
+            int64_t month_start_ms, month_end_ms;
+            month = utc_month(sqlite3_column_int64(oldest_stmt.get(), 1), month_start_ms, month_end_ms);
+            sqlite3_bind_int64(since_stmt.get(), 1, std::min(month_end_ms, before_ms));
+            if (sqlite3_step(since_stmt.get()) == SQLITE_ROW && sqlite3_column_type(since_stmt.get(), 0) != SQLITE_NULL) {
+                end_message_id = sqlite3_column_int(since_stmt.get(), 0);
+            }
+        }
+
+        int count = archive_month(month, first_message_id, end_message_id);
+        if (count < 0) {
+            return -1;
+        }
+        moved += count;
+    }
+
+    // Deletes only add tombstones to the search index until its segments are
+    // merged; after that, give the freed pages back so the hot file is only
+    // what is still hot
+    if (moved > 0) {
+        Lease lease = write_lease();
+        lease.connection.execute("INSERT INTO MessageSearch (MessageSearch) VALUES ('optimize');"
+                                 "VACUUM; PRAGMA wal_checkpoint(TRUNCATE);", "Failed to compact the database");
+    }
+    return moved;
+}
+
+int ChatDatabase::archive_month(const std::string& month, int first_message_id, int end_message_id) {
+    std::string file = month + "." + std::to_string(first_message_id) + ".db";
+    MessageArchive::Writer partition(archived, file);
+    PartitionInfo info;
+    {
+        Lease lease = write_lease();
+        ScopedStatement stmt(statement(lease, READ_MESSAGES_BEFORE_ID));
+        if (!stmt || !partition.is_open()) {
+            return -1;
+        }
+
+        sqlite3_bind_int(stmt.get(), 1, end_message_id);
+
+        int rc;
+        MessageRecord message;
+        while ((rc = sqlite3_step(stmt.get())) == SQLITE_ROW) {
+            message.message_id = sqlite3_column_int(stmt.get(), 0);
+            message.sender_id = sqlite3_column_int(stmt.get(), 1);
+            message.group_id = sqlite3_column_int(stmt.get(), 2);
+            message.text = column_string(stmt.get(), 3);
+            message.file_path = column_string(stmt.get(), 4);
+            message.sent_at_ms = sqlite3_column_int64(stmt.get(), 5);
+            if (!partition.add(message)) {
+                return -1;
+            }
+        }
+        if (rc != SQLITE_DONE) {
+            log_error() << "Failed to read messages to archive: " << sqlite3_errmsg(lease.connection.handle());
+            return -1;
+        }
+    }
+    if (!partition.finish(info)) {
+        return -1;
+    }
+    info.month = month;
+
+    // The sealed file is complete before the hot rows go, so a failure here
+    // leaves only an unreferenced file behind
+    Transaction transaction(*this);
+    bool stored = transaction.active() && run(BEGIN_ARCHIVING);
+    if (stored) {
+        Lease lease = write_lease();
+        ScopedStatement delete_stmt(statement(lease, DELETE_MESSAGES_BEFORE_ID));
+        ScopedStatement save_stmt(statement(lease, SAVE_PARTITION));
+        stored = delete_stmt && save_stmt;
+        if (stored) {
+            sqlite3_bind_int(delete_stmt.get(), 1, end_message_id);
+            sqlite3_bind_text(save_stmt.get(), 1, info.file.c_str(), -1, SQLITE_STATIC);
+            sqlite3_bind_text(save_stmt.get(), 2, info.month.c_str(), -1, SQLITE_STATIC);
+            sqlite3_bind_int(save_stmt.get(), 3, info.first_message_id);
+            sqlite3_bind_int(save_stmt.get(), 4, info.last_message_id);
+            sqlite3_bind_int(save_stmt.get(), 5, info.message_count);
+            stored = sqlite3_step(delete_stmt.get()) == SQLITE_DONE &&
+                     sqlite3_changes(lease.connection.handle()) == info.message_count &&
+                     sqlite3_step(save_stmt.get()) == SQLITE_DONE;
+        }
+    }
+    if (!stored || !run(END_ARCHIVING) || !transaction.commit()) {
+        log_error() << "Failed to archive " << month << ": " << sqlite3_errmsg(writer->handle());
+        unlink((archived.directory() + "/" + file).c_str());
+        return -1;
+    }
+    // Cached pages need no invalidation: the messages only moved
+    if (!archived.open(info)) {
+        return -1;
+    }
+    return info.message_count;
+}
+
+const MessageArchive& ChatDatabase::archive() const {
+    return archived;
+}
+
+// Shared handles, one per database file
+namespace {
+std::mutex registry_mutex;
+std::unordered_map<std::string, std::unique_ptr<ChatDatabase>>& registry() {
+    static std::unordered_map<std::string, std::unique_ptr<ChatDatabase>> databases;
+    return databases;
+}
+} // namespace
+
+ChatDatabase* get_database(const std::string& db_name) {
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    std::unique_ptr<ChatDatabase>& database = registry()[db_name];
+    if (!database || !database->is_open()) {
+        database.reset(new ChatDatabase(db_name));
+        if (!database->is_open()) {
+            database.reset();
+            return nullptr;
+        }
+    }
+    return database.get();
+}
+
+void close_database(const std::string& db_name) {
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    registry().erase(db_name);
+}
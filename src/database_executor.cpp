@@ -0,0 +1,212 @@
+#include "../include/database_executor.h"
+#include "../include/chat_database.h"
+#include "../include/metrics.h"
+#include <algorithm>
+
+namespace {
+
+const metrics::Gauge queued_reads("chat_db_executor_queued_jobs", "Jobs waiting for a database executor thread", "lane=\"read\"");
+const metrics::Gauge queued_writes("chat_db_executor_queued_jobs", "Jobs waiting for a database executor thread", "lane=\"write\"");
+
+} // namespace
+
+DatabaseExecutor::DatabaseExecutor(ChatDatabase& database, int read_threads) : database(database) {
+    for (int i = 0; i < std::max(1, read_threads); ++i) {
+        reads.threads.emplace_back(&DatabaseExecutor::run, this, std::ref(reads));
+    }
+    writes.threads.emplace_back(&DatabaseExecutor::run, this, std::ref(writes));
+}
+
+DatabaseExecutor::~DatabaseExecutor() {
+    // Reads first, so writes their callbacks queue still reach the writer thread
+    stop(reads);
+    stop(writes);
+}
+
+void DatabaseExecutor::push(Lane& lane, Job job) {
+    {
+        std::lock_guard<std::mutex> lock(lane.mutex);
+        if (!lane.stopping) {
+            lane.jobs.push_back(std::move(job));
+            ++lane.submitted;
+            (&lane == &reads ? queued_reads : queued_writes).add(1);
+            lane.ready.notify_one();
+            return;
+        }
+    }
+    job(); // Shutting down; nothing would ever pick it up
+}
+
+void DatabaseExecutor::run(Lane& lane) {
+    std::unique_lock<std::mutex> lock(lane.mutex);
+    while (true) {
+        lane.ready.wait(lock, [&lane]() { return lane.stopping || !lane.jobs.empty(); });
+        if (lane.jobs.empty()) {
+            return; // Stopping with nothing left to run
+        }
+        Job job = std::move(lane.jobs.front());
+        lane.jobs.pop_front();
+        (&lane == &reads ? queued_reads : queued_writes).add(-1);
+        lock.unlock();
+        job();
+        job = nullptr; // Captures are released before the job counts as finished
+        lock.lock();
+        ++lane.finished;
+        lane.drained.notify_all();
+    }
+}
+
+void DatabaseExecutor::wait(Lane& lane) {
+    std::unique_lock<std::mutex> lock(lane.mutex);
+    uint64_t target = lane.submitted;
+    lane.drained.wait(lock, [&lane, target]() { return lane.finished >= target; });
+}
+
+void DatabaseExecutor::stop(Lane& lane) {
+    {
+        std::lock_guard<std::mutex> lock(lane.mutex);
+        lane.stopping = true;
+    }
+    lane.ready.notify_all();
+    for (std::thread& thread : lane.threads) {
+        thread.join();
+    }
+    lane.threads.clear();
+}
+
+void DatabaseExecutor::flush() {
+    // A read's callback may queue a write and the reverse, so repeat until both are idle
+    while (true) {
+        wait(reads);
+        wait(writes);
+        std::lock_guard<std::mutex> read_lock(reads.mutex);
+        std::lock_guard<std::mutex> write_lock(writes.mutex);
+        if (reads.finished == reads.submitted && writes.finished == writes.submitted) {
+            return;
+        }
+    }
+}
+
+size_t DatabaseExecutor::pending_reads() const {
+    std::lock_guard<std::mutex> lock(reads.mutex);
+    return reads.jobs.size();
+}
+
+size_t DatabaseExecutor::pending_writes() const {
+    std::lock_guard<std::mutex> lock(writes.mutex);
+    return writes.jobs.size();
+}
+
+size_t DatabaseExecutor::read_thread_count() const {
+    return reads.threads.size();
+}
+
+// User management
+std::future<bool> DatabaseExecutor::register_user(std::string username, std::string password) {
+    return write([username = std::move(username), password = std::move(password)](ChatDatabase& db) {
+        return db.register_user(username, password);
+    });
+}
+
+std::future<bool> DatabaseExecutor::authenticate_user(std::string username, std::string password) {
+    // May rewrite an outdated hash, which the writer connection serializes on its own
+    return read([username = std::move(username), password = std::move(password)](ChatDatabase& db) {
+        return db.authenticate_user(username, password);
+    });
+}
+
+std::future<int> DatabaseExecutor::get_user_id(std::string username) {
+    return read([username = std::move(username)](ChatDatabase& db) { return db.get_user_id(username); });
+}
+
+std::future<std::string> DatabaseExecutor::get_username(int user_id) {
+    return read([user_id](ChatDatabase& db) { return db.get_username(user_id); });
+}
+
+std::future<std::vector<std::string>> DatabaseExecutor::get_usernames(std::vector<int> user_ids) {
+    return read([user_ids = std::move(user_ids)](ChatDatabase& db) { return db.get_usernames(user_ids); });
+}
+
+// Group management
+std::future<bool> DatabaseExecutor::create_group(std::string group_name) {
+    return write([group_name = std::move(group_name)](ChatDatabase& db) { return db.create_group(group_name); });
+}
+
+std::future<bool> DatabaseExecutor::add_user_to_group(int user_id, int group_id) {
+    return write([user_id, group_id](ChatDatabase& db) { return db.add_user_to_group(user_id, group_id); });
+}
+
+std::future<std::vector<bool>> DatabaseExecutor::add_users_to_group(int group_id, std::vector<int> user_ids) {
+    return write([group_id, user_ids = std::move(user_ids)](ChatDatabase& db) {
+        return db.add_users_to_group(group_id, user_ids);
+    });
+}
+
+std::future<bool> DatabaseExecutor::remove_user_from_group(int user_id, int group_id) {
+    return write([user_id, group_id](ChatDatabase& db) { return db.remove_user_from_group(user_id, group_id); });
+}
+
+std::future<std::vector<int>> DatabaseExecutor::get_user_groups(int user_id) {
+    return read([user_id](ChatDatabase& db) { return db.get_user_groups(user_id); });
+}
+
+std::future<std::vector<int>> DatabaseExecutor::get_group_members(int group_id) {
+    return read([group_id](ChatDatabase& db) { return db.get_group_members(group_id); });
+}
+
+std::future<std::string> DatabaseExecutor::get_group_name(int group_id) {
+    return read([group_id](ChatDatabase& db) { return db.get_group_name(group_id); });
+}
+
+// Message management
+std::future<bool> DatabaseExecutor::save_message(int sender_id, int group_id, std::string text, std::string file_path) {
+    return write([sender_id, group_id, text = std::move(text), file_path = std::move(file_path)](ChatDatabase& db) {
+        return db.save_message(sender_id, group_id, text, file_path);
+    });
+}
+
+std::future<std::vector<int>> DatabaseExecutor::save_messages(std::vector<MessageRecord> messages) {
+    return write([messages = std::move(messages)](ChatDatabase& db) { return db.save_messages(messages); });
+}
+
+std::future<std::vector<std::pair<std::string, std::string>>> DatabaseExecutor::get_group_messages(int group_id, int limit) {
+    return read([group_id, limit](ChatDatabase& db) { return db.get_group_messages(group_id, limit); });
+}
+
+std::future<std::vector<MessageRecord>> DatabaseExecutor::get_group_messages_before(int group_id, int before_message_id, int limit) {
+    return read([group_id, before_message_id, limit](ChatDatabase& db) {
+        return db.get_group_messages_before(group_id, before_message_id, limit);
+    });
+}
+
+std::future<std::vector<MessageRecord>> DatabaseExecutor::search_messages(int group_id, std::string query, int limit) {
+    return read([group_id, query = std::move(query), limit](ChatDatabase& db) {
+        return db.search_messages(group_id, query, limit);
+    });
+}
+
+// Group-Message relationship functions
+std::future<std::vector<int>> DatabaseExecutor::get_group_message_ids(int group_id) {
+    return read([group_id](ChatDatabase& db) { return db.get_group_message_ids(group_id); });
+}
+
+std::future<bool> DatabaseExecutor::remove_message_from_group(int message_id, int group_id) {
+    return write([message_id, group_id](ChatDatabase& db) { return db.remove_message_from_group(message_id, group_id); });
+}
+
+std::future<int> DatabaseExecutor::get_message_group_id(int message_id) {
+    return read([message_id](ChatDatabase& db) { return db.get_message_group_id(message_id); });
+}
+
+std::future<int> DatabaseExecutor::get_message_count_in_group(int group_id) {
+    return read([group_id](ChatDatabase& db) { return db.get_message_count_in_group(group_id); });
+}
+
+// Read markers
+std::future<bool> DatabaseExecutor::mark_read(int user_id, int group_id, int message_id) {
+    return write([user_id, group_id, message_id](ChatDatabase& db) { return db.mark_read(user_id, group_id, message_id); });
+}
+
+std::future<std::vector<std::pair<int, int>>> DatabaseExecutor::get_unread_counts(int user_id) {
+    return read([user_id](ChatDatabase& db) { return db.get_unread_counts(user_id); });
+}
@@ -0,0 +1,94 @@
+#include "../include/db_connection.h"
+#include "../include/logger.h"
+#include <sqlite3.h>
+
+DbConnection::DbConnection(const std::string& path, bool read_only, const DatabaseTuning& tuning) : db(nullptr) {
+    int flags = SQLITE_OPEN_NOMUTEX | SQLITE_OPEN_URI;
+    flags |= read_only ? SQLITE_OPEN_READONLY : (SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE);
+
+    int rc = sqlite3_open_v2(path.c_str(), &db, flags, nullptr);
+    if (rc) {
+        log_error() << "Can't open database: " << sqlite3_errmsg(db);
+        sqlite3_close(db);
+        db = nullptr;
+        return;
+    }
+
+    sqlite3_busy_timeout(db, tuning.busy_timeout_ms);
+
+    std::string pragmas = "PRAGMA mmap_size = " + std::to_string(tuning.mmap_size) + ";"
+                          "PRAGMA cache_size = -" + std::to_string(tuning.cache_size_kib) + ";";
+    if (!read_only && !is_memory_database(path)) {
+        // Readers work from a snapshot of the WAL and never block the writer
+        pragmas += "PRAGMA journal_mode = WAL;";
+    }
+    execute(pragmas.c_str(), "Failed to tune connection");
+}
+
+DbConnection::~DbConnection() {
+    for (sqlite3_stmt*& stmt : statements) {
+        sqlite3_finalize(stmt);
+        stmt = nullptr;
+    }
+    sqlite3_close(db);
+}
+
+bool DbConnection::is_open() const {
+    return db != nullptr;
+}
+
+sqlite3* DbConnection::handle() const {
+    return db;
+}
+
+std::recursive_mutex& DbConnection::mutex() {
+    return connection_mutex;
+}
+
+sqlite3_stmt* DbConnection::statement(int id, const char* sql) {
+    if (!db) {
+        return nullptr;
+    }
+    if (id >= static_cast<int>(statements.size())) {
+        statements.resize(id + 1, nullptr);
+    }
+    if (!statements[id]) {
+        int rc = sqlite3_prepare_v3(db, sql, -1, SQLITE_PREPARE_PERSISTENT, &statements[id], nullptr);
+        if (rc != SQLITE_OK) {
+            log_error() << "Failed to prepare statement: " << sqlite3_errmsg(db);
+            statements[id] = nullptr;
+        }
+    }
+    return statements[id];
+}
+
+// Helper function to execute SQL and handle errors
+bool DbConnection::execute(const char* sql, const std::string& error_msg) {
+    if (!db) {
+        return false;
+    }
+    char* errMsg = nullptr;
+    int rc = sqlite3_exec(db, sql, nullptr, nullptr, &errMsg);
+    if (rc != SQLITE_OK) {
+        log_error() << error_msg << ": " << (errMsg ? errMsg : sqlite3_errmsg(db));
+        sqlite3_free(errMsg);
+        return false;
+    }
+    return true;
+}
+
+ScopedStatement::~ScopedStatement() {
+    if (stmt) {
+        sqlite3_reset(stmt);
+        sqlite3_clear_bindings(stmt);
+    }
+}
+
+std::string column_string(sqlite3_stmt* stmt, int column) {
+    const unsigned char* text = sqlite3_column_text(stmt, column);
+    return text ? std::string(reinterpret_cast<const char*>(text)) : std::string();
+}
+
+bool is_memory_database(const std::string& path) {
+    return path.empty() || path == ":memory:" || path.find("mode=memory") != std::string::npos;
+}
@@ -0,0 +1,419 @@
+#include "../include/file_store.h"
+#include "../include/logger.h"
+#include <cerrno>
+#include <cstring>
+#include <iterator>
+#include <utility>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+namespace {
+
+const std::chrono::hours upload_timeout(1);
+const size_t max_name_length = 255;
+const size_t max_uploads_per_user = 4; // Each holds an fd and a temp file of up to max_file_size
+const size_t max_uploads = 256; // Across all users
+const size_t max_queued_bytes = 64 * 1024 * 1024; // Chunk data waiting for the I/O thread
+
+bool make_directory(const std::string& path) {
+    if (mkdir(path.c_str(), 0755) == 0 || errno == EEXIST) {
+        return true;
+    }
+    log_error() << "Failed to create " << path << ": " << strerror(errno);
+    return false;
+}
+
+bool write_all(int fd, const char* data, size_t length, uint64_t offset) {
+    while (length > 0) {
+        ssize_t written = pwrite(fd, data, length, static_cast<off_t>(offset));
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += written;
+        length -= static_cast<size_t>(written);
+        offset += static_cast<uint64_t>(written);
+    }
+    return true;
+}
+
+// A rename is only durable once the directory holding the new name is synced
+bool sync_directory(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    bool synced = fsync(fd) == 0;
+    close(fd);
+    return synced;
+}
+
+// Whether a stored file really holds the content its name promises. A crash
+// can leave a short or empty file under the digest, which must not be reused.
+bool holds_content(const std::string& path, uint64_t size, const std::string& digest) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat info;
+    bool matches = fstat(fd, &info) == 0 && static_cast<uint64_t>(info.st_size) == size;
+    Sha256 hash;
+    char buffer[64 * 1024];
+    while (matches) {
+        ssize_t count = read(fd, buffer, sizeof(buffer));
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count <= 0) {
+            matches = count == 0 && Sha256::hex(hash.finish()) == digest;
+            break;
+        }
+        hash.update(buffer, static_cast<size_t>(count));
+    }
+    close(fd);
+    return matches;
+}
+
+} // namespace
+
+FileSend::FileSend(FileSend&& other) noexcept
+    : fd(other.fd), transfer_id(other.transfer_id), offset(other.offset), remaining(other.remaining),
+      header_size(other.header_size), header_sent(other.header_sent), body_left(other.body_left), last(other.last) {
+    memcpy(header, other.header, sizeof(header));
+    other.fd = -1;
+}
+
+FileSend& FileSend::operator=(FileSend&& other) noexcept {
+    if (this != &other) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        fd = other.fd;
+        transfer_id = other.transfer_id;
+        offset = other.offset;
+        remaining = other.remaining;
+        memcpy(header, other.header, sizeof(header));
+        header_size = other.header_size;
+        header_sent = other.header_sent;
+        body_left = other.body_left;
+        last = other.last;
+        other.fd = -1;
+    }
+    return *this;
+}
+
+FileSend::~FileSend() {
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+// One partial upload. Its own mutex serialises chunks for it without holding
+// the store's map lock during file I/O.
+struct FileStore::Upload
+{
+    Upload() : fd(-1), size(0), received(0), group_id(-1), abandoned(false) {}
+    ~Upload() {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+
+    void discard() {
+        if (fd >= 0) {
+            close(fd);
+            fd = -1;
+            unlink(temp_path.c_str());
+        }
+        abandoned = true;
+    }
+
+    std::mutex mutex;
+    int fd;
+    std::string temp_path;
+    Sha256 hash; // Covers the first `received` bytes
+    uint64_t size;
+    uint64_t received;
+    int group_id;
+    std::string name;
+    std::chrono::steady_clock::time_point touched;
+    bool abandoned; // Removed from the store; a chunk that still holds it must fail
+};
+
+FileStore::FileStore(const std::string& root)
+    : root(root), queued_bytes(0), submitted(0), written(0), stopping(false) {
+}
+
+FileStore::~FileStore() {
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        stopping = true;
+    }
+    chunk_ready.notify_one();
+    if (writer.joinable()) {
+        writer.join();
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto& entry : uploads) {
+        std::lock_guard<std::mutex> upload_lock(entry.second->mutex);
+        entry.second->discard();
+    }
+}
+
+bool FileStore::open() {
+    if (!make_directory(root) || !make_directory(root + "/tmp")) {
+        return false;
+    }
+    // Hash state lives in memory, so uploads from an earlier run cannot resume
+    DIR* directory = opendir((root + "/tmp").c_str());
+    if (!directory) {
+        return false;
+    }
+    while (dirent* entry = readdir(directory)) {
+        if (entry->d_name[0] != '.') {
+            unlink((root + "/tmp/" + entry->d_name).c_str());
+        }
+    }
+    closedir(directory);
+    if (!writer.joinable()) {
+        writer = std::thread(&FileStore::run_writer, this);
+    }
+    return true;
+}
+
+int64_t FileStore::offer(int user_id, const protocol::FileOffer& offer, std::string& error) {
+    if (offer.size > max_file_size) {
+        error = "file too large";
+        return -1;
+    }
+    if (offer.name.empty() || offer.name.size() > max_name_length) {
+        error = "invalid file name";
+        return -1;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    expire_uploads();
+
+    UploadKey key(user_id, offer.transfer_id);
+    auto found = uploads.find(key);
+    if (found != uploads.end()) {
+        Upload& upload = *found->second;
+        std::unique_lock<std::mutex> upload_lock(upload.mutex, std::try_to_lock);
+        if (!upload_lock.owns_lock()) {
+            error = "transfer in progress";
+            return -1;
+        }
+        if (upload.size == offer.size && upload.group_id == offer.group_id) {
+            upload.touched = std::chrono::steady_clock::now();
+            return static_cast<int64_t>(upload.received);
+        }
+        upload.discard(); // Same id for a different file: start over
+        upload_lock.unlock();
+        uploads.erase(found);
+    }
+    auto own = std::distance(uploads.lower_bound(UploadKey(user_id, 0)), uploads.upper_bound(UploadKey(user_id, UINT64_MAX)));
+    if (static_cast<size_t>(own) >= max_uploads_per_user || uploads.size() >= max_uploads) {
+        error = "too many uploads";
+        return -1;
+    }
+
+    std::shared_ptr<Upload> upload = std::make_shared<Upload>();
+    upload->temp_path = root + "/tmp/" + std::to_string(user_id) + "-" + std::to_string(offer.transfer_id);
+    upload->fd = ::open(upload->temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (upload->fd < 0) {
+        log_error() << "Failed to create " << upload->temp_path << ": " << strerror(errno);
+        error = "cannot store file";
+        return -1;
+    }
+    upload->size = offer.size;
+    upload->group_id = offer.group_id;
+    upload->name = std::string(offer.name);
+    upload->touched = std::chrono::steady_clock::now();
+    uploads.emplace(key, std::move(upload));
+    return 0;
+}
+
+void FileStore::write_chunk(int user_id, const protocol::FileChunk& chunk, bool last, ChunkDone done) {
+    std::unique_lock<std::mutex> lock(queue_mutex);
+    if (!writer.joinable() || stopping) {
+        // Not open, or shutting down: written on the caller
+        lock.unlock();
+        Completed completed{-1, "", "", 0};
+        std::string error;
+        ChunkStatus status = store_chunk(user_id, chunk, last, completed, error);
+        if (done) {
+            done(status, completed, error);
+        }
+        return;
+    }
+    if (queued_bytes + chunk.data.size() > max_queued_bytes) {
+        lock.unlock();
+        if (done) {
+            done(ChunkStatus::FAILED, Completed{-1, "", "", 0}, "server busy");
+        }
+        return;
+    }
+    queued_bytes += chunk.data.size();
+    submitted++;
+    queue.push_back({user_id, chunk.transfer_id, chunk.offset, SharedBuffer::copy_of(chunk.data), last, std::move(done)});
+    if (queue.size() == 1) {
+        chunk_ready.notify_one();
+    }
+}
+
+void FileStore::flush() {
+    std::unique_lock<std::mutex> lock(queue_mutex);
+    uint64_t target = submitted;
+    chunks_written.wait(lock, [&] { return written >= target; });
+}
+
+void FileStore::run_writer() {
+    std::unique_lock<std::mutex> lock(queue_mutex);
+    while (true) {
+        chunk_ready.wait(lock, [&] { return stopping || !queue.empty(); });
+        if (queue.empty()) {
+            break; // Stopping, and everything queued is written
+        }
+        PendingChunk pending = std::move(queue.front());
+        queue.pop_front();
+        lock.unlock();
+
+        Completed completed{-1, "", "", 0};
+        std::string error;
+        protocol::FileChunk chunk{pending.transfer_id, pending.offset,
+                                  std::string_view(pending.data.data(), pending.data.size())};
+        ChunkStatus status = store_chunk(pending.user_id, chunk, pending.last, completed, error);
+        if (pending.done) {
+            pending.done(status, completed, error);
+        }
+
+        lock.lock();
+        queued_bytes -= pending.data.size();
+        written++;
+        chunks_written.notify_all();
+    }
+}
+
+FileStore::ChunkStatus FileStore::store_chunk(int user_id, const protocol::FileChunk& chunk, bool last,
+                                              Completed& completed, std::string& error) {
+    std::shared_ptr<Upload> upload;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto found = uploads.find(UploadKey(user_id, chunk.transfer_id));
+        if (found == uploads.end()) {
+            error = "unknown transfer";
+            return ChunkStatus::FAILED;
+        }
+        upload = found->second;
+    }
+
+    std::unique_lock<std::mutex> upload_lock(upload->mutex);
+    if (upload->abandoned) {
+        error = "unknown transfer";
+        return ChunkStatus::FAILED;
+    }
+    if (chunk.offset != upload->received) {
+        error = "expected offset " + std::to_string(upload->received);
+        return ChunkStatus::FAILED; // Kept, so a fresh FILE_OFFER learns where to resume
+    }
+    if (chunk.data.size() > upload->size - upload->received || (last && upload->received + chunk.data.size() != upload->size)) {
+        error = "size mismatch";
+        return ChunkStatus::FAILED;
+    }
+    if (!write_all(upload->fd, chunk.data.data(), chunk.data.size(), chunk.offset)) {
+        log_error() << "Failed to write " << upload->temp_path << ": " << strerror(errno);
+        error = "cannot store file";
+        return ChunkStatus::FAILED;
+    }
+    upload->hash.update(chunk.data);
+    upload->received += chunk.data.size();
+    upload->touched = std::chrono::steady_clock::now();
+    if (!last) {
+        return ChunkStatus::ACCEPTED;
+    }
+
+    // The file message is acknowledged once logged, so the content must be
+    // on disk under its name first: data, then the directory entry
+    std::string digest = Sha256::hex(upload->hash.finish());
+    std::string directory = root + "/" + digest.substr(0, 2);
+    std::string path = content_path(digest);
+    bool stored = make_directory(directory);
+    if (stored && access(path.c_str(), F_OK) == 0 && holds_content(path, upload->size, digest)) {
+        unlink(upload->temp_path.c_str()); // Already have this content
+    } else if (stored && fsync(upload->fd) != 0) {
+        log_error() << "Failed to sync " << upload->temp_path << ": " << strerror(errno);
+        stored = false;
+    } else if (stored && rename(upload->temp_path.c_str(), path.c_str()) != 0) {
+        log_error() << "Failed to store " << path << ": " << strerror(errno);
+        stored = false;
+    } else if (stored && !(sync_directory(directory) && sync_directory(root))) { // root too, in case directory is new
+        log_error() << "Failed to sync " << directory << ": " << strerror(errno);
+        stored = false;
+    }
+    upload->discard(); // Closes the fd; the temp file is already gone unless storing failed
+    completed = {upload->group_id, upload->name, digest, upload->size};
+    upload_lock.unlock();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto found = uploads.find(UploadKey(user_id, chunk.transfer_id));
+    if (found != uploads.end() && found->second == upload) {
+        uploads.erase(found);
+    }
+    if (!stored) {
+        error = "cannot store file";
+        return ChunkStatus::FAILED;
+    }
+    return ChunkStatus::COMPLETE;
+}
+
+int FileStore::open_content(const std::string& digest, uint64_t& size) {
+    if (!is_digest(digest)) {
+        return -1;
+    }
+    int fd = ::open(content_path(digest).c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        close(fd);
+        return -1;
+    }
+    size = static_cast<uint64_t>(info.st_size);
+    return fd;
+}
+
+bool FileStore::is_digest(const std::string& text) {
+    if (text.size() != 64) {
+        return false;
+    }
+    for (char c : text) {
+        if (!((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f'))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void FileStore::expire_uploads() {
+    auto cutoff = std::chrono::steady_clock::now() - upload_timeout;
+    for (auto it = uploads.begin(); it != uploads.end();) {
+        Upload& upload = *it->second;
+        std::unique_lock<std::mutex> upload_lock(upload.mutex, std::try_to_lock);
+        if (!upload_lock.owns_lock() || upload.touched > cutoff) {
+            ++it; // Busy means it is not stale
+            continue;
+        }
+        upload.discard();
+        upload_lock.unlock();
+        it = uploads.erase(it);
+    }
+}
+
+std::string FileStore::content_path(const std::string& digest) const {
+    return root + "/" + digest.substr(0, 2) + "/" + digest;
+}
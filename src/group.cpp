@@ -0,0 +1,87 @@
+#include "../include/group.h"
+
+Group::Group(int group_id, const std::string& name)
+    : group_id(group_id), message_count(0), details(new Details{name, time(nullptr), 0}) {
+    details->updated_at = details->created_at;
+}
+
+Group::Group() : Group(-1, "") {
+}
+
+Group::~Group() {
+}
+
+Group::Group(const Group& other)
+    : group_id(other.group_id), message_count(other.message_count), members(other.members),
+      details(other.details ? new Details(*other.details) : nullptr) {
+}
+
+Group& Group::operator=(const Group& other) {
+    if (this != &other) {
+        group_id = other.group_id;
+        message_count = other.message_count;
+        members = other.members;
+        details.reset(other.details ? new Details(*other.details) : nullptr);
+    }
+    return *this;
+}
+
+void Group::add_member(int user_id) {
+    if (members.insert(user_id)) {
+        touch();
+    }
+}
+
+void Group::remove_member(int user_id) {
+    if (members.erase(user_id)) {
+        touch();
+    }
+}
+
+bool Group::is_member(int user_id) const {
+    return members.contains(user_id);
+}
+
+bool Group::has_member(int user_id) const {
+    return is_member(user_id);
+}
+
+void Group::add_message() {
+    message_count++;
+    touch();
+}
+
+void Group::remove_message() {
+    if (message_count > 0) {
+        message_count--;
+        touch();
+    }
+}
+
+int Group::get_message_count() const {
+    return message_count;
+}
+
+int Group::get_member_count() const {
+    return static_cast<int>(members.size());
+}
+
+// A moved-from group has no details; it reads as unnamed and never touched
+const std::string& Group::name() const {
+    static const std::string unnamed;
+    return details ? details->name : unnamed;
+}
+
+time_t Group::created_at() const {
+    return details ? details->created_at : 0;
+}
+
+time_t Group::updated_at() const {
+    return details ? details->updated_at : 0;
+}
+
+void Group::touch() {
+    if (details) {
+        details->updated_at = time(nullptr);
+    }
+}
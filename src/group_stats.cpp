@@ -0,0 +1,82 @@
+#include "../include/group_stats.h"
+#include <algorithm>
+
+GroupStats::GroupStats() : is_loaded(false) {
+}
+
+void GroupStats::load(const std::vector<std::pair<int, Counter>>& counters, const std::vector<MarkerRow>& markers) {
+    for (Shard& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.groups.clear();
+    }
+    for (const auto& row : counters) {
+        Shard& shard = shard_of(row.first);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.groups[row.first].counter = row.second;
+    }
+    for (const MarkerRow& row : markers) {
+        Shard& shard = shard_of(row.group_id);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.groups[row.group_id].markers[row.user_id] = row.marker;
+    }
+    is_loaded = true;
+}
+
+void GroupStats::message_added(int group_id, int message_id) {
+    Shard& shard = shard_of(group_id);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    Counter& counter = shard.groups[group_id].counter;
+    counter.message_count++;
+    counter.last_message_id = std::max(counter.last_message_id, message_id);
+}
+
+void GroupStats::message_removed(int group_id, int message_id) {
+    Shard& shard = shard_of(group_id);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto found = shard.groups.find(group_id);
+    if (found == shard.groups.end()) {
+        return;
+    }
+    Entry& entry = found->second;
+    entry.counter.message_count = std::max(0, entry.counter.message_count - 1);
+    // Members who had read past it now have one message fewer behind their marker
+    for (auto& marker : entry.markers) {
+        if (marker.second.last_read_message_id >= message_id && marker.second.read_count > 0) {
+            marker.second.read_count--;
+        }
+    }
+}
+
+void GroupStats::mark_read(int user_id, int group_id, const ReadMarker& marker) {
+    Shard& shard = shard_of(group_id);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    Entry& entry = shard.groups[group_id];
+    auto inserted = entry.markers.emplace(user_id, marker);
+    if (!inserted.second && marker.last_read_message_id > inserted.first->second.last_read_message_id) {
+        inserted.first->second = marker;
+    }
+}
+
+GroupStats::Counter GroupStats::counter(int group_id) const {
+    const Shard& shard = shard_of(group_id);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto found = shard.groups.find(group_id);
+    return found == shard.groups.end() ? Counter() : found->second.counter;
+}
+
+int GroupStats::unread_count(int user_id, int group_id) const {
+    const Shard& shard = shard_of(group_id);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto found = shard.groups.find(group_id);
+    if (found == shard.groups.end()) {
+        return 0;
+    }
+    const Entry& entry = found->second;
+    auto marker = entry.markers.find(user_id);
+    int read = marker == entry.markers.end() ? 0 : marker->second.read_count;
+    return std::max(0, entry.counter.message_count - read);
+}
+
+bool GroupStats::loaded() const {
+    return is_loaded;
+}
@@ -0,0 +1,99 @@
+#include "../include/latency_histogram.h"
+#include <algorithm>
+#include <cmath>
+
+LatencyHistogram::LatencyHistogram() {
+    reset();
+}
+
+void LatencyHistogram::record(uint64_t nanoseconds) {
+    buckets[bucket_of(nanoseconds)]++;
+    total++;
+    smallest = std::min(smallest, nanoseconds);
+    largest = std::max(largest, nanoseconds);
+    sum += nanoseconds;
+}
+
+void LatencyHistogram::record(uint64_t nanoseconds, uint64_t times) {
+    if (times == 0) {
+        return;
+    }
+    buckets[bucket_of(nanoseconds)] += times;
+    total += times;
+    smallest = std::min(smallest, nanoseconds);
+    largest = std::max(largest, nanoseconds);
+    sum += static_cast<long double>(nanoseconds) * times;
+}
+
+void LatencyHistogram::merge(const LatencyHistogram& other) {
+    for (size_t i = 0; i < bucket_count; ++i) {
+        buckets[i] += other.buckets[i];
+    }
+    total += other.total;
+    smallest = std::min(smallest, other.smallest);
+    largest = std::max(largest, other.largest);
+    sum += other.sum;
+}
+
+void LatencyHistogram::reset() {
+    buckets.fill(0);
+    total = 0;
+    smallest = UINT64_MAX;
+    largest = 0;
+    sum = 0;
+}
+
+uint64_t LatencyHistogram::count() const {
+    return total;
+}
+
+uint64_t LatencyHistogram::min() const {
+    return total ? smallest : 0;
+}
+
+uint64_t LatencyHistogram::max() const {
+    return largest;
+}
+
+double LatencyHistogram::mean() const {
+    return total ? static_cast<double>(sum / total) : 0.0;
+}
+
+uint64_t LatencyHistogram::percentile(double percent) const {
+    if (total == 0) {
+        return 0;
+    }
+    // Rank of the sample at this percentile, 1-based
+    uint64_t rank = static_cast<uint64_t>(std::ceil(std::min(std::max(percent, 0.0), 100.0) / 100.0 * total));
+    rank = std::max<uint64_t>(rank, 1);
+
+    uint64_t seen = 0;
+    for (size_t i = 0; i < bucket_count; ++i) {
+        seen += buckets[i];
+        if (seen >= rank) {
+            return std::min(std::max(value_of(i), min()), largest);
+        }
+    }
+    return largest;
+}
+
+size_t LatencyHistogram::bucket_of(uint64_t nanoseconds) {
+    if (nanoseconds < sub_count) {
+        return static_cast<size_t>(nanoseconds);
+    }
+    int shift = 63 - __builtin_clzll(nanoseconds) - sub_bits;
+    if (shift > max_shift) {
+        return bucket_count - 1;
+    }
+    uint64_t mantissa = (nanoseconds >> shift) - sub_count; // 0 .. sub_count - 1
+    return static_cast<size_t>((shift + 1) * sub_count + mantissa);
+}
+
+uint64_t LatencyHistogram::value_of(size_t bucket) {
+    if (bucket < sub_count) {
+        return bucket;
+    }
+    int shift = static_cast<int>(bucket / sub_count) - 1;
+    uint64_t mantissa = bucket % sub_count;
+    return ((sub_count + mantissa) << shift) + ((uint64_t(1) << shift) >> 1);
+}
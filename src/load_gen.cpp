@@ -0,0 +1,569 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <queue>
+#include <deque>
+#include <thread>
+#include <atomic>
+#include <random>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+#include <memory>
+#include <unistd.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include "server.h"
+#include "chat_database.h"
+#include "protocol.h"
+#include "ring_buffer.h"
+#include "latency_histogram.h"
+#include "logger.h"
+
+// Closed-loop load generator: starts a Server in this process and drives it
+// over loopback with N simulated clients. Every client has at most one request
+// in flight; after each reply it waits an exponential think time (mean
+// 1 / rate) and then sends a message, fetches history, or joins/leaves a group.
+// Each SEND_MESSAGE carries its send time in client_tag, so every member that
+// receives the DELIVER_MESSAGE records the end-to-end delivery latency.
+//
+//   load_gen --clients 5000 --group-size 50 --rate 2 --duration 20 --history 0.05 --churn 0.01
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+using protocol::FrameType;
+
+struct Options
+{
+    int clients = 1000;
+    int group_size = 50; // Clients per base group
+    double rate = 1.0; // Actions per client per second, 0 for back-to-back
+    int message_size = 64; // Mean text length in bytes
+    std::string size_distribution = "exponential"; // fixed, uniform (0..2*mean) or exponential
+    double history = 0.05; // Share of actions that fetch a history page
+    double churn = 0.01; // Share of actions that join or leave an extra group
+    double duration = 10; // Measured seconds
+    double warmup = 2;
+    int threads = 4; // Client threads
+    int reactors = 0; // Server reactors, 0 for one per core
+    int shards = 1; // Database files the server splits groups over
+    std::string db = "data/load_gen.db";
+};
+
+int64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+}
+
+// Everything one client thread measured
+struct Stats
+{
+    LatencyHistogram delivery; // Send to receive, at every other member
+    LatencyHistogram ack; // Send to the stored message_id coming back
+    LatencyHistogram history;
+    LatencyHistogram membership; // JOIN_GROUP / LEAVE_GROUP round trips
+    uint64_t sent = 0;
+    uint64_t delivered = 0;
+    uint64_t dropped = 0; // Deliveries the server skipped because this client lagged
+    uint64_t errors = 0;
+    uint64_t bytes_received = 0;
+};
+
+struct Client
+{
+    int fd = -1;
+    int index = 0; // Across all workers
+    size_t slot = 0; // Within its worker
+    int base_group = 0;
+    int extra_group = 0; // Joined by churn, 0 if none
+    RingBuffer inbound{4096};
+    protocol::FrameParser parser;
+    std::string outbound;
+    size_t outbound_offset = 0;
+    FrameType waiting_for = FrameType::LOGIN; // Request in flight
+    bool busy = false;
+    int64_t request_started = 0;
+    bool logged_in = false;
+};
+
+class Worker
+{
+public:
+
+    Worker(const Options& options, int port, int group_count, int id, std::atomic<int64_t>& measure_from, std::atomic<bool>& stopping)
+        : options(options), port(port), group_count(group_count), rng(977 + id), epoll_fd(-1),
+          measure_from(measure_from), stopping(stopping), ready_clients(0) {}
+
+    ~Worker() {
+        for (Client& client : clients) {
+            if (client.fd >= 0) {
+                close(client.fd);
+            }
+        }
+        if (epoll_fd >= 0) {
+            close(epoll_fd);
+        }
+    }
+
+    void add_client(int index) {
+        clients.emplace_back(); // A deque, so earlier clients never move
+        clients.back().slot = clients.size() - 1;
+        clients.back().index = index;
+        clients.back().base_group = index / options.group_size + 1;
+    }
+
+    bool connect_all() {
+        epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        for (size_t i = 0; i < clients.size(); ++i) {
+            Client& client = clients[i];
+            client.fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            sockaddr_in addr;
+            memset(&addr, 0, sizeof(addr));
+            addr.sin_family = AF_INET;
+            addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            addr.sin_port = htons(port);
+            if (client.fd < 0 || connect(client.fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+                std::cerr << "Client " << client.index << " failed to connect: " << strerror(errno) << std::endl;
+                return false;
+            }
+            int enable = 1;
+            setsockopt(client.fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+            fcntl(client.fd, F_SETFL, fcntl(client.fd, F_GETFL) | O_NONBLOCK);
+
+            epoll_event event;
+            event.events = EPOLLIN | EPOLLOUT | EPOLLET;
+            event.data.u64 = i;
+            epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client.fd, &event);
+
+            std::string name = "load" + std::to_string(client.index);
+            protocol::encode_login(client.outbound, {true, name, "secret"});
+            start_request(client, FrameType::LOGIN);
+        }
+        return true;
+    }
+
+    void run() {
+        epoll_event events[256];
+        while (!stopping.load(std::memory_order_relaxed)) {
+            int timeout = next_timeout_ms();
+            int count = epoll_wait(epoll_fd, events, 256, timeout);
+            for (int i = 0; i < count; ++i) {
+                Client& client = clients[events[i].data.u64];
+                if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                    std::cerr << "Client " << client.index << " disconnected" << std::endl;
+                    stopping = true;
+                    return;
+                }
+                if (events[i].events & EPOLLOUT) {
+                    flush(client);
+                }
+                if (events[i].events & EPOLLIN) {
+                    receive(client);
+                }
+            }
+            run_due_actions();
+        }
+    }
+
+    int ready() const { return ready_clients.load(); }
+    size_t size() const { return clients.size(); }
+    Stats stats;
+
+private:
+
+    bool measuring(int64_t at) const { return at >= measure_from.load(std::memory_order_relaxed); }
+
+    double uniform() { return std::uniform_real_distribution<double>(0.0, 1.0)(rng); }
+
+    int64_t think_time_ns() {
+        if (options.rate <= 0) {
+            return 0;
+        }
+        return static_cast<int64_t>(std::exponential_distribution<double>(options.rate)(rng) * 1e9);
+    }
+
+    size_t message_length() {
+        double mean = options.message_size;
+        double length = mean;
+        if (options.size_distribution == "uniform") {
+            length = uniform() * 2 * mean;
+        } else if (options.size_distribution == "exponential") {
+            length = std::exponential_distribution<double>(1.0 / std::max(mean, 1.0))(rng);
+        }
+        return static_cast<size_t>(std::min(std::max(length, 1.0), 60000.0));
+    }
+
+    void schedule(Client& client, int64_t at) {
+        timers.push({at, client.slot});
+    }
+
+    int next_timeout_ms() {
+        if (timers.empty()) {
+            return 100;
+        }
+        int64_t wait = timers.top().first - now_ns();
+        return wait <= 0 ? 0 : static_cast<int>(std::min<int64_t>(wait / 1000000 + 1, 100));
+    }
+
+    void start_request(Client& client, FrameType type) {
+        client.waiting_for = type;
+        client.busy = true;
+        client.request_started = now_ns();
+        flush(client);
+    }
+
+    void run_due_actions() {
+        int64_t now = now_ns();
+        while (!timers.empty() && timers.top().first <= now) {
+            Client& client = clients[timers.top().second];
+            timers.pop();
+            next_action(client);
+        }
+    }
+
+    void next_action(Client& client) {
+        double pick = uniform();
+        if (pick < options.churn && group_count > 1) {
+            if (client.extra_group) {
+                protocol::encode_group(client.outbound, FrameType::LEAVE_GROUP, client.extra_group);
+                start_request(client, FrameType::LEAVE_GROUP);
+            } else {
+                int group = static_cast<int>(rng() % group_count) + 1;
+                if (group == client.base_group) {
+                    group = group % group_count + 1;
+                }
+                client.extra_group = group;
+                protocol::encode_group(client.outbound, FrameType::JOIN_GROUP, group);
+                start_request(client, FrameType::JOIN_GROUP);
+            }
+            return;
+        }
+        if (pick < options.churn + options.history) {
+            protocol::encode_history_request(client.outbound, {client.base_group, 0, 50});
+            start_request(client, FrameType::HISTORY_REQUEST);
+            return;
+        }
+
+        text.assign(message_length(), 'x');
+        int64_t sent_at = now_ns();
+        protocol::encode_send_message(client.outbound, {client.base_group, static_cast<uint64_t>(sent_at), text});
+        start_request(client, FrameType::SEND_MESSAGE);
+        if (measuring(sent_at)) {
+            stats.sent++;
+        }
+    }
+
+    void flush(Client& client) {
+        while (client.outbound_offset < client.outbound.size()) {
+            ssize_t sent = send(client.fd, client.outbound.data() + client.outbound_offset,
+                                client.outbound.size() - client.outbound_offset, MSG_NOSIGNAL);
+            if (sent < 0) {
+                if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                    stats.errors++;
+                }
+                return;
+            }
+            client.outbound_offset += static_cast<size_t>(sent);
+        }
+        client.outbound.clear();
+        client.outbound_offset = 0;
+    }
+
+    void receive(Client& client) {
+        while (true) {
+            iovec regions[2];
+            int count = client.inbound.write_regions(regions);
+            if (count == 0) {
+                client.inbound.reserve(client.inbound.capacity() * 2);
+                continue;
+            }
+            ssize_t received = readv(client.fd, regions, count);
+            if (received <= 0) {
+                if (received < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (received == 0) {
+                    std::cerr << "Server closed client " << client.index << std::endl;
+                    stopping = true;
+                }
+                return;
+            }
+            client.inbound.commit(static_cast<size_t>(received));
+            stats.bytes_received += static_cast<uint64_t>(received);
+
+            protocol::Frame frame;
+            protocol::ParseStatus status;
+            while ((status = client.parser.next(client.inbound, frame)) == protocol::ParseStatus::FRAME) {
+                handle_frame(client, frame);
+                client.parser.consume(client.inbound);
+            }
+            if (status == protocol::ParseStatus::INVALID) {
+                std::cerr << "Invalid frame from server" << std::endl;
+                stopping = true;
+                return;
+            }
+            if (client.inbound.free_space() == 0 || client.parser.required_capacity() > client.inbound.capacity()) {
+                client.inbound.reserve(std::max(client.inbound.capacity() * 2, client.parser.required_capacity()));
+            }
+        }
+    }
+
+    void handle_frame(Client& client, const protocol::Frame& frame) {
+        int64_t now = now_ns();
+        if (frame.type == FrameType::DELIVER_MESSAGE) {
+            protocol::DeliverMessage message;
+            if (protocol::decode_deliver_message(frame.payload, message) && measuring(static_cast<int64_t>(message.client_tag))) {
+                stats.delivery.record(static_cast<uint64_t>(now - static_cast<int64_t>(message.client_tag)));
+                stats.delivered++;
+            }
+            return;
+        }
+        if (frame.type == FrameType::MESSAGES_DROPPED) {
+            uint32_t dropped_count;
+            if (protocol::decode_messages_dropped(frame.payload, dropped_count)) {
+                stats.dropped += dropped_count;
+            }
+            return;
+        }
+
+        FrameType completed;
+        bool failed = false;
+        if (frame.type == FrameType::HISTORY_RESPONSE) {
+            completed = FrameType::HISTORY_REQUEST;
+        } else if (frame.type == FrameType::RESULT) {
+            protocol::ResultMessage result;
+            if (!protocol::decode_result(frame.payload, result)) {
+                stats.errors++;
+                return;
+            }
+            completed = static_cast<FrameType>(result.request_type);
+            failed = result.value < 0;
+        } else {
+            return;
+        }
+        if (!client.busy || completed != client.waiting_for) {
+            stats.errors++;
+            return;
+        }
+        client.busy = false;
+        if (failed) {
+            stats.errors++;
+        }
+
+        uint64_t elapsed = static_cast<uint64_t>(now - client.request_started);
+        bool counted = measuring(client.request_started);
+        switch (completed) {
+            case FrameType::LOGIN:
+                protocol::encode_group(client.outbound, FrameType::JOIN_GROUP, client.base_group);
+                start_request(client, FrameType::JOIN_GROUP);
+                return;
+            case FrameType::JOIN_GROUP:
+                if (!client.logged_in) {
+                    client.logged_in = true;
+                    ready_clients++;
+                    schedule(client, now + think_time_ns());
+                    return;
+                }
+                break;
+            case FrameType::LEAVE_GROUP:
+                client.extra_group = 0;
+                break;
+            default:
+                break;
+        }
+        if (counted) {
+            if (completed == FrameType::SEND_MESSAGE) {
+                stats.ack.record(elapsed);
+            } else if (completed == FrameType::HISTORY_REQUEST) {
+                stats.history.record(elapsed);
+            } else {
+                stats.membership.record(elapsed);
+            }
+        }
+        schedule(client, now + think_time_ns());
+    }
+
+    const Options& options;
+    int port;
+    int group_count;
+    std::mt19937_64 rng;
+    int epoll_fd;
+    std::atomic<int64_t>& measure_from;
+    std::atomic<bool>& stopping;
+    std::atomic<int> ready_clients;
+    std::deque<Client> clients;
+    std::priority_queue<std::pair<int64_t, size_t>, std::vector<std::pair<int64_t, size_t>>, std::greater<std::pair<int64_t, size_t>>> timers;
+    std::string text;
+};
+
+bool parse_options(int argc, char** argv, Options& options) {
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string flag = argv[i];
+        std::string value = argv[i + 1];
+        if (flag == "--clients") {
+            options.clients = std::stoi(value);
+        } else if (flag == "--group-size") {
+            options.group_size = std::stoi(value);
+        } else if (flag == "--rate") {
+            options.rate = std::stod(value);
+        } else if (flag == "--message-size") {
+            options.message_size = std::stoi(value);
+        } else if (flag == "--size-distribution") {
+            options.size_distribution = value;
+        } else if (flag == "--history") {
+            options.history = std::stod(value);
+        } else if (flag == "--churn") {
+            options.churn = std::stod(value);
+        } else if (flag == "--duration") {
+            options.duration = std::stod(value);
+        } else if (flag == "--warmup") {
+            options.warmup = std::stod(value);
+        } else if (flag == "--threads") {
+            options.threads = std::stoi(value);
+        } else if (flag == "--reactors") {
+            options.reactors = std::stoi(value);
+        } else if (flag == "--shards") {
+            options.shards = std::stoi(value);
+        } else if (flag == "--db") {
+            options.db = value;
+        } else {
+            std::cerr << "Unknown option " << flag << std::endl;
+            return false;
+        }
+    }
+    if (argc % 2 == 0) {
+        std::cerr << "Missing value for " << argv[argc - 1] << std::endl;
+        return false;
+    }
+    options.clients = std::max(options.clients, 1);
+    options.group_size = std::max(options.group_size, 1);
+    options.threads = std::max(std::min(options.threads, options.clients), 1);
+    return true;
+}
+
+void report(std::ostream& out, const std::string& name, const LatencyHistogram& histogram) {
+    out << "  " << name << ": " << histogram.count() << " samples, p50 " << histogram.percentile(50) / 1000
+        << " us, p99 " << histogram.percentile(99) / 1000 << " us, p999 " << histogram.percentile(99.9) / 1000
+        << " us, max " << histogram.max() / 1000 << " us" << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!parse_options(argc, argv, options)) {
+        std::cerr << "usage: load_gen [--clients N] [--group-size N] [--rate per-client/s] [--message-size bytes] "
+                     "[--size-distribution fixed|uniform|exponential] [--history share] [--churn share] "
+                     "[--duration s] [--warmup s] [--threads N] [--reactors N] [--shards N] [--db path]" << std::endl;
+        return 1;
+    }
+
+    for (int shard = -1; shard < options.shards; ++shard) {
+        std::string file = shard < 0 ? options.db : options.db + ".shard" + std::to_string(shard);
+        for (const char* suffix : {"", "-wal", "-shm"}) {
+            std::remove((file + suffix).c_str());
+        }
+    }
+
+    // Only problems from the server; its startup lines would interleave with the report
+    logging::set_level(LogLevel::WARN);
+    std::ostream& out = std::cout;
+
+    Server server(0, options.db, options.reactors, options.shards);
+    server.start();
+    ChatDatabase* database = get_database(options.db); // Users and groups are in the global file
+    if (database) {
+        database->set_password_cost(1000); // Every client registers; bench_auth is the login benchmark
+    }
+    int group_count = (options.clients + options.group_size - 1) / options.group_size;
+    bool ready = server.is_running() && database;
+    for (int g = 1; ready && g <= group_count; ++g) {
+        ready = database->create_group("load" + std::to_string(g));
+    }
+    if (!ready) {
+        std::cerr << "Failed to start the server" << std::endl;
+        return 1;
+    }
+
+    out << "=== Load Generator ===" << std::endl;
+    out << "  " << options.clients << " clients on " << options.threads << " threads, " << group_count
+        << " groups of " << options.group_size << ", " << options.rate << " actions/s per client, "
+        << options.message_size << "-byte " << options.size_distribution << " messages, "
+        << options.history * 100 << "% history, " << options.churn * 100 << "% churn" << std::endl;
+
+    std::atomic<int64_t> measure_from(INT64_MAX);
+    std::atomic<bool> stopping(false);
+    std::vector<std::unique_ptr<Worker>> workers;
+    for (int t = 0; t < options.threads; ++t) {
+        workers.emplace_back(new Worker(options, server.get_port(), group_count, t, measure_from, stopping));
+    }
+    for (int c = 0; c < options.clients; ++c) {
+        workers[c % options.threads]->add_client(c);
+    }
+
+    auto connect_start = Clock::now();
+    for (auto& worker : workers) {
+        if (!worker->connect_all()) {
+            return 1;
+        }
+    }
+    std::vector<std::thread> threads;
+    for (auto& worker : workers) {
+        threads.emplace_back(&Worker::run, worker.get());
+    }
+
+    // Wait until every client has logged in and joined its group
+    while (!stopping) {
+        int total = 0;
+        for (auto& worker : workers) {
+            total += worker->ready();
+        }
+        if (total == options.clients) {
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    std::chrono::duration<double> connect_time = Clock::now() - connect_start;
+    out << "  all clients logged in after " << connect_time.count() << " s" << std::endl;
+
+    std::this_thread::sleep_for(std::chrono::duration<double>(options.warmup));
+    measure_from = now_ns();
+    auto measure_start = Clock::now();
+    std::this_thread::sleep_for(std::chrono::duration<double>(options.duration));
+    std::chrono::duration<double> measured = Clock::now() - measure_start;
+    stopping = true;
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    server.stop();
+
+    Stats total;
+    for (auto& worker : workers) {
+        total.delivery.merge(worker->stats.delivery);
+        total.ack.merge(worker->stats.ack);
+        total.history.merge(worker->stats.history);
+        total.membership.merge(worker->stats.membership);
+        total.sent += worker->stats.sent;
+        total.delivered += worker->stats.delivered;
+        total.dropped += worker->stats.dropped;
+        total.errors += worker->stats.errors;
+        total.bytes_received += worker->stats.bytes_received;
+    }
+
+    double seconds = measured.count();
+    out << "  measured " << seconds << " s: " << static_cast<uint64_t>(total.sent / seconds) << " messages/s sent, "
+        << static_cast<uint64_t>(total.delivered / seconds) << " deliveries/s, " << total.dropped << " dropped, "
+        << static_cast<uint64_t>(total.bytes_received / seconds / (1024 * 1024)) << " MiB/s received, "
+        << total.errors << " errors" << std::endl;
+    report(out, "delivery (send to every member)", total.delivery);
+    report(out, "send ack (stored)", total.ack);
+    report(out, "history fetch", total.history);
+    report(out, "join/leave", total.membership);
+    return total.errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,251 @@
+#include "../include/logger.h"
+#include "../include/mpsc_queue.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unistd.h>
+
+namespace {
+
+using Clock = std::chrono::system_clock;
+
+struct Entry
+{
+    LogLevel level;
+    Clock::time_point time;
+    std::string text;
+};
+
+const char* level_name(LogLevel level) {
+    switch (level) {
+        case LogLevel::DEBUG: return "DEBUG";
+        case LogLevel::INFO: return "INFO";
+        case LogLevel::WARN: return "WARN";
+        case LogLevel::ERROR: return "ERROR";
+        case LogLevel::OFF: break;
+    }
+    return "";
+}
+
+// Lines allowed per level in the current one-second window
+struct RateWindow
+{
+    std::atomic<int64_t> second{0};
+    std::atomic<uint32_t> used{0};
+};
+
+// The writer thread and everything producers share with it. Created on first
+// use and never destroyed, so static destructors that log still find it; an
+// exit handler drains it and stops the thread instead.
+class Writer
+{
+public:
+
+    Writer() : queued(0), written(0), submitted(0), dropped_lines(0), reported_drops(0), stopping(false) {
+        thread = std::thread(&Writer::run, this);
+        std::atexit([]() { instance().stop(); });
+    }
+
+    static Writer& instance() {
+        static Writer* writer = new Writer();
+        return *writer;
+    }
+
+    bool admit(LogLevel level) {
+        uint32_t limit = rate_limit.load(std::memory_order_relaxed);
+        if (limit != 0) {
+            RateWindow& window = windows[static_cast<int>(level)];
+            int64_t now = std::chrono::duration_cast<std::chrono::seconds>(Clock::now().time_since_epoch()).count();
+            int64_t second = window.second.load(std::memory_order_relaxed);
+            if (second != now && window.second.compare_exchange_strong(second, now, std::memory_order_relaxed)) {
+                window.used.store(0, std::memory_order_relaxed);
+            }
+            if (window.used.fetch_add(1, std::memory_order_relaxed) >= limit) {
+                dropped_lines.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+        }
+        if (queued.fetch_add(1, std::memory_order_relaxed) >= logging::max_queued) {
+            queued.fetch_sub(1, std::memory_order_relaxed);
+            dropped_lines.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        return true;
+    }
+
+    void submit(Entry entry) {
+        if (stopping.load(std::memory_order_acquire)) {
+            queued.fetch_sub(1, std::memory_order_relaxed);
+            std::string line;
+            format(entry, line);
+            write_out(line); // The writer is gone; the process is exiting
+            return;
+        }
+        entries.push(std::move(entry));
+        submitted.fetch_add(1, std::memory_order_release);
+        wake.notify_one(); // Without the mutex; a missed wakeup costs at most one poll interval
+    }
+
+    void flush() {
+        uint64_t target = submitted.load(std::memory_order_acquire);
+        std::unique_lock<std::mutex> lock(mutex);
+        wake.notify_one();
+        idle.wait(lock, [&]() { return written >= target || stopping.load(std::memory_order_acquire); });
+    }
+
+    uint64_t dropped() const {
+        return dropped_lines.load(std::memory_order_relaxed);
+    }
+
+    std::atomic<int> minimum{static_cast<int>(LogLevel::INFO)};
+    std::atomic<uint32_t> rate_limit{200};
+
+private:
+
+    void run() {
+        std::string batch;
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            lock.unlock();
+            uint64_t drained = drain(batch);
+            lock.lock();
+            written += drained;
+            idle.notify_all();
+            if (stopping.load(std::memory_order_acquire)) {
+                return;
+            }
+            if (drained == 0) {
+                wake.wait_for(lock, std::chrono::milliseconds(100));
+            }
+        }
+    }
+
+    // Writes whatever is queued with one write(2) per batch; returns the line count
+    uint64_t drain(std::string& batch) {
+        batch.clear();
+        uint64_t count = 0;
+        Entry entry;
+        while (entries.pop(entry)) {
+            uint64_t lost = dropped_lines.load(std::memory_order_relaxed);
+            if (lost != reported_drops) {
+                batch += "(" + std::to_string(lost - reported_drops) + " log lines dropped)\n";
+                reported_drops = lost;
+            }
+            format(entry, batch);
+            ++count;
+        }
+        queued.fetch_sub(count, std::memory_order_relaxed);
+        write_out(batch);
+        return count;
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping.store(true, std::memory_order_release);
+        }
+        wake.notify_one();
+        if (thread.joinable()) {
+            thread.join();
+        }
+        std::string rest;
+        drain(rest); // Lines pushed while the thread was finishing
+    }
+
+    static void format(const Entry& entry, std::string& out) {
+        time_t seconds = Clock::to_time_t(entry.time);
+        int millis = static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(
+            entry.time.time_since_epoch()).count() % 1000);
+        struct tm utc;
+        gmtime_r(&seconds, &utc);
+        char stamp[32];
+        strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%S", &utc);
+        char prefix[64];
+        snprintf(prefix, sizeof(prefix), "%s.%03dZ %-5s ", stamp, millis, level_name(entry.level));
+        out += prefix;
+        out += entry.text;
+        out += '\n';
+    }
+
+    static void write_out(const std::string& text) {
+        size_t offset = 0;
+        while (offset < text.size()) {
+            ssize_t n = ::write(STDERR_FILENO, text.data() + offset, text.size() - offset);
+            if (n <= 0) {
+                return;
+            }
+            offset += static_cast<size_t>(n);
+        }
+    }
+
+    MpscQueue<Entry> entries;
+    std::atomic<size_t> queued;
+    RateWindow windows[static_cast<int>(LogLevel::OFF)];
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable idle;
+    uint64_t written; // Guarded by mutex
+    std::atomic<uint64_t> submitted;
+    std::atomic<uint64_t> dropped_lines;
+    uint64_t reported_drops; // Writer thread only
+    std::atomic<bool> stopping;
+    std::thread thread;
+};
+
+thread_local std::ostringstream line_buffer;
+thread_local bool line_open = false;
+
+} // namespace
+
+namespace logging
+{
+
+void set_level(LogLevel level) {
+    Writer::instance().minimum.store(static_cast<int>(level), std::memory_order_relaxed);
+}
+
+LogLevel level() {
+    return static_cast<LogLevel>(Writer::instance().minimum.load(std::memory_order_relaxed));
+}
+
+bool enabled(LogLevel level) {
+    return level != LogLevel::OFF &&
+           static_cast<int>(level) >= Writer::instance().minimum.load(std::memory_order_relaxed);
+}
+
+void set_rate_limit(uint32_t lines_per_second) {
+    Writer::instance().rate_limit.store(lines_per_second, std::memory_order_relaxed);
+}
+
+void flush() {
+    Writer::instance().flush();
+}
+
+uint64_t dropped() {
+    return Writer::instance().dropped();
+}
+
+} // namespace logging
+
+LogLine::LogLine(LogLevel level) : level(level), stream(nullptr) {
+    // A line logged while formatting another one on this thread is skipped
+    if (!line_open && logging::enabled(level) && Writer::instance().admit(level)) {
+        line_open = true;
+        line_buffer.str(std::string());
+        stream = &line_buffer;
+    }
+}
+
+LogLine::~LogLine() {
+    if (stream) {
+        Writer::instance().submit({level, Clock::now(), stream->str()});
+        line_open = false;
+    }
+}
@@ -0,0 +1,144 @@
+#include "../include/member_set.h"
+#include <algorithm>
+
+MemberSet::MemberSet(const std::vector<int>& ids) : count(0) {
+    std::vector<int> sorted(ids);
+    std::sort(sorted.begin(), sorted.end());
+    for (int id : sorted) {
+        insert(id); // Ascending, so every insert appends to the last bucket
+    }
+}
+
+std::vector<MemberSet::Bucket>::iterator MemberSet::find_bucket(uint16_t high) {
+    return std::lower_bound(buckets.begin(), buckets.end(), high,
+                            [](const Bucket& bucket, uint16_t key) { return bucket.high < key; });
+}
+
+std::vector<MemberSet::Bucket>::const_iterator MemberSet::find_bucket(uint16_t high) const {
+    return std::lower_bound(buckets.begin(), buckets.end(), high,
+                            [](const Bucket& bucket, uint16_t key) { return bucket.high < key; });
+}
+
+bool MemberSet::insert(int id) {
+    if (id < 0) {
+        return false;
+    }
+    uint16_t high = static_cast<uint16_t>(id >> 16);
+    uint16_t low = static_cast<uint16_t>(id & 0xffff);
+
+    auto bucket = find_bucket(high);
+    if (bucket == buckets.end() || bucket->high != high) {
+        bucket = buckets.insert(bucket, Bucket{high, false, 0, {}});
+    }
+
+    if (bucket->bitmap) {
+        uint16_t& word = bucket->data[low / 16];
+        uint16_t bit = static_cast<uint16_t>(1u << (low % 16));
+        if (word & bit) {
+            return false;
+        }
+        word |= bit;
+    } else {
+        auto position = std::lower_bound(bucket->data.begin(), bucket->data.end(), low);
+        if (position != bucket->data.end() && *position == low) {
+            return false;
+        }
+        bucket->data.insert(position, low);
+        if (bucket->data.size() > array_limit) {
+            to_bitmap(*bucket);
+        }
+    }
+    bucket->cardinality++;
+    count++;
+    return true;
+}
+
+bool MemberSet::erase(int id) {
+    if (id < 0) {
+        return false;
+    }
+    uint16_t high = static_cast<uint16_t>(id >> 16);
+    uint16_t low = static_cast<uint16_t>(id & 0xffff);
+
+    auto bucket = find_bucket(high);
+    if (bucket == buckets.end() || bucket->high != high) {
+        return false;
+    }
+
+    if (bucket->bitmap) {
+        uint16_t& word = bucket->data[low / 16];
+        uint16_t bit = static_cast<uint16_t>(1u << (low % 16));
+        if (!(word & bit)) {
+            return false;
+        }
+        word &= static_cast<uint16_t>(~bit);
+    } else {
+        auto position = std::lower_bound(bucket->data.begin(), bucket->data.end(), low);
+        if (position == bucket->data.end() || *position != low) {
+            return false;
+        }
+        bucket->data.erase(position);
+    }
+    bucket->cardinality--;
+    count--;
+
+    if (bucket->cardinality == 0) {
+        buckets.erase(bucket);
+    } else if (bucket->bitmap && bucket->cardinality < array_limit / 2) {
+        to_array(*bucket); // Half the threshold, so a bucket at the boundary does not flip on every change
+    }
+    return true;
+}
+
+bool MemberSet::contains(int id) const {
+    if (id < 0) {
+        return false;
+    }
+    uint16_t high = static_cast<uint16_t>(id >> 16);
+    uint16_t low = static_cast<uint16_t>(id & 0xffff);
+
+    auto bucket = find_bucket(high);
+    if (bucket == buckets.end() || bucket->high != high) {
+        return false;
+    }
+    if (bucket->bitmap) {
+        return (bucket->data[low / 16] >> (low % 16)) & 1;
+    }
+    return std::binary_search(bucket->data.begin(), bucket->data.end(), low);
+}
+
+size_t MemberSet::memory_bytes() const {
+    size_t bytes = buckets.capacity() * sizeof(Bucket);
+    for (const Bucket& bucket : buckets) {
+        bytes += bucket.data.capacity() * sizeof(uint16_t);
+    }
+    return bytes;
+}
+
+std::vector<int> MemberSet::to_vector() const {
+    std::vector<int> ids;
+    ids.reserve(count);
+    for_each([&ids](int id) { ids.push_back(id); });
+    return ids;
+}
+
+void MemberSet::to_bitmap(Bucket& bucket) {
+    std::vector<uint16_t> bits(bitmap_words, 0);
+    for (uint16_t low : bucket.data) {
+        bits[low / 16] |= static_cast<uint16_t>(1u << (low % 16));
+    }
+    bucket.data.swap(bits);
+    bucket.bitmap = true;
+}
+
+void MemberSet::to_array(Bucket& bucket) {
+    std::vector<uint16_t> values;
+    values.reserve(bucket.cardinality);
+    for (size_t word = 0; word < bitmap_words; ++word) {
+        for (uint16_t bits = bucket.data[word]; bits != 0; bits &= bits - 1) {
+            values.push_back(static_cast<uint16_t>(word * 16 + __builtin_ctz(bits)));
+        }
+    }
+    bucket.data.swap(values);
+    bucket.bitmap = false;
+}
@@ -0,0 +1,181 @@
+#include "../include/membership_index.h"
+#include <algorithm>
+#include <iterator>
+
+namespace {
+
+const MembershipIndex::IdList& empty_list() {
+    static const MembershipIndex::IdList empty = std::make_shared<const std::vector<int>>();
+    return empty;
+}
+
+} // namespace
+
+MembershipIndex::Directory::Directory() {
+    for (auto& shard : shards) {
+        shard = std::make_shared<const Table>();
+    }
+}
+
+MembershipIndex::IdList MembershipIndex::Directory::get(int key) const {
+    std::shared_ptr<const Table> table = std::atomic_load(&shards[shard_of(key)]);
+    auto found = table->find(key);
+    return found == table->end() ? empty_list() : found->second;
+}
+
+void MembershipIndex::Directory::insert(int key, int value) {
+    std::shared_ptr<const Table>& slot = shards[shard_of(key)];
+    std::shared_ptr<const Table> current = std::atomic_load(&slot);
+
+    std::shared_ptr<std::vector<int>> list;
+    auto found = current->find(key);
+    if (found == current->end()) {
+        list = std::make_shared<std::vector<int>>();
+    } else if (std::binary_search(found->second->begin(), found->second->end(), value)) {
+        return;
+    } else {
+        list = std::make_shared<std::vector<int>>(*found->second);
+    }
+    list->insert(std::upper_bound(list->begin(), list->end(), value), value);
+
+    std::shared_ptr<Table> next = std::make_shared<Table>(*current);
+    (*next)[key] = std::move(list);
+    std::atomic_store(&slot, std::shared_ptr<const Table>(std::move(next)));
+}
+
+void MembershipIndex::Directory::insert_values(int key, const std::vector<int>& values) {
+    std::shared_ptr<const Table>& slot = shards[shard_of(key)];
+    std::shared_ptr<const Table> current = std::atomic_load(&slot);
+
+    std::vector<int> sorted(values);
+    std::sort(sorted.begin(), sorted.end());
+    auto found = current->find(key);
+    std::shared_ptr<std::vector<int>> list = std::make_shared<std::vector<int>>();
+    if (found == current->end()) {
+        list->assign(sorted.begin(), sorted.end());
+    } else {
+        list->reserve(found->second->size() + sorted.size());
+        std::merge(found->second->begin(), found->second->end(), sorted.begin(), sorted.end(), std::back_inserter(*list));
+    }
+    list->erase(std::unique(list->begin(), list->end()), list->end());
+
+    std::shared_ptr<Table> next = std::make_shared<Table>(*current);
+    (*next)[key] = std::move(list);
+    std::atomic_store(&slot, std::shared_ptr<const Table>(std::move(next)));
+}
+
+void MembershipIndex::Directory::insert_keys(const std::vector<int>& keys, int value) {
+    // Copy each touched shard's table once, however many of its keys change
+    std::shared_ptr<Table> next[shard_count];
+    for (int key : keys) {
+        size_t shard = shard_of(key);
+        if (!next[shard]) {
+            next[shard] = std::make_shared<Table>(*std::atomic_load(&shards[shard]));
+        }
+        IdList& entry = (*next[shard])[key];
+        if (!entry) {
+            entry = std::make_shared<const std::vector<int>>(1, value);
+        } else if (!std::binary_search(entry->begin(), entry->end(), value)) {
+            std::shared_ptr<std::vector<int>> list = std::make_shared<std::vector<int>>(*entry);
+            list->insert(std::upper_bound(list->begin(), list->end(), value), value);
+            entry = std::move(list);
+        }
+    }
+    for (int i = 0; i < shard_count; ++i) {
+        if (next[i]) {
+            std::atomic_store(&shards[i], std::shared_ptr<const Table>(std::move(next[i])));
+        }
+    }
+}
+
+void MembershipIndex::Directory::erase(int key, int value) {
+    std::shared_ptr<const Table>& slot = shards[shard_of(key)];
+    std::shared_ptr<const Table> current = std::atomic_load(&slot);
+
+    auto found = current->find(key);
+    if (found == current->end() || !std::binary_search(found->second->begin(), found->second->end(), value)) {
+        return;
+    }
+
+    std::shared_ptr<Table> next = std::make_shared<Table>(*current);
+    if (found->second->size() == 1) {
+        next->erase(key);
+    } else {
+        std::shared_ptr<std::vector<int>> list = std::make_shared<std::vector<int>>(*found->second);
+        list->erase(std::lower_bound(list->begin(), list->end(), value));
+        (*next)[key] = std::move(list);
+    }
+    std::atomic_store(&slot, std::shared_ptr<const Table>(std::move(next)));
+}
+
+void MembershipIndex::Directory::reset(std::unordered_map<int, std::vector<int>>& lists) {
+    std::shared_ptr<Table> tables[shard_count];
+    for (auto& table : tables) {
+        table = std::make_shared<Table>();
+    }
+    for (auto& entry : lists) {
+        std::vector<int>& ids = entry.second;
+        std::sort(ids.begin(), ids.end());
+        ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+        (*tables[shard_of(entry.first)])[entry.first] = std::make_shared<const std::vector<int>>(std::move(ids));
+    }
+    for (int i = 0; i < shard_count; ++i) {
+        std::atomic_store(&shards[i], std::shared_ptr<const Table>(std::move(tables[i])));
+    }
+}
+
+MembershipIndex::MembershipIndex() : is_loaded(false) {
+}
+
+void MembershipIndex::load(const std::vector<std::pair<int, int>>& memberships) {
+    std::unordered_map<int, std::vector<int>> members;
+    std::unordered_map<int, std::vector<int>> groups;
+    for (const auto& row : memberships) {
+        members[row.first].push_back(row.second);
+        groups[row.second].push_back(row.first);
+    }
+
+    std::lock_guard<std::mutex> lock(write_mutex);
+    by_group.reset(members);
+    by_user.reset(groups);
+    is_loaded = true;
+}
+
+void MembershipIndex::add(int group_id, int user_id) {
+    std::lock_guard<std::mutex> lock(write_mutex);
+    by_group.insert(group_id, user_id);
+    by_user.insert(user_id, group_id);
+}
+
+void MembershipIndex::add_members(int group_id, const std::vector<int>& user_ids) {
+    if (user_ids.empty()) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(write_mutex);
+    by_group.insert_values(group_id, user_ids);
+    by_user.insert_keys(user_ids, group_id);
+}
+
+void MembershipIndex::remove(int group_id, int user_id) {
+    std::lock_guard<std::mutex> lock(write_mutex);
+    by_group.erase(group_id, user_id);
+    by_user.erase(user_id, group_id);
+}
+
+MembershipIndex::IdList MembershipIndex::members(int group_id) const {
+    return by_group.get(group_id);
+}
+
+MembershipIndex::IdList MembershipIndex::groups(int user_id) const {
+    return by_user.get(user_id);
+}
+
+bool MembershipIndex::is_member(int group_id, int user_id) const {
+    // Check the user's side: a user is in far fewer groups than a big group has members
+    IdList list = by_user.get(user_id);
+    return std::binary_search(list->begin(), list->end(), group_id);
+}
+
+bool MembershipIndex::loaded() const {
+    return is_loaded.load(std::memory_order_acquire);
+}
@@ -0,0 +1,431 @@
+#include "../include/message_archive.h"
+#include "../include/logger.h"
+#include <sqlite3.h>
+#include <zlib.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <climits>
+#include <cstdio>
+#include <unistd.h>
+#include <sys/stat.h>
+
+namespace {
+
+// Statements run against partition files, indexing each connection's statement cache
+enum PartitionStatement
+{
+    INSERT_BLOCK,
+    INSERT_INDEX,
+    BLOCKS_BEFORE,
+    COUNT_BLOCKS_AFTER,
+    FIND_GROUP,
+};
+
+const char* const partition_sql[] = {
+    "INSERT INTO MessageBlocks (group_id, first_message_id, last_message_id, message_count, raw_size, data) "
+    "VALUES (?, ?, ?, ?, ?, ?);",
+    "INSERT INTO MessageIndex (message_id, group_id) VALUES (?, ?);",
+    "SELECT raw_size, data FROM MessageBlocks WHERE group_id = ? AND first_message_id < ? "
+    "ORDER BY first_message_id DESC;",
+    "SELECT coalesce(sum(message_count), 0) FROM MessageBlocks WHERE group_id = ? AND first_message_id > ?;",
+    "SELECT group_id FROM MessageIndex WHERE message_id = ?;",
+};
+
+const char* const partition_schema =
+    "CREATE TABLE MessageBlocks ("
+    "group_id INTEGER NOT NULL, first_message_id INTEGER NOT NULL, last_message_id INTEGER NOT NULL, "
+    "message_count INTEGER NOT NULL, raw_size INTEGER NOT NULL, data BLOB NOT NULL, "
+    "PRIMARY KEY (group_id, first_message_id));"
+    "CREATE TABLE MessageIndex (message_id INTEGER PRIMARY KEY, group_id INTEGER NOT NULL);";
+
+// A block closes at whichever limit it reaches first
+const size_t block_messages = 128;
+const size_t block_bytes_limit = 32 * 1024;
+
+// Cold files see occasional reads; a small cache each keeps many months cheap
+DatabaseTuning partition_tuning() {
+    DatabaseTuning tuning;
+    tuning.cache_size_kib = 2048;
+    return tuning;
+}
+
+sqlite3_stmt* partition_statement(DbConnection& connection, PartitionStatement id) {
+    return connection.statement(id, partition_sql[id]);
+}
+
+// file: URI for a sealed partition; immutable=1 skips locking and change detection
+std::string read_only_uri(const std::string& path) {
+    std::string uri = "file:";
+    for (char c : path) {
+        if (c == '%' || c == '?' || c == '#') {
+            char escaped[4];
+            snprintf(escaped, sizeof(escaped), "%%%02X", static_cast<unsigned char>(c));
+            uri += escaped;
+        } else {
+            uri += c;
+        }
+    }
+    return uri + "?immutable=1";
+}
+
+// Block payload: per message, ascending by message_id, little-endian
+// message_id u32, sender_id u32, sent_at_ms u64, text length u32,
+// file_path length u32, then the text and file_path bytes
+void put_u32(std::string& out, uint32_t value) {
+    for (int shift = 0; shift < 32; shift += 8) {
+        out += static_cast<char>((value >> shift) & 0xff);
+    }
+}
+
+void put_u64(std::string& out, uint64_t value) {
+    for (int shift = 0; shift < 64; shift += 8) {
+        out += static_cast<char>((value >> shift) & 0xff);
+    }
+}
+
+uint64_t get_le(const unsigned char* data, int bytes) {
+    uint64_t value = 0;
+    for (int i = bytes - 1; i >= 0; --i) {
+        value = (value << 8) | data[i];
+    }
+    return value;
+}
+
+const size_t record_header = 4 + 4 + 8 + 4 + 4;
+
+// Inflates a stored block into messages, ascending
+bool decode_block(sqlite3_stmt* stmt, int group_id, std::vector<MessageRecord>& block) {
+    block.clear();
+    uLongf raw_size = static_cast<uLongf>(sqlite3_column_int(stmt, 0));
+    const Bytef* data = static_cast<const Bytef*>(sqlite3_column_blob(stmt, 1));
+    uLong size = static_cast<uLong>(sqlite3_column_bytes(stmt, 1));
+
+    std::string raw(raw_size, '\0');
+    if (uncompress(reinterpret_cast<Bytef*>(&raw[0]), &raw_size, data, size) != Z_OK || raw_size != raw.size()) {
+        log_error() << "Corrupt archive block in group " << group_id;
+        return false;
+    }
+
+    const unsigned char* position = reinterpret_cast<const unsigned char*>(raw.data());
+    const unsigned char* end = position + raw.size();
+    while (position < end) {
+        if (static_cast<size_t>(end - position) < record_header) {
+            return false;
+        }
+        MessageRecord message;
+        message.message_id = static_cast<int>(get_le(position, 4));
+        message.sender_id = static_cast<int>(get_le(position + 4, 4));
+        message.group_id = group_id;
+        message.sent_at_ms = static_cast<int64_t>(get_le(position + 8, 8));
+        size_t text_length = get_le(position + 16, 4);
+        size_t file_length = get_le(position + 20, 4);
+        position += record_header;
+        if (static_cast<size_t>(end - position) < text_length + file_length) {
+            return false;
+        }
+        message.text.assign(reinterpret_cast<const char*>(position), text_length);
+        message.file_path.assign(reinterpret_cast<const char*>(position + text_length), file_length);
+        position += text_length + file_length;
+        block.push_back(std::move(message));
+    }
+    return true;
+}
+
+} // namespace
+
+MessageArchive::MessageArchive(const std::string& directory) : root(directory) {}
+
+MessageArchive::~MessageArchive() = default;
+
+bool MessageArchive::enabled() const {
+    return !root.empty();
+}
+
+const std::string& MessageArchive::directory() const {
+    return root;
+}
+
+bool MessageArchive::open(const PartitionInfo& partition) {
+    if (!enabled()) {
+        return false;
+    }
+    std::shared_ptr<Partition> opened(new Partition{partition, nullptr});
+    opened->connection.reset(new DbConnection(read_only_uri(root + "/" + partition.file), true, partition_tuning()));
+    if (!opened->connection->is_open()) {
+        log_error() << "Failed to open archive partition " << partition.file;
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(partitions_mutex);
+    auto position = std::find_if(partitions_by_age.begin(), partitions_by_age.end(),
+                                 [&partition](const std::shared_ptr<Partition>& existing) {
+                                     return existing->info.first_message_id < partition.first_message_id;
+                                 });
+    partitions_by_age.insert(position, std::move(opened));
+    return true;
+}
+
+std::vector<PartitionInfo> MessageArchive::partitions() const {
+    std::vector<PartitionInfo> infos;
+    for (const auto& partition : snapshot()) {
+        infos.push_back(partition->info);
+    }
+    return infos;
+}
+
+MessageArchive::PartitionList MessageArchive::snapshot() const {
+    std::lock_guard<std::mutex> lock(partitions_mutex);
+    return partitions_by_age;
+}
+
+bool MessageArchive::read_group_page(int group_id, int before_message_id, int limit, std::vector<MessageRecord>& messages) {
+    int cursor = before_message_id > 0 ? before_message_id : INT_MAX;
+    size_t wanted = messages.size() + static_cast<size_t>(std::max(limit, 0));
+    std::vector<MessageRecord> block;
+
+    for (const auto& partition : snapshot()) {
+        if (messages.size() >= wanted) {
+            break;
+        }
+        if (partition->info.first_message_id >= cursor) {
+            continue; // Entirely newer than the page
+        }
+
+        std::lock_guard<std::recursive_mutex> lock(partition->connection->mutex());
+        ScopedStatement stmt(partition_statement(*partition->connection, BLOCKS_BEFORE));
+        if (!stmt) {
+            return false;
+        }
+        sqlite3_bind_int(stmt.get(), 1, group_id);
+        sqlite3_bind_int(stmt.get(), 2, cursor);
+
+        while (messages.size() < wanted && sqlite3_step(stmt.get()) == SQLITE_ROW) {
+            if (!decode_block(stmt.get(), group_id, block)) {
+                return false;
+            }
+            for (auto message = block.rbegin(); message != block.rend() && messages.size() < wanted; ++message) {
+                if (message->message_id < cursor) {
+                    messages.push_back(std::move(*message));
+                }
+            }
+        }
+        if (!messages.empty()) {
+            cursor = std::min(cursor, messages.back().message_id);
+        }
+    }
+    return true;
+}
+
+void MessageArchive::get_group_message_ids(int group_id, std::vector<int>& message_ids) {
+    std::vector<MessageRecord> block;
+    for (const auto& partition : snapshot()) {
+        std::lock_guard<std::recursive_mutex> lock(partition->connection->mutex());
+        ScopedStatement stmt(partition_statement(*partition->connection, BLOCKS_BEFORE));
+        if (!stmt) {
+            return;
+        }
+        sqlite3_bind_int(stmt.get(), 1, group_id);
+        sqlite3_bind_int(stmt.get(), 2, INT_MAX);
+
+        while (sqlite3_step(stmt.get()) == SQLITE_ROW && decode_block(stmt.get(), group_id, block)) {
+            for (auto message = block.rbegin(); message != block.rend(); ++message) {
+                message_ids.push_back(message->message_id);
+            }
+        }
+    }
+}
+
+int MessageArchive::count_after(int group_id, int message_id) {
+    int count = 0;
+    std::vector<MessageRecord> block;
+    for (const auto& partition : snapshot()) {
+        if (partition->info.last_message_id <= message_id) {
+            break; // This and every older partition is covered
+        }
+
+        std::lock_guard<std::recursive_mutex> lock(partition->connection->mutex());
+        ScopedStatement whole_stmt(partition_statement(*partition->connection, COUNT_BLOCKS_AFTER));
+        ScopedStatement partial_stmt(partition_statement(*partition->connection, BLOCKS_BEFORE));
+        if (!whole_stmt || !partial_stmt) {
+            return count;
+        }
+
+        // Whole blocks past the marker by their counts, the one it falls in by inflating it
+        sqlite3_bind_int(whole_stmt.get(), 1, group_id);
+        sqlite3_bind_int(whole_stmt.get(), 2, message_id);
+        if (sqlite3_step(whole_stmt.get()) == SQLITE_ROW) {
+            count += sqlite3_column_int(whole_stmt.get(), 0);
+        }
+        sqlite3_bind_int(partial_stmt.get(), 1, group_id);
+        sqlite3_bind_int64(partial_stmt.get(), 2, static_cast<int64_t>(message_id) + 1);
+        if (sqlite3_step(partial_stmt.get()) == SQLITE_ROW && decode_block(partial_stmt.get(), group_id, block)) {
+            count += static_cast<int>(std::count_if(block.begin(), block.end(), [message_id](const MessageRecord& message) {
+                return message.message_id > message_id;
+            }));
+        }
+    }
+    return count;
+}
+
+bool MessageArchive::find_message(int message_id, MessageRecord& message) {
+    std::vector<MessageRecord> block;
+    for (const auto& partition : snapshot()) {
+        if (message_id < partition->info.first_message_id || message_id > partition->info.last_message_id) {
+            continue;
+        }
+
+        std::lock_guard<std::recursive_mutex> lock(partition->connection->mutex());
+        ScopedStatement group_stmt(partition_statement(*partition->connection, FIND_GROUP));
+        ScopedStatement block_stmt(partition_statement(*partition->connection, BLOCKS_BEFORE));
+        if (!group_stmt || !block_stmt) {
+            return false;
+        }
+        sqlite3_bind_int(group_stmt.get(), 1, message_id);
+        if (sqlite3_step(group_stmt.get()) != SQLITE_ROW) {
+            return false;
+        }
+        int group_id = sqlite3_column_int(group_stmt.get(), 0);
+
+        sqlite3_bind_int(block_stmt.get(), 1, group_id);
+        sqlite3_bind_int64(block_stmt.get(), 2, static_cast<int64_t>(message_id) + 1);
+        if (sqlite3_step(block_stmt.get()) != SQLITE_ROW || !decode_block(block_stmt.get(), group_id, block)) {
+            return false;
+        }
+        for (MessageRecord& candidate : block) {
+            if (candidate.message_id == message_id) {
+                message = std::move(candidate);
+                return true;
+            }
+        }
+        return false;
+    }
+    return false;
+}
+
+MessageArchive::Writer::Writer(const MessageArchive& archive, const std::string& file)
+    : path(archive.directory() + "/" + file), group_id(-1), block_bytes(0),
+      totals{file, "", INT_MAX, 0, 0}, failed(false) {
+    if (!archive.enabled() || (mkdir(archive.directory().c_str(), 0755) != 0 && errno != EEXIST)) {
+        log_error() << "Failed to create archive directory " << archive.directory();
+        failed = true;
+        return;
+    }
+
+    // Built under a temporary name, so a crash never leaves a partial file the catalog could point at
+    std::string partial = path + ".partial";
+    unlink(partial.c_str());
+    connection.reset(new DbConnection(partial, false));
+    failed = !connection->is_open() ||
+             !connection->execute("PRAGMA journal_mode = OFF;", "Failed to configure archive partition") ||
+             !connection->execute(partition_schema, "Failed to create archive partition") ||
+             !connection->execute("BEGIN;", "Failed to start archive partition");
+}
+
+MessageArchive::Writer::~Writer() {
+    if (connection) {
+        connection.reset();
+        unlink((path + ".partial").c_str()); // finish() was not reached
+    }
+}
+
+bool MessageArchive::Writer::is_open() const {
+    return !failed;
+}
+
+bool MessageArchive::Writer::add(const MessageRecord& message) {
+    if (failed) {
+        return false;
+    }
+    if (message.group_id != group_id || block.size() >= block_messages || block_bytes >= block_bytes_limit) {
+        if (!flush_block()) {
+            return false;
+        }
+        group_id = message.group_id;
+    }
+    block.push_back(message);
+    block_bytes += record_header + message.text.size() + message.file_path.size();
+    return true;
+}
+
+bool MessageArchive::Writer::flush_block() {
+    if (block.empty()) {
+        return true;
+    }
+
+    std::string raw;
+    raw.reserve(block_bytes);
+    for (const MessageRecord& message : block) {
+        put_u32(raw, static_cast<uint32_t>(message.message_id));
+        put_u32(raw, static_cast<uint32_t>(message.sender_id));
+        put_u64(raw, static_cast<uint64_t>(message.sent_at_ms));
+        put_u32(raw, static_cast<uint32_t>(message.text.size()));
+        put_u32(raw, static_cast<uint32_t>(message.file_path.size()));
+        raw += message.text;
+        raw += message.file_path;
+    }
+
+    // Archiving is offline, so it can afford the slowest, smallest setting
+    uLongf compressed_size = compressBound(static_cast<uLong>(raw.size()));
+    std::string compressed(compressed_size, '\0');
+    if (compress2(reinterpret_cast<Bytef*>(&compressed[0]), &compressed_size,
+                  reinterpret_cast<const Bytef*>(raw.data()), static_cast<uLong>(raw.size()), Z_BEST_COMPRESSION) != Z_OK) {
+        log_error() << "Failed to compress archive block";
+        failed = true;
+        return false;
+    }
+
+    ScopedStatement block_stmt(partition_statement(*connection, INSERT_BLOCK));
+    ScopedStatement index_stmt(partition_statement(*connection, INSERT_INDEX));
+    if (!block_stmt || !index_stmt) {
+        failed = true;
+        return false;
+    }
+    sqlite3_bind_int(block_stmt.get(), 1, group_id);
+    sqlite3_bind_int(block_stmt.get(), 2, block.front().message_id);
+    sqlite3_bind_int(block_stmt.get(), 3, block.back().message_id);
+    sqlite3_bind_int(block_stmt.get(), 4, static_cast<int>(block.size()));
+    sqlite3_bind_int(block_stmt.get(), 5, static_cast<int>(raw.size()));
+    sqlite3_bind_blob(block_stmt.get(), 6, compressed.data(), static_cast<int>(compressed_size), SQLITE_STATIC);
+    if (sqlite3_step(block_stmt.get()) != SQLITE_DONE) {
+        log_error() << "Failed to write archive block: " << sqlite3_errmsg(connection->handle());
+        failed = true;
+        return false;
+    }
+
+    for (const MessageRecord& message : block) {
+        sqlite3_bind_int(index_stmt.get(), 1, message.message_id);
+        sqlite3_bind_int(index_stmt.get(), 2, group_id);
+        if (sqlite3_step(index_stmt.get()) != SQLITE_DONE) {
+            log_error() << "Failed to index archived message: " << sqlite3_errmsg(connection->handle());
+            failed = true;
+            return false;
+        }
+        sqlite3_reset(index_stmt.get());
+
+        totals.first_message_id = std::min(totals.first_message_id, message.message_id);
+        totals.last_message_id = std::max(totals.last_message_id, message.message_id);
+        totals.message_count++;
+    }
+
+    block.clear();
+    block_bytes = 0;
+    return true;
+}
+
+bool MessageArchive::Writer::finish(PartitionInfo& info) {
+    if (failed || !flush_block() ||
+        !connection->execute("COMMIT;", "Failed to commit archive partition")) {
+        return false;
+    }
+    connection.reset();
+
+    std::string partial = path + ".partial";
+    if (rename(partial.c_str(), path.c_str()) != 0 || chmod(path.c_str(), 0444) != 0) {
+        log_error() << "Failed to seal archive partition " << path << ": " << strerror(errno);
+        unlink(partial.c_str());
+        return false;
+    }
+    info = totals;
+    return true;
+}
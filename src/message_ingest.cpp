@@ -0,0 +1,186 @@
+#include "../include/message_ingest.h"
+#include "../include/logger.h"
+#include "../include/metrics.h"
+#include <memory>
+#include <vector>
+#include <algorithm>
+
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+const metrics::Gauge queued_messages("chat_ingest_queued_messages", "Messages waiting for the ingest writer");
+const metrics::Histogram batch_commit("chat_ingest_commit_seconds", "BEGIN to COMMIT of one ingest batch");
+const metrics::Histogram batch_size("chat_ingest_batch_messages", "Messages per ingest batch", "", 1);
+const metrics::Counter failed_messages("chat_ingest_failed_messages_total", "Messages the ingest writer could not store");
+
+} // namespace
+
+MessageIngestQueue::MessageIngestQueue(ChatDatabase& database, const IngestOptions& options)
+    : database(database), options(options), enqueued(0), committed(0), stopping(false),
+      totals{0, 0, 0, std::chrono::microseconds(0), 0.0}, started_at(Clock::now()) {
+    if (this->options.max_batch == 0) {
+        this->options.max_batch = 1;
+    }
+    if (options.durability) {
+        database.set_durability(*options.durability);
+    }
+    writer = std::thread(&MessageIngestQueue::run, this);
+}
+
+MessageIngestQueue::~MessageIngestQueue() {
+    stop();
+}
+
+std::future<int> MessageIngestQueue::enqueue(int sender_id, int group_id, std::string_view text, std::string_view file_path) {
+    auto promise = std::make_shared<std::promise<int>>();
+    std::future<int> result = promise->get_future();
+    enqueue(sender_id, group_id, text, file_path,
+            [promise](int message_id) { promise->set_value(message_id); });
+    return result;
+}
+
+void MessageIngestQueue::enqueue(int sender_id, int group_id, std::string_view text, std::string_view file_path, Callback done) {
+    push({sender_id, group_id, MessageText(text), MessageText(file_path), std::move(done), Clock::now()});
+}
+
+void MessageIngestQueue::push(PendingMessage message) {
+    std::unique_lock<std::mutex> lock(queue_mutex);
+    if (stopping) {
+        lock.unlock();
+        log_warn() << "Message ingest queue is stopped";
+        if (message.done) {
+            message.done(-1);
+        }
+        return;
+    }
+    queue.push_back(std::move(message));
+    ++enqueued;
+    queued_messages.add(1);
+    // Wake the writer for the first message of a batch and when a batch fills up
+    if (queue.size() == 1 || queue.size() >= options.max_batch) {
+        queue_ready.notify_one();
+    }
+}
+
+void MessageIngestQueue::flush() {
+    std::unique_lock<std::mutex> lock(queue_mutex);
+    uint64_t target = enqueued;
+    queue_ready.notify_one();
+    queue_drained.wait(lock, [&] { return committed >= target; });
+}
+
+void MessageIngestQueue::stop() {
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        stopping = true;
+    }
+    queue_ready.notify_one();
+    if (writer.joinable()) {
+        writer.join();
+    }
+}
+
+void MessageIngestQueue::set_batch_observer(BatchObserver observer) {
+    std::lock_guard<std::mutex> lock(queue_mutex);
+    this->observer = std::move(observer);
+}
+
+IngestStats MessageIngestQueue::stats() const {
+    std::lock_guard<std::mutex> lock(queue_mutex);
+    IngestStats current = totals;
+    std::chrono::duration<double> elapsed = Clock::now() - started_at;
+    current.throughput = elapsed.count() > 0 ? (totals.messages - totals.failed) / elapsed.count() : 0.0;
+    return current;
+}
+
+size_t MessageIngestQueue::pending() const {
+    std::lock_guard<std::mutex> lock(queue_mutex);
+    return queue.size();
+}
+
+void MessageIngestQueue::run() {
+    PendingQueue batch;
+    std::unique_lock<std::mutex> lock(queue_mutex);
+    while (true) {
+        queue_ready.wait(lock, [&] { return stopping || !queue.empty(); });
+        if (queue.empty()) {
+            break; // Stopping with nothing left to store
+        }
+
+        // Give the batch until max_delay after its oldest message to fill up
+        Clock::time_point deadline = queue.front().enqueued_at + options.max_delay;
+        queue_ready.wait_until(lock, deadline, [&] { return stopping || queue.size() >= options.max_batch; });
+
+        size_t count = std::min(queue.size(), options.max_batch);
+        for (size_t i = 0; i < count; ++i) {
+            batch.push_back(std::move(queue.front()));
+            queue.pop_front();
+        }
+        queued_messages.add(-static_cast<int64_t>(count));
+
+        lock.unlock();
+        write_batch(batch);
+        batch.clear();
+        lock.lock();
+
+        committed += count;
+        queue_drained.notify_all();
+    }
+}
+
+void MessageIngestQueue::write_batch(PendingQueue& batch) {
+    std::vector<int> message_ids(batch.size(), -1);
+    Clock::time_point begin = Clock::now();
+    {
+        ChatDatabase::Transaction transaction(database);
+        if (transaction.active()) {
+            for (size_t i = 0; i < batch.size(); ++i) {
+                const PendingMessage& message = batch[i];
+                message_ids[i] = database.store_message(message.sender_id, message.group_id, message.text, message.file_path);
+            }
+            if (!transaction.commit()) {
+                message_ids.assign(batch.size(), -1);
+            }
+        }
+    }
+    Clock::time_point end = Clock::now();
+
+    BatchStats batch_stats;
+    batch_stats.messages = batch.size();
+    batch_stats.failed = 0;
+    for (int message_id : message_ids) {
+        if (message_id == -1) {
+            ++batch_stats.failed;
+        }
+    }
+    batch_stats.commit_time = std::chrono::duration_cast<std::chrono::microseconds>(end - begin);
+    batch_commit.record(end - begin);
+    batch_size.record(batch_stats.messages);
+    failed_messages.add(batch_stats.failed);
+    batch_stats.latency = std::chrono::duration_cast<std::chrono::microseconds>(end - batch.front().enqueued_at);
+    std::chrono::duration<double> seconds = end - begin;
+    batch_stats.throughput = seconds.count() > 0 ? batch.size() / seconds.count() : 0.0;
+
+    // Report results before the writer counts the batch as committed
+    for (size_t i = 0; i < batch.size(); ++i) {
+        if (batch[i].done) {
+            batch[i].done(message_ids[i]);
+        }
+    }
+
+    BatchObserver current_observer;
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        totals.batches++;
+        totals.messages += batch_stats.messages;
+        totals.failed += batch_stats.failed;
+        if (batch_stats.latency > totals.max_latency) {
+            totals.max_latency = batch_stats.latency;
+        }
+        current_observer = observer;
+    }
+    if (current_observer) {
+        current_observer(batch_stats);
+    }
+}
@@ -0,0 +1,704 @@
+#include "../include/message_log.h"
+#include "../include/message_ingest.h"
+#include "../include/db_connection.h"
+#include "../include/logger.h"
+#include "../include/metrics.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+const metrics::Histogram sync_time("chat_log_sync_seconds", "fdatasync of the message log");
+const metrics::Histogram sync_size("chat_log_sync_messages", "Messages made durable by one log sync", "", 1);
+const metrics::Gauge unapplied_messages("chat_log_unapplied_messages", "Logged messages not yet in SQLite");
+const std::chrono::milliseconds retry_delay(100); // Before applying a batch again after SQLite refused it
+
+// Fixed part of a record; text and file path follow, padded to 8 bytes.
+// A zeroed header (preallocated space) ends a segment.
+struct RecordHeader
+{
+    uint32_t length; // Bytes of text and file path
+    uint32_t checksum; // crc32 of the header, with this field zero, and the payload
+    int32_t message_id;
+    int32_t sender_id;
+    int32_t group_id;
+    uint32_t text_length;
+    int64_t sent_at_ms;
+};
+
+static_assert(sizeof(RecordHeader) == 32, "RecordHeader is written to disk as is");
+
+size_t record_size(size_t payload) {
+    return (sizeof(RecordHeader) + payload + 7) & ~static_cast<size_t>(7);
+}
+
+uint32_t checksum(const RecordHeader& header, const char* payload) {
+    RecordHeader copy = header;
+    copy.checksum = 0;
+    uLong crc = crc32(0L, reinterpret_cast<const Bytef*>(&copy), sizeof(copy));
+    return static_cast<uint32_t>(crc32(crc, reinterpret_cast<const Bytef*>(payload), header.length));
+}
+
+int64_t now_ms() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+// Segment files are numbered in the order they take appends, zero-padded so
+// names sort that way, which is also message_id order
+std::string segment_file(int sequence) {
+    char name[32];
+    snprintf(name, sizeof(name), "%010d.seg", sequence);
+    return name;
+}
+
+// A new file is only durable once its directory entry is
+bool sync_directory(const std::string& directory) {
+    int fd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    bool synced = fsync(fd) == 0;
+    close(fd);
+    return synced;
+}
+
+} // namespace
+
+struct MessageLog::Segment
+{
+    explicit Segment(const std::string& path)
+        : path(path), fd(-1), map(nullptr), size(0), used(0), last_message_id(0), dirty(false) {}
+
+    ~Segment() {
+        if (map) {
+            munmap(map, size);
+        }
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+
+    std::string path;
+    int fd;
+    char* map;
+    size_t size;
+    size_t used; // Guarded by log_mutex
+    int last_message_id; // Guarded by log_mutex
+    bool dirty; // Written since the sync thread last flushed it; guarded by log_mutex
+};
+
+MessageLog::MessageLog(ChatDatabase& database, const MessageLogOptions& options)
+    : database(database), options(options), opened(false), next_sequence(1), reserved_next(0), reserved_end(0),
+      spare_first(0), spare_count(0), ids_failed(false), synced(0), finished(0), last_appended_id(0),
+      synced_through(0), finished_through(0), failed(false), sync_failed(false), stopping(false), abandoned(false),
+      totals{0, 0, 0, 0, 0, 0, 0, 0} {
+    this->options.segment_bytes = std::max<size_t>(this->options.segment_bytes, 64 * 1024);
+    this->options.max_batch = std::max<size_t>(this->options.max_batch, 1);
+    this->options.reserved_ids = std::max(this->options.reserved_ids, 1);
+    if (is_memory_database(database.name())) {
+        return; // Appends go to the ingest queue
+    }
+    log_directory = database.name() + ".log";
+    opened = open();
+    if (!opened) {
+        log_error() << "Message log " << log_directory << " is unusable; messages are refused";
+        return;
+    }
+    syncer = std::thread(&MessageLog::run_sync, this);
+    indexer = std::thread(&MessageLog::run_indexer, this);
+}
+
+MessageLog::~MessageLog() {
+    stop();
+}
+
+bool MessageLog::is_open() const {
+    return opened;
+}
+
+const std::string& MessageLog::directory() const {
+    return log_directory;
+}
+
+bool MessageLog::open() {
+    if (mkdir(log_directory.c_str(), 0755) != 0 && errno != EEXIST) {
+        log_error() << "Failed to create " << log_directory << ": " << strerror(errno);
+        return false;
+    }
+    if (!replay()) {
+        return false;
+    }
+
+    // The first segment, its successor and the first id block are ready before any append
+    int count = 0;
+    int first = database.reserve_message_ids(options.reserved_ids, count);
+    std::shared_ptr<Segment> active = first > 0 ? create_segment() : nullptr;
+    spare_segment = active ? create_segment() : nullptr;
+    if (!spare_segment) {
+        return false;
+    }
+    segments.push_back(std::move(active));
+    reserved_next = first;
+    reserved_end = static_cast<int64_t>(first) + count;
+    return true;
+}
+
+bool MessageLog::replay() {
+    int checkpoint = database.message_log_checkpoint();
+    if (checkpoint < 0) {
+        return false;
+    }
+    std::vector<std::pair<int, int>> failures; // Answered with -1, though they may have reached the disk
+    if (!database.failed_log_ranges(failures)) {
+        return false;
+    }
+    auto answered_failed = [&](int message_id) {
+        return std::any_of(failures.begin(), failures.end(), [&](const std::pair<int, int>& range) {
+            return message_id >= range.first && message_id <= range.second;
+        });
+    };
+    std::vector<std::string> files;
+    DIR* directory = opendir(log_directory.c_str());
+    if (!directory) {
+        log_error() << "Failed to list " << log_directory << ": " << strerror(errno);
+        return false;
+    }
+    while (dirent* entry = readdir(directory)) {
+        std::string name = entry->d_name;
+        if (name.size() > 4 && name.compare(name.size() - 4, 4, ".seg") == 0) {
+            files.push_back(name);
+            // New segments sort after these, even if some are still left after a crash
+            next_sequence = std::max(next_sequence, atoi(name.c_str()) + 1);
+        }
+    }
+    closedir(directory);
+    std::sort(files.begin(), files.end());
+
+    std::vector<MessageRecord> batch;
+    uint64_t rejected = 0;
+    for (const std::string& name : files) {
+        std::string path = log_directory + "/" + name;
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat info;
+        if (fd < 0 || fstat(fd, &info) != 0) {
+            log_error() << "Failed to open " << path << ": " << strerror(errno);
+            if (fd >= 0) {
+                close(fd);
+            }
+            return false;
+        }
+        size_t size = static_cast<size_t>(info.st_size);
+        void* map = size > 0 ? mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0) : nullptr;
+        close(fd);
+        if (map == MAP_FAILED) {
+            log_error() << "Failed to map " << path << ": " << strerror(errno);
+            return false;
+        }
+
+        // Records end at the first zeroed or torn one; nothing after it was acknowledged
+        const char* data = static_cast<const char*>(map);
+        size_t offset = 0;
+        while (offset + sizeof(RecordHeader) <= size) {
+            RecordHeader header;
+            memcpy(&header, data + offset, sizeof(header));
+            const char* payload = data + offset + sizeof(header);
+            if (header.message_id <= 0 || header.text_length > header.length ||
+                header.length > size - offset - sizeof(header) || checksum(header, payload) != header.checksum) {
+                break;
+            }
+            if (header.message_id > checkpoint && !answered_failed(header.message_id)) {
+                batch.push_back({header.message_id, header.sender_id, header.group_id, "",
+                                 std::string(payload, header.text_length),
+                                 std::string(payload + header.text_length, header.length - header.text_length),
+                                 header.sent_at_ms});
+            }
+            offset += record_size(header.length);
+            if (batch.size() >= options.max_batch) {
+                uint64_t before = rejected;
+                if (!apply(batch, rejected)) {
+                    munmap(map, size);
+                    return false;
+                }
+                totals.replayed += batch.size() - (rejected - before);
+                batch.clear();
+            }
+        }
+        if (map) {
+            munmap(map, size);
+        }
+    }
+    if (!batch.empty()) {
+        uint64_t before = rejected;
+        if (!apply(batch, rejected)) {
+            return false;
+        }
+        totals.replayed += batch.size() - (rejected - before);
+    }
+    totals.parked += rejected;
+    if (totals.replayed > 0) {
+        log_info() << "Replayed " << totals.replayed << " logged messages into " << database.name();
+    }
+
+    // Everything logged is in SQLite now, but the files only go once SQLite
+    // has it on disk; otherwise they are replayed again at the next start
+    if (!files.empty() && !database.checkpoint()) {
+        log_warn() << "Keeping " << files.size() << " replayed segments in " << log_directory << " until the next start";
+        return true;
+    }
+    for (const std::string& name : files) {
+        unlink((log_directory + "/" + name).c_str());
+    }
+    // Every failed range was in those files; ids are never handed out twice, so a leftover is harmless
+    if (!failures.empty()) {
+        database.clear_failed_log_ranges();
+    }
+    return true;
+}
+
+std::shared_ptr<MessageLog::Segment> MessageLog::create_segment() {
+    std::shared_ptr<Segment> segment = std::make_shared<Segment>(log_directory + "/" + segment_file(next_sequence++));
+    segment->fd = ::open(segment->path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (segment->fd < 0) {
+        log_error() << "Failed to create " << segment->path << ": " << strerror(errno);
+        return nullptr;
+    }
+    // Allocated up front, so a full disk fails here instead of as SIGBUS on a mapped write
+    int rc = posix_fallocate(segment->fd, 0, static_cast<off_t>(options.segment_bytes));
+    if (rc != 0) {
+        log_error() << "Failed to allocate " << segment->path << ": " << strerror(rc);
+        unlink(segment->path.c_str());
+        return nullptr;
+    }
+    void* map = mmap(nullptr, options.segment_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, segment->fd, 0);
+    if (map == MAP_FAILED) {
+        log_error() << "Failed to map " << segment->path << ": " << strerror(errno);
+        unlink(segment->path.c_str());
+        return nullptr;
+    }
+    segment->map = static_cast<char*>(map);
+    segment->size = options.segment_bytes;
+    if (!sync_directory(log_directory)) {
+        log_error() << "Failed to sync " << log_directory << ": " << strerror(errno);
+        unlink(segment->path.c_str());
+        return nullptr;
+    }
+    return segment;
+}
+
+MessageLog::Segment* MessageLog::writable_segment(size_t bytes, std::unique_lock<std::mutex>& lock) {
+    Segment* segment = segments.back().get();
+    if (segment->used + bytes <= segment->size) {
+        return segment;
+    }
+    // The sync thread flushes the full segment with the others still dirty
+    segment_ready.wait(lock, [&] { return spare_segment || failed || stopping; });
+    if (!spare_segment) {
+        return nullptr;
+    }
+    segments.push_back(std::move(spare_segment));
+    append_ready.notify_one(); // To make the next spare
+    return segments.back().get();
+}
+
+bool MessageLog::ids_wanted() const {
+    bool running_low = reserved_end - reserved_next < std::max(options.reserved_ids / 2, 1);
+    return !stopping && spare_first == 0 && running_low && (!ids_failed || Clock::now() >= ids_retry_at);
+}
+
+int MessageLog::next_message_id(std::unique_lock<std::mutex>& lock) {
+    if (reserved_next >= reserved_end) {
+        records_durable.notify_all(); // The indexer may not have seen the block run low
+        ids_ready.wait(lock, [&] { return spare_first > 0 || ids_failed || stopping; });
+        if (spare_first == 0) {
+            return -1;
+        }
+        reserved_next = spare_first;
+        reserved_end = static_cast<int64_t>(spare_first) + spare_count;
+        spare_first = 0;
+    }
+    if (ids_wanted()) {
+        records_durable.notify_all();
+    }
+    return reserved_next++;
+}
+
+std::future<int> MessageLog::append(int sender_id, int group_id, std::string_view text, std::string_view file_path) {
+    auto promise = std::make_shared<std::promise<int>>();
+    std::future<int> result = promise->get_future();
+    append(sender_id, group_id, text, file_path, [promise](int message_id) { promise->set_value(message_id); });
+    return result;
+}
+
+void MessageLog::append(int sender_id, int group_id, std::string_view text, std::string_view file_path, Callback done) {
+    if (!opened) {
+        if (log_directory.empty()) {
+            database.ingest_queue().enqueue(sender_id, group_id, text, file_path, std::move(done));
+        } else if (done) {
+            done(-1);
+        }
+        return;
+    }
+    size_t payload = text.size() + file_path.size();
+    size_t bytes = record_size(payload);
+
+    std::unique_lock<std::mutex> lock(log_mutex);
+    int message_id = -1;
+    if (stopping || failed) {
+        log_warn() << "Message log " << log_directory << " takes no more messages";
+    } else if (bytes > options.segment_bytes) {
+        log_warn() << "Message of " << payload << " bytes does not fit a log segment";
+    } else {
+        message_id = next_message_id(lock);
+    }
+    Segment* segment = message_id == -1 ? nullptr : writable_segment(bytes, lock);
+    if (!segment) {
+        // An id taken but never written is only a gap
+        lock.unlock();
+        if (done) {
+            done(-1);
+        }
+        return;
+    }
+
+    RecordHeader header{static_cast<uint32_t>(payload), 0, message_id, sender_id, group_id,
+                        static_cast<uint32_t>(text.size()), now_ms()};
+    char* out = segment->map + segment->used;
+    memcpy(out + sizeof(header), text.data(), text.size());
+    memcpy(out + sizeof(header) + text.size(), file_path.data(), file_path.size());
+    header.checksum = checksum(header, out + sizeof(header));
+    memcpy(out, &header, sizeof(header));
+    segment->used += bytes;
+    segment->last_message_id = message_id;
+    segment->dirty = true;
+    last_appended_id = message_id;
+
+    unsynced.push_back({message_id, sender_id, group_id, header.sent_at_ms, MessageText(text), MessageText(file_path),
+                        std::move(done)});
+    totals.appended++;
+    if (unsynced.size() == 1) {
+        append_ready.notify_one();
+    }
+}
+
+void MessageLog::sync() {
+    if (!opened) {
+        MessageIngestQueue* ingest = log_directory.empty() ? database.running_ingest_queue() : nullptr;
+        if (ingest) {
+            ingest->flush();
+        }
+        return;
+    }
+    std::unique_lock<std::mutex> lock(log_mutex);
+    uint64_t target = totals.appended;
+    records_durable.wait(lock, [&] { return synced >= target; });
+}
+
+void MessageLog::flush() {
+    if (!opened) {
+        MessageIngestQueue* ingest = log_directory.empty() ? database.running_ingest_queue() : nullptr;
+        if (ingest) {
+            ingest->flush();
+        }
+        return;
+    }
+    std::unique_lock<std::mutex> lock(log_mutex);
+    uint64_t target = totals.appended;
+    records_applied.wait(lock, [&] { return finished >= target; });
+}
+
+bool MessageLog::applying(int message_id) const {
+    if (!opened) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(log_mutex);
+    return message_id > finished_through && message_id <= last_appended_id;
+}
+
+void MessageLog::wait_applied(int message_id) {
+    if (!opened) {
+        return;
+    }
+    std::unique_lock<std::mutex> lock(log_mutex);
+    records_applied.wait(lock, [&] {
+        return message_id > last_appended_id || message_id <= finished_through || abandoned;
+    });
+}
+
+void MessageLog::stop() {
+    {
+        std::lock_guard<std::mutex> lock(log_mutex);
+        stopping = true;
+    }
+    append_ready.notify_one();
+    records_durable.notify_all();
+    segment_ready.notify_all();
+    ids_ready.notify_all();
+    if (syncer.joinable()) {
+        syncer.join();
+    }
+    if (indexer.joinable()) {
+        indexer.join();
+    }
+}
+
+MessageLogStats MessageLog::stats() const {
+    std::lock_guard<std::mutex> lock(log_mutex);
+    MessageLogStats current = totals;
+    current.segments = segments.size();
+    return current;
+}
+
+void MessageLog::run_sync() {
+    PendingQueue batch;
+    std::vector<std::shared_ptr<Segment>> dirty;
+    std::unique_lock<std::mutex> lock(log_mutex);
+    while (true) {
+        append_ready.wait(lock, [&] { return stopping || !unsynced.empty() || (!spare_segment && !failed); });
+
+        // The spare is made here, so an append never creates a file; a log
+        // that cannot make one takes no more appends
+        if (!spare_segment && !failed && !stopping) {
+            lock.unlock();
+            std::shared_ptr<Segment> spare = create_segment();
+            lock.lock();
+            spare_segment = std::move(spare);
+            failed = !spare_segment;
+            segment_ready.notify_all();
+        }
+        if (unsynced.empty()) {
+            if (stopping) {
+                break; // Nothing left to sync
+            }
+            continue;
+        }
+
+        // Everything appended so far sits in a segment written since its last
+        // sync, usually just the newest. fdatasync also writes back pages
+        // dirtied through the shared mapping.
+        size_t count = unsynced.size();
+        for (const std::shared_ptr<Segment>& segment : segments) {
+            if (segment->dirty) {
+                segment->dirty = false;
+                dirty.push_back(segment);
+            }
+        }
+        lock.unlock();
+        Clock::time_point begin = Clock::now();
+        bool durable = true;
+        for (const std::shared_ptr<Segment>& segment : dirty) {
+            if (fdatasync(segment->fd) != 0) {
+                log_error() << "Failed to sync " << segment->path << ": " << strerror(errno);
+                durable = false;
+            }
+        }
+        dirty.clear();
+        sync_time.record(Clock::now() - begin);
+        sync_size.record(count);
+        lock.lock();
+
+        for (size_t i = 0; i < count; ++i) {
+            batch.push_back(std::move(unsynced.front()));
+            unsynced.pop_front();
+        }
+        totals.syncs++;
+        // After a failed sync, later ones cannot vouch for the pages it lost
+        durable = durable && !sync_failed;
+        sync_failed = !durable;
+        failed = failed || !durable;
+        if (failed) {
+            segment_ready.notify_all();
+        }
+        lock.unlock();
+
+        // The records may still reach the disk, so replay is told to skip
+        // them before the clients are told they failed
+        if (!durable && (!database.save_failed_log_range(batch.front().message_id, batch.back().message_id) ||
+                         !database.checkpoint())) {
+            log_error() << "Messages " << batch.front().message_id << " to " << batch.back().message_id
+                        << " failed but may be replayed from " << log_directory;
+        }
+
+        for (PendingRecord& record : batch) {
+            if (record.done) {
+                record.done(durable ? record.message_id : -1);
+            }
+        }
+
+        lock.lock();
+        synced += count;
+        synced_through = batch.back().message_id;
+        if (durable) {
+            totals.durable += count;
+            unapplied_messages.add(static_cast<int64_t>(count));
+            for (PendingRecord& record : batch) {
+                unapplied.push_back(std::move(record));
+            }
+        } else {
+            // Unacknowledged, so not applied either
+            totals.failed += count;
+            finished += count;
+            if (unapplied.empty()) {
+                finished_through = synced_through; // Else the indexer moves it once the durable ones are in
+            }
+            records_applied.notify_all();
+        }
+        batch.clear();
+        records_durable.notify_all();
+    }
+}
+
+void MessageLog::run_indexer() {
+    std::vector<MessageRecord> records;
+    std::unique_lock<std::mutex> lock(log_mutex);
+    while (true) {
+        auto ready = [&] { return !unapplied.empty() || ids_wanted() || (stopping && finished == totals.appended); };
+        if (ids_failed) {
+            records_durable.wait_until(lock, ids_retry_at, ready);
+        } else {
+            records_durable.wait(lock, ready);
+        }
+
+        // The next id block is reserved here, ahead of the appends that need it
+        if (ids_wanted()) {
+            lock.unlock();
+            int count = 0;
+            int first = database.reserve_message_ids(options.reserved_ids, count);
+            lock.lock();
+            ids_failed = first < 0;
+            ids_retry_at = Clock::now() + retry_delay;
+            if (first > 0) {
+                spare_first = first;
+                spare_count = count;
+            }
+            ids_ready.notify_all();
+            continue;
+        }
+        if (unapplied.empty()) {
+            if (stopping && finished == totals.appended) {
+                break;
+            }
+            continue;
+        }
+
+        size_t count = std::min(unapplied.size(), options.max_batch);
+        if (abandoned) {
+            // Nothing after an abandoned batch is applied either, so the
+            // checkpoint stays before it and the next start replays all of it
+            for (size_t i = 0; i < count; ++i) {
+                unapplied.pop_front();
+            }
+            unapplied_messages.add(-static_cast<int64_t>(count));
+            finished += count;
+            records_applied.notify_all();
+            continue;
+        }
+        records.clear();
+        for (size_t i = 0; i < count; ++i) {
+            PendingRecord& record = unapplied[i];
+            records.push_back({record.message_id, record.sender_id, record.group_id, "", std::string(record.text.view()),
+                               std::string(record.file_path.view()), record.sent_at_ms});
+        }
+        lock.unlock();
+
+        // Records stay in the log until applied, so giving up at shutdown
+        // only leaves them for the next replay
+        uint64_t rejected = 0;
+        bool applied = apply(records, rejected);
+        while (!applied) {
+            lock.lock();
+            bool give_up = stopping;
+            lock.unlock();
+            if (give_up) {
+                log_error() << "Leaving the messages from " << records.front().message_id << " on in "
+                            << log_directory << " for the next start";
+                break;
+            }
+            std::this_thread::sleep_for(retry_delay);
+            applied = apply(records, rejected);
+        }
+        if (applied) {
+            retire_segments(records.back().message_id);
+        }
+
+        lock.lock();
+        for (size_t i = 0; i < count; ++i) {
+            unapplied.pop_front();
+        }
+        unapplied_messages.add(-static_cast<int64_t>(count));
+        finished += count;
+        if (applied) {
+            totals.applied += count - rejected;
+            totals.parked += rejected;
+            // Failed records after the last durable one are finished too
+            finished_through = unapplied.empty() ? synced_through : records.back().message_id;
+        } else {
+            abandoned = true;
+        }
+        records_applied.notify_all();
+    }
+}
+
+bool MessageLog::apply(const std::vector<MessageRecord>& records, uint64_t& rejected) {
+    ChatDatabase::Transaction transaction(database);
+    if (!transaction.active()) {
+        return false;
+    }
+    // A rejected record only aborts its own INSERT. It was acknowledged, so
+    // it is kept in RejectedMessages before the checkpoint moves past it; if
+    // even that fails the whole batch is retried.
+    uint64_t failures = 0;
+    for (const MessageRecord& record : records) {
+        if (database.insert_message(record)) {
+            continue;
+        }
+        if (!database.park_rejected_message(record)) {
+            return false;
+        }
+        log_error() << "Message " << record.message_id << " for group " << record.group_id
+                    << " was refused by " << database.name() << " and parked in RejectedMessages";
+        ++failures;
+    }
+    if (!database.save_message_log_checkpoint(records.back().message_id) || !transaction.commit()) {
+        return false;
+    }
+    rejected += failures;
+    return true;
+}
+
+void MessageLog::retire_segments(int applied_message_id) {
+    // The newest segment takes appends and is never retired. Only this
+    // thread removes segments, so the count stays valid without the lock.
+    size_t retired = 0;
+    {
+        std::lock_guard<std::mutex> lock(log_mutex);
+        while (retired + 1 < segments.size() && segments[retired]->last_message_id <= applied_message_id) {
+            ++retired;
+        }
+    }
+    // Commits at synchronous = NORMAL may not be on disk yet; a segment is the
+    // only copy of its records until they are. If the checkpoint cannot
+    // finish, the next batch tries again.
+    if (retired == 0 || !database.checkpoint()) {
+        return;
+    }
+    std::vector<std::shared_ptr<Segment>> done;
+    {
+        std::lock_guard<std::mutex> lock(log_mutex);
+        done.assign(segments.begin(), segments.begin() + retired);
+        segments.erase(segments.begin(), segments.begin() + retired);
+    }
+    for (const std::shared_ptr<Segment>& segment : done) {
+        unlink(segment->path.c_str());
+    }
+}
@@ -0,0 +1,130 @@
+#include "../include/message_search.h"
+#include "../include/logger.h"
+#include <sqlite3.h>
+#include <cstring>
+
+namespace message_search
+{
+
+namespace {
+
+const char group_separator = '\x1f';
+
+// A unicode61 tokenizer instance plus the callbacks that drive it
+struct GroupWords
+{
+    fts5_tokenizer words;
+    Fts5Tokenizer* instance;
+};
+
+// Forwards each word to FTS5 as "<group_id>:<word>", with offsets into the full input
+struct PrefixedSink
+{
+    void* context;
+    int (*emit)(void*, int, const char*, int, int, int);
+    std::string token;
+    size_t prefix_length; // "<group_id>:"
+    int offset; // Bytes before the text unicode61 sees
+};
+
+int emit_prefixed(void* context, int flags, const char* token, int length, int start, int end) {
+    PrefixedSink* sink = static_cast<PrefixedSink*>(context);
+    sink->token.resize(sink->prefix_length);
+    sink->token.append(token, static_cast<size_t>(length));
+    return sink->emit(sink->context, flags, sink->token.data(), static_cast<int>(sink->token.size()),
+                      start + sink->offset, end + sink->offset);
+}
+
+int create(void* context, const char** args, int arg_count, Fts5Tokenizer** out) {
+    fts5_api* api = static_cast<fts5_api*>(context);
+    void* words_context = nullptr;
+    GroupWords* tokenizer = new GroupWords();
+    int rc = api->xFindTokenizer(api, "unicode61", &words_context, &tokenizer->words);
+    if (rc == SQLITE_OK) {
+        rc = tokenizer->words.xCreate(words_context, args, arg_count, &tokenizer->instance); // Options go to unicode61
+    }
+    if (rc != SQLITE_OK) {
+        delete tokenizer;
+        return rc;
+    }
+    *out = reinterpret_cast<Fts5Tokenizer*>(tokenizer);
+    return SQLITE_OK;
+}
+
+void destroy(Fts5Tokenizer* instance) {
+    GroupWords* tokenizer = reinterpret_cast<GroupWords*>(instance);
+    tokenizer->words.xDelete(tokenizer->instance);
+    delete tokenizer;
+}
+
+int tokenize(Fts5Tokenizer* instance, void* context, int flags, const char* text, int length,
+             int (*emit)(void*, int, const char*, int, int, int)) {
+    GroupWords* tokenizer = reinterpret_cast<GroupWords*>(instance);
+    const char* separator = static_cast<const char*>(memchr(text, group_separator, static_cast<size_t>(length)));
+    if (!separator) {
+        return SQLITE_OK; // No group, nothing to index or match
+    }
+
+    PrefixedSink sink;
+    sink.context = context;
+    sink.emit = emit;
+    sink.token.assign(text, separator);
+    sink.token += ':';
+    sink.prefix_length = sink.token.size();
+    sink.offset = static_cast<int>(separator + 1 - text);
+    return tokenizer->words.xTokenize(tokenizer->instance, &sink, flags, separator + 1, length - sink.offset, emit_prefixed);
+}
+
+} // namespace
+
+bool register_tokenizer(sqlite3* db) {
+    fts5_api* api = nullptr;
+    sqlite3_stmt* stmt = nullptr;
+    if (sqlite3_prepare_v2(db, "SELECT fts5(?1);", -1, &stmt, nullptr) == SQLITE_OK) {
+        sqlite3_bind_pointer(stmt, 1, &api, "fts5_api_ptr", nullptr);
+        sqlite3_step(stmt);
+    }
+    sqlite3_finalize(stmt);
+    if (!api) {
+        log_error() << "SQLite was built without FTS5, message search is unavailable";
+        return false;
+    }
+
+    fts5_tokenizer tokenizer = {create, destroy, tokenize};
+    if (api->xCreateTokenizer(api, tokenizer_name, api, &tokenizer, nullptr) != SQLITE_OK) {
+        log_error() << "Failed to register the " << tokenizer_name << " tokenizer: " << sqlite3_errmsg(db);
+        return false;
+    }
+    return true;
+}
+
+std::string expression(int group_id, const std::string& query) {
+    std::string group = std::to_string(group_id) + group_separator;
+    std::string terms;
+    size_t position = 0;
+    while (position < query.size()) {
+        size_t end = query.find_first_of(" \t\r\n", position);
+        if (end == std::string::npos) {
+            end = query.size();
+        }
+        std::string word;
+        for (size_t i = position; i < end; ++i) {
+            if (query[i] != '"') {
+                word += query[i];
+            }
+        }
+        position = end + 1;
+
+        bool prefix = false;
+        while (!word.empty() && word.back() == '*') {
+            word.pop_back();
+            prefix = true;
+        }
+        if (!word.empty()) {
+            terms += (terms.empty() ? "\"" : " \"") + group + word + "\"" + (prefix ? "*" : "");
+        }
+    }
+    return terms;
+}
+
+} // namespace message_search
@@ -0,0 +1,59 @@
+#include "../include/message_text.h"
+#include "../include/buffer_pool.h"
+#include <cstring>
+
+MessageText::MessageText(std::string_view text) : length(0), pooled(nullptr) {
+    assign(text);
+}
+
+MessageText::MessageText(MessageText&& other) noexcept : length(0), pooled(nullptr) {
+    take(other);
+}
+
+MessageText::~MessageText() {
+    release();
+}
+
+MessageText& MessageText::operator=(const MessageText& other) {
+    if (this != &other) {
+        release();
+        assign(other.view());
+    }
+    return *this;
+}
+
+MessageText& MessageText::operator=(MessageText&& other) noexcept {
+    if (this != &other) {
+        release();
+        take(other);
+    }
+    return *this;
+}
+
+void MessageText::assign(std::string_view text) {
+    if (text.size() > inline_capacity) {
+        pooled = static_cast<char*>(buffer_pool::allocate(text.size()));
+    }
+    length = text.size();
+    if (length > 0) {
+        memcpy(pooled ? pooled : inline_bytes, text.data(), length);
+    }
+}
+
+void MessageText::take(MessageText& other) {
+    length = other.length;
+    pooled = other.pooled;
+    if (!pooled && length > 0) {
+        memcpy(inline_bytes, other.inline_bytes, length);
+    }
+    other.length = 0;
+    other.pooled = nullptr;
+}
+
+void MessageText::release() {
+    if (pooled) {
+        buffer_pool::deallocate(pooled, length);
+        pooled = nullptr;
+    }
+    length = 0;
+}
@@ -0,0 +1,298 @@
+#include "../include/metrics.h"
+#include "../include/latency_histogram.h"
+#include "../include/logger.h"
+#include <atomic>
+#include <cstdio>
+#include <mutex>
+#include <vector>
+
+namespace metrics
+{
+
+namespace {
+
+const uint32_t no_slot = UINT32_MAX;
+
+enum class Kind
+{
+    COUNTER,
+    GAUGE,
+    HISTOGRAM
+};
+
+struct Series
+{
+    std::string name;
+    std::string help;
+    std::string labels;
+    Kind kind;
+    double unit;
+    uint32_t slot;
+};
+
+// One thread's counts for one histogram
+struct HistogramCells
+{
+    std::atomic<uint64_t> buckets[LatencyHistogram::bucket_count] = {};
+    std::atomic<uint64_t> count{0};
+    std::atomic<uint64_t> sum{0};
+};
+
+// Everything one thread has recorded. Only the owning thread writes, so an
+// update is a relaxed load and store; readers see each cell whole.
+struct ThreadCells
+{
+    std::atomic<int64_t> values[max_values] = {};
+    std::atomic<HistogramCells*> histograms[max_histograms] = {};
+
+    ~ThreadCells() {
+        for (auto& cells : histograms) {
+            delete cells.load(std::memory_order_relaxed);
+        }
+    }
+
+    HistogramCells& histogram(uint32_t slot) {
+        HistogramCells* cells = histograms[slot].load(std::memory_order_acquire);
+        if (!cells) {
+            cells = new HistogramCells();
+            histograms[slot].store(cells, std::memory_order_release);
+        }
+        return *cells;
+    }
+};
+
+void bump(std::atomic<uint64_t>& cell, uint64_t amount) {
+    cell.store(cell.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+}
+
+class Registry
+{
+public:
+
+    // Never destroyed: threads that exit during shutdown still hand their counts back
+    static Registry& instance() {
+        static Registry* registry = new Registry();
+        return *registry;
+    }
+
+    uint32_t add(const std::string& name, const std::string& help, const std::string& labels, Kind kind, double unit) {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const Series& existing : series) {
+            if (existing.name == name && existing.labels == labels) {
+                if (existing.kind != kind) {
+                    log_error() << "Metric " << name << " is already registered as another type";
+                    return no_slot;
+                }
+                return existing.slot;
+            }
+        }
+        uint32_t& next = kind == Kind::HISTOGRAM ? histogram_slots : value_slots;
+        if (next >= (kind == Kind::HISTOGRAM ? max_histograms : max_values)) {
+            log_error() << "Too many metrics, " << name << "{" << labels << "} is not recorded";
+            return no_slot;
+        }
+        series.push_back({name, help, labels, kind, unit, next});
+        return next++;
+    }
+
+    void attach(ThreadCells* cells) {
+        std::lock_guard<std::mutex> lock(mutex);
+        threads.push_back(cells);
+    }
+
+    // Folds an exiting thread's counts into the retired totals
+    void detach(ThreadCells* cells) {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (size_t i = 0; i < max_values; ++i) {
+            retired.values[i].store(retired.values[i].load(std::memory_order_relaxed) +
+                                    cells->values[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+        }
+        for (uint32_t slot = 0; slot < max_histograms; ++slot) {
+            HistogramCells* source = cells->histograms[slot].load(std::memory_order_acquire);
+            if (source) {
+                HistogramCells& target = retired.histogram(slot);
+                for (size_t b = 0; b < LatencyHistogram::bucket_count; ++b) {
+                    bump(target.buckets[b], source->buckets[b].load(std::memory_order_relaxed));
+                }
+                bump(target.count, source->count.load(std::memory_order_relaxed));
+                bump(target.sum, source->sum.load(std::memory_order_relaxed));
+            }
+        }
+        for (size_t i = 0; i < threads.size(); ++i) {
+            if (threads[i] == cells) {
+                threads[i] = threads.back();
+                threads.pop_back();
+                break;
+            }
+        }
+    }
+
+    int64_t value(uint32_t slot) {
+        std::lock_guard<std::mutex> lock(mutex);
+        return sum_value(slot);
+    }
+
+    uint64_t histogram_count(uint32_t slot) {
+        std::lock_guard<std::mutex> lock(mutex);
+        uint64_t sum = 0;
+        collect(slot, [&sum](const HistogramCells& cells) { sum += cells.count.load(std::memory_order_relaxed); });
+        return sum;
+    }
+
+    std::string render() {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::string out;
+        std::vector<bool> written(series.size(), false);
+        for (size_t first = 0; first < series.size(); ++first) {
+            if (written[first]) {
+                continue;
+            }
+            // A family's series are written together, under one HELP and TYPE
+            const Series& family = series[first];
+            out += "# HELP " + family.name + " " + family.help + "\n";
+            out += "# TYPE " + family.name + " " +
+                   (family.kind == Kind::COUNTER ? "counter" : family.kind == Kind::GAUGE ? "gauge" : "summary") + "\n";
+            for (size_t i = first; i < series.size(); ++i) {
+                if (series[i].name == family.name) {
+                    write_series(series[i], out);
+                    written[i] = true;
+                }
+            }
+        }
+        return out;
+    }
+
+private:
+
+    Registry() : value_slots(0), histogram_slots(0) {}
+
+    template <typename Visit>
+    void collect(uint32_t slot, Visit visit) {
+        for (ThreadCells* cells : threads) {
+            HistogramCells* histogram = cells->histograms[slot].load(std::memory_order_acquire);
+            if (histogram) {
+                visit(*histogram);
+            }
+        }
+        HistogramCells* histogram = retired.histograms[slot].load(std::memory_order_relaxed);
+        if (histogram) {
+            visit(*histogram);
+        }
+    }
+
+    int64_t sum_value(uint32_t slot) {
+        int64_t sum = retired.values[slot].load(std::memory_order_relaxed);
+        for (ThreadCells* cells : threads) {
+            sum += cells->values[slot].load(std::memory_order_relaxed);
+        }
+        return sum;
+    }
+
+    static std::string labelled(const std::string& name, const std::string& labels, const std::string& extra = "") {
+        std::string all = labels.empty() ? extra : extra.empty() ? labels : labels + "," + extra;
+        return all.empty() ? name : name + "{" + all + "}";
+    }
+
+    static std::string number(double value) {
+        char text[32];
+        snprintf(text, sizeof(text), "%.9g", value);
+        return text;
+    }
+
+    void write_series(const Series& entry, std::string& out) {
+        if (entry.kind != Kind::HISTOGRAM) {
+            out += labelled(entry.name, entry.labels) + " " + std::to_string(sum_value(entry.slot)) + "\n";
+            return;
+        }
+        LatencyHistogram merged;
+        uint64_t sum = 0;
+        collect(entry.slot, [&](const HistogramCells& cells) {
+            for (size_t b = 0; b < LatencyHistogram::bucket_count; ++b) {
+                merged.record(LatencyHistogram::value_of(b), cells.buckets[b].load(std::memory_order_relaxed));
+            }
+            sum += cells.sum.load(std::memory_order_relaxed);
+        });
+        for (const char* quantile : {"0.5", "0.9", "0.99", "0.999"}) {
+            double value = merged.percentile(std::stod(quantile) * 100) * entry.unit;
+            out += labelled(entry.name, entry.labels, std::string("quantile=\"") + quantile + "\"") + " " + number(value) + "\n";
+        }
+        out += labelled(entry.name + "_sum", entry.labels) + " " + number(sum * entry.unit) + "\n";
+        out += labelled(entry.name + "_count", entry.labels) + " " + std::to_string(merged.count()) + "\n";
+    }
+
+    std::mutex mutex;
+    std::vector<Series> series;
+    uint32_t value_slots;
+    uint32_t histogram_slots;
+    std::vector<ThreadCells*> threads;
+    ThreadCells retired; // Counts of threads that have exited
+};
+
+// Registers the calling thread's cells on first use and retires them at thread exit
+struct ThreadHandle
+{
+    ThreadHandle() : cells(new ThreadCells()) { Registry::instance().attach(cells); }
+    ~ThreadHandle() {
+        Registry::instance().detach(cells);
+        delete cells;
+    }
+
+    ThreadCells* cells;
+};
+
+ThreadCells& local() {
+    thread_local ThreadHandle handle;
+    return *handle.cells;
+}
+
+} // namespace
+
+Counter::Counter(const std::string& name, const std::string& help, const std::string& labels)
+    : slot(Registry::instance().add(name, help, labels, Kind::COUNTER, 1)) {}
+
+void Counter::add(uint64_t amount) const {
+    if (slot != no_slot) {
+        std::atomic<int64_t>& cell = local().values[slot];
+        cell.store(cell.load(std::memory_order_relaxed) + static_cast<int64_t>(amount), std::memory_order_relaxed);
+    }
+}
+
+uint64_t Counter::value() const {
+    return slot == no_slot ? 0 : static_cast<uint64_t>(Registry::instance().value(slot));
+}
+
+Gauge::Gauge(const std::string& name, const std::string& help, const std::string& labels)
+    : slot(Registry::instance().add(name, help, labels, Kind::GAUGE, 1)) {}
+
+void Gauge::add(int64_t amount) const {
+    if (slot != no_slot) {
+        std::atomic<int64_t>& cell = local().values[slot];
+        cell.store(cell.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+    }
+}
+
+int64_t Gauge::value() const {
+    return slot == no_slot ? 0 : Registry::instance().value(slot);
+}
+
+Histogram::Histogram(const std::string& name, const std::string& help, const std::string& labels, double unit)
+    : slot(Registry::instance().add(name, help, labels, Kind::HISTOGRAM, unit)) {}
+
+void Histogram::record(uint64_t value) const {
+    if (slot != no_slot) {
+        HistogramCells& cells = local().histogram(slot);
+        bump(cells.buckets[LatencyHistogram::bucket_of(value)], 1);
+        bump(cells.count, 1);
+        bump(cells.sum, value);
+    }
+}
+
+uint64_t Histogram::count() const {
+    return slot == no_slot ? 0 : Registry::instance().histogram_count(slot);
+}
+
+std::string render() {
+    return Registry::instance().render();
+}
+
+} // namespace metrics
@@ -0,0 +1,131 @@
+#include "../include/metrics_endpoint.h"
+#include "../include/metrics.h"
+#include "../include/logger.h"
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <unistd.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+namespace {
+
+const int poll_interval_ms = 200; // How soon stop() is noticed
+const int client_timeout_s = 2; // A scraper that stalls longer is dropped
+const size_t max_request = 8192;
+
+void send_all(int fd, const std::string& data) {
+    size_t offset = 0;
+    while (offset < data.size()) {
+        ssize_t sent = ::send(fd, data.data() + offset, data.size() - offset, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent <= 0) {
+            return;
+        }
+        offset += static_cast<size_t>(sent);
+    }
+}
+
+std::string response(const char* status, const char* type, const std::string& body) {
+    return std::string("HTTP/1.0 ") + status + "\r\nContent-Type: " + type + "\r\nContent-Length: " +
+           std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+}
+
+} // namespace
+
+MetricsEndpoint::MetricsEndpoint(int port) : port(port), listen_fd(-1), running(false) {
+}
+
+MetricsEndpoint::~MetricsEndpoint() {
+    stop();
+}
+
+bool MetricsEndpoint::start() {
+    listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0) {
+        log_error() << "Failed to create metrics listener: " << strerror(errno);
+        return false;
+    }
+    int enable = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    if (bind(listen_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 || listen(listen_fd, 16) < 0) {
+        log_error() << "Failed to serve metrics on port " << port << ": " << strerror(errno);
+        close(listen_fd);
+        listen_fd = -1;
+        return false;
+    }
+    socklen_t length = sizeof(addr);
+    getsockname(listen_fd, reinterpret_cast<sockaddr*>(&addr), &length);
+    port = ntohs(addr.sin_port);
+
+    running = true;
+    thread = std::thread(&MetricsEndpoint::run, this);
+    return true;
+}
+
+void MetricsEndpoint::stop() {
+    running = false;
+    if (thread.joinable()) {
+        thread.join();
+    }
+    if (listen_fd >= 0) {
+        close(listen_fd);
+        listen_fd = -1;
+    }
+}
+
+int MetricsEndpoint::bound_port() const {
+    return port;
+}
+
+void MetricsEndpoint::run() {
+    while (running) {
+        pollfd listener = {listen_fd, POLLIN, 0};
+        if (poll(&listener, 1, poll_interval_ms) <= 0) {
+            continue;
+        }
+        int client = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (client < 0) {
+            continue;
+        }
+        timeval timeout = {client_timeout_s, 0};
+        setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        serve(client);
+        close(client);
+    }
+}
+
+void MetricsEndpoint::serve(int client) {
+    // Only the request line matters; read until the end of the headers
+    std::string request;
+    char buffer[1024];
+    while (request.find("\r\n\r\n") == std::string::npos && request.size() < max_request) {
+        ssize_t received = recv(client, buffer, sizeof(buffer), 0);
+        if (received < 0 && errno == EINTR) {
+            continue;
+        }
+        if (received <= 0) {
+            break;
+        }
+        request.append(buffer, static_cast<size_t>(received));
+    }
+
+    if (request.compare(0, 13, "GET /metrics ") == 0 || request.compare(0, 14, "GET /metrics\r\n") == 0) {
+        send_all(client, response("200 OK", "text/plain; version=0.0.4", metrics::render()));
+    } else if (request.compare(0, 4, "GET ") == 0) {
+        send_all(client, response("404 Not Found", "text/plain", "Not found\n"));
+    } else {
+        send_all(client, response("405 Method Not Allowed", "text/plain", "GET /metrics only\n"));
+    }
+}
@@ -0,0 +1,189 @@
+#include "../include/password_hash.h"
+#include "../include/logger.h"
+#include <cerrno>
+#include <cstring>
+#include <cstdlib>
+#include <sys/random.h>
+
+namespace password_hash
+{
+
+namespace {
+
+const char scheme[] = "pbkdf2-sha256$";
+const size_t salt_bytes = 16;
+
+// HMAC-SHA256 with the key's padded blocks absorbed once, so each PBKDF2
+// round costs two compressions instead of four
+class Hmac
+{
+public:
+
+    explicit Hmac(std::string_view key) {
+        uint8_t padded[64] = {0};
+        if (key.size() > sizeof(padded)) {
+            Sha256 shortened;
+            shortened.update(key);
+            Sha256::Digest digest = shortened.finish();
+            memcpy(padded, digest.data(), digest.size());
+        } else {
+            memcpy(padded, key.data(), key.size());
+        }
+
+        uint8_t block[64];
+        for (size_t i = 0; i < sizeof(block); ++i) {
+            block[i] = padded[i] ^ 0x36;
+        }
+        inner.update(block, sizeof(block));
+        for (size_t i = 0; i < sizeof(block); ++i) {
+            block[i] = padded[i] ^ 0x5c;
+        }
+        outer.update(block, sizeof(block));
+    }
+
+    Sha256::Digest sign(const void* data, size_t length) const {
+        Sha256 message = inner;
+        message.update(data, length);
+        Sha256::Digest digest = message.finish();
+        Sha256 result = outer;
+        result.update(digest.data(), digest.size());
+        return result.finish();
+    }
+
+private:
+
+    Sha256 inner;
+    Sha256 outer;
+};
+
+bool from_hex(std::string_view hex, std::string& out) {
+    if (hex.size() % 2 != 0) {
+        return false;
+    }
+    out.clear();
+    for (size_t i = 0; i < hex.size(); i += 2) {
+        int value = 0;
+        for (size_t j = i; j < i + 2; ++j) {
+            char c = hex[j];
+            int digit = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+            if (digit < 0) {
+                return false;
+            }
+            value = value * 16 + digit;
+        }
+        out += static_cast<char>(value);
+    }
+    return true;
+}
+
+std::string to_hex(const void* data, size_t length) {
+    static const char digits[] = "0123456789abcdef";
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    std::string out;
+    out.reserve(length * 2);
+    for (size_t i = 0; i < length; ++i) {
+        out += digits[bytes[i] >> 4];
+        out += digits[bytes[i] & 0xf];
+    }
+    return out;
+}
+
+// Compares every byte whatever the first difference, so timing says nothing about the match
+bool equal_constant_time(std::string_view a, std::string_view b) {
+    unsigned char difference = a.size() == b.size() ? 0 : 1;
+    for (size_t i = 0; i < a.size(); ++i) {
+        difference |= static_cast<unsigned char>(a[i] ^ (b.empty() ? 0 : b[i % b.size()]));
+    }
+    return difference == 0;
+}
+
+struct Parsed
+{
+    int iterations;
+    std::string salt;
+    std::string key;
+};
+
+// False for anything that is not a hash in our format, such as a plaintext password
+bool parse(std::string_view stored, Parsed& out) {
+    if (stored.compare(0, sizeof(scheme) - 1, scheme) != 0) {
+        return false;
+    }
+    stored.remove_prefix(sizeof(scheme) - 1);
+    size_t first = stored.find('$');
+    size_t second = first == std::string_view::npos ? first : stored.find('$', first + 1);
+    if (second == std::string_view::npos) {
+        return false;
+    }
+    std::string iterations(stored.substr(0, first));
+    char* end = nullptr;
+    long value = strtol(iterations.c_str(), &end, 10);
+    if (iterations.empty() || *end != '\0' || value <= 0 || value > 100000000) {
+        return false;
+    }
+    out.iterations = static_cast<int>(value);
+    return from_hex(stored.substr(first + 1, second - first - 1), out.salt) &&
+           from_hex(stored.substr(second + 1), out.key) && out.key.size() == sizeof(Sha256::Digest);
+}
+
+} // namespace
+
+Sha256::Digest pbkdf2(std::string_view password, std::string_view salt, int iterations) {
+    Hmac hmac(password);
+
+    // U1 = HMAC(password, salt || INT(1)); the key is U1 ^ U2 ^ ... ^ Uc
+    std::string first(salt);
+    first.append("\0\0\0\1", 4);
+    Sha256::Digest u = hmac.sign(first.data(), first.size());
+    Sha256::Digest key = u;
+    for (int i = 1; i < iterations; ++i) {
+        u = hmac.sign(u.data(), u.size());
+        for (size_t j = 0; j < key.size(); ++j) {
+            key[j] ^= u[j];
+        }
+    }
+    return key;
+}
+
+bool random_bytes(void* out, size_t length) {
+    uint8_t* bytes = static_cast<uint8_t*>(out);
+    while (length > 0) {
+        ssize_t got = getrandom(bytes, length, 0);
+        if (got < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            log_error() << "Failed to read random bytes: " << strerror(errno);
+            return false;
+        }
+        bytes += got;
+        length -= static_cast<size_t>(got);
+    }
+    return true;
+}
+
+std::string hash(std::string_view password, int iterations) {
+    uint8_t salt[salt_bytes];
+    if (iterations <= 0 || !random_bytes(salt, sizeof(salt))) {
+        return "";
+    }
+    Sha256::Digest key = pbkdf2(password, std::string_view(reinterpret_cast<const char*>(salt), sizeof(salt)), iterations);
+    return std::string(scheme) + std::to_string(iterations) + "$" + to_hex(salt, sizeof(salt)) + "$" +
+           to_hex(key.data(), key.size());
+}
+
+bool verify(std::string_view password, std::string_view stored) {
+    Parsed parsed;
+    if (!parse(stored, parsed)) {
+        return equal_constant_time(password, stored); // Written before passwords were hashed
+    }
+    Sha256::Digest key = pbkdf2(password, parsed.salt, parsed.iterations);
+    return equal_constant_time(std::string_view(reinterpret_cast<const char*>(key.data()), key.size()), parsed.key);
+}
+
+bool needs_upgrade(std::string_view stored, int iterations) {
+    Parsed parsed;
+    return !parse(stored, parsed) || parsed.iterations != iterations;
+}
+
+} // namespace password_hash
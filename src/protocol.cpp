@@ -0,0 +1,403 @@
+#include "../include/protocol.h"
+#include <algorithm>
+
+namespace protocol
+{
+
+namespace {
+
+uint32_t load_u32(const char* bytes) {
+    const unsigned char* b = reinterpret_cast<const unsigned char*>(bytes);
+    return static_cast<uint32_t>(b[0]) | static_cast<uint32_t>(b[1]) << 8 |
+           static_cast<uint32_t>(b[2]) << 16 | static_cast<uint32_t>(b[3]) << 24;
+}
+
+uint16_t load_u16(const char* bytes) {
+    const unsigned char* b = reinterpret_cast<const unsigned char*>(bytes);
+    return static_cast<uint16_t>(b[0] | b[1] << 8);
+}
+
+void store_le(char* destination, uint64_t value, size_t width) {
+    for (size_t i = 0; i < width; ++i) {
+        destination[i] = static_cast<char>((value >> (8 * i)) & 0xff);
+    }
+}
+
+} // namespace
+
+bool is_known_type(uint16_t type) {
+    return type >= static_cast<uint16_t>(FrameType::LOGIN) && type <= static_cast<uint16_t>(FrameType::FILE_DOWNLOAD);
+}
+
+// FrameParser
+
+FrameParser::FrameParser() : current_size(0), waiting_for(header_size) {
+}
+
+ParseStatus FrameParser::next(const RingBuffer& buffer, Frame& frame) {
+    if (buffer.size() < header_size) {
+        waiting_for = header_size;
+        return ParseStatus::NEED_MORE;
+    }
+
+    char header[header_size];
+    const char* contiguous_header = buffer.contiguous(0, header_size);
+    if (!contiguous_header) {
+        buffer.copy_out(0, header_size, header);
+        contiguous_header = header;
+    }
+    uint32_t length = load_u32(contiguous_header);
+    uint16_t type = load_u16(contiguous_header + 4);
+    uint16_t flags = load_u16(contiguous_header + 6);
+    if (length > max_payload || !is_known_type(type)) {
+        return ParseStatus::INVALID;
+    }
+
+    size_t total = header_size + length;
+    if (buffer.size() < total) {
+        waiting_for = total;
+        return ParseStatus::NEED_MORE;
+    }
+
+    const char* payload = buffer.contiguous(header_size, length);
+    if (!payload) {
+        // The payload wraps around the end of the ring: linearize just this frame
+        if (scratch.size() < length) {
+            scratch.resize(length);
+        }
+        buffer.copy_out(header_size, length, scratch.data());
+        payload = scratch.data();
+    }
+
+    frame.type = static_cast<FrameType>(type);
+    frame.flags = flags;
+    frame.payload = std::string_view(payload, length);
+    current_size = total;
+    waiting_for = header_size;
+    return ParseStatus::FRAME;
+}
+
+void FrameParser::consume(RingBuffer& buffer) {
+    buffer.consume(current_size);
+    current_size = 0;
+}
+
+size_t FrameParser::required_capacity() const {
+    return waiting_for;
+}
+
+// FrameWriter
+
+FrameWriter::FrameWriter(std::string& out, FrameType type, uint16_t flags)
+    : out(out), start(out.size()), type(type), flags(flags) {
+    out.append(header_size, '\0');
+}
+
+FrameWriter& FrameWriter::u8(uint8_t value) {
+    out.push_back(static_cast<char>(value));
+    return *this;
+}
+
+FrameWriter& FrameWriter::u16(uint16_t value) {
+    char bytes[2];
+    store_le(bytes, value, 2);
+    out.append(bytes, 2);
+    return *this;
+}
+
+FrameWriter& FrameWriter::u32(uint32_t value) {
+    char bytes[4];
+    store_le(bytes, value, 4);
+    out.append(bytes, 4);
+    return *this;
+}
+
+FrameWriter& FrameWriter::u64(uint64_t value) {
+    char bytes[8];
+    store_le(bytes, value, 8);
+    out.append(bytes, 8);
+    return *this;
+}
+
+FrameWriter& FrameWriter::str16(std::string_view value) {
+    size_t length = std::min<size_t>(value.size(), UINT16_MAX);
+    u16(static_cast<uint16_t>(length));
+    out.append(value.data(), length);
+    return *this;
+}
+
+FrameWriter& FrameWriter::str32(std::string_view value) {
+    u32(static_cast<uint32_t>(value.size()));
+    out.append(value.data(), value.size());
+    return *this;
+}
+
+FrameWriter& FrameWriter::bytes(std::string_view value) {
+    out.append(value.data(), value.size());
+    return *this;
+}
+
+void FrameWriter::finish() {
+    store_le(&out[start], out.size() - start - header_size, 4);
+    store_le(&out[start + 4], static_cast<uint16_t>(type), 2);
+    store_le(&out[start + 6], flags, 2);
+}
+
+// PayloadReader
+
+bool PayloadReader::need(size_t length) {
+    if (!valid || payload.size() - position < length) {
+        valid = false;
+        return false;
+    }
+    return true;
+}
+
+uint8_t PayloadReader::u8() {
+    if (!need(1)) {
+        return 0;
+    }
+    return static_cast<uint8_t>(payload[position++]);
+}
+
+uint16_t PayloadReader::u16() {
+    if (!need(2)) {
+        return 0;
+    }
+    uint16_t value = load_u16(payload.data() + position);
+    position += 2;
+    return value;
+}
+
+uint32_t PayloadReader::u32() {
+    if (!need(4)) {
+        return 0;
+    }
+    uint32_t value = load_u32(payload.data() + position);
+    position += 4;
+    return value;
+}
+
+uint64_t PayloadReader::u64() {
+    uint64_t low = u32();
+    uint64_t high = u32();
+    return low | high << 32;
+}
+
+std::string_view PayloadReader::str16() {
+    size_t length = u16();
+    if (!need(length)) {
+        return std::string_view();
+    }
+    std::string_view value = payload.substr(position, length);
+    position += length;
+    return value;
+}
+
+std::string_view PayloadReader::str32() {
+    size_t length = u32();
+    if (!need(length)) {
+        return std::string_view();
+    }
+    std::string_view value = payload.substr(position, length);
+    position += length;
+    return value;
+}
+
+std::string_view PayloadReader::rest() {
+    std::string_view value = payload.substr(position);
+    position = payload.size();
+    return value;
+}
+
+// Decoders: every field must be present and nothing may follow the last one
+
+bool decode_login(std::string_view payload, LoginRequest& out) {
+    PayloadReader reader(payload);
+    out.create_account = reader.u8() != 0;
+    out.username = reader.str16();
+    out.password = reader.str16();
+    return reader.ok() && reader.at_end();
+}
+
+bool decode_result(std::string_view payload, ResultMessage& out) {
+    PayloadReader reader(payload);
+    out.request_type = reader.u16();
+    out.value = reader.i32();
+    out.detail = reader.str16();
+    return reader.ok() && reader.at_end();
+}
+
+bool decode_group(std::string_view payload, int32_t& group_id) {
+    PayloadReader reader(payload);
+    group_id = reader.i32();
+    return reader.ok() && reader.at_end();
+}
+
+bool decode_send_message(std::string_view payload, SendMessageRequest& out) {
+    PayloadReader reader(payload);
+    out.group_id = reader.i32();
+    out.client_tag = reader.u64();
+    out.text = reader.str32();
+    return reader.ok() && reader.at_end();
+}
+
+bool decode_deliver_message(std::string_view payload, DeliverMessage& out) {
+    PayloadReader reader(payload);
+    out.group_id = reader.i32();
+    out.sender_id = reader.i32();
+    out.message_id = reader.i32();
+    out.sent_at_ms = reader.i64();
+    out.client_tag = reader.u64();
+    out.sender_name = reader.str16();
+    out.text = reader.str32();
+    return reader.ok() && reader.at_end();
+}
+
+bool decode_history_request(std::string_view payload, HistoryRequest& out) {
+    PayloadReader reader(payload);
+    out.group_id = reader.i32();
+    out.before_message_id = reader.i32();
+    out.limit = reader.u16();
+    return reader.ok() && reader.at_end();
+}
+
+bool decode_history_response(std::string_view payload, int32_t& group_id, std::vector<HistoryEntry>& out) {
+    PayloadReader reader(payload);
+    group_id = reader.i32();
+    uint16_t count = reader.u16();
+    out.clear();
+    for (uint16_t i = 0; i < count && reader.ok(); ++i) {
+        HistoryEntry entry;
+        entry.message_id = reader.i32();
+        entry.sender_id = reader.i32();
+        entry.sent_at_ms = reader.i64();
+        entry.username = reader.str16();
+        entry.text = reader.str32();
+        out.push_back(entry);
+    }
+    return reader.ok() && reader.at_end();
+}
+
+bool decode_file_chunk(std::string_view payload, FileChunk& out) {
+    PayloadReader reader(payload);
+    out.transfer_id = reader.u64();
+    out.offset = reader.u64();
+    out.data = reader.rest();
+    return reader.ok();
+}
+
+bool decode_messages_dropped(std::string_view payload, uint32_t& dropped_count) {
+    PayloadReader reader(payload);
+    dropped_count = reader.u32();
+    return reader.ok() && reader.at_end();
+}
+
+bool decode_file_offer(std::string_view payload, FileOffer& out) {
+    PayloadReader reader(payload);
+    out.transfer_id = reader.u64();
+    out.group_id = reader.i32();
+    out.size = reader.u64();
+    out.name = reader.str16();
+    return reader.ok() && reader.at_end();
+}
+
+bool decode_file_download(std::string_view payload, FileDownloadRequest& out) {
+    PayloadReader reader(payload);
+    out.message_id = reader.i32();
+    out.transfer_id = reader.u64();
+    out.offset = reader.u64();
+    out.length = reader.u64();
+    return reader.ok() && reader.at_end();
+}
+
+// Encoders
+
+void encode_login(std::string& out, const LoginRequest& request, uint16_t flags) {
+    FrameWriter writer(out, FrameType::LOGIN, flags);
+    writer.u8(request.create_account ? 1 : 0).str16(request.username).str16(request.password);
+    writer.finish();
+}
+
+void encode_result(std::string& out, const ResultMessage& result) {
+    FrameWriter writer(out, FrameType::RESULT);
+    writer.u16(result.request_type).i32(result.value).str16(result.detail);
+    writer.finish();
+}
+
+void encode_group(std::string& out, FrameType type, int32_t group_id) {
+    FrameWriter writer(out, type);
+    writer.i32(group_id);
+    writer.finish();
+}
+
+void encode_send_message(std::string& out, const SendMessageRequest& request) {
+    FrameWriter writer(out, FrameType::SEND_MESSAGE);
+    writer.i32(request.group_id).u64(request.client_tag).str32(request.text);
+    writer.finish();
+}
+
+void encode_deliver_message(std::string& out, const DeliverMessage& message, uint16_t flags) {
+    FrameWriter writer(out, FrameType::DELIVER_MESSAGE, flags);
+    writer.i32(message.group_id).i32(message.sender_id).i32(message.message_id).i64(message.sent_at_ms)
+          .u64(message.client_tag).str16(message.sender_name).str32(message.text);
+    writer.finish();
+}
+
+void set_deliver_message_id(std::string& frame, int32_t message_id) {
+    // After the frame header come group_id and sender_id, then message_id
+    if (frame.size() >= header_size + 12) {
+        store_le(&frame[header_size + 8], static_cast<uint32_t>(message_id), 4);
+    }
+}
+
+void encode_history_request(std::string& out, const HistoryRequest& request) {
+    FrameWriter writer(out, FrameType::HISTORY_REQUEST);
+    writer.i32(request.group_id).i32(request.before_message_id).u16(request.limit);
+    writer.finish();
+}
+
+void encode_history_response(std::string& out, int32_t group_id, const std::vector<HistoryEntry>& entries) {
+    FrameWriter writer(out, FrameType::HISTORY_RESPONSE);
+    size_t count = std::min<size_t>(entries.size(), UINT16_MAX);
+    writer.i32(group_id).u16(static_cast<uint16_t>(count));
+    for (size_t i = 0; i < count; ++i) {
+        const HistoryEntry& entry = entries[i];
+        writer.i32(entry.message_id).i32(entry.sender_id).i64(entry.sent_at_ms).str16(entry.username).str32(entry.text);
+    }
+    writer.finish();
+}
+
+void encode_file_chunk(std::string& out, const FileChunk& chunk, bool last) {
+    FrameWriter writer(out, FrameType::FILE_CHUNK, last ? FLAG_LAST_CHUNK : 0);
+    writer.u64(chunk.transfer_id).u64(chunk.offset).bytes(chunk.data);
+    writer.finish();
+}
+
+void encode_messages_dropped(std::string& out, uint32_t dropped_count) {
+    FrameWriter writer(out, FrameType::MESSAGES_DROPPED);
+    writer.u32(dropped_count);
+    writer.finish();
+}
+
+void encode_file_offer(std::string& out, const FileOffer& offer) {
+    FrameWriter writer(out, FrameType::FILE_OFFER);
+    writer.u64(offer.transfer_id).i32(offer.group_id).u64(offer.size).str16(offer.name);
+    writer.finish();
+}
+
+void encode_file_download(std::string& out, const FileDownloadRequest& request) {
+    FrameWriter writer(out, FrameType::FILE_DOWNLOAD);
+    writer.i32(request.message_id).u64(request.transfer_id).u64(request.offset).u64(request.length);
+    writer.finish();
+}
+
+void encode_file_chunk_header(char* out, uint64_t transfer_id, uint64_t offset, uint32_t data_length, bool last) {
+    store_le(out, static_cast<uint64_t>(data_length) + 16, 4);
+    store_le(out + 4, static_cast<uint16_t>(FrameType::FILE_CHUNK), 2);
+    store_le(out + 6, last ? FLAG_LAST_CHUNK : 0, 2);
+    store_le(out + header_size, transfer_id, 8);
+    store_le(out + header_size + 8, offset, 8);
+}
+
+} // namespace protocol
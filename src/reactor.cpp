@@ -0,0 +1,583 @@
+#include "../include/reactor.h"
+#include "../include/server.h"
+#include "../include/logger.h"
+#include "../include/metrics.h"
+#include <cerrno>
+#include <cstring>
+#include <climits>
+#include <algorithm>
+#include <unistd.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+namespace {
+
+const int max_events = 256;
+const size_t initial_buffer = 4096; // Receive ring size, grown for larger frames
+const int max_iovecs = 64;
+const int max_tasks_per_wake = 1024; // Posted tasks run between epoll batches, so sockets are not starved
+
+// Per-connection outbound queue bounds, in bytes. Broadcast frames are shared,
+// so the memory a lagging connection pins is usually far below these.
+const size_t low_watermark = 256 * 1024;
+const size_t high_watermark = 1024 * 1024;
+const size_t outbound_limit = 8 * 1024 * 1024;
+
+// Downloads: chunk size, file bytes one flush may send before yielding to
+// other connections, and concurrent downloads per connection
+const uint64_t file_chunk_size = 64 * 1024;
+const uint64_t file_bytes_per_flush = 1024 * 1024;
+const size_t max_downloads = 8;
+
+// Listener and connection sockets share the same epoll set; tag the listener
+// and the wakeup eventfd with fixed values so events can tell them apart
+const uint64_t listener_tag = UINT64_MAX;
+const uint64_t wake_tag = UINT64_MAX - 1;
+
+const metrics::Gauge open_connections("chat_connections", "Client connections currently open");
+const metrics::Counter bytes_received("chat_received_bytes_total", "Bytes read from client sockets");
+const metrics::Counter bytes_sent("chat_sent_bytes_total", "Bytes written to client sockets, file downloads included");
+const metrics::Counter frames_received("chat_received_frames_total", "Complete frames parsed from clients");
+const metrics::Counter deliveries_skipped("chat_skipped_deliveries_total", "Group deliveries skipped while the recipient lagged");
+
+enum class WriteProgress
+{
+    MORE, // Wrote something and the socket may take more
+    BLOCKED, // Socket buffer full; EPOLLOUT resumes
+    FAILED
+};
+
+// One sendmsg() over the queued frames
+WriteProgress write_frames(Connection& connection) {
+    iovec iov[max_iovecs];
+    int count = 0;
+    for (auto it = connection.outbound.begin(); it != connection.outbound.end() && count < max_iovecs; ++it, ++count) {
+        size_t skip = count == 0 ? connection.outbound_offset : 0;
+        iov[count].iov_base = const_cast<char*>(it->data()) + skip;
+        iov[count].iov_len = it->size() - skip;
+    }
+
+    msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = iov;
+    message.msg_iovlen = count;
+    ssize_t sent = sendmsg(connection.user.socket, &message, MSG_NOSIGNAL);
+    if (sent < 0) {
+        if (errno == EINTR) {
+            return WriteProgress::MORE;
+        }
+        return errno == EAGAIN || errno == EWOULDBLOCK ? WriteProgress::BLOCKED : WriteProgress::FAILED;
+    }
+
+    size_t remaining = static_cast<size_t>(sent);
+    bytes_sent.add(remaining);
+    connection.outbound_bytes -= remaining;
+    while (remaining > 0) {
+        size_t left = connection.outbound.front().size() - connection.outbound_offset;
+        if (remaining < left) {
+            connection.outbound_offset += remaining;
+            break;
+        }
+        remaining -= left;
+        connection.outbound.pop_front();
+        connection.outbound_offset = 0;
+    }
+
+    // Caught up: resume deliveries and say how many were skipped
+    if (connection.lagging && connection.outbound_bytes <= low_watermark) {
+        connection.lagging = false;
+        if (connection.dropped > 0) {
+            std::string notice;
+            protocol::encode_messages_dropped(notice, connection.dropped);
+            connection.dropped = 0;
+            connection.outbound_bytes += notice.size();
+            connection.outbound.push_back(SharedBuffer::copy_of(notice));
+        }
+    }
+    return WriteProgress::MORE;
+}
+
+// Frames the next file_chunk_size bytes of a download
+void start_file_chunk(FileSend& file) {
+    uint64_t length = std::min(file.remaining, file_chunk_size);
+    file.remaining -= length;
+    file.last = file.remaining == 0;
+    protocol::encode_file_chunk_header(file.header, file.transfer_id, file.offset, static_cast<uint32_t>(length), file.last);
+    file.header_size = protocol::file_chunk_header_size;
+    file.header_sent = 0;
+    file.body_left = static_cast<size_t>(length);
+}
+
+// Continues the current chunk: header from memory, body from the page cache.
+// MORE once the whole chunk is out.
+WriteProgress write_file_chunk(int socket, FileSend& file) {
+    while (file.header_sent < file.header_size) {
+        ssize_t sent = ::send(socket, file.header + file.header_sent, file.header_size - file.header_sent,
+                              MSG_NOSIGNAL | (file.body_left > 0 ? MSG_MORE : 0));
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno == EAGAIN || errno == EWOULDBLOCK ? WriteProgress::BLOCKED : WriteProgress::FAILED;
+        }
+        file.header_sent += static_cast<size_t>(sent);
+        bytes_sent.add(static_cast<uint64_t>(sent));
+    }
+    while (file.body_left > 0) {
+        off_t offset = static_cast<off_t>(file.offset);
+        ssize_t sent = sendfile(socket, file.fd, &offset, file.body_left);
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno == EAGAIN || errno == EWOULDBLOCK ? WriteProgress::BLOCKED : WriteProgress::FAILED;
+        }
+        if (sent == 0) {
+            return WriteProgress::FAILED; // File shrank under us; the frame cannot be completed
+        }
+        file.offset += static_cast<uint64_t>(sent);
+        bytes_sent.add(static_cast<uint64_t>(sent));
+        file.body_left -= static_cast<size_t>(sent);
+    }
+    file.header_size = 0;
+    return WriteProgress::MORE;
+}
+
+} // namespace
+
+Reactor::Reactor(Server& server, int index)
+    : server(server), reactor_index(index), listen_fd(-1), epoll_fd(-1), wake_fd(-1), port(0),
+      next_connection_id(1), connection_total(0), wake_pending(false), running(false) {
+}
+
+Reactor::~Reactor() {
+    stop();
+    if (listen_fd >= 0) {
+        close(listen_fd);
+    }
+    if (wake_fd >= 0) {
+        close(wake_fd);
+    }
+    if (epoll_fd >= 0) {
+        close(epoll_fd);
+    }
+}
+
+bool Reactor::listen(int port) {
+    listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0) {
+        log_error() << "Failed to create listener: " << strerror(errno);
+        return false;
+    }
+
+    // Every reactor binds the same port; the kernel spreads new connections across them
+    int enable = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable));
+
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if (bind(listen_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 ||
+        ::listen(listen_fd, SOMAXCONN) < 0) {
+        log_error() << "Failed to listen on port " << port << ": " << strerror(errno);
+        close(listen_fd);
+        listen_fd = -1;
+        return false;
+    }
+
+    socklen_t length = sizeof(addr);
+    getsockname(listen_fd, reinterpret_cast<sockaddr*>(&addr), &length);
+    this->port = ntohs(addr.sin_port);
+    return true;
+}
+
+int Reactor::bound_port() const {
+    return port;
+}
+
+bool Reactor::start() {
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (epoll_fd < 0 || wake_fd < 0 || listen_fd < 0) {
+        log_error() << "Failed to set up reactor " << reactor_index << ": " << strerror(errno);
+        return false;
+    }
+
+    epoll_event event;
+    event.events = EPOLLIN | EPOLLET;
+    event.data.u64 = listener_tag;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &event);
+    event.data.u64 = wake_tag;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &event);
+
+    running = true;
+    thread = std::thread(&Reactor::run, this);
+    return true;
+}
+
+void Reactor::stop() {
+    if (!running.exchange(false)) {
+        return;
+    }
+    wake();
+    if (thread.joinable()) {
+        thread.join();
+    }
+}
+
+void Reactor::post(Task task) {
+    tasks.push(std::move(task));
+    // Only the first post since the last drain pays for the eventfd write
+    if (!wake_pending.exchange(true)) {
+        wake();
+    }
+}
+
+void Reactor::wake() {
+    uint64_t one = 1;
+    if (write(wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        log_error() << "Failed to wake reactor " << reactor_index << ": " << strerror(errno);
+    }
+}
+
+size_t Reactor::connection_count() const {
+    return connection_total.load(std::memory_order_relaxed);
+}
+
+int Reactor::index() const {
+    return reactor_index;
+}
+
+void Reactor::run() {
+    epoll_event events[max_events];
+    while (running) {
+        int count = epoll_wait(epoll_fd, events, max_events, -1);
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            log_error() << "epoll_wait failed: " << strerror(errno);
+            break;
+        }
+
+        for (int i = 0; i < count; ++i) {
+            uint64_t tag = events[i].data.u64;
+            if (tag == listener_tag) {
+                accept_connections();
+                continue;
+            }
+            if (tag == wake_tag) {
+                uint64_t value;
+                while (read(wake_fd, &value, sizeof(value)) > 0) {
+                }
+                if (run_posted_tasks()) {
+                    wake_pending = true;
+                    wake(); // Finish the rest after the next epoll batch
+                }
+                continue;
+            }
+
+            auto found = connections.find(static_cast<int>(tag));
+            if (found == connections.end()) {
+                continue; // Closed earlier in this batch
+            }
+            Connection& connection = *found->second;
+            if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                close_connection(connection);
+                continue;
+            }
+            if ((events[i].events & EPOLLOUT) && !flush(connection)) {
+                connection.closing = true;
+            }
+            if (!connection.closing && (events[i].events & (EPOLLIN | EPOLLRDHUP))) {
+                handle_readable(connection);
+            }
+            if (connection.closing) {
+                close_connection(connection);
+            }
+        }
+
+        // Replies and broadcasts queued while handling this batch go out together
+        flush_pending();
+    }
+
+    while (run_posted_tasks()) {
+    }
+    flush_pending();
+    for (auto& entry : connections) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, entry.first, nullptr);
+    }
+    logged_in.clear();
+    open_connections.add(-static_cast<int64_t>(connections.size()));
+    connections.clear();
+    connection_total = 0;
+}
+
+void Reactor::accept_connections() {
+    // Edge-triggered: keep accepting until the backlog is empty
+    while (true) {
+        int fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                log_error() << "accept failed: " << strerror(errno);
+            }
+            return;
+        }
+
+        int enable = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+
+        epoll_event event;
+        event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        event.data.u64 = static_cast<uint64_t>(fd);
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+            log_error() << "Failed to watch connection: " << strerror(errno);
+            close(fd);
+            continue;
+        }
+        connections[fd].reset(new Connection(fd, next_connection_id++, this));
+        connection_total.fetch_add(1, std::memory_order_relaxed);
+        open_connections.add(1);
+    }
+}
+
+void Reactor::handle_readable(Connection& connection) {
+    RingBuffer& inbound = connection.inbound;
+    if (inbound.capacity() == 0) {
+        inbound.reserve(initial_buffer);
+    }
+
+    // Edge-triggered: drain the socket until it would block
+    while (true) {
+        iovec regions[2];
+        int count = inbound.write_regions(regions);
+        if (count == 0) {
+            inbound.reserve(inbound.capacity() * 2);
+            continue;
+        }
+        ssize_t received = readv(connection.user.socket, regions, count);
+        if (received < 0 && errno == EINTR) {
+            continue;
+        }
+        if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return;
+        }
+        if (received <= 0) {
+            connection.closing = true; // Peer closed or the socket failed
+            return;
+        }
+        inbound.commit(static_cast<size_t>(received));
+        bytes_received.add(static_cast<uint64_t>(received));
+
+        // Handle every complete frame in place, then make room for the next read
+        protocol::Frame frame;
+        protocol::ParseStatus status;
+        while ((status = connection.parser.next(inbound, frame)) == protocol::ParseStatus::FRAME) {
+            frames_received.add();
+            if (!server.handle_frame(connection, frame)) {
+                connection.closing = true;
+                return;
+            }
+            connection.parser.consume(inbound);
+        }
+        if (status == protocol::ParseStatus::INVALID || connection.closing) {
+            connection.closing = true;
+            return;
+        }
+        if (inbound.free_space() == 0 || connection.parser.required_capacity() > inbound.capacity()) {
+            inbound.reserve(std::max(inbound.capacity() * 2, connection.parser.required_capacity()));
+        }
+    }
+}
+
+void Reactor::send_to_all(const BufferRef& frame, const User* except) {
+    for (auto& entry : logged_in) {
+        if (&entry.second->user != except) {
+            deliver(*entry.second, frame);
+        }
+    }
+}
+
+void Reactor::send_to_group(const MembershipIndex::IdList& members, const BufferRef& frame, const User* except) {
+    // Walk whichever side is smaller: the group's members or the users logged in here
+    if (members->size() < logged_in.size()) {
+        for (int user_id : *members) {
+            auto range = logged_in.equal_range(user_id);
+            for (auto it = range.first; it != range.second; ++it) {
+                if (&it->second->user != except) {
+                    deliver(*it->second, frame);
+                }
+            }
+        }
+        return;
+    }
+    for (auto& entry : logged_in) {
+        if (&entry.second->user != except && std::binary_search(members->begin(), members->end(), entry.first)) {
+            deliver(*entry.second, frame);
+        }
+    }
+}
+
+void Reactor::bind_user(Connection& connection, int user_id) {
+    unbind_user(connection);
+    connection.user_id = user_id;
+    if (user_id != -1) {
+        logged_in.emplace(user_id, &connection);
+    }
+}
+
+void Reactor::send(Connection& connection, BufferRef frame) {
+    if (connection.closing) {
+        return;
+    }
+    connection.outbound_bytes += frame.size();
+    connection.outbound.push_back(std::move(frame));
+    if (connection.outbound_bytes > outbound_limit) {
+        // Not reading even its own replies; the flush below closes it
+        log_warn() << "Closing connection " << connection.user.socket << ": "
+                    << connection.outbound_bytes << " bytes unsent";
+        connection.closing = true;
+    }
+    schedule_flush(connection);
+}
+
+bool Reactor::send_file(Connection& connection, FileSend file) {
+    if (connection.closing || connection.downloads.size() >= max_downloads) {
+        return false;
+    }
+    connection.downloads.push_back(std::move(file));
+    schedule_flush(connection);
+    return true;
+}
+
+void Reactor::schedule_flush(Connection& connection) {
+    if (!connection.flush_scheduled) {
+        connection.flush_scheduled = true;
+        pending_flush.emplace_back(connection.user.socket, connection.id);
+    }
+}
+
+void Reactor::deliver(Connection& connection, const BufferRef& frame) {
+    if (connection.lagging) {
+        connection.dropped++;
+        deliveries_skipped.add();
+        return;
+    }
+    send(connection, frame);
+    if (connection.outbound_bytes > high_watermark) {
+        connection.lagging = true;
+    }
+}
+
+Connection* Reactor::find(int fd, uint64_t connection_id) {
+    auto found = connections.find(fd);
+    if (found == connections.end() || found->second->id != connection_id) {
+        return nullptr;
+    }
+    return found->second.get();
+}
+
+bool Reactor::flush(Connection& connection) {
+    // A chunk once started is finished first, since its bytes must be
+    // contiguous on the wire; between chunks, queued frames go ahead of the file
+    uint64_t file_bytes = 0;
+    while (true) {
+        WriteProgress progress;
+        if (!connection.downloads.empty() && connection.downloads.front().in_chunk()) {
+            progress = write_file_chunk(connection.user.socket, connection.downloads.front());
+        } else if (!connection.outbound.empty()) {
+            progress = write_frames(connection);
+        } else if (!connection.downloads.empty()) {
+            FileSend& file = connection.downloads.front();
+            if (file.finished()) {
+                connection.downloads.pop_front();
+                continue;
+            }
+            if (file_bytes >= file_bytes_per_flush) {
+                // Yield to other connections; the socket is still writable, so
+                // EPOLLOUT will not fire again and the rest is posted instead
+                int fd = connection.user.socket;
+                uint64_t connection_id = connection.id;
+                post([this, fd, connection_id]() {
+                    Connection* resumed = find(fd, connection_id);
+                    if (resumed) {
+                        schedule_flush(*resumed);
+                    }
+                });
+                return true;
+            }
+            start_file_chunk(file);
+            file_bytes += file.body_left;
+            continue;
+        } else {
+            return true;
+        }
+
+        if (progress == WriteProgress::BLOCKED) {
+            return true; // Full socket buffer: EPOLLOUT fires once the peer drains it
+        }
+        if (progress == WriteProgress::FAILED) {
+            return false;
+        }
+    }
+}
+
+void Reactor::unbind_user(Connection& connection) {
+    auto range = logged_in.equal_range(connection.user_id);
+    for (auto it = range.first; it != range.second; ++it) {
+        if (it->second == &connection) {
+            logged_in.erase(it);
+            break;
+        }
+    }
+    connection.user_id = -1;
+}
+
+void Reactor::close_connection(Connection& connection) {
+    unbind_user(connection);
+    int fd = connection.user.socket;
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+    connections.erase(fd); // Destroys the User, which closes the socket
+    connection_total.fetch_sub(1, std::memory_order_relaxed);
+    open_connections.add(-1);
+}
+
+void Reactor::flush_pending() {
+    // flush() never schedules another flush, so the list cannot grow while we walk it
+    for (const auto& entry : pending_flush) {
+        Connection* connection = find(entry.first, entry.second);
+        if (!connection) {
+            continue; // Closed after it queued
+        }
+        connection->flush_scheduled = false;
+        if (connection->closing || !flush(*connection)) {
+            close_connection(*connection);
+        }
+    }
+    pending_flush.clear();
+}
+
+bool Reactor::run_posted_tasks() {
+    // Cleared before draining: a post that lands after this writes wake_fd again
+    wake_pending = false;
+    Task task;
+    for (int ran = 0; ran < max_tasks_per_wake; ++ran) {
+        if (!tasks.pop(task)) {
+            return false;
+        }
+        task();
+    }
+    return true;
+}
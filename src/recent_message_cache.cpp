@@ -0,0 +1,178 @@
+#include "../include/recent_message_cache.h"
+#include <algorithm>
+
+RecentMessageCache::RecentMessageCache(size_t messages_per_group, size_t memory_budget)
+    : capacity(messages_per_group), budget(memory_budget), total_bytes(0), counters{0, 0, 0, 0, 0} {
+}
+
+bool RecentMessageCache::enabled() const {
+    return capacity > 0 && budget > 0;
+}
+
+size_t RecentMessageCache::messages_per_group() const {
+    return capacity;
+}
+
+bool RecentMessageCache::lookup(int group_id, int before_message_id, int limit, std::vector<MessageRecord>& out) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto found = entries.find(group_id);
+    if (found == entries.end()) {
+        counters.misses++;
+        return false;
+    }
+    Entry& entry = found->second;
+
+    // Newest message older than the cursor
+    auto end = entry.messages.end();
+    if (before_message_id > 0) {
+        end = std::lower_bound(entry.messages.begin(), entry.messages.end(), before_message_id,
+            [](const MessageRecord& message, int id) { return message.message_id < id; });
+    }
+    size_t available = static_cast<size_t>(end - entry.messages.begin());
+    size_t wanted = static_cast<size_t>(std::max(limit, 0));
+    if (available < wanted && !entry.whole_history) {
+        counters.misses++;
+        return false; // Part of the page is older than what is cached
+    }
+
+    size_t count = std::min(available, wanted);
+    out.clear();
+    out.reserve(count);
+    for (auto it = end; count > 0; --count) {
+        out.push_back(*--it);
+    }
+    touch(entry);
+    counters.hits++;
+    return true;
+}
+
+uint64_t RecentMessageCache::begin_fill(int group_id) {
+    std::lock_guard<std::mutex> lock(mutex);
+    Fill& pending = fills[group_id];
+    pending.loading++;
+    return pending.version;
+}
+
+void RecentMessageCache::fill(int group_id, uint64_t token, const std::vector<MessageRecord>& newest_first, bool whole_history) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto pending = fills.find(group_id);
+    if (pending == fills.end()) {
+        return;
+    }
+    bool unchanged = pending->second.version == token;
+    if (--pending->second.loading == 0) {
+        fills.erase(pending);
+    }
+    if (!unchanged || entries.count(group_id)) {
+        return; // Raced with a commit, or another caller filled it first
+    }
+
+    Entry& entry = entries[group_id];
+    size_t keep = std::min(newest_first.size(), capacity);
+    entry.whole_history = whole_history && keep == newest_first.size();
+    entry.bytes = 0;
+    for (size_t i = keep; i > 0; --i) {
+        entry.messages.push_back(newest_first[i - 1]);
+        entry.bytes += footprint(entry.messages.back());
+    }
+    lru.push_front(group_id);
+    entry.lru_position = lru.begin();
+    total_bytes += entry.bytes;
+    evict_over_budget(group_id);
+}
+
+void RecentMessageCache::cancel_fill(int group_id) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto pending = fills.find(group_id);
+    if (pending != fills.end() && --pending->second.loading == 0) {
+        fills.erase(pending);
+    }
+}
+
+void RecentMessageCache::append(const MessageRecord& message) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto pending = fills.find(message.group_id);
+    if (pending != fills.end()) {
+        pending->second.version++;
+    }
+
+    auto found = entries.find(message.group_id);
+    if (found == entries.end()) {
+        return;
+    }
+    Entry& entry = found->second;
+    if (!entry.messages.empty() && entry.messages.back().message_id >= message.message_id) {
+        // Either the fill already read it from the database, or it committed
+        // after a newer message (ids from the message log); drop the group then
+        bool cached = std::binary_search(entry.messages.begin(), entry.messages.end(), message,
+                                         [](const MessageRecord& a, const MessageRecord& b) { return a.message_id < b.message_id; });
+        if (!cached && (message.message_id > entry.messages.front().message_id || entry.whole_history)) {
+            erase(found);
+        }
+        return;
+    }
+
+    entry.messages.push_back(message);
+    size_t added = footprint(entry.messages.back());
+    entry.bytes += added;
+    total_bytes += added;
+    if (entry.messages.size() > capacity) {
+        size_t removed = footprint(entry.messages.front());
+        entry.bytes -= removed;
+        total_bytes -= removed;
+        entry.messages.pop_front();
+        entry.whole_history = false;
+    }
+    touch(entry);
+    evict_over_budget(message.group_id);
+}
+
+void RecentMessageCache::invalidate(int group_id) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto pending = fills.find(group_id);
+    if (pending != fills.end()) {
+        pending->second.version++;
+    }
+    auto found = entries.find(group_id);
+    if (found != entries.end()) {
+        erase(found);
+    }
+}
+
+bool RecentMessageCache::contains(int group_id) {
+    std::lock_guard<std::mutex> lock(mutex);
+    return entries.count(group_id) != 0;
+}
+
+RecentCacheStats RecentMessageCache::stats() {
+    std::lock_guard<std::mutex> lock(mutex);
+    RecentCacheStats current = counters;
+    current.groups = entries.size();
+    current.bytes = total_bytes;
+    return current;
+}
+
+size_t RecentMessageCache::footprint(const MessageRecord& message) {
+    return sizeof(MessageRecord) + message.username.capacity() + message.text.capacity() + message.file_path.capacity();
+}
+
+void RecentMessageCache::touch(Entry& entry) {
+    lru.splice(lru.begin(), lru, entry.lru_position);
+}
+
+void RecentMessageCache::evict_over_budget(int keep_group_id) {
+    while (total_bytes > budget && !lru.empty()) {
+        int coldest = lru.back();
+        if (coldest == keep_group_id) {
+            break; // Only the group being written is left
+        }
+        erase(entries.find(coldest));
+        counters.evictions++;
+    }
+}
+
+void RecentMessageCache::erase(std::unordered_map<int, Entry>::iterator found) {
+    total_bytes -= found->second.bytes;
+    lru.erase(found->second.lru_position);
+    entries.erase(found);
+}
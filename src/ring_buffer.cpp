@@ -0,0 +1,115 @@
+#include "../include/ring_buffer.h"
+#include <cstring>
+#include <algorithm>
+
+namespace {
+
+size_t round_up_power_of_two(size_t value) {
+    size_t result = 1;
+    while (result < value) {
+        result <<= 1;
+    }
+    return result;
+}
+
+} // namespace
+
+RingBuffer::RingBuffer(size_t capacity) : cap(0), head(0), tail(0) {
+    if (capacity > 0) {
+        reserve(capacity);
+    }
+}
+
+RingBuffer::~RingBuffer() {
+}
+
+size_t RingBuffer::capacity() const {
+    return cap;
+}
+
+size_t RingBuffer::size() const {
+    return static_cast<size_t>(tail - head);
+}
+
+size_t RingBuffer::free_space() const {
+    return cap - size();
+}
+
+bool RingBuffer::empty() const {
+    return head == tail;
+}
+
+void RingBuffer::reserve(size_t capacity) {
+    if (capacity <= cap) {
+        return;
+    }
+    size_t new_cap = round_up_power_of_two(capacity);
+    std::unique_ptr<char[]> grown(new char[new_cap]);
+    size_t stored = size();
+    if (stored > 0) {
+        copy_out(0, stored, grown.get());
+    }
+    data = std::move(grown);
+    cap = new_cap;
+    head = 0;
+    tail = stored;
+}
+
+int RingBuffer::write_regions(iovec regions[2]) {
+    size_t space = free_space();
+    if (space == 0) {
+        return 0;
+    }
+    size_t start = static_cast<size_t>(tail & (cap - 1));
+    size_t first = std::min(space, cap - start);
+    regions[0].iov_base = data.get() + start;
+    regions[0].iov_len = first;
+    if (first == space) {
+        return 1;
+    }
+    regions[1].iov_base = data.get();
+    regions[1].iov_len = space - first;
+    return 2;
+}
+
+void RingBuffer::commit(size_t length) {
+    tail += std::min(length, free_space());
+}
+
+size_t RingBuffer::append(const char* bytes, size_t length) {
+    iovec regions[2];
+    int count = write_regions(regions);
+    size_t stored = 0;
+    for (int i = 0; i < count && stored < length; ++i) {
+        size_t chunk = std::min(length - stored, regions[i].iov_len);
+        memcpy(regions[i].iov_base, bytes + stored, chunk);
+        stored += chunk;
+    }
+    commit(stored);
+    return stored;
+}
+
+const char* RingBuffer::contiguous(size_t offset, size_t length) const {
+    if (offset + length > size()) {
+        return nullptr;
+    }
+    size_t start = static_cast<size_t>((head + offset) & (cap - 1));
+    if (start + length > cap) {
+        return nullptr;
+    }
+    return data.get() + start;
+}
+
+void RingBuffer::copy_out(size_t offset, size_t length, char* destination) const {
+    size_t start = static_cast<size_t>((head + offset) & (cap - 1));
+    size_t first = std::min(length, cap - start);
+    memcpy(destination, data.get() + start, first);
+    memcpy(destination + first, data.get(), length - first);
+}
+
+void RingBuffer::consume(size_t length) {
+    head += std::min(length, size());
+    if (head == tail) {
+        head = tail = 0; // Restart at the front so the next frame is less likely to wrap
+    }
+}
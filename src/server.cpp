@@ -0,0 +1,614 @@
+#include "../include/server.h"
+#include "../include/sharded_database.h"
+#include "../include/message_ingest.h"
+#include "../include/message_log.h"
+#include "../include/database_executor.h"
+#include "../include/logger.h"
+#include "../include/metrics.h"
+#include <chrono>
+#include <algorithm>
+#include <climits>
+#include <thread>
+#include <csignal>
+#include <sys/resource.h>
+
+namespace {
+
+std::atomic<int> next_server_id(1);
+const uint16_t max_history_page = 200;
+const std::chrono::minutes session_ttl(10);
+const size_t max_sessions = 1 << 20;
+const size_t max_pending_logins = 4096; // Beyond this a password login is refused as busy
+
+const metrics::Histogram fanout("chat_group_fanout_members", "Members a group message is broadcast to", "", 1);
+const metrics::Counter logins("chat_logins_total", "Successful logins", "method=\"password\"");
+const metrics::Counter token_logins("chat_logins_total", "Successful logins", "method=\"token\"");
+const metrics::Counter failed_logins("chat_failed_logins_total", "Logins refused for bad credentials, a busy pool or an expired token");
+
+// Idle clients cost one descriptor each, so lift the soft limit to the hard one
+void raise_descriptor_limit() {
+    rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+}
+
+// Encodes into a per-thread scratch string and copies the result into a shared
+// buffer, so the only allocation per frame is the buffer itself
+template <typename Encode>
+BufferRef encode_shared(Encode encode) {
+    thread_local std::string scratch;
+    scratch.clear();
+    encode(scratch);
+    return SharedBuffer::copy_of(scratch);
+}
+
+// File sizes and offsets travel in the i32 RESULT value
+static_assert(FileStore::max_file_size <= INT32_MAX, "file sizes must fit a RESULT value");
+
+BufferRef result_frame(protocol::FrameType request, int32_t value, std::string_view detail = "") {
+    return encode_shared([&](std::string& out) {
+        protocol::encode_result(out, {static_cast<uint16_t>(request), value, detail});
+    });
+}
+
+// Hands a frame built on a database thread to the reactor that owns the
+// connection; dropped if the client left in the meantime
+void send_later(Reactor* owner, int fd, uint64_t connection_id, BufferRef frame) {
+    owner->post([owner, fd, connection_id, frame]() {
+        Connection* connection = owner->find(fd, connection_id);
+        if (connection) {
+            owner->send(*connection, frame);
+        }
+    });
+}
+
+int64_t now_ms() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+// Uploaded files live beside the database: data/chat.db stores into data/files
+std::string file_root(const std::string& db_name) {
+    size_t slash = db_name.rfind('/');
+    return (slash == std::string::npos ? std::string(".") : db_name.substr(0, slash)) + "/files";
+}
+
+// A password login on its way through the auth pool
+struct PendingLogin
+{
+    Reactor* owner;
+    int fd;
+    uint64_t connection_id;
+    bool create_account;
+    std::string username;
+    std::string password;
+};
+
+// A download whose message has been looked up, on its way back to the reactor
+struct PendingDownload
+{
+    Reactor* owner;
+    int fd;
+    uint64_t connection_id;
+    protocol::FileDownloadRequest request;
+    int group_id;
+    std::string digest;
+};
+
+// Everything the announcement of a stored upload needs once its message_id is known
+struct StoredFile
+{
+    Reactor* owner;
+    int fd;
+    uint64_t connection_id;
+    int32_t sender_id;
+    std::string sender_name;
+    int64_t sent_at_ms;
+    uint64_t transfer_id;
+    FileStore::Completed file;
+};
+
+} // namespace
+
+Server::Server(int port, const std::string& db_name, int reactor_count, int shard_count)
+    : server_id(next_server_id++), port(port), db_name(db_name), shard_count(shard_count),
+      sessions(session_ttl, max_sessions), reactor_count(reactor_count), running(false) {
+    if (this->reactor_count <= 0) {
+        this->reactor_count = std::max(1u, std::thread::hardware_concurrency());
+    }
+}
+
+Server::~Server() {
+    stop();
+}
+
+void Server::start() {
+    if (running) {
+        return;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    raise_descriptor_limit();
+
+    database.reset(new ShardedDatabase(db_name, shard_count));
+    if (!database->is_open() || !database->init_schema()) {
+        log_error() << "Failed to open database " << db_name;
+        return;
+    }
+    // Messages acknowledged before a crash but not yet in SQLite are replayed here
+    for (int i = 0; i < database->shard_count(); ++i) {
+        MessageLog& log = database->shard(i).message_log();
+        if (!log.is_open() && !log.directory().empty()) {
+            log_error() << "Failed to open message log " << log.directory();
+            return;
+        }
+    }
+    files.reset(new FileStore(file_root(db_name)));
+    if (!files->open()) {
+        log_error() << "Failed to open file store for " << db_name;
+        return;
+    }
+    auth.reset(new AuthPool(0, max_pending_logins));
+
+    // The first listener resolves port 0, the rest share whatever it bound
+    for (int i = 0; i < reactor_count; ++i) {
+        std::unique_ptr<Reactor> reactor(new Reactor(*this, i));
+        if (!reactor->listen(port)) {
+            reactors.clear();
+            return;
+        }
+        port = reactor->bound_port();
+        reactors.push_back(std::move(reactor));
+    }
+
+    for (auto& reactor : reactors) {
+        if (!reactor->start()) {
+            stop();
+            return;
+        }
+    }
+    running = true;
+    log_info() << "Server " << server_id << " listening on port " << port
+                 << " with " << reactors.size() << " reactors and " << database->shard_count() << " database shards";
+}
+
+void Server::stop() {
+    for (auto& reactor : reactors) {
+        reactor->stop();
+    }
+    auth.reset(); // Running checks post to the reactors, which are stopped but not yet destroyed
+    if (files) {
+        files->flush(); // A finished upload still appends its file message below
+    }
+    // Pending replies and acks post to the reactors, so they must outlive the queued work.
+    // Only what is running is flushed; nothing gets started just to be stopped
+    for (int i = 0; database && i < database->shard_count(); ++i) {
+        ChatDatabase& shard = database->shard(i);
+        DatabaseExecutor* executor = shard.running_executor();
+        if (executor) {
+            executor->flush();
+        }
+        MessageLog* log = shard.running_message_log();
+        if (log) {
+            log->flush();
+        }
+        MessageIngestQueue* ingest = shard.running_ingest_queue();
+        if (ingest) {
+            ingest->flush();
+        }
+    }
+    reactors.clear();
+    running = false;
+}
+
+bool Server::is_running() const {
+    return running;
+}
+
+int Server::get_port() const {
+    return port;
+}
+
+int Server::get_user_count() {
+    size_t total = 0;
+    for (auto& reactor : reactors) {
+        total += reactor->connection_count();
+    }
+    return static_cast<int>(total);
+}
+
+void Server::broadcast(const BufferRef& frame, User* sender) {
+    // Every reactor delivers to the connections it owns, on its own thread;
+    // the tasks only copy the reference, never the encoded bytes
+    for (auto& reactor : reactors) {
+        Reactor* target = reactor.get();
+        target->post([target, frame, sender]() { target->send_to_all(frame, sender); });
+    }
+}
+
+void Server::broadcast_to_group(int group_id, const BufferRef& frame, User* sender) {
+    // One membership snapshot serves every reactor, however the group changes meanwhile
+    MembershipIndex::IdList members = database->group_shard(group_id).membership().members(group_id);
+    fanout.record(members->size());
+    for (auto& reactor : reactors) {
+        Reactor* target = reactor.get();
+        target->post([target, members, frame, sender]() { target->send_to_group(members, frame, sender); });
+    }
+}
+
+bool Server::is_member(const Connection& connection, int group_id) const {
+    return database->group_shard(group_id).membership().is_member(group_id, connection.user_id);
+}
+
+void Server::reply(Connection& connection, protocol::FrameType request, int32_t value, std::string_view detail) {
+    connection.owner->send(connection, result_frame(request, value, detail));
+}
+
+bool Server::handle_frame(Connection& connection, const protocol::Frame& frame) {
+    using protocol::FrameType;
+
+    if (frame.type != FrameType::LOGIN && connection.user_id == -1) {
+        reply(connection, frame.type, -1, "login required");
+        return true;
+    }
+
+    switch (frame.type) {
+        case FrameType::LOGIN: {
+            protocol::LoginRequest request;
+            return protocol::decode_login(frame.payload, request) &&
+                   handle_login(connection, request, (frame.flags & protocol::FLAG_SESSION_TOKEN) != 0);
+        }
+        case FrameType::JOIN_GROUP: {
+            int32_t group_id;
+            return protocol::decode_group(frame.payload, group_id) && handle_join(connection, group_id);
+        }
+        case FrameType::LEAVE_GROUP: {
+            int32_t group_id;
+            return protocol::decode_group(frame.payload, group_id) && handle_leave(connection, group_id);
+        }
+        case FrameType::SEND_MESSAGE: {
+            protocol::SendMessageRequest request;
+            return protocol::decode_send_message(frame.payload, request) && handle_send(connection, request);
+        }
+        case FrameType::HISTORY_REQUEST: {
+            protocol::HistoryRequest request;
+            return protocol::decode_history_request(frame.payload, request) && handle_history(connection, request);
+        }
+        case FrameType::FILE_OFFER: {
+            protocol::FileOffer offer;
+            return protocol::decode_file_offer(frame.payload, offer) && handle_file_offer(connection, offer);
+        }
+        case FrameType::FILE_CHUNK: {
+            protocol::FileChunk chunk;
+            return protocol::decode_file_chunk(frame.payload, chunk) &&
+                   handle_file_chunk(connection, chunk, (frame.flags & protocol::FLAG_LAST_CHUNK) != 0);
+        }
+        case FrameType::FILE_DOWNLOAD: {
+            protocol::FileDownloadRequest request;
+            return protocol::decode_file_download(frame.payload, request) && handle_file_download(connection, request);
+        }
+        default:
+            return false; // Server-to-client frame sent by a client
+    }
+}
+
+bool Server::handle_login(Connection& connection, const protocol::LoginRequest& request, bool session_token) {
+    if (connection.authenticating) {
+        reply(connection, protocol::FrameType::LOGIN, -1, "login in progress");
+        return true;
+    }
+
+    // A reconnect within the session TTL is one hash lookup on this thread
+    if (session_token) {
+        int user_id = sessions.lookup(request.password, request.username);
+        if (user_id == -1) {
+            failed_logins.add();
+            reply(connection, protocol::FrameType::LOGIN, -1, "session expired");
+            return true;
+        }
+        token_logins.add();
+        finish_login(connection, user_id, std::string(request.username), std::string(request.password));
+        return true;
+    }
+
+    // Password logins run the KDF on the auth pool and come back as a posted task
+    std::shared_ptr<PendingLogin> login = std::make_shared<PendingLogin>(PendingLogin{
+        connection.owner, connection.user.socket, connection.id, request.create_account,
+        std::string(request.username), std::string(request.password)});
+    bool queued = auth->submit([this, login]() {
+        int user_id = -1;
+        if (login->create_account && database->get_user_id(login->username) == -1 &&
+            database->register_user(login->username, login->password)) {
+            user_id = database->get_user_id(login->username); // Just hashed; no need to check it again
+        } else if (database->authenticate_user(login->username, login->password)) {
+            user_id = database->get_user_id(login->username);
+        }
+        std::string token;
+        if (user_id != -1) {
+            token = sessions.issue(user_id, login->username);
+            logins.add();
+        }
+
+        login->owner->post([this, login, user_id, token]() {
+            Connection* connection = login->owner->find(login->fd, login->connection_id);
+            if (connection) {
+                connection->authenticating = false;
+                finish_login(*connection, user_id, login->username, token);
+            }
+        });
+    });
+    if (!queued) {
+        failed_logins.add();
+        reply(connection, protocol::FrameType::LOGIN, -1, "server busy, retry");
+        return true;
+    }
+    connection.authenticating = true;
+    return true;
+}
+
+void Server::finish_login(Connection& connection, int user_id, const std::string& username, const std::string& token) {
+    if (user_id == -1) {
+        failed_logins.add();
+        reply(connection, protocol::FrameType::LOGIN, -1, "invalid username or password");
+        return;
+    }
+    connection.owner->bind_user(connection, user_id);
+    connection.user.username = username;
+    reply(connection, protocol::FrameType::LOGIN, user_id, token);
+}
+
+bool Server::handle_join(Connection& connection, int32_t group_id) {
+    if (is_member(connection, group_id)) {
+        reply(connection, protocol::FrameType::JOIN_GROUP, group_id);
+        return true;
+    }
+
+    // Membership writes run on the executor's writer, in the order they arrive
+    Reactor* owner = connection.owner;
+    int fd = connection.user.socket;
+    uint64_t connection_id = connection.id;
+    int user_id = connection.user_id;
+    // Groups are named in the global file, members are kept by the group's shard
+    ChatDatabase* global = &database->global();
+    database->group_shard(group_id).executor().write(
+        [global, user_id, group_id](ChatDatabase& shard) {
+            return !global->get_group_name(group_id).empty() && shard.add_user_to_group(user_id, group_id);
+        },
+        [owner, fd, connection_id, group_id](bool joined) {
+            send_later(owner, fd, connection_id, joined ? result_frame(protocol::FrameType::JOIN_GROUP, group_id)
+                                                        : result_frame(protocol::FrameType::JOIN_GROUP, -1, "cannot join group"));
+        });
+    return true;
+}
+
+bool Server::handle_leave(Connection& connection, int32_t group_id) {
+    if (!is_member(connection, group_id)) {
+        reply(connection, protocol::FrameType::LEAVE_GROUP, -1, "not a member");
+        return true;
+    }
+
+    Reactor* owner = connection.owner;
+    int fd = connection.user.socket;
+    uint64_t connection_id = connection.id;
+    int user_id = connection.user_id;
+    database->group_shard(group_id).executor().write(
+        [user_id, group_id](ChatDatabase& shard) { return shard.remove_user_from_group(user_id, group_id); },
+        [owner, fd, connection_id, group_id](bool left) {
+            send_later(owner, fd, connection_id, left ? result_frame(protocol::FrameType::LEAVE_GROUP, group_id)
+                                                      : result_frame(protocol::FrameType::LEAVE_GROUP, -1, "not a member"));
+        });
+    return true;
+}
+
+bool Server::handle_send(Connection& connection, const protocol::SendMessageRequest& request) {
+    if (!is_member(connection, request.group_id)) {
+        reply(connection, protocol::FrameType::SEND_MESSAGE, -1, "not a member");
+        return true;
+    }
+
+    // Encoded now, while the text is at hand, but only delivered once the log
+    // has the message on disk, so members get the real message_id for
+    // history cursors and read markers. A message that fails is never shown.
+    protocol::DeliverMessage message;
+    message.group_id = request.group_id;
+    message.sender_id = connection.user_id;
+    message.message_id = 0;
+    message.sent_at_ms = now_ms();
+    message.client_tag = request.client_tag;
+    message.sender_name = connection.user.username;
+    message.text = request.text;
+    BufferRef pending = encode_shared([&](std::string& out) { protocol::encode_deliver_message(out, message); });
+
+    Reactor* owner = connection.owner;
+    int fd = connection.user.socket;
+    uint64_t connection_id = connection.id;
+    int32_t group_id = request.group_id;
+    database->group_shard(group_id).message_log().append(connection.user_id, group_id, request.text, "",
+        [this, owner, fd, connection_id, group_id, pending](int message_id) {
+            owner->post([this, owner, fd, connection_id, group_id, pending, message_id]() {
+                Connection* sender = owner->find(fd, connection_id);
+                if (message_id > 0) {
+                    broadcast_to_group(group_id, encode_shared([&](std::string& out) {
+                        out.append(pending.data(), pending.size());
+                        protocol::set_deliver_message_id(out, message_id);
+                    }), sender ? &sender->user : nullptr);
+                }
+                if (sender) {
+                    owner->send(*sender, encode_shared([message_id](std::string& out) {
+                        protocol::encode_result(out, {static_cast<uint16_t>(protocol::FrameType::SEND_MESSAGE), message_id, ""});
+                    }));
+                }
+            });
+        });
+    return true;
+}
+
+bool Server::handle_history(Connection& connection, const protocol::HistoryRequest& request) {
+    if (!is_member(connection, request.group_id)) {
+        reply(connection, protocol::FrameType::HISTORY_REQUEST, -1, "not a member");
+        return true;
+    }
+
+    // A page may come from disk or the archive, so it is read and encoded on a reader thread
+    Reactor* owner = connection.owner;
+    int fd = connection.user.socket;
+    uint64_t connection_id = connection.id;
+    int32_t group_id = request.group_id;
+    int32_t before_message_id = request.before_message_id;
+    uint16_t limit = std::min(request.limit, max_history_page);
+    ShardedDatabase* sharded = database.get();
+    sharded->group_shard(group_id).executor().read(
+        [sharded, group_id, before_message_id, limit](ChatDatabase&) {
+            return sharded->get_group_messages_before(group_id, before_message_id, limit); // Names from the global file
+        },
+        [owner, fd, connection_id, group_id](const std::vector<MessageRecord>& records) {
+            std::vector<protocol::HistoryEntry> entries;
+            entries.reserve(records.size());
+            for (const MessageRecord& record : records) {
+                entries.push_back({record.message_id, record.sender_id, record.sent_at_ms, record.username, record.text});
+            }
+            send_later(owner, fd, connection_id, encode_shared([&](std::string& out) {
+                protocol::encode_history_response(out, group_id, entries);
+            }));
+        });
+    return true;
+}
+
+bool Server::handle_file_offer(Connection& connection, const protocol::FileOffer& offer) {
+    if (!is_member(connection, offer.group_id)) {
+        reply(connection, protocol::FrameType::FILE_OFFER, -1, "not a member");
+        return true;
+    }
+    std::string error;
+    int64_t offset = files->offer(connection.user_id, offer, error);
+    reply(connection, protocol::FrameType::FILE_OFFER, static_cast<int32_t>(offset), error);
+    return true;
+}
+
+bool Server::handle_file_chunk(Connection& connection, const protocol::FileChunk& chunk, bool last) {
+    // Chunks are written and hashed on the file store's thread, in the order
+    // they arrive; only a failed chunk or the final one is answered
+    Reactor* owner = connection.owner;
+    int fd = connection.user.socket;
+    uint64_t connection_id = connection.id;
+    if (!last) {
+        files->write_chunk(connection.user_id, chunk, false,
+            [owner, fd, connection_id](FileStore::ChunkStatus status, const FileStore::Completed&, const std::string& error) {
+                if (status == FileStore::ChunkStatus::FAILED) {
+                    send_later(owner, fd, connection_id, result_frame(protocol::FrameType::FILE_CHUNK, -1, error));
+                }
+            });
+        return true;
+    }
+
+    // The download request names the message, so the group hears of the file
+    // only once it is stored. Every member is told, the uploader's other
+    // sessions included; the uploading connection also gets the message_id.
+    std::shared_ptr<StoredFile> stored = std::make_shared<StoredFile>(StoredFile{
+        owner, fd, connection_id, connection.user_id, connection.user.username, 0, chunk.transfer_id,
+        FileStore::Completed{-1, "", "", 0}});
+    files->write_chunk(connection.user_id, chunk, true,
+        [this, stored](FileStore::ChunkStatus status, const FileStore::Completed& file, const std::string& error) {
+            if (status != FileStore::ChunkStatus::COMPLETE) {
+                send_later(stored->owner, stored->fd, stored->connection_id,
+                           result_frame(protocol::FrameType::FILE_CHUNK, -1, error));
+                return;
+            }
+            stored->file = file;
+            stored->sent_at_ms = now_ms();
+            database->group_shard(file.group_id).message_log().append(stored->sender_id, file.group_id, file.name,
+                                                                      file.digest, [this, stored](int message_id) {
+                if (message_id > 0) {
+                    protocol::DeliverMessage message;
+                    message.group_id = stored->file.group_id;
+                    message.sender_id = stored->sender_id;
+                    message.message_id = message_id;
+                    message.sent_at_ms = stored->sent_at_ms;
+                    message.client_tag = stored->transfer_id;
+                    message.sender_name = stored->sender_name;
+                    message.text = stored->file.name;
+                    broadcast_to_group(stored->file.group_id, encode_shared([&](std::string& out) {
+                        protocol::encode_deliver_message(out, message, protocol::FLAG_FILE_MESSAGE);
+                    }), nullptr);
+                }
+                Reactor* owner = stored->owner;
+                owner->post([stored, message_id]() {
+                    Connection* sender = stored->owner->find(stored->fd, stored->connection_id);
+                    if (sender) {
+                        stored->owner->send(*sender, encode_shared([message_id](std::string& out) {
+                            protocol::encode_result(out, {static_cast<uint16_t>(protocol::FrameType::FILE_CHUNK), message_id, ""});
+                        }));
+                    }
+                });
+            });
+        });
+    return true;
+}
+
+bool Server::handle_file_download(Connection& connection, const protocol::FileDownloadRequest& request) {
+    std::shared_ptr<PendingDownload> download = std::make_shared<PendingDownload>(PendingDownload{
+        connection.owner, connection.user.socket, connection.id, request, -1, ""});
+    int32_t message_id = request.message_id;
+    ChatDatabase* shard = database->message_shard(message_id);
+    if (!shard) {
+        reply(connection, protocol::FrameType::FILE_DOWNLOAD, -1, "no such file");
+        return true;
+    }
+    // The upload's ack can beat its row into SQLite. Only an id the log is
+    // still applying makes the reader wait, and for one batch at most.
+    MessageLog* log = shard->running_message_log();
+    MessageLog* pending = log && log->applying(message_id) ? log : nullptr;
+    shard->executor().read(
+        [download, message_id, pending](ChatDatabase& db) {
+            if (pending) {
+                pending->wait_applied(message_id);
+            }
+            download->group_id = db.get_message_file(message_id, download->digest);
+            return download;
+        },
+        [this](std::shared_ptr<PendingDownload> download) {
+            download->owner->post([this, download]() {
+                Connection* connection = download->owner->find(download->fd, download->connection_id);
+                if (connection) {
+                    finish_download(*connection, download->request, download->group_id, download->digest);
+                }
+            });
+        });
+    return true;
+}
+
+void Server::finish_download(Connection& connection, const protocol::FileDownloadRequest& request, int group_id,
+                             const std::string& digest) {
+    if (group_id == -1 || digest.empty() || !is_member(connection, group_id)) {
+        reply(connection, protocol::FrameType::FILE_DOWNLOAD, -1, "no such file");
+        return;
+    }
+
+    uint64_t size = 0;
+    int fd = files->open_content(digest, size);
+    if (fd < 0) {
+        reply(connection, protocol::FrameType::FILE_DOWNLOAD, -1, "file missing");
+        return;
+    }
+    FileSend file(fd, request.transfer_id, request.offset, 0); // Owns fd from here on
+    if (size > FileStore::max_file_size) {
+        // Not uploaded through this server; its size would wrap the RESULT value
+        reply(connection, protocol::FrameType::FILE_DOWNLOAD, -1, "file too large");
+        return;
+    }
+    if (request.offset > size) {
+        reply(connection, protocol::FrameType::FILE_DOWNLOAD, -1, "offset past the end");
+        return;
+    }
+    uint64_t available = size - request.offset;
+    file.remaining = request.length == 0 ? available : std::min(request.length, available);
+
+    if (!connection.owner->send_file(connection, std::move(file))) {
+        reply(connection, protocol::FrameType::FILE_DOWNLOAD, -1, "too many downloads");
+        return;
+    }
+    // Queued frames go out before a download's first chunk, so this RESULT
+    // precedes the content. It carries the full size, for resuming later.
+    reply(connection, protocol::FrameType::FILE_DOWNLOAD, static_cast<int32_t>(size));
+}
@@ -0,0 +1,48 @@
+#include <string>
+#include <memory>
+#include <csignal>
+#include <pthread.h>
+#include "server.h"
+#include "logger.h"
+#include "metrics_endpoint.h"
+
+int main(int argc, char** argv) {
+    int port = argc > 1 ? std::stoi(argv[1]) : 8080;
+    std::string dbPath = argc > 2 ? argv[2] : "data/chat.db";
+    int reactors = argc > 3 ? std::stoi(argv[3]) : 0;
+    int metrics_port = argc > 4 ? std::stoi(argv[4]) : -1; // Prometheus text on 127.0.0.1, off unless given
+    std::string level = argc > 5 ? argv[5] : "info";
+    int shards = argc > 6 ? std::stoi(argv[6]) : 1; // Database files groups are split over
+
+    logging::set_level(level == "debug" ? LogLevel::DEBUG : level == "warn" ? LogLevel::WARN :
+                       level == "error" ? LogLevel::ERROR : LogLevel::INFO);
+
+    // Block the shutdown signals before any reactor thread exists, then wait for them here
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+    Server server(port, dbPath, reactors, shards);
+    server.start();
+    if (!server.is_running()) {
+        log_error() << "Failed to start server";
+        return 1;
+    }
+
+    std::unique_ptr<MetricsEndpoint> endpoint;
+    if (metrics_port >= 0) {
+        endpoint.reset(new MetricsEndpoint(metrics_port));
+        if (endpoint->start()) {
+            log_info() << "Metrics at http://127.0.0.1:" << endpoint->bound_port() << "/metrics";
+        }
+    }
+
+    int received;
+    sigwait(&signals, &received);
+    log_info() << "Shutting down with " << server.get_user_count() << " connected users";
+    endpoint.reset();
+    server.stop();
+    return 0;
+}
@@ -0,0 +1,63 @@
+#include "../include/session_cache.h"
+#include "../include/password_hash.h"
+#include <algorithm>
+#include <functional>
+#include <iterator>
+
+SessionCache::SessionCache(std::chrono::seconds ttl, size_t max_sessions)
+    : ttl(ttl), max_per_shard(std::max<size_t>(1, max_sessions / shard_count)) {}
+
+SessionCache::Shard& SessionCache::shard_of(std::string_view token) {
+    return shards[std::hash<std::string_view>()(token) % shard_count];
+}
+
+std::string SessionCache::issue(int user_id, const std::string& username) {
+    uint8_t bytes[16];
+    if (!password_hash::random_bytes(bytes, sizeof(bytes))) {
+        return "";
+    }
+    static const char digits[] = "0123456789abcdef";
+    std::string token;
+    for (uint8_t byte : bytes) {
+        token += digits[byte >> 4];
+        token += digits[byte & 0xf];
+    }
+
+    Clock::time_point now = Clock::now();
+    Shard& shard = shard_of(token);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    if (shard.sessions.size() >= max_per_shard) {
+        // Expired sessions first; if the shard is still full, any one makes room
+        for (auto it = shard.sessions.begin(); it != shard.sessions.end();) {
+            it = it->second.expires <= now ? shard.sessions.erase(it) : std::next(it);
+        }
+        if (shard.sessions.size() >= max_per_shard) {
+            shard.sessions.erase(shard.sessions.begin());
+        }
+    }
+    shard.sessions[token] = Session{user_id, username, now + ttl};
+    return token;
+}
+
+int SessionCache::lookup(std::string_view token, std::string_view username) {
+    Shard& shard = shard_of(token);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.sessions.find(std::string(token));
+    if (it == shard.sessions.end()) {
+        return -1;
+    }
+    if (it->second.expires <= Clock::now()) {
+        shard.sessions.erase(it);
+        return -1;
+    }
+    return it->second.username == username ? it->second.user_id : -1;
+}
+
+size_t SessionCache::size() const {
+    size_t total = 0;
+    for (const Shard& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        total += shard.sessions.size();
+    }
+    return total;
+}
@@ -0,0 +1,277 @@
+#include "../include/sharded_database.h"
+#include "../include/db_connection.h"
+#include "../include/logger.h"
+#include <algorithm>
+
+namespace {
+
+std::string shard_name(const std::string& db_name, int index) {
+    return db_name + ".shard" + std::to_string(index);
+}
+
+} // namespace
+
+ShardedDatabase::ShardedDatabase(const std::string& db_name, int shard_count)
+    : db_name(db_name), global_database(nullptr) {
+    if (shard_count < 1) {
+        log_error() << "A sharded database needs at least one shard";
+        return;
+    }
+    // Every memory database name maps to the same shared handle
+    if (shard_count > 1 && is_memory_database(db_name)) {
+        log_error() << "A memory database cannot be sharded";
+        return;
+    }
+
+    ChatDatabase* global = get_database(db_name);
+    if (!global) {
+        return;
+    }
+    std::vector<ChatDatabase*> opened;
+    if (shard_count == 1) {
+        opened.push_back(global);
+    }
+    for (int i = 0; shard_count > 1 && i < shard_count; ++i) {
+        ChatDatabase* shard = get_database(shard_name(db_name, i));
+        if (!shard) {
+            log_error() << "Failed to open shard " << shard_name(db_name, i);
+            return;
+        }
+        opened.push_back(shard);
+    }
+    global_database = global;
+    shards.swap(opened);
+}
+
+bool ShardedDatabase::is_open() const {
+    return global_database != nullptr;
+}
+
+bool ShardedDatabase::init_schema() {
+    if (!is_open() || !global_database->init_schema()) {
+        return false;
+    }
+    int count = shard_count();
+    if (count > 1 && !global_database->assign_shard(-1, count)) {
+        return false;
+    }
+    for (int i = 0; i < count; ++i) {
+        if (!shards[i]->init_schema() || !shards[i]->assign_shard(i, count)) {
+            log_error() << "Failed to initialize shard " << i << " of " << db_name;
+            return false;
+        }
+    }
+    return true;
+}
+
+bool ShardedDatabase::set_durability(Durability durability) {
+    bool all = is_open() && global_database->set_durability(durability);
+    for (size_t i = 0; shard_count() > 1 && i < shards.size(); ++i) {
+        all = shards[i]->set_durability(durability) && all;
+    }
+    return all;
+}
+
+int ShardedDatabase::shard_count() const {
+    return static_cast<int>(shards.size());
+}
+
+// Routing
+ChatDatabase& ShardedDatabase::global() {
+    return *global_database;
+}
+
+ChatDatabase& ShardedDatabase::shard(int index) {
+    return *shards[index];
+}
+
+ChatDatabase& ShardedDatabase::group_shard(int group_id) {
+    // Unsigned, so a bogus negative id from a client still lands on a shard
+    return *shards[static_cast<unsigned>(group_id) % shards.size()];
+}
+
+ChatDatabase* ShardedDatabase::message_shard(int message_id) {
+    if (message_id <= 0) {
+        return nullptr;
+    }
+    int index = (message_id - 1) / message_id_slice(shard_count());
+    return index < shard_count() ? shards[index] : nullptr;
+}
+
+void ShardedDatabase::fill_usernames(std::vector<MessageRecord>& messages) {
+    if (shard_count() == 1) {
+        return; // The shard is the global file and named them already
+    }
+    for (MessageRecord& message : messages) {
+        message.username = global_database->get_username(message.sender_id);
+    }
+}
+
+// User management
+bool ShardedDatabase::register_user(const std::string& username, const std::string& password) {
+    return global_database->register_user(username, password);
+}
+
+bool ShardedDatabase::authenticate_user(const std::string& username, const std::string& password) {
+    return global_database->authenticate_user(username, password);
+}
+
+int ShardedDatabase::get_user_id(const std::string& username) {
+    return global_database->get_user_id(username);
+}
+
+std::string ShardedDatabase::get_username(int user_id) {
+    return global_database->get_username(user_id);
+}
+
+std::vector<std::string> ShardedDatabase::get_usernames(const std::vector<int>& user_ids) {
+    return global_database->get_usernames(user_ids);
+}
+
+// Group management
+bool ShardedDatabase::create_group(const std::string& group_name) {
+    return global_database->create_group(group_name);
+}
+
+bool ShardedDatabase::add_user_to_group(int user_id, int group_id) {
+    return group_shard(group_id).add_user_to_group(user_id, group_id);
+}
+
+std::vector<bool> ShardedDatabase::add_users_to_group(int group_id, const std::vector<int>& user_ids) {
+    return group_shard(group_id).add_users_to_group(group_id, user_ids);
+}
+
+bool ShardedDatabase::remove_user_from_group(int user_id, int group_id) {
+    return group_shard(group_id).remove_user_from_group(user_id, group_id);
+}
+
+std::vector<int> ShardedDatabase::get_user_groups(int user_id) {
+    if (shard_count() == 1) {
+        return shards[0]->get_user_groups(user_id);
+    }
+    std::vector<int> groups;
+    for (ChatDatabase* shard : shards) {
+        std::vector<int> part = shard->get_user_groups(user_id);
+        groups.insert(groups.end(), part.begin(), part.end());
+    }
+    std::sort(groups.begin(), groups.end());
+    return groups;
+}
+
+std::vector<int> ShardedDatabase::get_group_members(int group_id) {
+    return group_shard(group_id).get_group_members(group_id);
+}
+
+std::string ShardedDatabase::get_group_name(int group_id) {
+    return global_database->get_group_name(group_id);
+}
+
+Group ShardedDatabase::get_group(int group_id) {
+    std::string group_name = get_group_name(group_id);
+    if (group_name.empty()) {
+        return Group();
+    }
+    Group group(group_id, group_name);
+    group.members = MemberSet(get_group_members(group_id));
+    group.message_count = std::max(0, get_message_count_in_group(group_id));
+    return group;
+}
+
+// Message management
+bool ShardedDatabase::save_message(int sender_id, int group_id, const std::string& text, const std::string& file_path) {
+    return group_shard(group_id).save_message(sender_id, group_id, text, file_path);
+}
+
+int ShardedDatabase::store_message(int sender_id, int group_id, std::string_view text, std::string_view file_path) {
+    return group_shard(group_id).store_message(sender_id, group_id, text, file_path);
+}
+
+std::vector<int> ShardedDatabase::save_messages(const std::vector<MessageRecord>& messages) {
+    if (shard_count() == 1) {
+        return shards[0]->save_messages(messages);
+    }
+    // Split by shard, store each part in its own transaction, then put the ids back in order
+    std::vector<std::vector<MessageRecord>> parts(shards.size());
+    std::vector<std::vector<size_t>> positions(shards.size());
+    for (size_t i = 0; i < messages.size(); ++i) {
+        size_t index = static_cast<unsigned>(messages[i].group_id) % shards.size();
+        parts[index].push_back(messages[i]);
+        positions[index].push_back(i);
+    }
+    std::vector<int> message_ids(messages.size(), -1);
+    for (size_t index = 0; index < shards.size(); ++index) {
+        if (parts[index].empty()) {
+            continue;
+        }
+        std::vector<int> stored = shards[index]->save_messages(parts[index]);
+        for (size_t j = 0; j < stored.size(); ++j) {
+            message_ids[positions[index][j]] = stored[j];
+        }
+    }
+    return message_ids;
+}
+
+std::vector<std::pair<std::string, std::string>> ShardedDatabase::get_group_messages(int group_id, int limit) {
+    std::vector<std::pair<std::string, std::string>> messages;
+    for (MessageRecord& record : get_group_messages_before(group_id, 0, limit)) {
+        messages.push_back({std::move(record.username), std::move(record.text)});
+    }
+    return messages;
+}
+
+std::vector<MessageRecord> ShardedDatabase::get_group_messages_before(int group_id, int before_message_id, int limit) {
+    std::vector<MessageRecord> messages = group_shard(group_id).get_group_messages_before(group_id, before_message_id, limit);
+    fill_usernames(messages);
+    return messages;
+}
+
+std::vector<MessageRecord> ShardedDatabase::search_messages(int group_id, const std::string& query, int limit) {
+    std::vector<MessageRecord> messages = group_shard(group_id).search_messages(group_id, query, limit);
+    fill_usernames(messages);
+    return messages;
+}
+
+// Group-Message relationship functions
+std::vector<int> ShardedDatabase::get_group_message_ids(int group_id) {
+    return group_shard(group_id).get_group_message_ids(group_id);
+}
+
+bool ShardedDatabase::remove_message_from_group(int message_id, int group_id) {
+    return group_shard(group_id).remove_message_from_group(message_id, group_id);
+}
+
+int ShardedDatabase::get_message_group_id(int message_id) {
+    ChatDatabase* shard = message_shard(message_id);
+    return shard ? shard->get_message_group_id(message_id) : -1;
+}
+
+int ShardedDatabase::get_message_file(int message_id, std::string& file_path) {
+    ChatDatabase* shard = message_shard(message_id);
+    if (!shard) {
+        file_path.clear();
+        return -1;
+    }
+    return shard->get_message_file(message_id, file_path);
+}
+
+int ShardedDatabase::get_message_count_in_group(int group_id) {
+    return group_shard(group_id).get_message_count_in_group(group_id);
+}
+
+// Read markers and unread counts
+bool ShardedDatabase::mark_read(int user_id, int group_id, int message_id) {
+    return group_shard(group_id).mark_read(user_id, group_id, message_id);
+}
+
+std::vector<std::pair<int, int>> ShardedDatabase::get_unread_counts(int user_id) {
+    if (shard_count() == 1) {
+        return shards[0]->get_unread_counts(user_id);
+    }
+    std::vector<std::pair<int, int>> counts;
+    for (ChatDatabase* shard : shards) {
+        std::vector<std::pair<int, int>> part = shard->get_unread_counts(user_id);
+        counts.insert(counts.end(), part.begin(), part.end());
+    }
+    std::sort(counts.begin(), counts.end());
+    return counts;
+}
@@ -0,0 +1,19 @@
+#include "../include/shared_buffer.h"
+#include "../include/buffer_pool.h"
+#include <cstring>
+#include <new>
+
+BufferRef SharedBuffer::copy_of(std::string_view bytes) {
+    void* memory = buffer_pool::allocate(sizeof(SharedBuffer) + bytes.size());
+    SharedBuffer* buffer = new (memory) SharedBuffer(bytes.size());
+    memcpy(reinterpret_cast<char*>(buffer + 1), bytes.data(), bytes.size()); // The bytes follow the header
+    return BufferRef(buffer);
+}
+
+void SharedBuffer::release() {
+    if (references.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        size_t bytes = sizeof(SharedBuffer) + length;
+        this->~SharedBuffer();
+        buffer_pool::deallocate(this, bytes);
+    }
+}
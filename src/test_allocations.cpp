@@ -0,0 +1,183 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <new>
+#include <cstdlib>
+#include "../include/protocol.h"
+#include "../include/ring_buffer.h"
+#include "../include/shared_buffer.h"
+#include "../include/connection.h"
+#include "../include/reactor.h"
+#include "../include/chat_database.h"
+#include "../include/message_ingest.h"
+
+// Counts every global operator new made by the calling thread. The ingest
+// writer's SQLite work happens on its own thread and is not counted; what is
+// measured is the reactor side of a send: parse, encode, fan-out, flush,
+// enqueue for storage and the ack coming back.
+thread_local uint64_t allocations = 0;
+
+void* operator new(size_t size) {
+    allocations++;
+    void* block = std::malloc(size ? size : 1);
+    if (!block) {
+        throw std::bad_alloc();
+    }
+    return block;
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void* block) noexcept {
+    std::free(block);
+}
+
+void operator delete[](void* block) noexcept {
+    std::free(block);
+}
+
+void operator delete(void* block, size_t) noexcept {
+    std::free(block);
+}
+
+void operator delete[](void* block, size_t) noexcept {
+    std::free(block);
+}
+
+namespace {
+
+const int recipients = 32;
+
+// Everything one simulated reactor thread owns
+struct SendPath
+{
+    SendPath(MessageIngestQueue& ingest) : ingest(ingest), members(std::make_shared<std::vector<int>>()) {
+        for (int i = 0; i < recipients; ++i) {
+            connections.emplace_back(new Connection(-1, i + 1, nullptr));
+            members->push_back(i + 1);
+        }
+        inbound.reserve(4096);
+    }
+
+    // One SEND_MESSAGE from arrival to the ack, like Server::handle_send and Reactor
+    void send(const std::string& request) {
+        inbound.append(request.data(), request.size());
+        protocol::Frame frame;
+        protocol::SendMessageRequest decoded;
+        if (parser.next(inbound, frame) != protocol::ParseStatus::FRAME ||
+            !protocol::decode_send_message(frame.payload, decoded)) {
+            failures++;
+            return;
+        }
+
+        scratch.clear();
+        protocol::encode_deliver_message(scratch, {decoded.group_id, 1, 0, 0, decoded.client_tag, "alice", decoded.text});
+        BufferRef delivery = SharedBuffer::copy_of(scratch);
+        MembershipIndex::IdList snapshot = members;
+        mailbox.push([this, snapshot, delivery]() {
+            for (int user_id : *snapshot) {
+                connections[user_id - 1]->outbound.push_back(delivery);
+            }
+        });
+
+        SendPath* self = this;
+        ingest.enqueue(1, decoded.group_id, decoded.text, "", [self](int message_id) {
+            self->mailbox.push([self, message_id]() {
+                self->scratch.clear();
+                protocol::encode_result(self->scratch, {static_cast<uint16_t>(protocol::FrameType::SEND_MESSAGE), message_id, ""});
+                self->connections[0]->outbound.push_back(SharedBuffer::copy_of(self->scratch));
+            });
+        });
+        parser.consume(inbound);
+        drain();
+    }
+
+    // Posted tasks, then every outbound queue as if the sockets took it all
+    void drain() {
+        Reactor::Task task;
+        while (mailbox.pop(task)) {
+            task();
+        }
+        for (auto& connection : connections) {
+            while (!connection->outbound.empty()) {
+                connection->outbound.pop_front();
+            }
+        }
+    }
+
+    MessageIngestQueue& ingest;
+    std::vector<std::unique_ptr<Connection>> connections;
+    std::shared_ptr<std::vector<int>> members;
+    MpscQueue<Reactor::Task> mailbox;
+    RingBuffer inbound;
+    protocol::FrameParser parser;
+    std::string scratch;
+    int failures = 0;
+};
+
+} // namespace
+
+int main() {
+    std::cout << "=== Send Path Allocation Test ===" << std::endl;
+
+    ChatDatabase database(":memory:");
+    if (!database.init_schema() || !database.register_user("alice", "pw") || !database.create_group("general")) {
+        std::cout << "✗ Could not set up the database" << std::endl;
+        return 1;
+    }
+    MessageIngestQueue ingest(database);
+    SendPath path(ingest);
+
+    // Test 1: the counter sees ordinary heap use
+    std::cout << "\n1. Testing the allocation counter..." << std::endl;
+    uint64_t before = allocations;
+    std::string heap(200, 'x');
+    if (allocations > before) {
+        std::cout << "✓ A 200-byte std::string counted " << allocations - before << " allocation(s)" << std::endl;
+    } else {
+        std::cout << "✗ Allocation counter is not hooked in" << std::endl;
+        return 1;
+    }
+
+    // Test 2: steady-state sends, short and long text
+    std::cout << "\n2. Testing steady-state sends..." << std::endl;
+    std::vector<std::string> requests;
+    for (size_t length : {24, 120, 900}) {
+        std::string request;
+        protocol::encode_send_message(request, {1, 42, std::string(length, 'm')});
+        requests.push_back(request);
+    }
+
+    // The warm-up runs the same pattern, so the pools and the queues reach
+    // their high-water marks before anything is counted. Flushing every 100
+    // sends keeps the backlog, and with it the memory the pool must hold, bounded.
+    auto run = [&](int sends) {
+        for (int i = 0; i < sends; ++i) {
+            path.send(requests[i % requests.size()]);
+            if (i % 100 == 99) {
+                ingest.flush();
+            }
+        }
+        ingest.flush();
+        path.drain();
+    };
+    run(50000);
+
+    const int measured = 50000;
+    before = allocations;
+    run(measured);
+    uint64_t counted = allocations - before;
+
+    if (path.failures == 0 && counted == 0) {
+        std::cout << "✓ " << measured << " sends to " << recipients << " recipients made no global allocations" << std::endl;
+    } else {
+        std::cout << "✗ " << counted << " global allocations over " << measured << " sends (" << path.failures << " failed)" << std::endl;
+        return 1;
+    }
+
+    std::cout << "\n=== All allocation tests completed successfully! ===" << std::endl;
+    return 0;
+}
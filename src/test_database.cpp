@@ -1,7 +1,21 @@
 #include <iostream>
 #include <string>
 #include <cassert>
+#include <chrono>
+#include <filesystem>
+#include <algorithm>
+#include <climits>
+#include <future>
+#include <thread>
+#include <memory>
 #include "database.h"
+#include "chat_database.h"
+#include "password_hash.h"
+#include "database_executor.h"
+#include "sharded_database.h"
+#include "message_log.h"
+#include "metrics.h"
+#include "logger.h"
 
 int main() {
     std::cout << "=== Comprehensive Database Test Suite ===" << std::endl;
@@ -161,6 +175,635 @@ int main() {
         std::cout << "✗ Group 2 should be empty" << std::endl;
     }
     
+    // Test 7: Paginated history
+    std::cout << "\n7. Testing paginated history..." << std::endl;
+    
+    for (int i = 0; i < 5; i++) {
+        save_message(dbPath, userId3, 2, "Page message " + std::to_string(i));
+    }
+    
+    // Walk group 2 newest-first, two messages per page
+    std::vector<MessageRecord> page = get_group_messages_before(dbPath, 2, 0, 2);
+    int pages = 0;
+    int lastId = 0;
+    bool ordered = true;
+    while (!page.empty()) {
+        pages++;
+        for (const auto& msg : page) {
+            if ((lastId != 0 && msg.message_id >= lastId) || msg.sent_at_ms <= 0) {
+                ordered = false;
+            }
+            lastId = msg.message_id;
+        }
+        page = get_group_messages_before(dbPath, 2, lastId, 2);
+    }
+    
+    int total = get_message_count_in_group(dbPath, 2);
+    if (ordered && pages == (total + 1) / 2) {
+        std::cout << "✓ Paged through " << total << " messages in " << pages << " pages" << std::endl;
+    } else {
+        std::cout << "✗ Paginated history returned messages out of order" << std::endl;
+    }
+
+    // Test 8: Batch operations
+    std::cout << "\n8. Testing batch operations..." << std::endl;
+
+    // The repeated id is rejected without rolling back the others
+    std::vector<bool> added = add_users_to_group(dbPath, 2, {userId1, userId2, userId1});
+    std::vector<int> joinedGroups = get_user_groups(dbPath, userId2);
+    if (added == std::vector<bool>{true, true, false} && get_group_members(dbPath, 2).size() == 2 &&
+        std::binary_search(joinedGroups.begin(), joinedGroups.end(), 2)) {
+        std::cout << "✓ Batch added 2 users to group 2, duplicate rejected" << std::endl;
+    } else {
+        std::cout << "✗ Batch add to group returned wrong results" << std::endl;
+    }
+
+    std::vector<MessageRecord> batch(3);
+    for (size_t i = 0; i < batch.size(); i++) {
+        batch[i].sender_id = userId1;
+        batch[i].group_id = 2;
+        batch[i].text = "Batch message " + std::to_string(i);
+    }
+    int countBefore = get_message_count_in_group(dbPath, 2);
+    std::vector<int> savedIds = save_messages(dbPath, batch);
+    bool saved = savedIds.size() == 3 && savedIds[0] > 0 && savedIds[1] > savedIds[0] && savedIds[2] > savedIds[1];
+    if (saved && get_message_count_in_group(dbPath, 2) == countBefore + 3) {
+        std::cout << "✓ Batch saved 3 messages" << std::endl;
+    } else {
+        std::cout << "✗ Batch save returned wrong ids" << std::endl;
+    }
+
+    std::vector<std::string> names = get_usernames(dbPath, {userId1, userId2, 9999});
+    if (names == std::vector<std::string>{"alice", "bob", ""}) {
+        std::cout << "✓ Batch username lookup works" << std::endl;
+    } else {
+        std::cout << "✗ Batch username lookup returned wrong names" << std::endl;
+    }
+
+    // Test 9: Group layout
+    std::cout << "\n9. Testing group layout..." << std::endl;
+
+    Group group = get_database(dbPath)->get_group(2);
+    if (group.group_id == 2 && group.name() == "random" && group.is_member(userId1) && !group.is_member(userId3) &&
+        group.get_message_count() == get_message_count_in_group(dbPath, 2)) {
+        std::cout << "✓ Group 2 loaded with " << group.get_member_count() << " members and "
+                  << group.get_message_count() << " messages" << std::endl;
+    } else {
+        std::cout << "✗ Group 2 loaded with wrong contents" << std::endl;
+    }
+
+    // A moved-from group stays readable
+    Group moved = std::move(group);
+    moved.add_message();
+    if (moved.name() == "random" && group.name().empty() && group.updated_at() == 0) {
+        std::cout << "✓ Moved-from group reads as unnamed" << std::endl;
+    } else {
+        std::cout << "✗ Moved group has the wrong name" << std::endl;
+    }
+
+    // Large enough for the dense bucket to switch to a bitmap and back
+    MemberSet large;
+    for (int id = 1; id <= 20000; id += 2) {
+        large.insert(id);
+    }
+    large.insert(100000);
+    bool dense = large.size() == 10001 && large.contains(19999) && !large.contains(20000) && large.contains(100000) &&
+                 large.memory_bytes() < 10001 * sizeof(int);
+    for (int id = 1; id <= 20000; id += 2) {
+        large.erase(id);
+    }
+    if (dense && large.to_vector() == std::vector<int>{100000}) {
+        std::cout << "✓ Member set switched between bitmap and array storage" << std::endl;
+    } else {
+        std::cout << "✗ Member set lookups disagree with its contents" << std::endl;
+    }
+
+    // Test 10: Message search
+    std::cout << "\n10. Testing message search..." << std::endl;
+
+    int plain = get_database(dbPath)->store_message(userId1, 1, "Deploying the release tonight");
+    int better = get_database(dbPath)->store_message(userId2, 1, "release notes: release blockers and release dates");
+    get_database(dbPath)->store_message(userId2, 2, "release in the other group");
+    std::vector<MessageRecord> hits = search_messages(dbPath, 1, "release");
+    if (hits.size() == 2 && hits[0].message_id == better && hits[1].message_id == plain && hits[0].username == "bob") {
+        std::cout << "✓ Search ranked 2 matches in group 1" << std::endl;
+    } else {
+        std::cout << "✗ Search returned " << hits.size() << " messages in the wrong order" << std::endl;
+    }
+
+    hits = search_messages(dbPath, 1, "deploy* TONIGHT");
+    bool prefix = hits.size() == 1 && hits[0].message_id == plain;
+    remove_message_from_group(dbPath, plain, 1);
+    if (prefix && search_messages(dbPath, 1, "deploy*").empty() && search_messages(dbPath, 1, "\" OR *").empty()) {
+        std::cout << "✓ Prefix search works and deleted messages leave the index" << std::endl;
+    } else {
+        std::cout << "✗ Prefix search or index maintenance failed" << std::endl;
+    }
+
+    // Test 11: Unread counts
+    std::cout << "\n11. Testing unread counts..." << std::endl;
+
+    // userId1 and userId2 are in groups 1 and 2 by now
+    int readUpTo = save_messages(dbPath, batch).back();
+    int countGroup2 = get_message_count_in_group(dbPath, 2);
+    bool marked = mark_read(dbPath, userId1, 2, readUpTo) && mark_read(dbPath, userId1, 2, readUpTo - 1); // The older mark is ignored
+    save_message(dbPath, userId2, 2, "Unread one");
+    save_message(dbPath, userId2, 2, "Unread two");
+    int newest = get_group_message_ids(dbPath, 2).front();
+    remove_message_from_group(dbPath, newest, 2); // An unread message goes away
+    remove_message_from_group(dbPath, readUpTo, 2); // And a read one
+    std::vector<std::pair<int, int>> unread = get_unread_counts(dbPath, userId1);
+    std::vector<std::pair<int, int>> expected = {{1, get_message_count_in_group(dbPath, 1)}, {2, 1}};
+    if (marked && get_message_count_in_group(dbPath, 2) == countGroup2 && unread == expected) {
+        std::cout << "✓ 1 unread message in group 2, all " << expected[0].second << " unread in group 1" << std::endl;
+    } else {
+        std::cout << "✗ Unread counts disagree with the read markers" << std::endl;
+    }
+
+    // Test 12: Archived history
+    std::cout << "\n12. Testing archived history..." << std::endl;
+
+    std::string archivePath = "data/archive_test.db";
+    for (const char* suffix : {"", "-wal", "-shm", ".archive"}) {
+        std::filesystem::remove_all(archivePath + suffix);
+    }
+    {
+        ChatDatabase archiveDb(archivePath);
+        archiveDb.init_schema();
+        archiveDb.register_user("ann", "pw");
+        archiveDb.create_group("old");
+        archiveDb.create_group("other");
+        archiveDb.add_user_to_group(1, 1);
+        archiveDb.add_user_to_group(1, 2);
+
+        // Two archive runs make two partitions; the last messages stay hot
+        auto later = []() {
+            return std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count() + 1000;
+        };
+        int fileMessage = archiveDb.store_message(1, 1, "", "ab/cd");
+        for (int i = 0; i < 400; ++i) {
+            archiveDb.store_message(1, 1 + i % 3 / 2, "archived line " + std::to_string(i));
+        }
+        std::vector<MessageRecord> history = archiveDb.get_group_messages_before(1, 0, 1000);
+        archiveDb.mark_read(1, 1, history[100].message_id);
+        int movedFirst = archiveDb.archive_messages(later());
+        for (int i = 0; i < 60; ++i) {
+            archiveDb.store_message(1, 1 + i % 2, "second run " + std::to_string(i));
+        }
+        int movedSecond = archiveDb.archive_messages(later());
+        for (int i = 0; i < 5; ++i) {
+            archiveDb.store_message(1, 1, "still hot " + std::to_string(i));
+        }
+
+        std::vector<int> ids = archiveDb.get_group_message_ids(1);
+        std::vector<MessageRecord> paged;
+        for (int cursor = 0;;) {
+            std::vector<MessageRecord> page = archiveDb.get_group_messages_before(1, cursor, 37);
+            if (page.empty()) {
+                break;
+            }
+            cursor = page.back().message_id;
+            paged.insert(paged.end(), page.begin(), page.end());
+        }
+        bool pagesMatch = paged.size() == ids.size() && paged.size() == history.size() + 35;
+        for (size_t i = 0; pagesMatch && i < paged.size(); ++i) {
+            pagesMatch = paged[i].message_id == ids[i] && paged[i].username == "ann" &&
+                         (i < 35 || paged[i].text == history[i - 35].text);
+        }
+
+        std::string filePath;
+        std::vector<std::pair<int, int>> unread = archiveDb.get_unread_counts(1);
+        if (movedFirst == 401 && movedSecond == 60 && archiveDb.archive().partitions().size() == 2 && pagesMatch &&
+            archiveDb.get_message_file(fileMessage, filePath) == 1 && filePath == "ab/cd" &&
+            archiveDb.get_message_count_in_group(1) == static_cast<int>(ids.size()) &&
+            unread.size() == 2 && unread[0].second == 100 + 35) {
+            std::cout << "✓ " << paged.size() << " messages read back across 2 partitions and the hot table" << std::endl;
+        } else {
+            std::cout << "✗ Archived history does not match what was stored" << std::endl;
+        }
+    }
+    ChatDatabase reopened(archivePath);
+    if (reopened.init_schema() && reopened.get_group_messages_before(2, 0, 1000).size() == 163 &&
+        reopened.mark_read(1, 1, reopened.get_group_message_ids(1)[20]) && // 15 archived and 5 hot messages newer
+        reopened.get_unread_counts(1)[0].second == 20) {
+        std::cout << "✓ Partitions reopen from the catalog and unread counts cover archived messages" << std::endl;
+    } else {
+        std::cout << "✗ Reopened archive is incomplete" << std::endl;
+    }
+
+    // Test 13: Password hashing
+    std::cout << "\n13. Testing password hashing..." << std::endl;
+
+    // RFC 7914 section 11 uses these PBKDF2-HMAC-SHA256 vectors
+    bool vectors = Sha256::hex(password_hash::pbkdf2("password", "salt", 1)) ==
+                       "120fb6cffcf8b32c43e7225256c4f837a86548c92ccc35480805987cb70be17b" &&
+                   Sha256::hex(password_hash::pbkdf2("password", "salt", 4096)) ==
+                       "c5e478d59288c841aa530db6845c4c8d962893a001ce4e11a4963873aa98134a";
+    std::string stored = password_hash::hash("hunter2", 1000);
+    if (vectors && password_hash::verify("hunter2", stored) && !password_hash::verify("hunter3", stored) &&
+        stored != password_hash::hash("hunter2", 1000) && password_hash::needs_upgrade(stored, 2000) &&
+        password_hash::verify("legacy", "legacy") && password_hash::needs_upgrade("legacy", 1000)) {
+        std::cout << "✓ PBKDF2 matches the RFC vectors and salted hashes verify" << std::endl;
+    } else {
+        std::cout << "✗ Password hashing is wrong" << std::endl;
+    }
+
+    // A new cost applies to new hashes, and to old ones at their next login
+    get_database(dbPath)->set_password_cost(2000);
+    if (authenticate_user(dbPath, "bob", "password456") && authenticate_user(dbPath, "bob", "password456") &&
+        !authenticate_user(dbPath, "bob", "password123") && !authenticate_user(dbPath, "nobody", "password456")) {
+        std::cout << "✓ Logins still work after the hash is upgraded to a new cost" << std::endl;
+    } else {
+        std::cout << "✗ Login failed after changing the password cost" << std::endl;
+    }
+
+    // Test 14: Asynchronous calls
+    std::cout << "\n14. Testing the database executor..." << std::endl;
+
+    {
+        // Looking for a running executor does not start one
+        bool startedLazily = get_database(dbPath)->running_executor() == nullptr;
+        DatabaseExecutor& executor = get_database(dbPath)->executor();
+        startedLazily = startedLazily && get_database(dbPath)->running_executor() == &executor;
+        int countBefore = get_message_count_in_group(dbPath, 1);
+        std::vector<int> savedIds;
+        for (int i = 0; i < 20; ++i) {
+            // Callbacks run on the writer thread, one job at a time
+            executor.write([i](ChatDatabase& db) { return db.store_message(1, 1, "async " + std::to_string(i)); },
+                           [&savedIds](int message_id) { savedIds.push_back(message_id); });
+        }
+        std::future<std::vector<int>> groups = executor.get_user_groups(userId1);
+        std::vector<std::future<std::vector<MessageRecord>>> pages;
+        for (int i = 0; i < 8; ++i) {
+            // Readers do not wait for the writer, so these may run before, between or after the writes
+            pages.push_back(executor.get_group_messages_before(1, 0, 5));
+        }
+        executor.flush();
+        bool ordered = savedIds.size() == 20 && std::is_sorted(savedIds.begin(), savedIds.end()) && savedIds[0] > 0;
+        bool pagesOk = true;
+        for (auto& page : pages) {
+            size_t size = page.get().size();
+            pagesOk = pagesOk && size >= static_cast<size_t>(std::min(countBefore, 5)) && size <= 5;
+        }
+        std::vector<MessageRecord> latest = executor.get_group_messages_before(1, 0, 1).get();
+        if (startedLazily && ordered && pagesOk && !groups.get().empty() && latest.size() == 1 && latest[0].message_id == savedIds.back() &&
+            executor.get_message_count_in_group(1).get() == countBefore + 20 &&
+            executor.pending_reads() == 0 && executor.pending_writes() == 0) {
+            std::cout << "✓ Writes run in submission order and reads after flush() see every one" << std::endl;
+        } else {
+            std::cout << "✗ Executor results are out of order" << std::endl;
+        }
+    }
+
+    // Test 15: Metrics and logging
+    std::cout << "\n15. Testing metrics and logging..." << std::endl;
+
+    {
+        metrics::Counter counter("test_events_total", "Events counted by the test");
+        metrics::Gauge gauge("test_depth", "Depth tracked by the test");
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 4; ++t) {
+            threads.emplace_back([&counter, &gauge, t]() {
+                for (int i = 0; i < 1000; ++i) {
+                    counter.add();
+                }
+                gauge.add(t == 0 ? 10 : -1); // Per-thread shares go negative, the sum does not
+            });
+        }
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+        metrics::Histogram latency("chat_db_call_seconds", "Latency of ChatDatabase calls", "call=\"get_group_name\"");
+        uint64_t calls = latency.count();
+        get_group_name(dbPath, 1);
+
+        // A page served from the recent-message cache is not a SQLite sample
+        metrics::Histogram pages("chat_db_call_seconds", "Latency of ChatDatabase calls", "call=\"get_group_messages_before\"");
+        ChatDatabase* db = get_database(dbPath);
+        db->get_group_messages_before(1, 0, 5);
+        uint64_t hits = db->recent_cache_stats().hits;
+        uint64_t queries = pages.count();
+        db->get_group_messages_before(1, 0, 5);
+        bool hitUntimed = db->recent_cache_stats().hits == hits + 1 && pages.count() == queries;
+
+        std::string text = metrics::render();
+        bool metricsOk = counter.value() == 4000 && gauge.value() == 7 && latency.count() == calls + 1 && hitUntimed &&
+                         text.find("# TYPE chat_db_call_seconds summary") != std::string::npos &&
+                         text.find("chat_db_call_seconds_count{call=\"register_user\"}") != std::string::npos &&
+                         text.find("test_events_total 4000\n") != std::string::npos;
+
+        // Two lines get through the limit, the rest are counted as dropped
+        uint64_t droppedBefore = logging::dropped();
+        logging::set_rate_limit(2);
+        for (int i = 0; i < 10; ++i) {
+            log_warn() << "Rate limit check " << i;
+        }
+        logging::flush();
+        logging::set_rate_limit(200);
+        bool loggingOk = logging::dropped() - droppedBefore >= 8 && !logging::enabled(LogLevel::DEBUG);
+        if (metricsOk && loggingOk) {
+            std::cout << "✓ Per-thread counts sum across exited threads and the log drops lines over its rate" << std::endl;
+        } else {
+            std::cout << "✗ Metrics or log rate limit are wrong" << std::endl;
+        }
+    }
+
+    // Test 16: Sharded layout
+    std::cout << "\n16. Testing sharded databases..." << std::endl;
+
+    {
+        for (std::string file : {"data/sharded.db", "data/sharded.db.shard0", "data/sharded.db.shard1", "data/sharded.db.shard2"}) {
+            for (const char* suffix : {"", "-wal", "-shm"}) {
+                std::filesystem::remove(file + suffix);
+            }
+        }
+        ShardedDatabase sharded("data/sharded.db", 3);
+        bool opened = sharded.is_open() && sharded.init_schema() && sharded.register_user("dana", "pw") &&
+                      sharded.register_user("erin", "pw");
+        int dana = sharded.get_user_id("dana");
+        int erin = sharded.get_user_id("erin");
+        for (int g = 1; opened && g <= 4; ++g) {
+            opened = sharded.create_group("shard group " + std::to_string(g)) && sharded.add_user_to_group(dana, g);
+        }
+        opened = opened && sharded.add_user_to_group(erin, 2);
+
+        // Each group writes to its own shard from its own thread
+        std::vector<std::thread> writers;
+        std::vector<int> lastIds(5, -1);
+        for (int g = 1; g <= 3; ++g) {
+            writers.emplace_back([&sharded, &lastIds, dana, g]() {
+                for (int i = 0; i < 50; ++i) {
+                    lastIds[g] = sharded.store_message(dana, g, "sharded " + std::to_string(i));
+                }
+            });
+        }
+        for (std::thread& writer : writers) {
+            writer.join();
+        }
+        lastIds[4] = sharded.store_message(dana, 4, "same shard as group 1");
+
+        bool routed = true;
+        for (int g = 1; g <= 4; ++g) {
+            routed = routed && lastIds[g] > 0 && sharded.message_shard(lastIds[g]) == &sharded.group_shard(g) &&
+                     sharded.get_message_group_id(lastIds[g]) == g;
+        }
+        std::vector<MessageRecord> page = sharded.get_group_messages_before(2, 0, 5);
+        std::vector<std::pair<int, int>> unread = sharded.get_unread_counts(erin);
+        bool merged = sharded.get_user_groups(dana) == std::vector<int>({1, 2, 3, 4}) &&
+                      unread == std::vector<std::pair<int, int>>({{2, 50}}) &&
+                      sharded.get_message_count_in_group(1) == 50 && sharded.get_message_count_in_group(4) == 1 &&
+                      page.size() == 5 && page[0].message_id == lastIds[2] && page[0].username == "dana" &&
+                      sharded.get_group(3).members.size() == 1;
+
+        // The files remember their layout, and the global file takes no messages
+        ShardedDatabase resized("data/sharded.db", 2);
+        bool guarded = !resized.init_schema() && sharded.global().store_message(dana, 1, "misrouted") == -1;
+        if (opened && routed && merged && guarded) {
+            std::cout << "✓ Groups route to their shard and ids name the shard that stored them" << std::endl;
+        } else {
+            std::cout << "✗ Sharded routing is wrong" << std::endl;
+        }
+    }
+
+    // Test 17: Write-ahead message log
+    std::cout << "\n17. Testing the message log..." << std::endl;
+
+    {
+        for (std::string file : {"data/logged.db", "data/replayed.db"}) {
+            for (const char* suffix : {"", "-wal", "-shm"}) {
+                std::filesystem::remove(file + suffix);
+            }
+            std::filesystem::remove_all(file + ".log");
+        }
+        ChatDatabase* logged = get_database("data/logged.db");
+        bool opened = logged && logged->init_schema() && logged->register_user("fay", "pw") &&
+                      logged->create_group("logged group");
+        int fay = opened ? logged->get_user_id("fay") : -1;
+        std::vector<int> ids;
+        std::vector<MessageRecord> page;
+        MessageLogStats written{};
+        bool inFlight = false;
+        {
+            MessageLogOptions options;
+            options.segment_bytes = 64 * 1024;
+            options.max_batch = 16;
+            MessageLog log(*logged, options);
+            opened = opened && log.is_open() && logged->add_user_to_group(fay, 1);
+
+            // Acked ids ascend, and flush() makes them visible in history
+            std::vector<std::future<int>> acks;
+            for (int i = 0; opened && i < 40; ++i) {
+                acks.push_back(log.append(fay, 1, "logged " + std::to_string(i)));
+            }
+            for (auto& ack : acks) {
+                ids.push_back(ack.get());
+            }
+            log.flush();
+            page = logged->get_group_messages_before(1, 0, 50);
+
+            // Hold the writer so the next records are durable but not applied, and keep a copy of the log
+            {
+                ChatDatabase::Transaction hold(*logged);
+                for (int i = 0; opened && i < 10; ++i) {
+                    acks.push_back(log.append(fay, 1, "unapplied " + std::to_string(i)));
+                }
+                for (size_t i = 40; i < acks.size(); ++i) {
+                    ids.push_back(acks[i].get());
+                }
+                std::filesystem::copy("data/logged.db.log", "data/replayed.db.log");
+                // Only ids still on their way to SQLite would make a reader wait
+                inFlight = ids.size() == 50 && log.applying(ids.back()) && !log.applying(ids[0]) && !log.applying(INT_MAX);
+            }
+            log.flush();
+            written = log.stats();
+        }
+        bool ordered = ids.size() == 50 && ids.front() > 0 && std::is_sorted(ids.begin(), ids.end()) &&
+                       std::adjacent_find(ids.begin(), ids.end()) == ids.end();
+        bool visible = inFlight && page.size() == 40 && page.front().message_id == ids[39] && page.front().text == "logged 39" &&
+                       written.applied == 50 && written.durable == 50 && written.syncs <= 50 &&
+                       logged->message_log_checkpoint() == ids.back();
+
+        // A copy taken before the last records reached SQLite replays all of them
+        ChatDatabase* replayed = get_database("data/replayed.db");
+        MessageLogStats recovered{};
+        std::vector<MessageRecord> restored;
+        if (replayed && replayed->init_schema()) {
+            MessageLog log(*replayed);
+            recovered = log.stats();
+            restored = replayed->get_group_messages_before(1, 0, 50);
+        }
+        bool replayedAll = recovered.replayed >= 10 && restored.size() == recovered.replayed &&
+                           restored.front().message_id == ids.back() && restored.front().text == "unapplied 9" &&
+                           replayed->message_log_checkpoint() == ids.back() &&
+                           replayed->store_message(fay, 1, "after replay") > ids.back();
+        if (opened && ordered && visible && replayedAll) {
+            std::cout << "✓ Logged messages are acked in order, indexed in batches and replayed after a crash" << std::endl;
+        } else {
+            std::cout << "✗ Message log is wrong" << std::endl;
+        }
+
+        // Small segments and id blocks: appends swap in the spares made by the log's threads
+        std::vector<int> rolled;
+        MessageLogStats rolling{};
+        {
+            MessageLogOptions options;
+            options.segment_bytes = 64 * 1024;
+            options.reserved_ids = 16;
+            MessageLog log(*logged, options);
+            std::vector<std::future<int>> acks;
+            const std::string filler(200, 'x');
+            for (int i = 0; i < 2000; ++i) {
+                acks.push_back(log.append(fay, 1, filler));
+            }
+            for (auto& ack : acks) {
+                rolled.push_back(ack.get());
+            }
+            log.flush();
+            rolling = log.stats();
+        }
+        bool rolledOk = rolled.front() > ids.back() && std::is_sorted(rolled.begin(), rolled.end()) &&
+                        std::adjacent_find(rolled.begin(), rolled.end()) == rolled.end() &&
+                        rolling.applied == 2000 && rolling.failed == 0 && logged->get_message_count_in_group(1) == 2050;
+
+        // Retired segments were only deleted once SQLite had their records on disk; reopening finds nothing to replay
+        size_t segmentFiles = 0;
+        for (const auto& entry : std::filesystem::directory_iterator("data/logged.db.log")) {
+            segmentFiles += entry.path().extension() == ".seg" ? 1 : 0;
+        }
+        MessageLogStats reopened{};
+        int afterReopen = -1;
+        {
+            MessageLog log(*logged);
+            reopened = log.stats();
+            afterReopen = log.append(fay, 1, "after reopen").get();
+        }
+        bool retiredOk = rolling.segments <= 2 && segmentFiles <= 3 && reopened.replayed == 0 && reopened.parked == 0 &&
+                         afterReopen > rolled.back() && logged->get_message_count_in_group(1) == 2051;
+        if (rolledOk && retiredOk) {
+            std::cout << "✓ Appends roll over segments and id blocks prepared off the caller's thread" << std::endl;
+        } else {
+            std::cout << "✗ Appends across segments or id blocks went wrong" << std::endl;
+        }
+
+        // Reserved blocks stop at the end of a shard's slice instead of running into the trigger
+        for (std::string file : {"data/sliced.db", "data/sliced.db.shard0", "data/sliced.db.shard1"}) {
+            for (const char* suffix : {"", "-wal", "-shm"}) {
+                std::filesystem::remove(file + suffix);
+            }
+        }
+        ShardedDatabase sliced("data/sliced.db", 2);
+        bool slicedOpen = sliced.is_open() && sliced.init_schema();
+        ChatDatabase& first = sliced.shard(0);
+        int sliceEnd = message_id_slice(2);
+        int reserved = 0;
+        int bulk = slicedOpen ? first.reserve_message_ids(sliceEnd - 10, reserved) : -1;
+        int tail = first.reserve_message_ids(100, reserved);
+        bool clamped = bulk == 1 && tail == sliceEnd - 9 && reserved == 10 &&
+                       first.insert_message({sliceEnd, 1, 2, "", "last id of the slice", "", 0}) &&
+                       first.reserve_message_ids(1, reserved) == -1 && reserved == 0 &&
+                       first.store_message(1, 2, "past the slice") == -1;
+        if (clamped) {
+            std::cout << "✓ Reserved ids stay inside the shard's slice" << std::endl;
+        } else {
+            std::cout << "✗ Id reservation ran past the shard's slice" << std::endl;
+        }
+
+        // Logged records the shard refuses (ids past its slice) are parked, not dropped
+        for (const char* suffix : {"", "-wal", "-shm"}) {
+            std::filesystem::remove(std::string("data/overflow.db") + suffix);
+        }
+        std::filesystem::remove_all("data/overflow.db.log");
+        ChatDatabase* overflow = get_database("data/overflow.db");
+        bool overflowOpen = overflow && overflow->init_schema() && overflow->reserve_message_ids(sliceEnd, reserved) == 1;
+        {
+            MessageLog log(*overflow);
+            for (int i = 0; overflowOpen && i < 3; ++i) {
+                overflowOpen = log.append(1, 2, "beyond shard 0").get() > sliceEnd;
+            }
+        }
+        std::filesystem::remove_all("data/sliced.db.shard0.log");
+        std::filesystem::copy("data/overflow.db.log", "data/sliced.db.shard0.log");
+        MessageLogStats parked{};
+        {
+            MessageLog log(first);
+            parked = log.stats();
+        }
+        if (overflowOpen && parked.parked == 3 && parked.replayed == 0 && first.message_log_checkpoint() > sliceEnd) {
+            std::cout << "✓ Refused log records are parked and counted apart from replayed ones" << std::endl;
+        } else {
+            std::cout << "✗ Refused log records were lost or miscounted" << std::endl;
+        }
+
+        // A batch given up at shutdown stops the indexer, so no later batch moves the checkpoint past it
+        for (const char* suffix : {"", "-wal", "-shm"}) {
+            std::filesystem::remove(std::string("data/abandoned.db") + suffix);
+        }
+        std::filesystem::remove_all("data/abandoned.db.log");
+        DatabaseTuning impatient;
+        impatient.busy_timeout_ms = 100;
+        ChatDatabase stalled("data/abandoned.db", impatient);
+        bool stalledOpen = stalled.init_schema() && stalled.register_user("gil", "pw") && stalled.create_group("stalled group");
+        ChatDatabase blocker("data/abandoned.db");
+        std::vector<int> stalledIds;
+        MessageLogStats given{};
+        {
+            MessageLogOptions options;
+            options.max_batch = 1;
+            MessageLog log(stalled, options);
+            int gil = stalled.get_user_id("gil");
+            std::unique_ptr<ChatDatabase::Transaction> hold(new ChatDatabase::Transaction(blocker));
+            for (int i = 0; stalledOpen && i < 3; ++i) {
+                stalledIds.push_back(log.append(gil, 1, "stalled " + std::to_string(i)).get());
+            }
+            // The first batch fails after stopping has begun; the writer is let go while the second waits on it
+            std::thread stopper([&log] { log.stop(); });
+            std::this_thread::sleep_for(std::chrono::milliseconds(150));
+            hold.reset();
+            stopper.join();
+            given = log.stats();
+        }
+        std::filesystem::remove_all("data/unsynced.db.log");
+        std::filesystem::copy("data/abandoned.db.log", "data/unsynced.db.log");
+        MessageLogStats resumed{};
+        {
+            MessageLog log(stalled);
+            resumed = log.stats();
+        }
+        bool abandonedOk = stalledOpen && stalledIds.size() == 3 && stalledIds.front() > 0 && given.durable == 3 &&
+                           given.applied == 0 && resumed.replayed == 3 && stalled.get_message_count_in_group(1) == 3 &&
+                           stalled.message_log_checkpoint() == stalledIds.back();
+        if (abandonedOk) {
+            std::cout << "✓ Batches given up at shutdown are replayed from the log at the next start" << std::endl;
+        } else {
+            std::cout << "✗ Records given up at shutdown were lost" << std::endl;
+        }
+
+        // Records answered with -1 after a failed sync stay in the log, but replay skips them
+        for (const char* suffix : {"", "-wal", "-shm"}) {
+            std::filesystem::remove(std::string("data/unsynced.db") + suffix);
+        }
+        ChatDatabase* unsynced = get_database("data/unsynced.db");
+        bool unsyncedOpen = unsynced && unsynced->init_schema() && stalledIds.size() == 3 &&
+                            unsynced->save_failed_log_range(stalledIds[1], stalledIds[2]);
+        MessageLogStats skipped{};
+        std::vector<MessageRecord> survivors;
+        if (unsyncedOpen) {
+            MessageLog log(*unsynced);
+            skipped = log.stats();
+            survivors = unsynced->get_group_messages_before(1, 0, 10);
+        }
+        std::vector<std::pair<int, int>> leftover;
+        bool skippedOk = unsyncedOpen && skipped.replayed == 1 && survivors.size() == 1 &&
+                         survivors.front().message_id == stalledIds[0] && unsynced->failed_log_ranges(leftover) &&
+                         leftover.empty() && !std::filesystem::exists("data/unsynced.db.log/0000000001.seg");
+        if (skippedOk) {
+            std::cout << "✓ Replay skips logged records that were answered as failed" << std::endl;
+        } else {
+            std::cout << "✗ Records answered as failed came back at replay" << std::endl;
+        }
+    }
+
     std::cout << "\n=== All tests completed successfully! ===" << std::endl;
     return 0;
 } 
\ No newline at end of file
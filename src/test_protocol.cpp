@@ -0,0 +1,303 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <random>
+#include <filesystem>
+#include <future>
+#include "protocol.h"
+#include "ring_buffer.h"
+#include "file_store.h"
+
+// Fuzz-style round trip: random frames are encoded, fed through a small ring
+// buffer in random-sized pieces, parsed back and compared field by field.
+
+namespace {
+
+using namespace protocol;
+
+std::mt19937 rng(12345);
+
+int random_int(int low, int high) {
+    return std::uniform_int_distribution<int>(low, high)(rng);
+}
+
+std::string random_string(size_t max_length) {
+    std::string value(random_int(0, static_cast<int>(max_length)), '\0');
+    for (char& c : value) {
+        c = static_cast<char>(random_int(0, 255));
+    }
+    return value;
+}
+
+// Owns the strings a generated frame's views point at
+struct Sample
+{
+    FrameType type;
+    std::string a;
+    std::string b;
+    int32_t x;
+    int32_t y;
+    uint64_t tag;
+    std::string encoded;
+};
+
+Sample make_sample() {
+    Sample s;
+    s.type = static_cast<FrameType>(random_int(1, 12));
+    s.a = random_string(40);
+    s.b = random_string(random_int(0, 3) == 0 ? 3000 : 60);
+    s.x = random_int(-5, 1000000);
+    s.y = random_int(-5, 1000000);
+    s.tag = (static_cast<uint64_t>(rng()) << 32) | rng();
+
+    switch (s.type) {
+        case FrameType::LOGIN: encode_login(s.encoded, {s.x % 2 == 0, s.a, s.b}); break;
+        case FrameType::RESULT: encode_result(s.encoded, {static_cast<uint16_t>(s.y), s.x, s.a}); break;
+        case FrameType::JOIN_GROUP:
+        case FrameType::LEAVE_GROUP: encode_group(s.encoded, s.type, s.x); break;
+        case FrameType::SEND_MESSAGE: encode_send_message(s.encoded, {s.x, s.tag, s.b}); break;
+        case FrameType::DELIVER_MESSAGE: encode_deliver_message(s.encoded, {s.x, s.y, s.x ^ s.y, -s.x, s.tag, s.a, s.b}); break;
+        case FrameType::HISTORY_REQUEST: encode_history_request(s.encoded, {s.x, s.y, static_cast<uint16_t>(s.y)}); break;
+        case FrameType::HISTORY_RESPONSE:
+            encode_history_response(s.encoded, s.x, {{s.x, s.y, s.x, s.a, s.b}, {s.y, s.x, s.y, s.b, s.a}});
+            break;
+        case FrameType::FILE_CHUNK:
+            if (s.y % 2 == 0) {
+                encode_file_chunk(s.encoded, {s.tag, static_cast<uint64_t>(s.y), s.b}, s.x % 2 == 0);
+            } else {
+                // Header written separately, the way downloads stream file content after it
+                s.encoded.resize(file_chunk_header_size);
+                encode_file_chunk_header(&s.encoded[0], s.tag, static_cast<uint64_t>(s.y), static_cast<uint32_t>(s.b.size()), s.x % 2 == 0);
+                s.encoded += s.b;
+            }
+            break;
+        case FrameType::MESSAGES_DROPPED: encode_messages_dropped(s.encoded, static_cast<uint32_t>(s.y)); break;
+        case FrameType::FILE_OFFER: encode_file_offer(s.encoded, {s.tag, s.x, static_cast<uint64_t>(s.y), s.a}); break;
+        case FrameType::FILE_DOWNLOAD: encode_file_download(s.encoded, {s.x, s.tag, static_cast<uint64_t>(s.y), s.tag >> 7}); break;
+    }
+    return s;
+}
+
+bool matches(const Sample& s, const Frame& frame) {
+    if (frame.type != s.type) {
+        return false;
+    }
+    switch (s.type) {
+        case FrameType::LOGIN: {
+            LoginRequest r;
+            return decode_login(frame.payload, r) && r.create_account == (s.x % 2 == 0) && r.username == s.a && r.password == s.b;
+        }
+        case FrameType::RESULT: {
+            ResultMessage r;
+            return decode_result(frame.payload, r) && r.request_type == static_cast<uint16_t>(s.y) && r.value == s.x && r.detail == s.a;
+        }
+        case FrameType::JOIN_GROUP:
+        case FrameType::LEAVE_GROUP: {
+            int32_t group_id;
+            return decode_group(frame.payload, group_id) && group_id == s.x;
+        }
+        case FrameType::SEND_MESSAGE: {
+            SendMessageRequest r;
+            return decode_send_message(frame.payload, r) && r.group_id == s.x && r.client_tag == s.tag && r.text == s.b;
+        }
+        case FrameType::DELIVER_MESSAGE: {
+            DeliverMessage r;
+            return decode_deliver_message(frame.payload, r) && r.group_id == s.x && r.sender_id == s.y &&
+                   r.message_id == (s.x ^ s.y) && r.sent_at_ms == -s.x && r.client_tag == s.tag &&
+                   r.sender_name == s.a && r.text == s.b;
+        }
+        case FrameType::HISTORY_REQUEST: {
+            HistoryRequest r;
+            return decode_history_request(frame.payload, r) && r.group_id == s.x && r.before_message_id == s.y &&
+                   r.limit == static_cast<uint16_t>(s.y);
+        }
+        case FrameType::HISTORY_RESPONSE: {
+            int32_t group_id;
+            std::vector<HistoryEntry> entries;
+            return decode_history_response(frame.payload, group_id, entries) && group_id == s.x && entries.size() == 2 &&
+                   entries[0].message_id == s.x && entries[0].username == s.a && entries[0].text == s.b &&
+                   entries[1].sent_at_ms == s.y && entries[1].username == s.b && entries[1].text == s.a;
+        }
+        case FrameType::FILE_CHUNK: {
+            FileChunk r;
+            return decode_file_chunk(frame.payload, r) && r.transfer_id == s.tag && r.offset == static_cast<uint64_t>(s.y) &&
+                   r.data == s.b && ((frame.flags & FLAG_LAST_CHUNK) != 0) == (s.x % 2 == 0);
+        }
+        case FrameType::MESSAGES_DROPPED: {
+            uint32_t dropped_count;
+            return decode_messages_dropped(frame.payload, dropped_count) && dropped_count == static_cast<uint32_t>(s.y);
+        }
+        case FrameType::FILE_OFFER: {
+            FileOffer r;
+            return decode_file_offer(frame.payload, r) && r.transfer_id == s.tag && r.group_id == s.x &&
+                   r.size == static_cast<uint64_t>(s.y) && r.name == s.a;
+        }
+        case FrameType::FILE_DOWNLOAD: {
+            FileDownloadRequest r;
+            return decode_file_download(frame.payload, r) && r.message_id == s.x && r.transfer_id == s.tag &&
+                   r.offset == static_cast<uint64_t>(s.y) && r.length == s.tag >> 7;
+        }
+    }
+    return false;
+}
+
+} // namespace
+
+int main() {
+    std::cout << "=== Protocol Round-Trip Test ===" << std::endl;
+
+    // Test 1: random frames through a ring that is smaller than some frames
+    std::cout << "\n1. Testing encode/parse round trip..." << std::endl;
+    const int frameCount = 20000;
+    std::vector<Sample> samples;
+    std::string stream;
+    for (int i = 0; i < frameCount; ++i) {
+        samples.push_back(make_sample());
+        stream += samples.back().encoded;
+    }
+
+    RingBuffer ring(1024);
+    FrameParser parser;
+    size_t fed = 0;
+    int parsed = 0;
+    bool ok = true;
+    while (ok && parsed < frameCount) {
+        size_t chunk = std::min<size_t>(random_int(1, 700), stream.size() - fed);
+        fed += ring.append(stream.data() + fed, chunk);
+
+        Frame frame;
+        ParseStatus status;
+        while ((status = parser.next(ring, frame)) == ParseStatus::FRAME) {
+            if (!matches(samples[parsed], frame)) {
+                std::cout << "✗ Frame " << parsed << " did not round-trip" << std::endl;
+                ok = false;
+                break;
+            }
+            parser.consume(ring);
+            parsed++;
+        }
+        if (status == ParseStatus::INVALID) {
+            std::cout << "✗ Valid frame " << parsed << " was rejected" << std::endl;
+            ok = false;
+        }
+        if (ring.free_space() == 0 || parser.required_capacity() > ring.capacity()) {
+            ring.reserve(std::max(ring.capacity() * 2, parser.required_capacity()));
+        }
+    }
+    if (!ok) {
+        return 1;
+    }
+    std::cout << "✓ " << parsed << " frames round-tripped, ring grew to " << ring.capacity() << " bytes" << std::endl;
+
+    // Test 2: truncated payloads must fail to decode, never read past the end
+    std::cout << "\n2. Testing truncated payloads..." << std::endl;
+    int rejected = 0;
+    int truncatedTotal = 0;
+    for (int i = 0; i < 2000; ++i) {
+        Sample s = make_sample();
+        if (s.type == FrameType::FILE_CHUNK || s.encoded.size() <= header_size) {
+            continue; // Chunk data runs to the end of the payload, any length is valid
+        }
+        std::string_view payload(s.encoded.data() + header_size, random_int(0, static_cast<int>(s.encoded.size() - header_size) - 1));
+        Frame frame{s.type, 0, payload};
+        truncatedTotal++;
+        if (!matches(s, frame)) {
+            rejected++;
+        }
+    }
+    if (rejected == truncatedTotal) {
+        std::cout << "✓ All " << truncatedTotal << " truncated payloads rejected" << std::endl;
+    } else {
+        std::cout << "✗ " << truncatedTotal - rejected << " truncated payloads decoded" << std::endl;
+        return 1;
+    }
+
+    // Test 3: garbage headers are reported as invalid instead of waiting forever
+    std::cout << "\n3. Testing invalid headers..." << std::endl;
+    RingBuffer garbage(64);
+    const char oversized[header_size] = {'\xff', '\xff', '\xff', '\x7f', 1, 0, 0, 0};
+    const char unknownType[header_size] = {0, 0, 0, 0, '\x63', 0, 0, 0};
+    Frame frame;
+    garbage.append(oversized, header_size);
+    bool oversizedRejected = parser.next(garbage, frame) == ParseStatus::INVALID;
+    garbage.consume(header_size);
+    garbage.append(unknownType, header_size);
+    bool unknownRejected = parser.next(garbage, frame) == ParseStatus::INVALID;
+    if (oversizedRejected && unknownRejected) {
+        std::cout << "✓ Oversized and unknown frames rejected" << std::endl;
+    } else {
+        std::cout << "✗ Invalid header accepted" << std::endl;
+        return 1;
+    }
+
+    // Test 4: a delivery encoded before its message_id is known gets it patched in
+    std::cout << "\n4. Testing message_id patching..." << std::endl;
+    std::string delivery;
+    encode_deliver_message(delivery, {7, 9, 0, 123456789, 42, "sender", "text"});
+    set_deliver_message_id(delivery, 1234567);
+    DeliverMessage patched;
+    bool patchedOk = decode_deliver_message(std::string_view(delivery).substr(header_size), patched) &&
+                     patched.group_id == 7 && patched.sender_id == 9 && patched.message_id == 1234567 &&
+                     patched.sent_at_ms == 123456789 && patched.text == "text";
+    if (patchedOk) {
+        std::cout << "✓ Patched message_id decodes with the other fields intact" << std::endl;
+    } else {
+        std::cout << "✗ Patching message_id broke the delivery" << std::endl;
+        return 1;
+    }
+
+    // Test 5: uploads are stored under their digest, and a damaged copy is not trusted
+    std::cout << "\n5. Testing the file store..." << std::endl;
+    std::filesystem::remove_all("test_files");
+    FileStore store("test_files");
+    std::string content = random_string(100000);
+    auto upload = [&](uint64_t transfer_id, FileStore::Completed& completed) {
+        std::string error;
+        if (store.offer(1, {transfer_id, 3, content.size(), "notes.txt"}, error) != 0) {
+            return false;
+        }
+        // Two chunks, written in order on the store's thread
+        std::promise<bool> done;
+        std::string_view whole(content);
+        store.write_chunk(1, {transfer_id, 0, whole.substr(0, 4096)}, false, nullptr);
+        store.write_chunk(1, {transfer_id, 4096, whole.substr(4096)}, true,
+            [&](FileStore::ChunkStatus status, const FileStore::Completed& file, const std::string&) {
+                completed = file;
+                done.set_value(status == FileStore::ChunkStatus::COMPLETE);
+            });
+        return done.get_future().get();
+    };
+    FileStore::Completed first, second;
+    bool storedOk = store.open() && upload(1, first) && first.size == content.size();
+    std::string stored_path = "test_files/" + first.digest.substr(0, 2) + "/" + first.digest;
+    if (storedOk) {
+        std::filesystem::resize_file(stored_path, content.size() / 2); // As a crash before the data was synced could leave it
+    }
+    storedOk = storedOk && upload(2, second) && second.digest == first.digest &&
+               std::filesystem::file_size(stored_path) == content.size();
+
+    // Open uploads are capped per user; finished ones do not count
+    std::string error;
+    bool cappedOk = true;
+    for (uint64_t transfer_id = 10; transfer_id < 14; ++transfer_id) {
+        cappedOk = cappedOk && store.offer(1, {transfer_id, 3, 10, "part"}, error) == 0;
+    }
+    cappedOk = cappedOk && store.offer(1, {14, 3, 10, "part"}, error) == -1 && error == "too many uploads" &&
+               store.offer(1, {13, 3, 10, "part"}, error) == 0 && store.offer(2, {14, 3, 10, "part"}, error) == 0;
+    std::filesystem::remove_all("test_files");
+    if (storedOk) {
+        std::cout << "✓ A stored copy cut short is replaced by the next upload of the same content" << std::endl;
+    } else {
+        std::cout << "✗ File store kept a damaged copy" << std::endl;
+        return 1;
+    }
+    if (cappedOk) {
+        std::cout << "✓ A user cannot hold more than a few uploads open" << std::endl;
+    } else {
+        std::cout << "✗ Upload cap is wrong" << std::endl;
+        return 1;
+    }
+
+    std::cout << "\n=== All protocol tests completed successfully! ===" << std::endl;
+    return 0;
+}
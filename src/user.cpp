@@ -0,0 +1,11 @@
+#include "../include/user.h"
+#include <unistd.h>
+
+User::User(int sock) : socket(sock), is_active(true), created_at(time(nullptr)) {
+}
+
+User::~User() {
+    if (socket >= 0) {
+        close(socket);
+    }
+}
@@ -0,0 +1,107 @@
+#include "../include/user_directory.h"
+#include <new>
+#include <cstring>
+#include <algorithm>
+
+UserDirectory::UserDirectory()
+    : segments(new std::atomic<Segment*>[max_segments]), chunk_used(chunk_size), count(0), is_loaded(false) {
+    for (size_t i = 0; i < max_segments; ++i) {
+        segments[i].store(nullptr, std::memory_order_relaxed);
+    }
+}
+
+UserDirectory::~UserDirectory() {
+    for (size_t i = 0; i < max_segments; ++i) {
+        delete segments[i].load(std::memory_order_relaxed);
+    }
+}
+
+void UserDirectory::load(const std::vector<std::pair<int, std::string>>& users) {
+    std::lock_guard<std::mutex> lock(write_mutex);
+    for (const auto& user : users) {
+        insert_locked(user.first, user.second);
+    }
+    is_loaded = true;
+}
+
+void UserDirectory::insert(int user_id, std::string_view name) {
+    std::lock_guard<std::mutex> lock(write_mutex);
+    insert_locked(user_id, name);
+}
+
+std::string_view UserDirectory::name(int user_id) const {
+    size_t id = static_cast<size_t>(user_id);
+    if (user_id < 0 || (id >> segment_bits) >= max_segments) {
+        return std::string_view();
+    }
+    Segment* segment = segments[id >> segment_bits].load(std::memory_order_acquire);
+    if (!segment) {
+        return std::string_view();
+    }
+    const Name* interned = segment->names[id & (segment_size - 1)].load(std::memory_order_acquire);
+    return interned ? interned->view() : std::string_view();
+}
+
+int UserDirectory::id(std::string_view name) const {
+    std::shared_lock<std::shared_mutex> lock(ids_mutex);
+    auto found = ids.find(name);
+    return found == ids.end() ? -1 : found->second;
+}
+
+bool UserDirectory::loaded() const {
+    return is_loaded.load(std::memory_order_acquire);
+}
+
+size_t UserDirectory::size() const {
+    return count.load(std::memory_order_relaxed);
+}
+
+const UserDirectory::Name* UserDirectory::intern(std::string_view name) {
+    size_t needed = sizeof(Name) + name.size();
+    needed = (needed + alignof(Name) - 1) & ~(alignof(Name) - 1);
+    if (chunk_used + needed > chunk_size) {
+        chunks.emplace_back(new char[std::max(chunk_size, needed)]);
+        chunk_used = 0;
+    }
+    char* memory = chunks.back().get() + chunk_used;
+    chunk_used += needed;
+
+    Name* interned = new (memory) Name{static_cast<uint32_t>(name.size())};
+    memcpy(interned + 1, name.data(), name.size());
+    return interned;
+}
+
+void UserDirectory::insert_locked(int user_id, std::string_view name) {
+    size_t id = static_cast<size_t>(user_id);
+    if (user_id < 0 || (id >> segment_bits) >= max_segments) {
+        return;
+    }
+
+    std::atomic<Segment*>& slot = segments[id >> segment_bits];
+    Segment* segment = slot.load(std::memory_order_relaxed);
+    if (!segment) {
+        segment = new Segment();
+        for (auto& entry : segment->names) {
+            entry.store(nullptr, std::memory_order_relaxed);
+        }
+        slot.store(segment, std::memory_order_release);
+    }
+
+    std::atomic<const Name*>& entry = segment->names[id & (segment_size - 1)];
+    const Name* existing = entry.load(std::memory_order_relaxed);
+    if (existing && existing->view() == name) {
+        return;
+    }
+
+    const Name* interned = intern(name);
+    {
+        std::unique_lock<std::shared_mutex> lock(ids_mutex);
+        if (existing) {
+            ids.erase(existing->view()); // Renamed; the old view stays valid for earlier readers
+        } else {
+            count.fetch_add(1, std::memory_order_relaxed);
+        }
+        ids[interned->view()] = user_id;
+    }
+    entry.store(interned, std::memory_order_release);
+}